@@ -5,6 +5,10 @@
 int main(int argc, char* argv[]) {
   std::string dag_file;
   std::string out_file;
+  std::string cache_file;
+  std::string profile_file;
+  double tune_fraction = moab::DagMC::DEFAULT_TUNE_FRACTION;
+  int num_threads = 0;
   bool verbose = false;
 
   ProgOptions po("build_obb: A tool to prebuild your DAGMC OBB Tree");
@@ -16,11 +20,35 @@ int main(int argc, char* argv[]) {
                          "Specify the output filename (default "
                          ")",
                          &out_file);
+  po.addOpt<std::string>("cache,c",
+                         "Also write a memory-mappable BVH cache file for "
+                         "the output file",
+                         &cache_file);
+  po.addOpt<std::string>("profile,p",
+                         "Tune the cached BVH trees of the slowest volumes "
+                         "of this CSV query profile of a pilot run",
+                         &profile_file);
+  po.addOpt<double>("tune-fraction,f",
+                    "Share of the query time of the profile taken by the "
+                    "tuned volumes (default 0.8)",
+                    &tune_fraction);
+  po.addOpt<int>("threads,t",
+                 "Number of threads used to build the BVH trees and to "
+                 "measure the geometry (default the OpenMP default); the "
+                 "OBB trees are always built on one thread",
+                 &num_threads);
 
   po.addOptionHelpHeading("Options for loading files");
 
   po.parseCommandLine(argc, argv);
 
+  // the tuned trees are only kept by the BVH cache
+  if (profile_file != "" && cache_file == "") {
+    std::cerr << "The tuned BVH trees need a cache file (--cache)"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   // make new DagMC
   moab::DagMC* DAG = new moab::DagMC();
 
@@ -46,6 +74,7 @@ int main(int argc, char* argv[]) {
   }
 
   // initialize geometry
+  DAG->set_build_threads(num_threads);
   rval = DAG->init_OBBTree();
   if (moab::MB_SUCCESS != rval) {
     std::cerr << "DAGMC failed to initialize geometry and create OBB tree"
@@ -53,6 +82,19 @@ int main(int argc, char* argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  const moab::DagMC::SetupTimes& times = DAG->setup_times();
+  std::cout << "Setup times (s): geometry " << times.geometry << ", trees "
+            << times.trees << ", indices " << times.indices << std::endl;
+
+  // tag the surfaces and volumes with their measures, so that runs on the
+  // new file do not compute them
+  rval = DAG->compute_measures();
+  if (moab::MB_SUCCESS != rval) {
+    std::cerr << "DAGMC failed to measure the surfaces and volumes"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   // write the new file
   rval = DAG->write_mesh(out_file.c_str(), out_file.length());
   if (moab::MB_SUCCESS != rval) {
@@ -60,5 +102,41 @@ int main(int argc, char* argv[]) {
     exit(EXIT_FAILURE);
   }
 
+  if (cache_file == "") return 0;
+
+  // the runs read the new file, so the cache is keyed to it and holds the
+  // handles it is read with: read it back, its OBB trees are not rebuilt
+  delete DAG;
+  DAG = new moab::DagMC();
+  rval = DAG->load_file(out_file.c_str());
+  if (moab::MB_SUCCESS != rval) {
+    std::cerr << "DAGMC failed to read back the output file: " << out_file
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  DAG->set_build_threads(num_threads);
+  rval = DAG->init_OBBTree();
+  if (moab::MB_SUCCESS != rval) {
+    std::cerr << "DAGMC failed to initialize the output file" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // write the BVH cache, with tuned trees for the slowest volumes
+  if (profile_file != "") {
+    rval = DAG->tune_trees_from_profile(profile_file.c_str(), tune_fraction);
+    if (moab::MB_SUCCESS != rval) {
+      std::cerr << "DAGMC failed to tune the BVH trees from " << profile_file
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  rval = DAG->write_accel_cache(cache_file.c_str());
+  if (moab::MB_SUCCESS != rval) {
+    std::cerr << "DAGMC failed to write the BVH cache " << cache_file
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  delete DAG;
+
   return 0;
 }
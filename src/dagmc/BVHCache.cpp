@@ -0,0 +1,274 @@
+#include "BVHCache.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "moab/ErrorHandler.hpp"
+
+namespace moab {
+
+namespace {
+
+const char MAGIC[8] = {'D', 'A', 'G', 'M', 'C', 'B', 'V', 'H'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304u;
+// alignment of every array in the file
+const uint64_t ALIGNMENT = 64;
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+
+// hash whole words, then the trailing bytes
+void hash_bytes(uint64_t& hash, const char* data, size_t count) {
+  const size_t words = count / sizeof(uint64_t);
+  for (size_t i = 0; i < words; i++) {
+    uint64_t word;
+    memcpy(&word, data + i * sizeof(uint64_t), sizeof(uint64_t));
+    hash = (hash ^ word) * FNV_PRIME;
+  }
+  for (size_t i = words * sizeof(uint64_t); i < count; i++)
+    hash = (hash ^ (unsigned char)data[i]) * FNV_PRIME;
+}
+
+inline uint64_t align(uint64_t offset) {
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// write size bytes at offset, padding the file up to offset with zeros
+bool write_at(std::ofstream& out, uint64_t& position, uint64_t offset,
+              const void* data, uint64_t size) {
+  static const char zeros[ALIGNMENT] = {0};
+  if (offset < position || offset - position >= ALIGNMENT) return false;
+  out.write(zeros, offset - position);
+  out.write(static_cast<const char*>(data), size);
+  position = offset + size;
+  return out.good();
+}
+
+}  // namespace
+
+BVHCache::BuildLock::BuildLock(const char* filename) : fd(-1) {
+  const std::string lock_name = std::string(filename) + ".lock";
+  fd = ::open(lock_name.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd < 0) return;
+  int rc;
+  do {
+    rc = flock(fd, LOCK_EX);
+  } while (0 != rc && EINTR == errno);
+  if (0 != rc) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+BVHCache::BuildLock::~BuildLock() {
+  // the lock file stays, removing it would let a waiting process lock a
+  // file that a new process no longer sees
+  if (fd >= 0) {
+    flock(fd, LOCK_UN);
+    ::close(fd);
+  }
+}
+
+BVHCache::BVHCache() : mapAddr(NULL), mapSize(0) {}
+
+BVHCache::~BVHCache() { close(); }
+
+const size_t BVHCache::KEY_BYTES;
+
+ErrorCode BVHCache::file_key(const char* filename, uint64_t& key) {
+  struct stat st;
+  if (0 != stat(filename, &st)) return MB_FILE_DOES_NOT_EXIST;
+  std::ifstream in(filename, std::ios::binary);
+  if (!in) return MB_FILE_DOES_NOT_EXIST;
+
+  key = FNV_OFFSET_BASIS;
+  const uint64_t stats[2] = {(uint64_t)st.st_size, (uint64_t)st.st_mtime};
+  hash_bytes(key, reinterpret_cast<const char*>(stats), sizeof(stats));
+
+  // the first bytes, then the last ones that were not read yet
+  const uint64_t size = st.st_size;
+  const uint64_t tail = size > 2 * KEY_BYTES ? size - KEY_BYTES : KEY_BYTES;
+  std::vector<char> buffer(KEY_BYTES);
+  in.read(&buffer[0], std::min<uint64_t>(KEY_BYTES, size));
+  hash_bytes(key, &buffer[0], in.gcount());
+  if (size > tail) {
+    in.seekg(tail);
+    in.read(&buffer[0], size - tail);
+    hash_bytes(key, &buffer[0], in.gcount());
+  }
+  if (!in) MB_SET_ERR(MB_FAILURE, "Failed to read " << filename);
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHCache::write(const char* filename, uint64_t geometry_hash,
+                          const std::vector<Volume>& volumes) {
+  // lay out the file
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.geometry_hash = geometry_hash;
+  header.num_volumes = volumes.size();
+  header.block_size = FacetBVH::BLOCK_SIZE;
+  header.node_size = sizeof(FacetBVH::Node);
+  header.handle_size = sizeof(EntityHandle);
+  header.volumes_offset = align(sizeof(Header));
+
+  std::vector<VolumeRecord> records(volumes.size());
+  uint64_t end =
+      align(header.volumes_offset + volumes.size() * sizeof(VolumeRecord));
+  for (size_t i = 0; i < volumes.size(); i++) {
+    const FacetBVH::Arrays& arrays = volumes[i].arrays;
+    VolumeRecord& record = records[i];
+    record.handle = volumes[i].handle;
+    record.num_nodes = arrays.num_nodes;
+    record.num_slots = arrays.num_slots;
+    record.num_triangles = arrays.num_triangles;
+    record.nodes_offset = end;
+    end = align(end + arrays.num_nodes * sizeof(FacetBVH::Node));
+    record.coords_offset = end;
+    end = align(end + 9 * arrays.num_slots * sizeof(double));
+    record.packed_offset = end;
+    end = align(end + 9 * arrays.num_slots * sizeof(double));
+    record.tri_index_offset = end;
+    end = align(end + arrays.num_slots * sizeof(uint32_t));
+    record.facets_offset = end;
+    end = align(end + arrays.num_slots * sizeof(EntityHandle));
+    record.surfaces_offset = end;
+    end = align(end + arrays.num_slots * sizeof(EntityHandle));
+  }
+  header.file_size = end;
+
+  // write under a name unique to this process, then move it into place
+  std::ostringstream tmp_name;
+  tmp_name << filename << ".tmp." << getpid();
+  std::ofstream out(tmp_name.str().c_str(), std::ios::binary);
+  if (!out)
+    MB_SET_ERR(MB_FILE_WRITE_ERROR, "Failed to open " << tmp_name.str());
+
+  uint64_t position = 0;
+  bool ok = write_at(out, position, 0, &header, sizeof(header));
+  for (size_t i = 0; ok && i < records.size(); i++) {
+    const uint64_t offset = header.volumes_offset + i * sizeof(VolumeRecord);
+    ok = write_at(out, position, offset, &records[i], sizeof(VolumeRecord));
+  }
+  for (size_t i = 0; ok && i < volumes.size(); i++) {
+    const FacetBVH::Arrays& arrays = volumes[i].arrays;
+    const VolumeRecord& record = records[i];
+    ok = write_at(out, position, record.nodes_offset, arrays.nodes,
+                  arrays.num_nodes * sizeof(FacetBVH::Node)) &&
+         write_at(out, position, record.coords_offset, arrays.coords,
+                  9 * arrays.num_slots * sizeof(double)) &&
+         write_at(out, position, record.packed_offset, arrays.packed,
+                  9 * arrays.num_slots * sizeof(double)) &&
+         write_at(out, position, record.tri_index_offset, arrays.tri_index,
+                  arrays.num_slots * sizeof(uint32_t)) &&
+         write_at(out, position, record.facets_offset, volumes[i].facets,
+                  arrays.num_slots * sizeof(EntityHandle)) &&
+         write_at(out, position, record.surfaces_offset, volumes[i].surfaces,
+                  arrays.num_slots * sizeof(EntityHandle));
+  }
+  if (ok) ok = write_at(out, position, end, NULL, 0);
+  out.close();
+
+  if (!ok || out.fail() || 0 != rename(tmp_name.str().c_str(), filename)) {
+    remove(tmp_name.str().c_str());
+    MB_SET_ERR(MB_FILE_WRITE_ERROR, "Failed to write " << filename);
+  }
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHCache::open(const char* filename, uint64_t geometry_hash) {
+  close();
+
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) return MB_FILE_DOES_NOT_EXIST;
+  struct stat st;
+  if (0 != fstat(fd, &st) || st.st_size < (off_t)sizeof(Header)) {
+    ::close(fd);
+    return MB_FAILURE;
+  }
+  void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (MAP_FAILED == addr) return MB_FAILURE;
+  mapAddr = addr;
+  mapSize = st.st_size;
+
+  const Header& header = *static_cast<const Header*>(mapAddr);
+  if (0 != memcmp(header.magic, MAGIC, sizeof(MAGIC)) ||
+      VERSION != header.version || BYTE_ORDER_MARK != header.byte_order ||
+      geometry_hash != header.geometry_hash ||
+      mapSize != header.file_size ||
+      FacetBVH::BLOCK_SIZE != header.block_size ||
+      sizeof(FacetBVH::Node) != header.node_size ||
+      sizeof(EntityHandle) != header.handle_size) {
+    close();
+    return MB_FAILURE;
+  }
+
+  const VolumeRecord* records = static_cast<const VolumeRecord*>(
+      array(header.volumes_offset, header.num_volumes, sizeof(VolumeRecord)));
+  if (!records) {
+    close();
+    return MB_FAILURE;
+  }
+
+  volumes.resize(header.num_volumes);
+  for (size_t i = 0; i < volumes.size(); i++) {
+    const VolumeRecord& record = records[i];
+    Volume& volume = volumes[i];
+    FacetBVH::Arrays& arrays = volume.arrays;
+    volume.handle = record.handle;
+    arrays.num_nodes = record.num_nodes;
+    arrays.num_slots = record.num_slots;
+    arrays.num_triangles = record.num_triangles;
+    arrays.nodes = static_cast<const FacetBVH::Node*>(array(
+        record.nodes_offset, record.num_nodes, sizeof(FacetBVH::Node)));
+    arrays.coords = static_cast<const double*>(
+        array(record.coords_offset, 9 * record.num_slots, sizeof(double)));
+    arrays.packed = static_cast<const double*>(
+        array(record.packed_offset, 9 * record.num_slots, sizeof(double)));
+    arrays.tri_index = static_cast<const uint32_t*>(
+        array(record.tri_index_offset, record.num_slots, sizeof(uint32_t)));
+    volume.facets = static_cast<const EntityHandle*>(
+        array(record.facets_offset, record.num_slots, sizeof(EntityHandle)));
+    volume.surfaces = static_cast<const EntityHandle*>(array(
+        record.surfaces_offset, record.num_slots, sizeof(EntityHandle)));
+    if (!arrays.nodes || !arrays.coords || !arrays.packed ||
+        !arrays.tri_index || !volume.facets || !volume.surfaces ||
+        record.num_slots % FacetBVH::BLOCK_SIZE ||
+        record.num_triangles > record.num_slots) {
+      close();
+      return MB_FAILURE;
+    }
+  }
+  return MB_SUCCESS;
+}
+
+void BVHCache::close() {
+  if (mapAddr) munmap(mapAddr, mapSize);
+  mapAddr = NULL;
+  mapSize = 0;
+  volumes.clear();
+}
+
+const void* BVHCache::array(uint64_t offset, uint64_t count,
+                            size_t size) const {
+  if (offset % ALIGNMENT || offset > mapSize ||
+      count > (mapSize - offset) / size)
+    return NULL;
+  return static_cast<const char*>(mapAddr) + offset;
+}
+
+}  // namespace moab
@@ -0,0 +1,152 @@
+#ifndef DAGMC_BVH_CACHE_HPP
+#define DAGMC_BVH_CACHE_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "FacetBVH.hpp"
+#include "moab/Types.hpp"
+
+namespace moab {
+
+/**\brief memory-mappable file of BVH trees
+ *
+ * A BVH cache holds the flat arrays of the FacetBVH of every volume together
+ * with the facet and surface handles of the triangle slots, so that a run
+ * can map the file read-only and query the trees in place instead of
+ * building them. All processes mapping the same file share the physical
+ * pages of the page cache.
+ *
+ * The file is a 64 byte header, a table with one VolumeRecord per volume
+ * and the arrays, each starting on a 64 byte boundary. Locations are byte
+ * offsets from the start of the file, so the file can be mapped anywhere.
+ * The header stores the key of the geometry file the trees were built from
+ * (see file_key()), and a cache is rejected if the key, the format version
+ * or the binary layout (byte order, node, block and handle sizes) differs.
+ *
+ * For the ranks of a parallel run, a cache under /dev/shm is a node-local
+ * shared memory segment: one rank per node builds it under a BuildLock and
+ * every rank maps the same pages.
+ */
+class BVHCache {
+ public:
+  static const uint32_t VERSION = 2;
+
+  /** the trees of one volume, as written to or mapped from a cache */
+  struct Volume {
+    EntityHandle handle;
+    FacetBVH::Arrays arrays;
+    /** facet handle of each slot */
+    const EntityHandle* facets;
+    /** surface of each slot */
+    const EntityHandle* surfaces;
+  };
+
+  /**\brief exclusive lock of the processes building a cache
+   *
+   * Held with flock() on the file named like the cache with a .lock suffix,
+   * so that of the processes of a node that start together only the first
+   * one builds and writes the cache while the others wait and then map it.
+   * The lock is released on destruction, or by the system if the process
+   * dies. If the lock file cannot be created, locked() is false and the
+   * processes build the trees on their own as before.
+   */
+  class BuildLock {
+   public:
+    explicit BuildLock(const char* filename);
+    ~BuildLock();
+
+    bool locked() const { return fd >= 0; }
+
+   private:
+    BuildLock(const BuildLock&);
+    BuildLock& operator=(const BuildLock&);
+
+    int fd;
+  };
+
+  BVHCache();
+  ~BVHCache();
+
+  /**\brief key of a geometry file, cheap enough to take on every start
+   *
+   * 64-bit FNV-1a hash of the size and modification time of the file and of
+   * its first and last KEY_BYTES bytes; the rest of the file is not read.
+   * A cache whose handles do not match the loaded mesh is rejected by the
+   * reader anyway.
+   */
+  static ErrorCode file_key(const char* filename, uint64_t& key);
+
+  /** bytes read from each end of the file by file_key() */
+  static const size_t KEY_BYTES = 1 << 16;
+
+  /**\brief write a cache file
+   *
+   * The file is written under a temporary name and renamed into place, so
+   * that processes reading the cache never see a partial file.
+   */
+  static ErrorCode write(const char* filename, uint64_t geometry_hash,
+                         const std::vector<Volume>& volumes);
+
+  /**\brief map a cache file
+   *
+   * Fails with MB_FILE_DOES_NOT_EXIST if the file cannot be opened and with
+   * MB_FAILURE if it is invalid or was written for another geometry file.
+   * The arrays of get_volumes() stay valid until close() or destruction.
+   */
+  ErrorCode open(const char* filename, uint64_t geometry_hash);
+
+  /** unmap the file */
+  void close();
+
+  const std::vector<Volume>& get_volumes() const { return volumes; }
+
+  /** bytes of the mapping */
+  size_t size() const { return mapSize; }
+
+ private:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t geometry_hash;
+    uint64_t file_size;
+    uint32_t num_volumes;
+    uint32_t block_size;
+    uint32_t node_size;
+    uint32_t handle_size;
+    uint64_t volumes_offset;
+    uint64_t reserved;
+  };
+
+  struct VolumeRecord {
+    uint64_t handle;
+    uint64_t num_nodes;
+    uint64_t num_slots;
+    uint64_t num_triangles;
+    uint64_t nodes_offset;
+    uint64_t coords_offset;
+    uint64_t packed_offset;
+    uint64_t tri_index_offset;
+    uint64_t facets_offset;
+    uint64_t surfaces_offset;
+  };
+
+  // not copyable: the volumes point into the mapping
+  BVHCache(const BVHCache&);
+  BVHCache& operator=(const BVHCache&);
+
+  /** pointer to an array of count values of size bytes at offset, or NULL if
+   *  it does not fit in the mapping */
+  const void* array(uint64_t offset, uint64_t count, size_t size) const;
+
+  void* mapAddr;
+  size_t mapSize;
+  std::vector<Volume> volumes;
+};
+
+}  // namespace moab
+
+#endif
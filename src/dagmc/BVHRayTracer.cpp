@@ -0,0 +1,1241 @@
+#include "BVHRayTracer.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace moab {
+
+BVHRayTracer::BVHRayTracer(GeomTopoTool* geom_topo_tool,
+                           double overlap_thickness,
+                           double numerical_precision)
+    : GTT(geom_topo_tool),
+      MBI(geom_topo_tool->get_moab_instance()),
+      overlapThickness(overlap_thickness),
+      numericalPrecision(numerical_precision),
+      traversalOrder(FacetBVH::ORDER_FRONT_TO_BACK),
+      storage(STORAGE_FULL),
+      sharedComplement(false) {}
+
+const double BVHRayTracer::INSTANCE_TOLERANCE = 1e-6;
+const int BVHRayTracer::TUNED_LEAF_SIZE = 4;
+
+BVHRayTracer::BuildTimes::BuildTimes() : threads(0), facets(0.), trees(0.) {}
+
+ErrorCode BVHRayTracer::add_instance(EntityHandle instance,
+                                     EntityHandle prototype,
+                                     const InstanceTransform& transform) {
+  if (instance == prototype)
+    MB_SET_ERR(MB_FAILURE, "A volume cannot be an instance of itself");
+  if (instances.count(prototype))
+    MB_SET_ERR(MB_FAILURE, "Prototype volume " << GTT->global_id(prototype)
+                                               << " is itself an instance");
+  for (auto i = instances.begin(); i != instances.end(); ++i) {
+    if (i->second.prototype == instance)
+      MB_SET_ERR(MB_FAILURE, "Volume " << GTT->global_id(instance)
+                                       << " is already a prototype");
+  }
+  Instance& entry = instances[instance];
+  entry.prototype = prototype;
+  entry.transform = transform;
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::build(int num_threads) {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+
+  Range vols, surf_range;
+  ErrorCode rval = GTT->get_gsets_by_dimension(3, vols);
+  MB_CHK_SET_ERR(rval, "Could not get volumes from GTT");
+  rval = GTT->get_gsets_by_dimension(2, surf_range);
+  MB_CHK_SET_ERR(rval, "Could not get surfaces from GTT");
+  const std::vector<EntityHandle> surfs(surf_range.begin(), surf_range.end());
+#ifdef _OPENMP
+  buildTimes.threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+#else
+  buildTimes.threads = 1;
+#endif
+
+  // gather the facets of each surface once, for the volumes on both sides;
+  // MOAB is not thread-safe, so only the trees are built in parallel
+  std::vector<SurfaceFacets> surf_facets(surfs.size());
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    rval = get_surface_facets(surfs[i], surf_facets[i]);
+    MB_CHK_SET_ERR(rval, "Failed to get the facets of the surfaces");
+  }
+
+  // a shared implicit complement is set up once its neighbours are built
+  EntityHandle shared_compl = 0;
+  std::vector<EntityHandle> compl_neighbours;
+  std::unordered_set<EntityHandle> compl_surfs;
+  EntityHandle impl_compl;
+  if (sharedComplement &&
+      MB_SUCCESS == GTT->get_implicit_complement(impl_compl)) {
+    rval = get_complement_neighbours(impl_compl, compl_neighbours,
+                                     compl_surfs);
+    MB_CHK_SET_ERR(rval, "Failed to get the neighbours of the implicit "
+                         "complement");
+    if (!compl_neighbours.empty()) shared_compl = impl_compl;
+  }
+
+  // find the facets of each volume
+  std::unordered_map<EntityHandle, const SurfaceFacets*> surf_map;
+  for (unsigned i = 0; i < surfs.size(); i++)
+    surf_map[surfs[i]] = &surf_facets[i];
+  const std::vector<EntityHandle> vol_list(vols.begin(), vols.end());
+  std::vector<std::vector<const SurfaceFacets*>> vol_surfs(vol_list.size());
+  std::vector<std::vector<int>> vol_senses(vol_list.size());
+  std::vector<std::pair<size_t, unsigned>> order(vol_list.size());
+  for (unsigned i = 0; i < vol_list.size(); i++) {
+    std::vector<EntityHandle> children;
+    rval = get_volume_surfaces(vol_list[i], children, vol_senses[i]);
+    MB_CHK_SET_ERR(rval, "Failed to get the surfaces of volume "
+                             << GTT->global_id(vol_list[i]));
+    size_t num_facets = 0;
+    for (unsigned j = 0; j < children.size(); j++) {
+      auto it = surf_map.find(children[j]);
+      if (it == surf_map.end())
+        MB_SET_ERR(MB_FAILURE, "Volume " << GTT->global_id(vol_list[i])
+                                         << " has an unknown surface");
+      vol_surfs[i].push_back(it->second);
+      num_facets += it->second->facets.size();
+    }
+    order[i] = std::make_pair(num_facets, i);
+  }
+  Clock::time_point facets_done = Clock::now();
+
+  // queue the trees as tasks, largest first so that the small ones fill the
+  // gaps at the end; idle threads take the next queued tree
+  std::sort(order.rbegin(), order.rend());
+  std::vector<std::unique_ptr<VolumeTree>> new_trees(vol_list.size());
+#pragma omp parallel num_threads(buildTimes.threads)
+#pragma omp single
+  for (unsigned k = 0; k < order.size(); k++) {
+    const unsigned i = order[k].second;
+    if (instances.count(vol_list[i]) || shared_compl == vol_list[i]) continue;
+#pragma omp task firstprivate(i)
+    {
+      new_trees[i].reset(new VolumeTree);
+      build_tree(vol_surfs[i], vol_senses[i], storage,
+                 tunedVolumes.count(vol_list[i]) > 0, *new_trees[i]);
+      new_trees[i]->built = true;
+    }
+  }
+
+  for (unsigned i = 0; i < vol_list.size(); i++) {
+    if (new_trees[i]) trees[vol_list[i]] = std::move(new_trees[i]);
+  }
+
+  // the instances only match their facets to the built prototype trees
+  for (unsigned i = 0; i < vol_list.size(); i++) {
+    auto instance = instances.find(vol_list[i]);
+    if (instance == instances.end()) continue;
+    auto prototype = trees.find(instance->second.prototype);
+    if (prototype == trees.end())
+      MB_SET_ERR(MB_FAILURE, "Unknown prototype of volume "
+                                 << GTT->global_id(vol_list[i]));
+    std::unique_ptr<VolumeTree> tree(new VolumeTree);
+    if (!build_instance_tree(vol_surfs[i], vol_senses[i], *prototype->second,
+                             instance->second.transform, *tree))
+      MB_SET_ERR(MB_FAILURE, "Volume " << GTT->global_id(vol_list[i])
+                                       << " does not match its prototype");
+    tree->built = true;
+    trees[vol_list[i]] = std::move(tree);
+  }
+
+  if (shared_compl) {
+    std::vector<const VolumeTree*> neighbours;
+    for (unsigned i = 0; i < compl_neighbours.size(); i++)
+      neighbours.push_back(trees[compl_neighbours[i]].get());
+    std::unique_ptr<VolumeTree> tree(new VolumeTree);
+    share_neighbour_trees(neighbours, compl_surfs, *tree);
+    tree->built = true;
+    trees[shared_compl] = std::move(tree);
+  }
+  Clock::time_point trees_done = Clock::now();
+
+  buildTimes.facets =
+      std::chrono::duration<double>(facets_done - start).count();
+  buildTimes.trees =
+      std::chrono::duration<double>(trees_done - facets_done).count();
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::build_volume(EntityHandle volume) {
+  std::unique_ptr<VolumeTree> tree(new VolumeTree);
+  ErrorCode rval = build_volume_tree(volume, *tree);
+  MB_CHK_SET_ERR(rval, "Failed to build the tree of the volume");
+  tree->built = true;
+
+  // a shared complement is set up again on the new tree of its neighbour
+  EntityHandle sharing = 0;
+  auto old = trees.find(volume);
+  if (sharedComplement && old != trees.end()) {
+    for (auto i = trees.begin(); i != trees.end(); ++i) {
+      const std::vector<const VolumeTree*>& neighbours = i->second->neighbours;
+      if (std::find(neighbours.begin(), neighbours.end(),
+                    old->second.get()) != neighbours.end())
+        sharing = i->first;
+    }
+  }
+  trees[volume] = std::move(tree);
+  if (sharing) return build_volume(sharing);
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::build_lazy() {
+  Range vols;
+  ErrorCode rval = GTT->get_gsets_by_dimension(3, vols);
+  MB_CHK_SET_ERR(rval, "Could not get volumes from GTT");
+
+  // every volume gets its entry now, so that the map is not modified by the
+  // queries that build the trees; its facets are read when it is built
+  clear();
+  for (Range::iterator i = vols.begin(); i != vols.end(); ++i)
+    trees[*i].reset(new VolumeTree);
+  buildTimes = BuildTimes();
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::tune_volumes(
+    const std::vector<EntityHandle>& volumes) {
+  std::unordered_set<EntityHandle> prototypes;
+  for (auto i = instances.begin(); i != instances.end(); ++i)
+    prototypes.insert(i->second.prototype);
+
+  for (unsigned i = 0; i < volumes.size(); i++) {
+    const EntityHandle volume = volumes[i];
+    if (instances.count(volume) || prototypes.count(volume)) continue;
+    if (!tunedVolumes.insert(volume).second) continue;
+    // deferred trees are tuned when they are built
+    auto tree = trees.find(volume);
+    if (tree == trees.end() || !tree->second->built) continue;
+    ErrorCode rval = build_volume(volume);
+    MB_CHK_SET_ERR(rval, "Failed to rebuild the tree of volume "
+                             << GTT->global_id(volume));
+  }
+  return MB_SUCCESS;
+}
+
+void BVHRayTracer::get_tree_counts(size_t& num_built,
+                                   size_t& num_volumes) const {
+  num_built = 0;
+  num_volumes = trees.size();
+  for (auto i = trees.begin(); i != trees.end(); ++i) {
+    if (i->second->built) num_built++;
+  }
+}
+
+ErrorCode BVHRayTracer::build_volume_tree(EntityHandle volume,
+                                          VolumeTree& tree) const {
+  // MOAB is not thread-safe, and the trees built by the queries may be built
+  // on any thread: only the reads from MOAB are serialized, and the facets
+  // read are dropped once the tree is built
+  ErrorCode rval;
+  std::vector<EntityHandle> neighbours;
+  std::unordered_set<EntityHandle> compl_surfs;
+  if (sharedComplement) {
+    std::lock_guard<std::mutex> lock(moabMutex);
+    if (GTT->is_implicit_complement(volume)) {
+      rval = get_complement_neighbours(volume, neighbours, compl_surfs);
+      MB_CHK_SET_ERR(rval, "Failed to get the neighbours of the implicit "
+                           "complement");
+    }
+  }
+
+  // the neighbours are built first, unless they have no tree at all
+  std::vector<const VolumeTree*> neighbour_trees(neighbours.size());
+  for (unsigned i = 0; i < neighbours.size(); i++) {
+    if (!trees.count(neighbours[i])) {
+      neighbour_trees.clear();
+      break;
+    }
+    rval = get_tree(neighbours[i], neighbour_trees[i]);
+    MB_CHK_SET_ERR(rval, "Failed to get the tree of a neighbour");
+  }
+  if (!neighbour_trees.empty()) {
+    share_neighbour_trees(neighbour_trees, compl_surfs, tree);
+    return MB_SUCCESS;
+  }
+
+  std::vector<SurfaceFacets> surf_facets;
+  std::vector<const SurfaceFacets*> surfs;
+  std::vector<int> senses;
+  {
+    std::lock_guard<std::mutex> lock(moabMutex);
+    rval = get_volume_facets(volume, surf_facets, senses);
+    MB_CHK_SET_ERR(rval, "Failed to get the facets of the volume");
+  }
+  for (unsigned i = 0; i < surf_facets.size(); i++)
+    surfs.push_back(&surf_facets[i]);
+
+  auto instance = instances.find(volume);
+  if (instance == instances.end()) {
+    build_tree(surfs, senses, storage, tunedVolumes.count(volume) > 0, tree);
+    return MB_SUCCESS;
+  }
+
+  const VolumeTree* prototype;
+  rval = get_tree(instance->second.prototype, prototype);
+  MB_CHK_SET_ERR(rval, "Failed to get the tree of the prototype");
+  if (!build_instance_tree(surfs, senses, *prototype,
+                           instance->second.transform, tree))
+    MB_SET_ERR(MB_FAILURE, "Volume " << GTT->global_id(volume)
+                                     << " does not match its prototype");
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::get_volume_facets(
+    EntityHandle volume, std::vector<SurfaceFacets>& surf_facets,
+    std::vector<int>& senses) const {
+  std::vector<EntityHandle> surfs;
+  ErrorCode rval = get_volume_surfaces(volume, surfs, senses);
+  MB_CHK_SET_ERR(rval, "Failed to get the surfaces of the volume");
+  surf_facets.resize(surfs.size());
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    rval = get_surface_facets(surfs[i], surf_facets[i]);
+    MB_CHK_SET_ERR(rval, "Failed to get the facets of a surface");
+  }
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::get_surface_facets(EntityHandle surface,
+                                           SurfaceFacets& result) const {
+  result.surface = surface;
+  result.facets.clear();
+  ErrorCode rval = MBI->get_entities_by_type(surface, MBTRI, result.facets);
+  MB_CHK_SET_ERR(rval, "Failed to get the facets of a surface");
+  result.coords.clear();
+  if (result.facets.empty()) return MB_SUCCESS;
+
+  std::vector<EntityHandle> conn;
+  rval = MBI->get_connectivity(&result.facets[0], result.facets.size(), conn);
+  MB_CHK_SET_ERR(rval, "Failed to get the facet connectivity");
+  result.coords.resize(3 * conn.size());
+  rval = MBI->get_coords(&conn[0], conn.size(), &result.coords[0]);
+  MB_CHK_SET_ERR(rval, "Failed to get the facet coordinates");
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::get_volume_surfaces(EntityHandle volume,
+                                            std::vector<EntityHandle>& surfs,
+                                            std::vector<int>& senses) const {
+  surfs.clear();
+  ErrorCode rval = MBI->get_child_meshsets(volume, surfs);
+  MB_CHK_SET_ERR(rval, "Failed to get the surfaces of the volume");
+  senses.resize(surfs.size());
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    rval = GTT->get_sense(surfs[i], volume, senses[i]);
+    MB_CHK_SET_ERR(rval, "Failed to get the sense of a surface");
+  }
+  return MB_SUCCESS;
+}
+
+void BVHRayTracer::gather_facets(const std::vector<const SurfaceFacets*>& surfs,
+                                 const std::vector<int>& senses,
+                                 std::vector<double>& coords,
+                                 std::vector<EntityHandle>& facets,
+                                 std::vector<EntityHandle>& surfaces) {
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    const SurfaceFacets& surf = *surfs[i];
+    const size_t first = coords.size();
+    coords.insert(coords.end(), surf.coords.begin(), surf.coords.end());
+
+    // store the facets so that their normals point out of the volume
+    if (-1 == senses[i]) {
+      for (size_t j = first; j < coords.size(); j += 9) {
+        std::swap_ranges(&coords[j + 3], &coords[j + 6], &coords[j + 6]);
+      }
+    }
+
+    facets.insert(facets.end(), surf.facets.begin(), surf.facets.end());
+    surfaces.insert(surfaces.end(), surf.facets.size(), surf.surface);
+  }
+}
+
+void BVHRayTracer::build_tree(const std::vector<const SurfaceFacets*>& surfs,
+                              const std::vector<int>& senses, Storage storage,
+                              bool tuned, VolumeTree& tree) {
+  std::vector<EntityHandle> facets, surfaces;
+  std::vector<double> coords;
+  gather_facets(surfs, senses, coords, facets, surfaces);
+
+  if (tuned)
+    tree.bvh.build(coords.empty() ? NULL : &coords[0], facets.size(),
+                   TUNED_LEAF_SIZE, FacetBVH::BUILD_SWEEP);
+  else
+    tree.bvh.build(coords.empty() ? NULL : &coords[0], facets.size());
+
+  // the compact tree is made from the full one, which is then dropped
+  std::vector<uint32_t> full_slots;
+  if (STORAGE_FULL != storage) {
+    tree.compact.build(tree.bvh,
+                       STORAGE_COMPACT_FLOAT == storage
+                           ? CompactBVH::PRECISION_FLOAT
+                           : CompactBVH::PRECISION_DOUBLE,
+                       full_slots);
+  }
+
+  // keep the per-triangle data in the same order as the tree; the slots that
+  // pad the leaves keep null handles
+  const uint32_t num_slots =
+      STORAGE_FULL != storage ? full_slots.size() : tree.bvh.num_slots();
+  tree.facet_store.assign(num_slots, 0);
+  tree.surface_store.assign(num_slots, 0);
+  for (uint32_t slot = 0; slot < num_slots; slot++) {
+    const uint32_t index = tree.bvh.triangle(
+        STORAGE_FULL != storage ? full_slots[slot] : slot);
+    if (FacetBVH::UNUSED_SLOT == index) continue;
+    tree.facet_store[slot] = facets[index];
+    tree.surface_store[slot] = surfaces[index];
+  }
+  tree.facets = tree.facet_store.data();
+  tree.surfaces = tree.surface_store.data();
+  if (STORAGE_FULL != storage) tree.bvh.clear();
+}
+
+ErrorCode BVHRayTracer::get_complement_neighbours(
+    EntityHandle impl_compl, std::vector<EntityHandle>& neighbours,
+    std::unordered_set<EntityHandle>& surfaces) const {
+  neighbours.clear();
+  surfaces.clear();
+  std::vector<EntityHandle> surfs;
+  ErrorCode rval = MBI->get_child_meshsets(impl_compl, surfs);
+  MB_CHK_SET_ERR(rval, "Failed to get the surfaces of the volume");
+
+  std::unordered_set<EntityHandle> found;
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    EntityHandle fwd, rev;
+    rval = GTT->get_surface_senses(surfs[i], fwd, rev);
+    MB_CHK_SET_ERR(rval, "Failed to get the volumes of a surface");
+    // the instances have no facets of their own in their trees
+    const EntityHandle other = fwd == impl_compl ? rev : fwd;
+    if (!other || other == impl_compl || instances.count(other)) {
+      neighbours.clear();
+      surfaces.clear();
+      return MB_SUCCESS;
+    }
+    if (found.insert(other).second) neighbours.push_back(other);
+    surfaces.insert(surfs[i]);
+  }
+  return MB_SUCCESS;
+}
+
+void BVHRayTracer::share_neighbour_trees(
+    const std::vector<const VolumeTree*>& neighbours,
+    const std::unordered_set<EntityHandle>& surfaces, VolumeTree& tree) {
+  size_t total_slots = 0;
+  for (unsigned i = 0; i < neighbours.size(); i++)
+    total_slots += neighbours[i]->num_slots();
+  tree.facet_store.reserve(total_slots);
+  tree.surface_store.reserve(total_slots);
+
+  std::vector<double> boxes(6 * neighbours.size());
+  tree.neighbour_slots.assign(1, 0);
+  for (unsigned i = 0; i < neighbours.size(); i++) {
+    const VolumeTree& neighbour = *neighbours[i];
+    neighbour.get_bounds(&boxes[6 * i], &boxes[6 * i + 3]);
+
+    // keep the handles of the facets bounding the complement, in the slots
+    // of the neighbour; consecutive slots mostly share a surface
+    const uint32_t num_slots = neighbour.num_slots();
+    EntityHandle last_surf = 0;
+    bool bounds_compl = false;
+    for (uint32_t slot = 0; slot < num_slots; slot++) {
+      const EntityHandle surf = neighbour.surfaces[slot];
+      if (surf != last_surf) {
+        last_surf = surf;
+        bounds_compl = surfaces.count(surf) > 0;
+      }
+      tree.facet_store.push_back(bounds_compl ? neighbour.facets[slot] : 0);
+      tree.surface_store.push_back(bounds_compl ? surf : 0);
+    }
+    tree.neighbour_slots.push_back(tree.facet_store.size());
+  }
+  tree.neighbour_boxes.build(boxes.data(), neighbours.size());
+  tree.neighbours = neighbours;
+  tree.facets = tree.facet_store.data();
+  tree.surfaces = tree.surface_store.data();
+}
+
+bool BVHRayTracer::build_instance_tree(
+    const std::vector<const SurfaceFacets*>& surfs,
+    const std::vector<int>& senses, const VolumeTree& prototype,
+    const InstanceTransform& transform, VolumeTree& tree) {
+  std::vector<EntityHandle> facets, surfaces;
+  std::vector<double> coords;
+  gather_facets(surfs, senses, coords, facets, surfaces);
+
+  // the triangles of the prototype in slot order
+  const uint32_t num_slots = prototype.num_slots();
+  std::vector<double> proto_coords;
+  std::vector<uint32_t> proto_slots;
+  for (uint32_t slot = 0; slot < num_slots; slot++) {
+    double tri[9];
+    if (!prototype.triangle_coords(slot, tri)) continue;
+    proto_coords.insert(proto_coords.end(), tri, tri + 9);
+    proto_slots.push_back(slot);
+  }
+  double lower[3], upper[3];
+  prototype.get_bounds(lower, upper);
+  double diagonal = 0.0;
+  for (int k = 0; k < 3; k++)
+    diagonal += (upper[k] - lower[k]) * (upper[k] - lower[k]);
+  const FacetMatcher matcher(proto_coords.data(), proto_slots.size(),
+                             INSTANCE_TOLERANCE * sqrt(diagonal));
+
+  std::vector<uint32_t> matches;
+  if (!matcher.match(coords.data(), facets.size(), transform, matches))
+    return false;
+
+  tree.facet_store.assign(num_slots, 0);
+  tree.surface_store.assign(num_slots, 0);
+  for (size_t i = 0; i < facets.size(); i++) {
+    tree.facet_store[proto_slots[matches[i]]] = facets[i];
+    tree.surface_store[proto_slots[matches[i]]] = surfaces[i];
+  }
+  tree.facets = tree.facet_store.data();
+  tree.surfaces = tree.surface_store.data();
+  tree.prototype = &prototype;
+  tree.transform = transform;
+
+  for (int k = 0; k < 3; k++) {
+    tree.lower[k] = std::numeric_limits<double>::max();
+    tree.upper[k] = -std::numeric_limits<double>::max();
+  }
+  for (size_t i = 0; i < coords.size(); i += 3) {
+    for (int k = 0; k < 3; k++) {
+      tree.lower[k] = std::min(tree.lower[k], coords[i + k]);
+      tree.upper[k] = std::max(tree.upper[k], coords[i + k]);
+    }
+  }
+  return true;
+}
+
+size_t BVHRayTracer::VolumeTree::num_slots() const {
+  if (shared()) return neighbour_slots.back();
+  const VolumeTree& tree = owner();
+  return tree.compact.empty() ? tree.bvh.num_slots()
+                              : tree.compact.num_slots();
+}
+
+bool BVHRayTracer::VolumeTree::triangle_coords(uint32_t slot,
+                                               double tri[9]) const {
+  if (shared()) {
+    const unsigned i = neighbour_of(slot);
+    if (!neighbours[i]->triangle_coords(slot - neighbour_slots[i], tri))
+      return false;
+    // the facets face out of the neighbour, into the complement
+    std::swap_ranges(tri + 3, tri + 6, tri + 6);
+    return true;
+  }
+  const VolumeTree& tree = owner();
+  if (!tree.compact.empty()) {
+    tree.compact.triangle_coords(slot, tri);
+    return true;
+  }
+  if (FacetBVH::UNUSED_SLOT == tree.bvh.triangle(slot)) return false;
+  std::copy(tree.bvh.triangle_coords(slot), tree.bvh.triangle_coords(slot) + 9,
+            tri);
+  return true;
+}
+
+void BVHRayTracer::VolumeTree::get_bounds(double lower[3],
+                                          double upper[3]) const {
+  if (shared()) {
+    neighbour_boxes.get_bounds(lower, upper);
+    return;
+  }
+  const VolumeTree& tree = owner();
+  if (tree.compact.empty())
+    tree.bvh.get_bounds(lower, upper);
+  else
+    tree.compact.get_bounds(lower, upper);
+}
+
+unsigned BVHRayTracer::VolumeTree::neighbour_of(uint32_t slot) const {
+  return std::upper_bound(neighbour_slots.begin(), neighbour_slots.end(),
+                          slot) -
+         neighbour_slots.begin() - 1;
+}
+
+template <class Filter>
+bool BVHRayTracer::VolumeTree::shared_ray_fire(
+    const FacetBVH::Ray& ray, double nonneg_ray_len, const double* neg_ray_len,
+    const int* orientation, const Filter& skip, uint32_t& hit,
+    double& hit_dist, uint32_t* neg_hit, double* neg_hit_dist,
+    FacetBVH::TraversalOrder order, FacetBVH::TraversalStats* stats) const {
+  // the ray enters the neighbour where it leaves the complement
+  const int flipped = orientation ? -*orientation : 0;
+
+  struct Nearest {
+    const VolumeTree* tree;
+    const FacetBVH::Ray* ray;
+    const double* neg_ray_len;
+    const int* orientation;
+    const Filter* skip;
+    FacetBVH::TraversalOrder order;
+    FacetBVH::TraversalStats* stats;
+    bool found, found_neg;
+    uint32_t hit, neg_hit;
+    double dist, neg_dist;
+
+    void operator()(uint32_t i, double, double& t_max) {
+      // the neighbours are not shared trees, so the queries go to their
+      // trees directly
+      const VolumeTree& neighbour = *tree->neighbours[i];
+      const uint32_t offset = tree->neighbour_slots[i];
+      const NeighbourFilter<Filter> filter = {tree->facets, offset, skip};
+      uint32_t slot = 0, neg_slot = 0;
+      double slot_dist = 0., neg_slot_dist = 0.;
+      const bool hit_neighbour =
+          neighbour.compact.empty()
+              ? neighbour.bvh.ray_fire(*ray, t_max, neg_ray_len, orientation,
+                                       filter, slot, slot_dist, &neg_slot,
+                                       &neg_slot_dist, order, stats)
+              : neighbour.compact.ray_fire(*ray, t_max, neg_ray_len,
+                                           orientation, filter, slot,
+                                           slot_dist, &neg_slot,
+                                           &neg_slot_dist, order, stats);
+      if (hit_neighbour) {
+        found = true;
+        hit = offset + slot;
+        dist = t_max = slot_dist;
+      }
+      if (neg_slot_dist < 0 && (!found_neg || neg_slot_dist > neg_dist)) {
+        found_neg = true;
+        neg_hit = offset + neg_slot;
+        neg_dist = neg_slot_dist;
+      }
+    }
+  };
+
+  Nearest nearest = {this, &ray, neg_ray_len, orientation ? &flipped : NULL,
+                     &skip, order, stats, false, false, 0, 0, 0.0, 0.0};
+  neighbour_boxes.ray_traverse(ray, neg_ray_len ? *neg_ray_len : 0.0,
+                               nonneg_ray_len, nearest, stats);
+  if (nearest.found) {
+    hit = nearest.hit;
+    hit_dist = nearest.dist;
+  }
+  if (neg_hit && neg_hit_dist) {
+    *neg_hit = nearest.found_neg ? nearest.neg_hit : 0;
+    *neg_hit_dist = nearest.found_neg ? nearest.neg_dist : 0.0;
+  }
+  return nearest.found;
+}
+
+template <class Filter>
+void BVHRayTracer::VolumeTree::shared_ray_intersect_all(
+    const FacetBVH::Ray& ray, double nonneg_ray_len, const Filter& skip,
+    std::vector<uint32_t>& hits, std::vector<double>& dists) const {
+  struct All {
+    const VolumeTree* tree;
+    const FacetBVH::Ray* ray;
+    double nonneg_ray_len;
+    const Filter* skip;
+    std::vector<uint32_t>* hits;
+    std::vector<double>* dists;
+    std::vector<uint32_t>* slots;
+    std::vector<double>* slot_dists;
+
+    void operator()(uint32_t i, double, double&) {
+      const VolumeTree& neighbour = *tree->neighbours[i];
+      const uint32_t offset = tree->neighbour_slots[i];
+      const NeighbourFilter<Filter> filter = {tree->facets, offset, skip};
+      if (neighbour.compact.empty())
+        neighbour.bvh.ray_intersect_all(*ray, nonneg_ray_len, filter, *slots,
+                                        *slot_dists);
+      else
+        neighbour.compact.ray_intersect_all(*ray, nonneg_ray_len, filter,
+                                            *slots, *slot_dists);
+      for (unsigned j = 0; j < slots->size(); j++) {
+        hits->push_back(offset + (*slots)[j]);
+        dists->push_back((*slot_dists)[j]);
+      }
+    }
+  };
+
+  hits.clear();
+  dists.clear();
+  std::vector<uint32_t> slots;
+  std::vector<double> slot_dists;
+  All all = {this, &ray, nonneg_ray_len, &skip, &hits, &dists, &slots,
+             &slot_dists};
+  neighbour_boxes.ray_traverse(ray, 0.0, nonneg_ray_len, all);
+}
+
+template <class Filter>
+bool BVHRayTracer::VolumeTree::shared_closest_triangle(const double point[3],
+                                                       const Filter& skip,
+                                                       uint32_t& nearest,
+                                                       double& dist) const {
+  struct Closest {
+    const VolumeTree* tree;
+    const double* point;
+    const Filter* skip;
+    bool found;
+    uint32_t nearest;
+    double dist;
+
+    void operator()(uint32_t i, double, double& best_sqr) {
+      const VolumeTree& neighbour = *tree->neighbours[i];
+      const uint32_t offset = tree->neighbour_slots[i];
+      const NeighbourFilter<Filter> filter = {tree->facets, offset, skip};
+      uint32_t slot = 0;
+      double slot_dist = 0.;
+      const bool found_neighbour =
+          neighbour.compact.empty()
+              ? neighbour.bvh.closest_triangle(point, filter, slot, slot_dist)
+              : neighbour.compact.closest_triangle(point, filter, slot,
+                                                   slot_dist);
+      if (!found_neighbour || slot_dist * slot_dist >= best_sqr) return;
+      found = true;
+      nearest = offset + slot;
+      dist = slot_dist;
+      best_sqr = slot_dist * slot_dist;
+    }
+  };
+
+  Closest closest = {this, point, &skip, false, 0, 0.0};
+  neighbour_boxes.closest_traverse(point, std::numeric_limits<double>::max(),
+                                   closest);
+  if (closest.found) {
+    nearest = closest.nearest;
+    dist = closest.dist;
+  }
+  return closest.found;
+}
+
+void BVHRayTracer::VolumeTree::to_local(const double p[3],
+                                        double result[3]) const {
+  if (prototype) {
+    transform.to_prototype(p, result);
+  } else {
+    for (int k = 0; k < 3; k++) result[k] = p[k];
+  }
+}
+
+void BVHRayTracer::VolumeTree::dir_to_local(const double v[3],
+                                            double result[3]) const {
+  if (prototype) {
+    transform.rotate_to_prototype(v, result);
+  } else {
+    for (int k = 0; k < 3; k++) result[k] = v[k];
+  }
+}
+
+void BVHRayTracer::clear() {
+  trees.clear();
+  cache.reset();
+}
+
+ErrorCode BVHRayTracer::write_cache(const char* filename,
+                                    uint64_t geometry_hash) const {
+  if (!instances.empty())
+    MB_SET_ERR(MB_FAILURE, "Instanced volumes cannot be cached");
+  std::vector<BVHCache::Volume> volumes;
+  for (auto i = trees.begin(); i != trees.end(); ++i) {
+    if (!i->second->built)
+      MB_SET_ERR(MB_FAILURE, "The BVH of volume " << GTT->global_id(i->first)
+                                                  << " has not been built");
+    if (!i->second->compact.empty())
+      MB_SET_ERR(MB_FAILURE, "Compact trees cannot be cached");
+    if (i->second->shared())
+      MB_SET_ERR(MB_FAILURE, "Shared complement trees cannot be cached");
+    BVHCache::Volume volume;
+    volume.handle = i->first;
+    volume.arrays = i->second->bvh.get_arrays();
+    volume.facets = i->second->facets;
+    volume.surfaces = i->second->surfaces;
+    volumes.push_back(volume);
+  }
+  return BVHCache::write(filename, geometry_hash, volumes);
+}
+
+ErrorCode BVHRayTracer::read_cache(const char* filename,
+                                   uint64_t geometry_hash) {
+  std::unique_ptr<BVHCache> new_cache(new BVHCache);
+  ErrorCode rval = new_cache->open(filename, geometry_hash);
+  if (MB_SUCCESS != rval) return rval;
+
+  // the handles in the cache are only meaningful if the geometry was loaded
+  // the same way: check that the cache has a tree for every volume, whose
+  // slots hold exactly the facets of the volume, each with its surface
+  Range vols;
+  rval = GTT->get_gsets_by_dimension(3, vols);
+  MB_CHK_SET_ERR(rval, "Could not get volumes from GTT");
+  const std::vector<BVHCache::Volume>& volumes = new_cache->get_volumes();
+  if (volumes.size() != vols.size()) return MB_FAILURE;
+  std::vector<std::pair<EntityHandle, EntityHandle>> mesh_facets,
+      cache_facets;
+  for (unsigned i = 0; i < volumes.size(); i++) {
+    const BVHCache::Volume& volume = volumes[i];
+    if (vols.find(volume.handle) == vols.end()) return MB_FAILURE;
+    std::vector<EntityHandle> surfs;
+    rval = MBI->get_child_meshsets(volume.handle, surfs);
+    MB_CHK_SET_ERR(rval, "Failed to get the surfaces of the volume");
+    mesh_facets.clear();
+    for (unsigned j = 0; j < surfs.size(); j++) {
+      Range tris;
+      rval = MBI->get_entities_by_type(surfs[j], MBTRI, tris);
+      MB_CHK_SET_ERR(rval, "Failed to get the facets of a surface");
+      for (Range::iterator t = tris.begin(); t != tris.end(); ++t)
+        mesh_facets.push_back(std::make_pair(*t, surfs[j]));
+    }
+    if (mesh_facets.size() != volume.arrays.num_triangles) return MB_FAILURE;
+
+    // the slots padding the leaves have null handles
+    cache_facets.clear();
+    for (size_t slot = 0; slot < volume.arrays.num_slots; slot++) {
+      if (volume.facets[slot])
+        cache_facets.push_back(
+            std::make_pair(volume.facets[slot], volume.surfaces[slot]));
+    }
+    std::sort(mesh_facets.begin(), mesh_facets.end());
+    std::sort(cache_facets.begin(), cache_facets.end());
+    if (mesh_facets != cache_facets) return MB_FAILURE;
+  }
+
+  clear();
+  for (unsigned i = 0; i < volumes.size(); i++) {
+    std::unique_ptr<VolumeTree> tree(new VolumeTree);
+    tree->bvh.attach(volumes[i].arrays);
+    tree->facets = volumes[i].facets;
+    tree->surfaces = volumes[i].surfaces;
+    tree->built = true;
+    trees[volumes[i].handle] = std::move(tree);
+  }
+  cache = std::move(new_cache);
+  return MB_SUCCESS;
+}
+
+void BVHRayTracer::get_sizes(size_t& num_trees, size_t& num_triangles,
+                             size_t& num_nodes) const {
+  num_trees = 0;
+  num_triangles = 0;
+  num_nodes = 0;
+  for (auto i = trees.begin(); i != trees.end(); ++i) {
+    if (!i->second->built) continue;
+    num_trees++;
+    num_triangles += i->second->query_bvh().num_triangles() +
+                     i->second->owner().compact.num_triangles();
+    num_nodes += i->second->bvh.num_nodes() + i->second->compact.num_nodes();
+  }
+}
+
+size_t BVHRayTracer::memory_use() const {
+  size_t result = cache ? cache->size() : 0;
+  for (auto i = trees.begin(); i != trees.end(); ++i) {
+    const VolumeTree& tree = *i->second;
+    result += sizeof(VolumeTree);
+    // trees being built by another thread are not counted
+    if (!tree.built) continue;
+    result += tree.bvh.memory_use() + tree.compact.memory_use() +
+              (tree.facet_store.capacity() + tree.surface_store.capacity()) *
+                  sizeof(EntityHandle) +
+              tree.neighbour_boxes.memory_use() +
+              tree.neighbours.capacity() * sizeof(const VolumeTree*) +
+              tree.neighbour_slots.capacity() * sizeof(uint32_t);
+    if (tree.dipoles_built)
+      result += tree.dipoles.capacity() * sizeof(FacetBVH::Dipole);
+  }
+  return result;
+}
+
+ErrorCode BVHRayTracer::get_bounds(EntityHandle volume, double lower[3],
+                                   double upper[3]) const {
+  const VolumeTree* tree;
+  ErrorCode rval = get_tree(volume, tree);
+  MB_CHK_SET_ERR(rval, "Failed to get the volume tree");
+  if (tree->prototype) {
+    std::copy(tree->lower, tree->lower + 3, lower);
+    std::copy(tree->upper, tree->upper + 3, upper);
+  } else {
+    tree->get_bounds(lower, upper);
+  }
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::get_tree(EntityHandle volume,
+                                 const VolumeTree*& tree) const {
+  auto it = trees.find(volume);
+  if (it == trees.end())
+    MB_SET_ERR(MB_ENTITY_NOT_FOUND, "No BVH for volume " << volume);
+  VolumeTree* vol_tree = it->second.get();
+
+  // build a deferred tree on first use; the acquire load pairs with the
+  // release store so that other threads see the finished tree
+  if (!vol_tree->built.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(vol_tree->build_mutex);
+    if (!vol_tree->built.load(std::memory_order_relaxed)) {
+      ErrorCode rval = build_volume_tree(volume, *vol_tree);
+      MB_CHK_SET_ERR(rval, "Failed to build the BVH of volume "
+                               << GTT->global_id(volume));
+      vol_tree->built.store(true, std::memory_order_release);
+    }
+  }
+  tree = vol_tree;
+  return MB_SUCCESS;
+}
+
+template <class History>
+ErrorCode BVHRayTracer::ray_fire(const EntityHandle volume,
+                                 const double point[3], const double dir[3],
+                                 EntityHandle& next_surf,
+                                 double& next_surf_dist, History* history,
+                                 double user_dist_limit, int ray_orientation,
+                                 FacetBVH::TraversalStats* stats) {
+  const VolumeTree* tree;
+  ErrorCode rval = get_tree(volume, tree);
+  MB_CHK_SET_ERR(rval, "Failed to get the volume tree");
+
+  double local_point[3], local_dir[3];
+  tree->to_local(point, local_point);
+  tree->dir_to_local(dir, local_dir);
+  const FacetBVH::Ray ray(local_point, local_dir, numericalPrecision);
+  double nonneg_ray_len = std::numeric_limits<double>::max();
+  if (user_dist_limit > 0) nonneg_ray_len = user_dist_limit;
+  // only look behind the ray origin if an overlap thickness is set
+  double neg_ray_len = -overlapThickness;
+  const double* neg_ray_len_ptr = overlapThickness > 0 ? &neg_ray_len : NULL;
+  const int* orientation = ray_orientation ? &ray_orientation : NULL;
+
+  HistoryFilter<History> skip = {tree, history};
+  uint32_t hit, neg_hit;
+  double dist, neg_dist;
+  bool found = tree->ray_fire(
+      ray, nonneg_ray_len, neg_ray_len_ptr, orientation, skip, hit, dist,
+      &neg_hit, &neg_dist, traversalOrder, stats);
+
+  // a ray starting in an overlap has already passed its exit surface
+  if (neg_dist < 0) {
+    found = true;
+    hit = neg_hit;
+    dist = neg_dist;
+  }
+
+  if (!found) {
+    next_surf = 0;
+    return MB_SUCCESS;
+  }
+
+  // the triangles of a float tree are rounded, so the distance is taken again
+  // to the plane of the facet in MOAB
+  if (tree->rounded()) {
+    double coords[9];
+    rval = facet_coords(tree->facets[hit], coords);
+    MB_CHK_SET_ERR(rval, "Failed to get the facet coordinates");
+    CompactBVH::refine_distance(coords, point, dir, dist);
+  }
+
+  next_surf = tree->surfaces[hit];
+  next_surf_dist = std::max(0.0, dist);
+  if (history) history->add_entity(tree->facets[hit]);
+
+  return MB_SUCCESS;
+}
+
+template <class History>
+ErrorCode BVHRayTracer::point_in_volume(const EntityHandle volume,
+                                        const double xyz[3], int& result,
+                                        const double* uvw,
+                                        const History* history) {
+  const VolumeTree* tree;
+  ErrorCode rval = get_tree(volume, tree);
+  MB_CHK_SET_ERR(rval, "Failed to get the volume tree");
+
+  // use the given direction unless it is missing or zero, in which case a
+  // fixed direction unlikely to line up with the facet edges is used
+  double dir[3] = {0.5773502691896257, 0.6172133998483676,
+                   0.5345224838248488};
+  if (uvw && (uvw[0] != 0 || uvw[1] != 0 || uvw[2] != 0)) {
+    dir[0] = uvw[0];
+    dir[1] = uvw[1];
+    dir[2] = uvw[2];
+  }
+
+  // an instance shares the tree of its prototype, queried in its frame
+  double local_xyz[3];
+  const double world_dir[3] = {dir[0], dir[1], dir[2]};
+  tree->to_local(xyz, local_xyz);
+  tree->dir_to_local(world_dir, dir);
+  const FacetBVH::Ray ray(local_xyz, dir, numericalPrecision);
+  const double large = 1e15;
+  HistoryFilter<History> skip = {tree, history};
+
+  if (0 == overlapThickness) {
+    // only the first crossing is needed
+    uint32_t hit;
+    double dist;
+    if (!tree->ray_fire(ray, large, NULL, NULL, skip, hit, dist)) {
+      result = 0;
+      return MB_SUCCESS;
+    }
+    double tri[9];
+    tree->triangle_coords(hit, tri);
+    double normal[3];
+    FacetBVH::triangle_normal(tri, normal);
+    double sense_dir =
+        normal[0] * dir[0] + normal[1] * dir[1] + normal[2] * dir[2];
+    // the point is inside if the ray leaves the volume
+    result = sense_dir > 0.0 ? 1 : 0;
+    return MB_SUCCESS;
+  }
+
+  // with overlaps the point is inside if the ray leaves the volume more often
+  // than it enters it
+  std::vector<uint32_t> hits;
+  std::vector<double> dists;
+  tree->ray_intersect_all(ray, large, skip, hits, dists);
+  int sum = 0;
+  for (unsigned i = 0; i < hits.size(); i++) {
+    double tri[9], normal[3];
+    tree->triangle_coords(hits[i], tri);
+    FacetBVH::triangle_normal(tri, normal);
+    double sense_dir =
+        normal[0] * dir[0] + normal[1] * dir[1] + normal[2] * dir[2];
+    if (sense_dir > 0.0)
+      sum++;
+    else if (sense_dir < 0.0)
+      sum--;
+  }
+
+  if (sum > 0)
+    result = 1;
+  else if (sum < 0)
+    result = 0;
+  else
+    result = GTT->is_implicit_complement(volume) ? 1 : 0;
+
+  return MB_SUCCESS;
+}
+
+template <class History>
+ErrorCode BVHRayTracer::test_volume_boundary(const EntityHandle volume,
+                                             const EntityHandle surface,
+                                             const double xyz[3],
+                                             const double uvw[3], int& result,
+                                             const History* history) {
+  ErrorCode rval;
+  EntityHandle facet;
+  if (history && history->size()) {
+    // the current facet is the last one in the history
+    rval = history->get_last_intersection(facet);
+    MB_CHK_SET_ERR(rval, "Failed to get the last intersection");
+  } else {
+    const VolumeTree* tree;
+    rval = get_tree(volume, tree);
+    MB_CHK_SET_ERR(rval, "Failed to get the volume tree");
+    double local_xyz[3];
+    tree->to_local(xyz, local_xyz);
+    uint32_t nearest;
+    double dist;
+    if (!tree->closest_triangle(local_xyz, FacetBVH::NoFilter(), nearest,
+                                dist))
+      MB_SET_ERR(MB_FAILURE, "Volume has no facets");
+    facet = tree->facets[nearest];
+  }
+
+  return boundary_case(volume, result, uvw, facet, surface);
+}
+
+ErrorCode BVHRayTracer::closest_to_location(EntityHandle volume,
+                                            const double point[3],
+                                            double& result,
+                                            EntityHandle* surface) {
+  const VolumeTree* tree;
+  ErrorCode rval = get_tree(volume, tree);
+  MB_CHK_SET_ERR(rval, "Failed to get the volume tree");
+
+  double local_point[3];
+  tree->to_local(point, local_point);
+  uint32_t nearest;
+  if (!tree->closest_triangle(local_point, FacetBVH::NoFilter(), nearest,
+                              result))
+    MB_SET_ERR(MB_FAILURE, "Volume has no facets");
+  if (surface) *surface = tree->surfaces[nearest];
+
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::get_dipole_tree(EntityHandle volume,
+                                        const VolumeTree*& tree) const {
+  ErrorCode rval = get_tree(volume, tree);
+  MB_CHK_SET_ERR(rval, "Failed to get the volume tree");
+
+  // same scheme as the deferred trees: computed once, read-only after; the
+  // instances use the dipoles of their prototype
+  const VolumeTree& owner = tree->owner();
+  if (!owner.compact.empty() || owner.shared())
+    MB_SET_ERR(MB_NOT_IMPLEMENTED, "Winding numbers need the full trees");
+  if (!owner.dipoles_built.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(owner.build_mutex);
+    if (!owner.dipoles_built.load(std::memory_order_relaxed)) {
+      owner.bvh.build_dipoles(owner.dipoles);
+      owner.dipoles_built.store(true, std::memory_order_release);
+    }
+  }
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::winding_number(EntityHandle volume,
+                                       const double xyz[3], double& result) {
+  const VolumeTree* tree;
+  ErrorCode rval = get_dipole_tree(volume, tree);
+  MB_CHK_ERR(rval);
+  double local_xyz[3];
+  tree->to_local(xyz, local_xyz);
+  result = tree->query_bvh().winding_number(local_xyz,
+                                            tree->owner().dipoles.data());
+
+  // the facets of the implicit complement face into the other volumes, so
+  // their winding number is -1 inside them and 0 elsewhere
+  EntityHandle impl_compl;
+  if (MB_SUCCESS == GTT->get_implicit_complement(impl_compl) &&
+      impl_compl == volume)
+    result += 1.0;
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::point_in_volume_winding(EntityHandle volume,
+                                                const double xyz[3],
+                                                int& result) {
+  double winding;
+  ErrorCode rval = winding_number(volume, xyz, winding);
+  MB_CHK_ERR(rval);
+  result = winding > 0.5 ? 1 : 0;
+  return MB_SUCCESS;
+}
+
+template <class History>
+ErrorCode BVHRayTracer::get_normal(EntityHandle surf, const double xyz[3],
+                                   double angle[3], const History* history) {
+  ErrorCode rval;
+  EntityHandle facet;
+  if (history && history->size()) {
+    rval = history->get_last_intersection(facet);
+    MB_CHK_SET_ERR(rval, "Failed to get the last intersection");
+  } else {
+    // search the tree of a volume on either side of the surface, restricted
+    // to the facets of the surface
+    EntityHandle fwd, rev;
+    rval = GTT->get_surface_senses(surf, fwd, rev);
+    MB_CHK_SET_ERR(rval, "Failed to get the volumes of the surface");
+    const VolumeTree* tree;
+    rval = get_tree(fwd ? fwd : rev, tree);
+    MB_CHK_SET_ERR(rval, "Failed to get the volume tree");
+
+    struct OtherSurfaces {
+      const VolumeTree* tree;
+      EntityHandle surf;
+      bool operator()(uint32_t slot) const {
+        return tree->surfaces[slot] != surf;
+      }
+    } skip = {tree, surf};
+    double local_xyz[3];
+    tree->to_local(xyz, local_xyz);
+    uint32_t nearest;
+    double dist;
+    if (!tree->closest_triangle(local_xyz, skip, nearest, dist))
+      MB_SET_ERR(MB_FAILURE, "Surface has no facets");
+    facet = tree->facets[nearest];
+  }
+
+  return facet_normal(facet, angle);
+}
+
+ErrorCode BVHRayTracer::facet_coords(EntityHandle facet,
+                                     double coords[9]) const {
+  const EntityHandle* conn;
+  int len;
+  ErrorCode rval = MBI->get_connectivity(facet, conn, len);
+  MB_CHK_SET_ERR(rval, "Failed to get the facet connectivity");
+  if (3 != len) MB_SET_ERR(MB_FAILURE, "Incorrect connectivity length");
+
+  rval = MBI->get_coords(conn, 3, coords);
+  MB_CHK_SET_ERR(rval, "Failed to get the facet coordinates");
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::facet_normal(EntityHandle facet, double normal[3]) {
+  double coords[9];
+  ErrorCode rval = facet_coords(facet, coords);
+  MB_CHK_ERR(rval);
+
+  FacetBVH::triangle_normal(coords, normal);
+  double len2 = normal[0] * normal[0] + normal[1] * normal[1] +
+                normal[2] * normal[2];
+  if (len2 > 0) {
+    double inv = 1.0 / sqrt(len2);
+    for (int i = 0; i < 3; i++) normal[i] *= inv;
+  }
+  return MB_SUCCESS;
+}
+
+ErrorCode BVHRayTracer::boundary_case(EntityHandle volume, int& result,
+                                      const double* uvw, EntityHandle facet,
+                                      EntityHandle surface) {
+  // uvw is not given
+  if (!uvw || uvw[0] > 1.0 || uvw[1] > 1.0 || uvw[2] > 1.0) {
+    result = -1;
+    return MB_SUCCESS;
+  }
+
+  double normal[3];
+  ErrorCode rval = facet_normal(facet, normal);
+  MB_CHK_SET_ERR(rval, "Failed to get the facet normal");
+
+  int sense;
+  rval = GTT->get_sense(surface, volume, sense);
+  MB_CHK_SET_ERR(rval, "Failed to get the surface sense");
+
+  double sense_dir =
+      sense * (normal[0] * uvw[0] + normal[1] * uvw[1] + normal[2] * uvw[2]);
+  if (sense_dir < 0.0)
+    result = 0;  // entering
+  else if (sense_dir > 0.0)
+    result = 1;  // leaving
+  else
+    result = -1;  // tangent
+
+  return MB_SUCCESS;
+}
+
+// the queries are compiled for both kinds of ray history
+template ErrorCode BVHRayTracer::ray_fire(const EntityHandle, const double[3],
+                                          const double[3], EntityHandle&,
+                                          double&, RayHistory*, double, int,
+                                          FacetBVH::TraversalStats*);
+template ErrorCode BVHRayTracer::ray_fire(const EntityHandle, const double[3],
+                                          const double[3], EntityHandle&,
+                                          double&, InlineRayHistory*, double,
+                                          int, FacetBVH::TraversalStats*);
+template ErrorCode BVHRayTracer::point_in_volume(const EntityHandle,
+                                                 const double[3], int&,
+                                                 const double*,
+                                                 const RayHistory*);
+template ErrorCode BVHRayTracer::point_in_volume(const EntityHandle,
+                                                 const double[3], int&,
+                                                 const double*,
+                                                 const InlineRayHistory*);
+template ErrorCode BVHRayTracer::test_volume_boundary(
+    const EntityHandle, const EntityHandle, const double[3], const double[3],
+    int&, const RayHistory*);
+template ErrorCode BVHRayTracer::test_volume_boundary(
+    const EntityHandle, const EntityHandle, const double[3], const double[3],
+    int&, const InlineRayHistory*);
+template ErrorCode BVHRayTracer::get_normal(EntityHandle, const double[3],
+                                            double[3], const RayHistory*);
+template ErrorCode BVHRayTracer::get_normal(EntityHandle, const double[3],
+                                            double[3],
+                                            const InlineRayHistory*);
+
+}  // namespace moab
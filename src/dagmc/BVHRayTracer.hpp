@@ -0,0 +1,518 @@
+#ifndef DAGMC_BVH_RAY_TRACER_HPP
+#define DAGMC_BVH_RAY_TRACER_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "BVHCache.hpp"
+#include "BoxBVH.hpp"
+#include "CompactBVH.hpp"
+#include "FacetBVH.hpp"
+#include "InlineRayHistory.hpp"
+#include "VolumeInstance.hpp"
+#include "moab/GeomQueryTool.hpp"
+#include "moab/GeomTopoTool.hpp"
+#include "moab/Interface.hpp"
+
+namespace moab {
+
+/**\brief geometry queries on native BVH trees
+ *
+ * BVHRayTracer answers the tree based queries of GeomQueryTool (ray_fire,
+ * point_in_volume, test_volume_boundary, closest_to_location and get_normal)
+ * using one FacetBVH per volume instead of the MOAB OBB trees. The facets of
+ * each volume are copied out of MOAB once, oriented so that their normals
+ * point out of the volume, and the queries only touch the flat copies.
+ *
+ * Results follow the GeomQueryTool conventions, including the ray history
+ * (which holds facet handles, so histories can be passed between the two
+ * implementations), the ray orientation and the overlap thickness.
+ */
+class BVHRayTracer {
+ public:
+  typedef GeomQueryTool::RayHistory RayHistory;
+
+  BVHRayTracer(GeomTopoTool* geom_topo_tool, double overlap_thickness = 0.,
+               double numerical_precision = 0.001);
+
+  /** wall clock seconds spent in the phases of the last build() */
+  struct BuildTimes {
+    BuildTimes();
+
+    int threads;
+    /** gathering the facets of all surfaces */
+    double facets;
+    /** building the trees of all volumes */
+    double trees;
+  };
+
+  /**\brief build the trees of all volumes, including the implicit complement
+   *
+   * The facets of the surfaces are gathered from MOAB on the calling
+   * thread, and then the trees of the volumes are built in parallel as
+   * OpenMP tasks, largest first, on num_threads threads (0 for the OpenMP
+   * default).
+   */
+  ErrorCode build(int num_threads = 0);
+
+  /** build the tree of a single volume */
+  ErrorCode build_volume(EntityHandle volume);
+
+  /**\brief defer building the trees until they are used
+   *
+   * Registers every volume without building its tree. The first query on a
+   * volume builds its tree; concurrent first queries from several threads
+   * build it once, the others wait for it. Volumes that are never queried
+   * are never built, and their facets are never read: a tree reads the
+   * facets of its volume when it is built, under a lock as MOAB is not
+   * thread-safe, and drops them once it is built.
+   */
+  ErrorCode build_lazy();
+
+  /** distance, relative to the size of the prototype, within which the
+   *  facets of an instance must match those of its prototype */
+  static const double INSTANCE_TOLERANCE;
+
+  /**\brief share the tree of a prototype volume with a congruent instance
+   *
+   * The instance is queried through the tree of the prototype, with the
+   * rays and points moved into the frame of the prototype; only the facet
+   * and surface handles of its triangles are stored for the instance. Its
+   * facets are matched to the triangles of the prototype when its tree is
+   * built, which fails if they are not congruent under the transform. Must
+   * be called before the trees are built. A prototype cannot itself be an
+   * instance, and instanced trees cannot be written to a cache. This saves
+   * tree memory only; the facets of the instance stay in MOAB.
+   */
+  ErrorCode add_instance(EntityHandle instance, EntityHandle prototype,
+                         const InstanceTransform& transform);
+
+  bool have_instances() const { return !instances.empty(); }
+
+  /** preferred maximum number of triangles in the leaves of the trees of
+   *  tuned volumes */
+  static const int TUNED_LEAF_SIZE;
+
+  /**\brief build the trees of some volumes for speed over build time
+   *
+   * The trees of the tuned volumes, the ones that take most of the queries,
+   * are built with FacetBVH::BUILD_SWEEP and leaves of TUNED_LEAF_SIZE
+   * triangles, which takes a few times longer. The trees of these volumes
+   * that are already built are rebuilt, so this must not be called while
+   * other threads query the trees. Prototypes and instances keep the trees
+   * they share.
+   */
+  ErrorCode tune_volumes(const std::vector<EntityHandle>& volumes);
+
+  bool is_tuned(EntityHandle volume) const {
+    return tunedVolumes.count(volume) > 0;
+  }
+
+  /** number of volumes whose trees have been built, of all volumes */
+  void get_tree_counts(size_t& num_built, size_t& num_volumes) const;
+
+  /** remove all trees */
+  void clear();
+
+  const BuildTimes& get_build_times() const { return buildTimes; }
+
+  /** write the trees of all volumes to a BVHCache file for the geometry file
+   *  with the given BVHCache::file_key(); the trees must all have been
+   *  built */
+  ErrorCode write_cache(const char* filename, uint64_t geometry_hash) const;
+
+  /**\brief use the trees of a BVHCache file
+   *
+   * Replaces all trees by those of the cache, which stays mapped into memory
+   * until the trees are cleared. Fails without changing the trees if the
+   * file does not exist, was written for another geometry file or does not
+   * match the loaded volumes, facets and surfaces.
+   */
+  ErrorCode read_cache(const char* filename, uint64_t geometry_hash);
+
+  bool have_trees() const { return !trees.empty(); }
+
+  /** number of built volume trees, their triangles and tree nodes */
+  void get_sizes(size_t& num_trees, size_t& num_triangles,
+                 size_t& num_nodes) const;
+
+  /** total bytes used by the trees, including a mapped cache file */
+  size_t memory_use() const;
+
+  /** axis-aligned bounding box of a volume */
+  ErrorCode get_bounds(EntityHandle volume, double lower[3],
+                       double upper[3]) const;
+
+  /* The queries taking a ray history accept either a RayHistory or an
+   * InlineRayHistory (History); the history may be NULL. */
+
+  /** the traversal work of the ray is added to stats if it is given */
+  template <class History>
+  ErrorCode ray_fire(const EntityHandle volume, const double point[3],
+                     const double dir[3], EntityHandle& next_surf,
+                     double& next_surf_dist, History* history,
+                     double user_dist_limit = 0, int ray_orientation = 1,
+                     FacetBVH::TraversalStats* stats = NULL);
+
+  template <class History>
+  ErrorCode point_in_volume(const EntityHandle volume, const double xyz[3],
+                            int& result, const double* uvw,
+                            const History* history);
+
+  template <class History>
+  ErrorCode test_volume_boundary(const EntityHandle volume,
+                                 const EntityHandle surface,
+                                 const double xyz[3], const double uvw[3],
+                                 int& result, const History* history);
+
+  ErrorCode closest_to_location(EntityHandle volume, const double point[3],
+                                double& result, EntityHandle* surface = 0);
+
+  /**\brief generalized winding number of the boundary of a volume around a
+   * point
+   *
+   * Close to 1 inside the volume and 0 outside, including for the implicit
+   * complement. The dipoles of the tree are computed on the first call for
+   * each volume. Fails with MB_NOT_IMPLEMENTED for the compact trees.
+   */
+  ErrorCode winding_number(EntityHandle volume, const double xyz[3],
+                           double& result);
+
+  /** point containment from the winding number: result is 1 if it is above
+   *  1/2, and 0 otherwise */
+  ErrorCode point_in_volume_winding(EntityHandle volume, const double xyz[3],
+                                    int& result);
+
+  template <class History>
+  ErrorCode get_normal(EntityHandle surf, const double xyz[3],
+                       double angle[3], const History* history);
+
+  double get_overlap_thickness() const { return overlapThickness; }
+  double get_numerical_precision() const { return numericalPrecision; }
+  void set_overlap_thickness(double value) { overlapThickness = value; }
+  void set_numerical_precision(double value) { numericalPrecision = value; }
+
+  /** how the trees of the volumes are stored */
+  enum Storage {
+    /** FacetBVH trees, whose leaves are tested in vectorized blocks */
+    STORAGE_FULL,
+    /** CompactBVH trees with double precision vertices */
+    STORAGE_COMPACT,
+    /** CompactBVH trees with single precision vertices; ray_fire()
+     *  refines the distance of the hit on the facet in MOAB */
+    STORAGE_COMPACT_FLOAT
+  };
+
+  /**\brief storage of the trees built from now on
+   *
+   * The compact trees take a fifth of the memory of the full trees or
+   * less, but test their triangles one at a time. They cannot be written to
+   * a cache, and winding_number() needs the full trees. STORAGE_FULL by
+   * default.
+   */
+  void set_storage(Storage value) { storage = value; }
+  Storage get_storage() const { return storage; }
+
+  /**\brief query the implicit complement through the trees of its neighbours
+   *
+   * The implicit complement is bounded by every exterior surface, so its
+   * tree is the largest of the model, and the last one to finish building.
+   * With this set, trees built from now on give the complement no tree of
+   * its own: a BoxBVH over the bounding boxes of the volumes it borders
+   * finds the ones a ray can reach, and only their trees are searched, for
+   * the facets of the surfaces they share with the complement. Setting it
+   * up takes a copy of the facet handles once the trees of the neighbours
+   * are built, for a tenth of the memory of its own tree; its rays take
+   * about as long, somewhat longer if it borders many small volumes. The
+   * complement keeps a tree of its own if it borders an instance, or has a
+   * surface with no volume on the other side. Shared trees cannot be
+   * written to a cache, and winding_number() needs the full trees. Off by
+   * default.
+   */
+  void set_shared_complement(bool value) { sharedComplement = value; }
+  bool shared_complement() const { return sharedComplement; }
+
+  /** order of the tree traversal of ray_fire(), front to back by default */
+  FacetBVH::TraversalOrder get_traversal_order() const {
+    return traversalOrder;
+  }
+  void set_traversal_order(FacetBVH::TraversalOrder order) {
+    traversalOrder = order;
+  }
+
+ private:
+  /** tree and per-triangle data of one volume */
+  struct VolumeTree {
+    VolumeTree()
+        : facets(NULL),
+          surfaces(NULL),
+          prototype(NULL),
+          built(false),
+          dipoles_built(false) {}
+
+    /** the tree answering the queries: the own tree, or the tree of the
+     *  prototype of an instance */
+    const VolumeTree& owner() const { return prototype ? *prototype : *this; }
+    const FacetBVH& query_bvh() const { return owner().bvh; }
+
+    /** a point or a direction in the frame of the tree of owner() */
+    void to_local(const double p[3], double result[3]) const;
+    void dir_to_local(const double v[3], double result[3]) const;
+
+    /* The queries of the tree of owner(), full or compact. */
+
+    size_t num_slots() const;
+
+    /** coordinates of the triangle in a slot; false for the slots that pad
+     *  the leaves of a full tree */
+    bool triangle_coords(uint32_t slot, double tri[9]) const;
+
+    void get_bounds(double lower[3], double upper[3]) const;
+
+    template <class Filter>
+    bool ray_fire(const FacetBVH::Ray& ray, double nonneg_ray_len,
+                  const double* neg_ray_len, const int* orientation,
+                  const Filter& skip, uint32_t& hit, double& hit_dist,
+                  uint32_t* neg_hit = NULL, double* neg_hit_dist = NULL,
+                  FacetBVH::TraversalOrder order =
+                      FacetBVH::ORDER_FRONT_TO_BACK,
+                  FacetBVH::TraversalStats* stats = NULL) const {
+      if (shared())
+        return shared_ray_fire(ray, nonneg_ray_len, neg_ray_len, orientation,
+                               skip, hit, hit_dist, neg_hit, neg_hit_dist,
+                               order, stats);
+      const VolumeTree& tree = owner();
+      if (!tree.compact.empty())
+        return tree.compact.ray_fire(ray, nonneg_ray_len, neg_ray_len,
+                                     orientation, skip, hit, hit_dist,
+                                     neg_hit, neg_hit_dist, order, stats);
+      return tree.bvh.ray_fire(ray, nonneg_ray_len, neg_ray_len, orientation,
+                               skip, hit, hit_dist, neg_hit, neg_hit_dist,
+                               order, stats);
+    }
+
+    template <class Filter>
+    void ray_intersect_all(const FacetBVH::Ray& ray, double nonneg_ray_len,
+                           const Filter& skip, std::vector<uint32_t>& hits,
+                           std::vector<double>& dists) const {
+      if (shared()) {
+        shared_ray_intersect_all(ray, nonneg_ray_len, skip, hits, dists);
+        return;
+      }
+      const VolumeTree& tree = owner();
+      if (!tree.compact.empty())
+        tree.compact.ray_intersect_all(ray, nonneg_ray_len, skip, hits,
+                                       dists);
+      else
+        tree.bvh.ray_intersect_all(ray, nonneg_ray_len, skip, hits, dists);
+    }
+
+    template <class Filter>
+    bool closest_triangle(const double point[3], const Filter& skip,
+                          uint32_t& nearest, double& dist) const {
+      if (shared())
+        return shared_closest_triangle(point, skip, nearest, dist);
+      const VolumeTree& tree = owner();
+      if (!tree.compact.empty())
+        return tree.compact.closest_triangle(point, skip, nearest, dist);
+      return tree.bvh.closest_triangle(point, skip, nearest, dist);
+    }
+
+    /** whether the hits are on triangles rounded to single precision */
+    bool rounded() const {
+      if (shared()) return neighbours[0]->rounded();
+      return !owner().compact.empty() &&
+             CompactBVH::PRECISION_FLOAT == owner().compact.precision();
+    }
+
+    /** whether this is an implicit complement queried through the trees of
+     *  its neighbours, see set_shared_complement() */
+    bool shared() const { return !neighbours.empty(); }
+
+    /** the neighbour holding a slot of a shared tree */
+    unsigned neighbour_of(uint32_t slot) const;
+
+    /* The queries of a shared tree. */
+
+    template <class Filter>
+    bool shared_ray_fire(const FacetBVH::Ray& ray, double nonneg_ray_len,
+                         const double* neg_ray_len, const int* orientation,
+                         const Filter& skip, uint32_t& hit, double& hit_dist,
+                         uint32_t* neg_hit, double* neg_hit_dist,
+                         FacetBVH::TraversalOrder order,
+                         FacetBVH::TraversalStats* stats) const;
+
+    template <class Filter>
+    void shared_ray_intersect_all(const FacetBVH::Ray& ray,
+                                  double nonneg_ray_len, const Filter& skip,
+                                  std::vector<uint32_t>& hits,
+                                  std::vector<double>& dists) const;
+
+    template <class Filter>
+    bool shared_closest_triangle(const double point[3], const Filter& skip,
+                                 uint32_t& nearest, double& dist) const;
+
+    FacetBVH bvh;
+    /** the tree with STORAGE_COMPACT, in which case bvh is empty */
+    CompactBVH compact;
+    /** facet handle of each triangle slot */
+    const EntityHandle* facets;
+    /** surface of each triangle slot */
+    const EntityHandle* surfaces;
+    /** storage of the handles, unless they are in the cache */
+    std::vector<EntityHandle> facet_store;
+    std::vector<EntityHandle> surface_store;
+    /** tree of the prototype of an instance, whose triangle slots the
+     *  facets and surfaces above follow, and the placement of the instance */
+    const VolumeTree* prototype;
+    InstanceTransform transform;
+    /** bounding box of an instance */
+    double lower[3];
+    double upper[3];
+    /** of a shared tree: the trees of the neighbours, a tree over their
+     *  boxes, and the first slot of each neighbour in the facets and
+     *  surfaces above, followed by the number of slots. The slots of the
+     *  facets of other surfaces of the neighbours hold null handles. */
+    std::vector<const VolumeTree*> neighbours;
+    BoxBVH neighbour_boxes;
+    std::vector<uint32_t> neighbour_slots;
+    /** set once the tree has been built; the tree is read-only after */
+    std::atomic<bool> built;
+    /** held while building a deferred tree or the dipoles */
+    mutable std::mutex build_mutex;
+    /** dipoles of the tree nodes, for winding_number(); computed on first
+     *  use, also for trees that are otherwise read-only */
+    mutable std::vector<FacetBVH::Dipole> dipoles;
+    /** set once the dipoles have been computed */
+    mutable std::atomic<bool> dipoles_built;
+  };
+
+  /** facets of a surface and their coordinates, 9 per facet */
+  struct SurfaceFacets {
+    EntityHandle surface;
+    std::vector<EntityHandle> facets;
+    std::vector<double> coords;
+  };
+
+  /** skips triangles whose facets are in a ray history */
+  template <class History>
+  struct HistoryFilter {
+    const VolumeTree* tree;
+    const History* history;
+    bool operator()(uint32_t slot) const {
+      return history && history->in_history(tree->facets[slot]);
+    }
+  };
+
+  /** the filter of a shared tree applied to the slots of one of its
+   *  neighbours, which also skips the facets not bounding the complement */
+  template <class Filter>
+  struct NeighbourFilter {
+    const EntityHandle* facets;
+    uint32_t offset;
+    const Filter* skip;
+    bool operator()(uint32_t slot) const {
+      return !facets[offset + slot] || (*skip)(offset + slot);
+    }
+  };
+
+  /** the tree of a volume, building it first if it was deferred */
+  ErrorCode get_tree(EntityHandle volume, const VolumeTree*& tree) const;
+
+  /** an instance and the volume whose tree it shares */
+  struct Instance {
+    EntityHandle prototype;
+    InstanceTransform transform;
+  };
+
+  /** the tree of a volume with its dipoles, computing them first */
+  ErrorCode get_dipole_tree(EntityHandle volume, const VolumeTree*& tree) const;
+
+  /** read the facets of the surfaces of a volume, and the senses of the
+   *  volume relative to them */
+  ErrorCode get_volume_facets(EntityHandle volume,
+                              std::vector<SurfaceFacets>& surf_facets,
+                              std::vector<int>& senses) const;
+
+  /** build the tree of a volume from its facets in MOAB, which it reads
+   *  under moabMutex */
+  ErrorCode build_volume_tree(EntityHandle volume, VolumeTree& tree) const;
+
+  ErrorCode get_surface_facets(EntityHandle surface,
+                               SurfaceFacets& result) const;
+
+  ErrorCode get_volume_surfaces(EntityHandle volume,
+                                std::vector<EntityHandle>& surfs,
+                                std::vector<int>& senses) const;
+
+  /** the facets of the given surfaces, with the triangles of the surfaces
+   *  of sense -1 reversed so that they all face out of the volume */
+  static void gather_facets(const std::vector<const SurfaceFacets*>& surfs,
+                            const std::vector<int>& senses,
+                            std::vector<double>& coords,
+                            std::vector<EntityHandle>& facets,
+                            std::vector<EntityHandle>& surfaces);
+
+  /** build the tree of a volume bounded by the given surfaces, with the
+   *  senses of the volume relative to them, tuned or not; only reads the
+   *  arguments, so that trees can be built concurrently */
+  static void build_tree(const std::vector<const SurfaceFacets*>& surfs,
+                         const std::vector<int>& senses, Storage storage,
+                         bool tuned, VolumeTree& tree);
+
+  /** set up the tree of an instance of the volume with the given built
+   *  tree; false if the facets do not match the prototype */
+  static bool build_instance_tree(
+      const std::vector<const SurfaceFacets*>& surfs,
+      const std::vector<int>& senses, const VolumeTree& prototype,
+      const InstanceTransform& transform, VolumeTree& tree);
+
+  /** the volumes bordering the implicit complement, whose trees it shares,
+   *  and its surfaces; no volumes if it cannot share their trees */
+  ErrorCode get_complement_neighbours(
+      EntityHandle impl_compl, std::vector<EntityHandle>& neighbours,
+      std::unordered_set<EntityHandle>& surfaces) const;
+
+  /** set up the shared tree of the implicit complement on the built trees
+   *  of its neighbours */
+  static void share_neighbour_trees(
+      const std::vector<const VolumeTree*>& neighbours,
+      const std::unordered_set<EntityHandle>& surfaces, VolumeTree& tree);
+
+  /** facet-based equivalent of GeomQueryTool::boundary_case */
+  ErrorCode boundary_case(EntityHandle volume, int& result, const double* uvw,
+                          EntityHandle facet, EntityHandle surface);
+
+  /** coordinates of a facet as stored in MOAB */
+  ErrorCode facet_coords(EntityHandle facet, double coords[9]) const;
+
+  /** unit normal of a facet as stored in MOAB */
+  ErrorCode facet_normal(EntityHandle facet, double normal[3]);
+
+  GeomTopoTool* GTT;
+  Interface* MBI;
+  double overlapThickness;
+  double numericalPrecision;
+  FacetBVH::TraversalOrder traversalOrder;
+  Storage storage;
+  bool sharedComplement;
+  BuildTimes buildTimes;
+
+  std::unordered_map<EntityHandle, std::unique_ptr<VolumeTree>> trees;
+  std::unordered_map<EntityHandle, Instance> instances;
+  /** volumes whose trees are built by tune_volumes() */
+  std::unordered_set<EntityHandle> tunedVolumes;
+  /** mapped cache file holding the trees, if they were read from one */
+  std::unique_ptr<BVHCache> cache;
+  /** held while a tree reads its facets from MOAB, so that the trees built
+   *  by the queries on several threads read them in turn */
+  mutable std::mutex moabMutex;
+};
+
+}  // namespace moab
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef DAGMC_BVH_TRAVERSAL_STATS_HPP
+#define DAGMC_BVH_TRAVERSAL_STATS_HPP
+
+namespace moab {
+
+/** work done by BVH ray traversals, accumulated over any number of rays;
+ *  also known as FacetBVH::TraversalStats */
+struct BVHTraversalStats {
+  BVHTraversalStats() { reset(); }
+  void reset() { node_tests = leaves_visited = triangle_tests = 0; }
+
+  /** node boxes tested against a ray */
+  unsigned long node_tests;
+  /** leaves whose triangles were tested */
+  unsigned long leaves_visited;
+  unsigned long triangle_tests;
+};
+
+}  // namespace moab
+
+#endif
@@ -0,0 +1,134 @@
+#include "BoxBVH.hpp"
+
+namespace moab {
+
+BoxBVH::BoxBVH() {}
+
+void BoxBVH::clear() { std::vector<Node>().swap(nodes); }
+
+void BoxBVH::build(const double* boxes, uint32_t num_boxes) {
+  clear();
+  if (0 == num_boxes) return;
+
+  std::vector<uint32_t> order(num_boxes);
+  for (uint32_t i = 0; i < num_boxes; i++) order[i] = i;
+  nodes.reserve(2 * num_boxes - 1);
+  build_node(boxes, order, 0, num_boxes, 0);
+}
+
+namespace {
+
+// orders boxes by their centers along an axis, and then by index
+struct CenterLess {
+  CenterLess(const double* boxes, int axis) : boxes(boxes), axis(axis) {}
+  bool operator()(uint32_t a, uint32_t b) const {
+    const double ca = boxes[6 * a + axis] + boxes[6 * a + 3 + axis];
+    const double cb = boxes[6 * b + axis] + boxes[6 * b + 3 + axis];
+    return ca < cb || (ca == cb && a < b);
+  }
+  const double* boxes;
+  int axis;
+};
+
+// extend the box given by lower and upper, or start it if first is set
+void grow(const double* box, double lower[3], double upper[3], bool first) {
+  for (int k = 0; k < 3; k++) {
+    lower[k] = first ? box[k] : std::min(lower[k], box[k]);
+    upper[k] = first ? box[3 + k] : std::max(upper[k], box[3 + k]);
+  }
+}
+
+double half_area(const double lower[3], const double upper[3]) {
+  const double dx = upper[0] - lower[0], dy = upper[1] - lower[1],
+               dz = upper[2] - lower[2];
+  return dx * dy + dy * dz + dz * dx;
+}
+
+}  // namespace
+
+void BoxBVH::build_node(const double* boxes, std::vector<uint32_t>& order,
+                        uint32_t begin, uint32_t end, int depth) {
+  const uint32_t index = nodes.size();
+  nodes.push_back(Node());
+
+  double lower[3], upper[3], center_lower[3], center_upper[3];
+  for (int k = 0; k < 3; k++) {
+    lower[k] = center_lower[k] = std::numeric_limits<double>::max();
+    upper[k] = center_upper[k] = -std::numeric_limits<double>::max();
+  }
+  for (uint32_t i = begin; i < end; i++) {
+    const double* box = boxes + 6 * order[i];
+    for (int k = 0; k < 3; k++) {
+      lower[k] = std::min(lower[k], box[k]);
+      upper[k] = std::max(upper[k], box[3 + k]);
+      const double center = box[k] + box[3 + k];
+      center_lower[k] = std::min(center_lower[k], center);
+      center_upper[k] = std::max(center_upper[k], center);
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    nodes[index].lower[k] = lower[k];
+    nodes[index].upper[k] = upper[k];
+  }
+
+  if (1 == end - begin) {
+    nodes[index].leaf = true;
+    nodes[index].offset = order[begin];
+    return;
+  }
+
+  // surface area heuristic evaluated between every two neighbouring centers
+  // on each axis, as FacetBVH::BUILD_SWEEP; deep in the tree, the halves of
+  // a median split keep the depth below MAX_DEPTH for any number of boxes
+  const uint32_t count = end - begin;
+  int best_axis = 0;
+  uint32_t best_left = count / 2;
+  if (depth < MAX_DEPTH - 32) {
+    std::vector<uint32_t> sorted(order.begin() + begin, order.begin() + end);
+    double best_cost = std::numeric_limits<double>::max();
+    std::vector<double> right_area(count);
+    for (int axis = 0; axis < 3; axis++) {
+      std::sort(sorted.begin(), sorted.end(), CenterLess(boxes, axis));
+      double box_lower[3], box_upper[3];
+      for (uint32_t i = count; i-- > 0;) {
+        grow(boxes + 6 * sorted[i], box_lower, box_upper, i == count - 1);
+        right_area[i] = half_area(box_lower, box_upper);
+      }
+      for (uint32_t i = 0; i + 1 < count; i++) {
+        grow(boxes + 6 * sorted[i], box_lower, box_upper, 0 == i);
+        const double cost = half_area(box_lower, box_upper) * (i + 1) +
+                            right_area[i + 1] * (count - i - 1);
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_left = i + 1;
+        }
+      }
+    }
+  } else {
+    for (int k = 1; k < 3; k++) {
+      if (center_upper[k] - center_lower[k] >
+          center_upper[best_axis] - center_lower[best_axis])
+        best_axis = k;
+    }
+  }
+  const uint32_t mid = begin + best_left;
+  std::nth_element(order.begin() + begin, order.begin() + mid,
+                   order.begin() + end, CenterLess(boxes, best_axis));
+
+  nodes[index].leaf = false;
+  build_node(boxes, order, begin, mid, depth + 1);
+  nodes[index].offset = nodes.size();
+  build_node(boxes, order, mid, end, depth + 1);
+}
+
+void BoxBVH::get_bounds(double lower[3], double upper[3]) const {
+  for (int k = 0; k < 3; k++) {
+    lower[k] = empty() ? 0.0 : nodes[0].lower[k];
+    upper[k] = empty() ? 0.0 : nodes[0].upper[k];
+  }
+}
+
+size_t BoxBVH::memory_use() const { return nodes.capacity() * sizeof(Node); }
+
+}  // namespace moab
@@ -0,0 +1,234 @@
+#ifndef DAGMC_BOX_BVH_HPP
+#define DAGMC_BOX_BVH_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "FacetBVH.hpp"
+
+namespace moab {
+
+/**\brief bounding volume hierarchy over a set of axis-aligned boxes
+ *
+ * BoxBVH is the top level of a two-level tree: each box bounds something
+ * with a tree of its own, and the queries only report which boxes a ray
+ * passes through, nearest entry first, or which boxes are near a point,
+ * nearest first. The visitor that is called for each box searches the tree
+ * inside it and may narrow the search, so that the boxes beyond the nearest
+ * hit found so far are skipped.
+ *
+ * The tree is built with the surface area heuristic evaluated between every
+ * two neighbouring box centers on each axis, down to leaves of one box, and
+ * stored in depth-first order like FacetBVH; a build takes O(n log^2 n) for
+ * n boxes, which is small next to the trees in the boxes.
+ *
+ * BVHRayTracer builds one over the volumes bordering the implicit
+ * complement, see BVHRayTracer::set_shared_complement().
+ */
+class BoxBVH {
+ public:
+  /** maximum depth of the tree, which is also the traversal stack size */
+  static const int MAX_DEPTH = 64;
+
+  BoxBVH();
+
+  /**\brief build the tree
+   *
+   * \param boxes lower and upper corners of each box, 6 values per box
+   * \param num_boxes number of boxes
+   */
+  void build(const double* boxes, uint32_t num_boxes);
+
+  void clear();
+
+  bool empty() const { return nodes.empty(); }
+  size_t num_nodes() const { return nodes.size(); }
+
+  /** bounding box of all boxes */
+  void get_bounds(double lower[3], double upper[3]) const;
+
+  /** bytes used by the nodes */
+  size_t memory_use() const;
+
+  /**\brief visit the boxes hit by a ray within [t_min, t_max]
+   *
+   * Calls visit(box, t_entry, t_max) for each box that the ray enters at
+   * t_entry before t_max, with the boxes grown by the tolerance of the ray.
+   * The nearer child of a node is visited first; visit may shrink t_max to
+   * skip the boxes entered beyond it. The node tests are added to stats if
+   * it is given.
+   */
+  template <class Visitor>
+  void ray_traverse(const FacetBVH::Ray& ray, double t_min, double t_max,
+                    Visitor& visit,
+                    FacetBVH::TraversalStats* stats = NULL) const;
+
+  /**\brief visit the boxes nearer to a point than a distance
+   *
+   * Calls visit(box, dist_sqr, best_sqr) for each box whose squared
+   * distance dist_sqr from the point is below best_sqr, nearer children
+   * first; visit may shrink best_sqr to skip the boxes farther away.
+   */
+  template <class Visitor>
+  void closest_traverse(const double point[3], double best_sqr,
+                        Visitor& visit) const;
+
+ private:
+  struct Node {
+    double lower[3];
+    double upper[3];
+    /** the box of a leaf or the second child of an interior node */
+    uint32_t offset;
+    bool leaf;
+  };
+
+  /** recursively build the subtree over boxes [begin, end) of order */
+  void build_node(const double* boxes, std::vector<uint32_t>& order,
+                  uint32_t begin, uint32_t end, int depth);
+
+  /** whether the ray hits the box of a node within [t_min, t_max], and if
+   *  so the distance at which it enters the box, at least t_min */
+  static bool ray_box(const Node& node, const FacetBVH::Ray& ray,
+                      double t_min, double t_max, double& t_entry);
+
+  static double box_dist_sqr(const Node& node, const double point[3]);
+
+  std::vector<Node> nodes;
+};
+
+inline bool BoxBVH::ray_box(const Node& node, const FacetBVH::Ray& ray,
+                            double t_min, double t_max, double& t_entry) {
+  for (int i = 0; i < 3; i++) {
+    const double lo = node.lower[i] - ray.tolerance;
+    const double hi = node.upper[i] + ray.tolerance;
+    if (ray.dir[i] == 0.0) {
+      if (ray.origin[i] < lo || ray.origin[i] > hi) return false;
+      continue;
+    }
+    double t0 = (lo - ray.origin[i]) * ray.inv_dir[i];
+    double t1 = (hi - ray.origin[i]) * ray.inv_dir[i];
+    if (t0 > t1) std::swap(t0, t1);
+    if (t0 > t_min) t_min = t0;
+    if (t1 < t_max) t_max = t1;
+    if (t_min > t_max) return false;
+  }
+  t_entry = t_min;
+  return true;
+}
+
+inline double BoxBVH::box_dist_sqr(const Node& node, const double point[3]) {
+  double result = 0.0;
+  for (int i = 0; i < 3; i++) {
+    double d = 0.0;
+    if (point[i] < node.lower[i])
+      d = node.lower[i] - point[i];
+    else if (point[i] > node.upper[i])
+      d = point[i] - node.upper[i];
+    result += d * d;
+  }
+  return result;
+}
+
+template <class Visitor>
+void BoxBVH::ray_traverse(const FacetBVH::Ray& ray, double t_min,
+                          double t_max, Visitor& visit,
+                          FacetBVH::TraversalStats* stats) const {
+  if (empty()) return;
+
+  // front to back, as in FacetBVH::traverse()
+  struct Entry {
+    uint32_t node;
+    double t_entry;
+  };
+  Entry stack[MAX_DEPTH];
+  int top = 0;
+  double t_entry;
+  if (stats) stats->node_tests++;
+  if (!ray_box(nodes[0], ray, t_min, t_max, t_entry)) return;
+  uint32_t current = 0;
+  while (true) {
+    const Node& node = nodes[current];
+    if (node.leaf) {
+      visit(node.offset, t_entry, t_max);
+    } else {
+      uint32_t near_child = current + 1, far_child = node.offset;
+      double t_near, t_far;
+      if (stats) stats->node_tests += 2;
+      const bool hit_near =
+          ray_box(nodes[near_child], ray, t_min, t_max, t_near);
+      const bool hit_far = ray_box(nodes[far_child], ray, t_min, t_max, t_far);
+      if (hit_near && hit_far) {
+        if (t_far < t_near) {
+          std::swap(near_child, far_child);
+          std::swap(t_near, t_far);
+        }
+        stack[top].node = far_child;
+        stack[top].t_entry = t_far;
+        top++;
+        current = near_child;
+        t_entry = t_near;
+        continue;
+      }
+      if (hit_near || hit_far) {
+        current = hit_near ? near_child : far_child;
+        t_entry = hit_near ? t_near : t_far;
+        continue;
+      }
+    }
+    while (top > 0 && stack[top - 1].t_entry > t_max) top--;
+    if (top == 0) break;
+    top--;
+    current = stack[top].node;
+    t_entry = stack[top].t_entry;
+  }
+}
+
+template <class Visitor>
+void BoxBVH::closest_traverse(const double point[3], double best_sqr,
+                              Visitor& visit) const {
+  if (empty()) return;
+
+  struct Entry {
+    uint32_t node;
+    double dist_sqr;
+  };
+  Entry stack[MAX_DEPTH];
+  int top = 0;
+  uint32_t current = 0;
+  double dist_sqr = box_dist_sqr(nodes[0], point);
+  while (true) {
+    const Node& node = nodes[current];
+    if (dist_sqr < best_sqr) {
+      if (node.leaf) {
+        visit(node.offset, dist_sqr, best_sqr);
+      } else {
+        // descend into the nearer child first
+        uint32_t first = current + 1, second = node.offset;
+        double first_sqr = box_dist_sqr(nodes[first], point);
+        double second_sqr = box_dist_sqr(nodes[second], point);
+        if (second_sqr < first_sqr) {
+          std::swap(first, second);
+          std::swap(first_sqr, second_sqr);
+        }
+        stack[top].node = second;
+        stack[top].dist_sqr = second_sqr;
+        top++;
+        current = first;
+        dist_sqr = first_sqr;
+        continue;
+      }
+    }
+    if (top == 0) break;
+    top--;
+    current = stack[top].node;
+    dist_sqr = stack[top].dist_sqr;
+  }
+}
+
+}  // namespace moab
+
+#endif
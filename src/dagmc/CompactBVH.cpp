@@ -0,0 +1,195 @@
+#include "CompactBVH.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#include <unordered_map>
+
+namespace moab {
+
+const int CompactBVH::QUANTIZATION_STEPS;
+
+namespace {
+
+// a vertex of the pool, compared bit for bit
+struct VertexKey {
+  double xyz[3];
+
+  bool operator==(const VertexKey& other) const {
+    return 0 == memcmp(xyz, other.xyz, sizeof(xyz));
+  }
+};
+
+struct VertexHash {
+  size_t operator()(const VertexKey& key) const {
+    uint64_t bits[3];
+    memcpy(bits, key.xyz, sizeof(bits));
+    uint64_t hash = bits[0] * 0x9e3779b97f4a7c15ull;
+    hash ^= bits[1] + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    hash ^= bits[2] + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return hash;
+  }
+};
+
+}  // namespace
+
+CompactBVH::CompactBVH() : vertexPrecision(PRECISION_DOUBLE) {
+  for (int i = 0; i < 3; i++) root.lower[i] = root.upper[i] = 0.0;
+}
+
+void CompactBVH::clear() {
+  std::vector<Node>().swap(nodes);
+  std::vector<uint32_t>().swap(indices);
+  std::vector<double>().swap(doubleVertices);
+  std::vector<float>().swap(floatVertices);
+}
+
+size_t CompactBVH::num_vertices() const {
+  return (PRECISION_DOUBLE == vertexPrecision ? doubleVertices.size()
+                                              : floatVertices.size()) /
+         3;
+}
+
+void CompactBVH::encode(const Box& box, const Box& parent, Node& node) {
+  for (int i = 0; i < 3; i++) {
+    const double extent = parent.upper[i] - parent.lower[i];
+    int lo = 0, hi = QUANTIZATION_STEPS;
+    if (extent > 0) {
+      lo = (int)floor((box.lower[i] - parent.lower[i]) / extent *
+                      QUANTIZATION_STEPS);
+      hi = (int)ceil((box.upper[i] - parent.lower[i]) / extent *
+                     QUANTIZATION_STEPS);
+      lo = std::max(0, std::min(lo, QUANTIZATION_STEPS));
+      hi = std::max(lo, std::min(hi, QUANTIZATION_STEPS));
+    }
+    node.lower[i] = lo;
+    node.upper[i] = hi;
+
+    // step outwards until the decoded bounds contain the box despite the
+    // rounding of the decoding
+    Box decoded;
+    decode(node, parent, decoded);
+    while (node.lower[i] > 0 && decoded.lower[i] > box.lower[i]) {
+      node.lower[i]--;
+      decode(node, parent, decoded);
+    }
+    while (node.upper[i] < QUANTIZATION_STEPS &&
+           decoded.upper[i] < box.upper[i]) {
+      node.upper[i]++;
+      decode(node, parent, decoded);
+    }
+  }
+}
+
+void CompactBVH::build(const FacetBVH& bvh, Precision precision,
+                       std::vector<uint32_t>& slots) {
+  clear();
+  slots.clear();
+  vertexPrecision = precision;
+  if (bvh.empty()) return;
+
+  // the vertex pool and the triangles, without the padding slots
+  std::unordered_map<VertexKey, uint32_t, VertexHash> pool;
+  std::vector<double> vertices;
+  std::vector<uint32_t> compact_slot(bvh.num_slots(), 0);
+  for (uint32_t slot = 0; slot < bvh.num_slots(); slot++) {
+    if (FacetBVH::UNUSED_SLOT == bvh.triangle(slot)) continue;
+    compact_slot[slot] = slots.size();
+    slots.push_back(slot);
+    const double* tri = bvh.triangle_coords(slot);
+    for (int v = 0; v < 3; v++) {
+      VertexKey key;
+      for (int k = 0; k < 3; k++) {
+        key.xyz[k] = PRECISION_FLOAT == precision ? (float)tri[3 * v + k]
+                                                  : tri[3 * v + k];
+      }
+      auto it = pool.insert(std::make_pair(key, (uint32_t)pool.size()));
+      if (it.second) vertices.insert(vertices.end(), key.xyz, key.xyz + 3);
+      indices.push_back(it.first->second);
+    }
+  }
+  if (PRECISION_DOUBLE == precision)
+    doubleVertices.swap(vertices);
+  else
+    floatVertices.assign(vertices.begin(), vertices.end());
+
+  // the exact boxes of the stored triangles, children before their parents
+  const size_t num_nodes = bvh.num_nodes();
+  const FacetBVH::Node* full = bvh.get_nodes();
+  nodes.resize(num_nodes);
+  std::vector<Box> boxes(num_nodes);
+  for (size_t n = num_nodes; n-- > 0;) {
+    Box& box = boxes[n];
+    Node& node = nodes[n];
+    node.unused = 0;
+    node.count = full[n].count;
+    if (full[n].is_leaf()) {
+      node.offset = compact_slot[full[n].offset];
+      for (int i = 0; i < 3; i++) {
+        box.lower[i] = std::numeric_limits<double>::max();
+        box.upper[i] = -std::numeric_limits<double>::max();
+      }
+      for (uint32_t t = node.offset; t < node.offset + node.count; t++) {
+        double tri[9];
+        triangle_coords(t, tri);
+        for (int v = 0; v < 3; v++) {
+          for (int i = 0; i < 3; i++) {
+            box.lower[i] = std::min(box.lower[i], tri[3 * v + i]);
+            box.upper[i] = std::max(box.upper[i], tri[3 * v + i]);
+          }
+        }
+      }
+    } else {
+      node.offset = full[n].offset;
+      const Box& first = boxes[n + 1];
+      const Box& second = boxes[node.offset];
+      for (int i = 0; i < 3; i++) {
+        box.lower[i] = std::min(first.lower[i], second.lower[i]);
+        box.upper[i] = std::max(first.upper[i], second.upper[i]);
+      }
+    }
+  }
+
+  // quantize each node against the decoded box of its parent, parents
+  // before their children; the root decodes to its exact box
+  root = boxes[0];
+  encode(boxes[0], root, nodes[0]);
+  std::vector<Box> decoded(num_nodes);
+  decode(nodes[0], root, decoded[0]);
+  for (size_t n = 0; n < num_nodes; n++) {
+    if (nodes[n].is_leaf()) continue;
+    const uint32_t children[2] = {(uint32_t)n + 1, nodes[n].offset};
+    for (int c = 0; c < 2; c++) {
+      encode(boxes[children[c]], decoded[n], nodes[children[c]]);
+      decode(nodes[children[c]], decoded[n], decoded[children[c]]);
+    }
+  }
+}
+
+size_t CompactBVH::memory_use() const {
+  return nodes.capacity() * sizeof(Node) +
+         indices.capacity() * sizeof(uint32_t) +
+         doubleVertices.capacity() * sizeof(double) +
+         floatVertices.capacity() * sizeof(float);
+}
+
+void CompactBVH::get_bounds(double lower[3], double upper[3]) const {
+  for (int i = 0; i < 3; i++) {
+    lower[i] = empty() ? 0.0 : root.lower[i];
+    upper[i] = empty() ? 0.0 : root.upper[i];
+  }
+}
+
+void CompactBVH::refine_distance(const double tri[9], const double origin[3],
+                                 const double dir[3], double& dist) {
+  double normal[3];
+  FacetBVH::triangle_normal(tri, normal);
+  const double denom =
+      normal[0] * dir[0] + normal[1] * dir[1] + normal[2] * dir[2];
+  if (0.0 == denom) return;
+  dist = (normal[0] * (tri[0] - origin[0]) + normal[1] * (tri[1] - origin[1]) +
+          normal[2] * (tri[2] - origin[2])) /
+         denom;
+}
+
+}  // namespace moab
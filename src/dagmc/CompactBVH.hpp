@@ -0,0 +1,444 @@
+#ifndef DAGMC_COMPACT_BVH_HPP
+#define DAGMC_COMPACT_BVH_HPP
+
+#include <stdint.h>
+
+#include <limits>
+#include <vector>
+
+#include "FacetBVH.hpp"
+
+namespace moab {
+
+/**\brief compact read-only form of a FacetBVH
+ *
+ * Holds the tree of a FacetBVH in a fraction of its memory, for models
+ * whose trees do not fit otherwise. The vertices of the triangles are
+ * stored once in a shared pool, as doubles or as floats, and each triangle
+ * as three 32-bit indices into the pool; the padding slots of the leaves
+ * are dropped. The nodes keep the layout of the FacetBVH but take 16
+ * bytes: the bounds of a node are quantized to QUANTIZATION_STEPS steps of
+ * the box of its parent, rounded outwards, so that the decoded boxes still
+ * contain their triangles and the queries visit every node the full tree
+ * would, plus a few.
+ *
+ * The triangles are tested one at a time with the scalar Plucker test of
+ * FacetBVH on the pooled vertices, which neighbouring triangles share, so
+ * the tests stay watertight. With PRECISION_FLOAT the vertices are rounded
+ * to floats, which moves the facets by about 1e-7 of their coordinates;
+ * refine_distance() recomputes the distance of a hit on the original
+ * double coordinates of its facet. The queries mirror those of FacetBVH and
+ * report slots of this tree, whose FacetBVH slots build() returns.
+ */
+class CompactBVH {
+ public:
+  /** how the vertex coordinates are stored */
+  enum Precision { PRECISION_DOUBLE, PRECISION_FLOAT };
+
+  /** number of steps of the quantized node bounds */
+  static const int QUANTIZATION_STEPS = 255;
+
+  /** tree node with bounds relative to the box of its parent */
+  struct Node {
+    /** bounds in steps of 1 / QUANTIZATION_STEPS of the extent of the
+     *  decoded box of the parent */
+    uint8_t lower[3];
+    uint8_t upper[3];
+    uint16_t unused;
+    /** first slot of a leaf or the second child of an interior node */
+    uint32_t offset;
+    /** number of triangles in a leaf, or FacetBVH::INTERIOR_FLAG */
+    uint32_t count;
+
+    bool is_leaf() const { return !(count & FacetBVH::INTERIOR_FLAG); }
+  };
+
+  CompactBVH();
+
+  /**\brief build the compact form of a tree
+   *
+   * \param bvh a built tree, which may be cleared afterwards
+   * \param precision storage of the vertex coordinates
+   * \param slots set to the slot of bvh of each slot of this tree
+   */
+  void build(const FacetBVH& bvh, Precision precision,
+             std::vector<uint32_t>& slots);
+
+  /** remove the tree and release its memory */
+  void clear();
+
+  bool empty() const { return nodes.empty(); }
+  Precision precision() const { return vertexPrecision; }
+  size_t num_triangles() const { return indices.size() / 3; }
+  size_t num_slots() const { return num_triangles(); }
+  size_t num_nodes() const { return nodes.size(); }
+  size_t num_vertices() const;
+
+  /** coordinates of the triangle in slot i, as stored */
+  void triangle_coords(uint32_t i, double tri[9]) const;
+
+  /** bytes used by the nodes, the vertex pool and the triangles */
+  size_t memory_use() const;
+
+  /** bounding box of all triangles */
+  void get_bounds(double lower[3], double upper[3]) const;
+
+  /**\brief distance along a ray to the plane of a triangle
+   *
+   * Refines the distance of a hit found on the rounded coordinates with the
+   * original coordinates of the triangle; dist is not changed if the ray is
+   * parallel to the plane.
+   */
+  static void refine_distance(const double tri[9], const double origin[3],
+                              const double dir[3], double& dist);
+
+  /** nearest intersection of a ray, as FacetBVH::ray_fire */
+  template <class Filter>
+  bool ray_fire(const FacetBVH::Ray& ray, double nonneg_ray_len,
+                const double* neg_ray_len, const int* orientation,
+                const Filter& skip, uint32_t& hit, double& hit_dist,
+                uint32_t* neg_hit = NULL, double* neg_hit_dist = NULL,
+                FacetBVH::TraversalOrder order = FacetBVH::ORDER_FRONT_TO_BACK,
+                FacetBVH::TraversalStats* stats = NULL) const;
+
+  /** all intersections of a ray, as FacetBVH::ray_intersect_all */
+  template <class Filter>
+  void ray_intersect_all(const FacetBVH::Ray& ray, double nonneg_ray_len,
+                         const Filter& skip, std::vector<uint32_t>& hits,
+                         std::vector<double>& dists) const;
+
+  /** triangle closest to a point, as FacetBVH::closest_triangle */
+  template <class Filter>
+  bool closest_triangle(const double point[3], const Filter& skip,
+                        uint32_t& nearest, double& dist) const;
+
+ private:
+  struct Box {
+    double lower[3];
+    double upper[3];
+  };
+
+  /** the box of a node from its quantized bounds and the box of its
+   *  parent; the build and the queries decode with the same operations */
+  static void decode(const Node& node, const Box& parent, Box& result);
+
+  /** quantize a box, rounding outwards, so that it decodes to a box that
+   *  contains it */
+  static void encode(const Box& box, const Box& parent, Node& node);
+
+  static bool ray_box(const Box& box, const FacetBVH::Ray& ray, double t_min,
+                      double t_max, double& t_entry);
+
+  static double box_dist_sqr(const Box& box, const double point[3]);
+
+  /** traverse the nodes hit by a ray, calling visit(slot, tri, t_max) for
+   *  every triangle of the leaves it hits; visit may shrink t_max */
+  template <class Visitor>
+  void traverse(const FacetBVH::Ray& ray, double t_min, double& t_max,
+                Visitor& visit, FacetBVH::TraversalOrder order,
+                FacetBVH::TraversalStats* stats) const;
+
+  std::vector<Node> nodes;
+  /** exact box of the root, which the boxes of the nodes are relative to */
+  Box root;
+  /** three vertex indices per slot */
+  std::vector<uint32_t> indices;
+  /** the vertex pool, 3 coordinates per vertex in one of the precisions */
+  std::vector<double> doubleVertices;
+  std::vector<float> floatVertices;
+  Precision vertexPrecision;
+};
+
+inline void CompactBVH::triangle_coords(uint32_t i, double tri[9]) const {
+  const uint32_t* index = &indices[3 * i];
+  if (PRECISION_DOUBLE == vertexPrecision) {
+    for (int v = 0; v < 3; v++)
+      for (int k = 0; k < 3; k++)
+        tri[3 * v + k] = doubleVertices[3 * index[v] + k];
+  } else {
+    for (int v = 0; v < 3; v++)
+      for (int k = 0; k < 3; k++)
+        tri[3 * v + k] = floatVertices[3 * index[v] + k];
+  }
+}
+
+inline void CompactBVH::decode(const Node& node, const Box& parent,
+                               Box& result) {
+  for (int i = 0; i < 3; i++) {
+    const double step =
+        (parent.upper[i] - parent.lower[i]) / QUANTIZATION_STEPS;
+    // the end steps are the bounds of the parent themselves
+    result.lower[i] = node.lower[i] == QUANTIZATION_STEPS
+                          ? parent.upper[i]
+                          : parent.lower[i] + node.lower[i] * step;
+    result.upper[i] = node.upper[i] == QUANTIZATION_STEPS
+                          ? parent.upper[i]
+                          : parent.lower[i] + node.upper[i] * step;
+  }
+}
+
+inline bool CompactBVH::ray_box(const Box& box, const FacetBVH::Ray& ray,
+                                double t_min, double t_max,
+                                double& t_entry) {
+  for (int i = 0; i < 3; i++) {
+    const double lo = box.lower[i] - ray.tolerance;
+    const double hi = box.upper[i] + ray.tolerance;
+    if (ray.dir[i] == 0.0) {
+      if (ray.origin[i] < lo || ray.origin[i] > hi) return false;
+      continue;
+    }
+    double t0 = (lo - ray.origin[i]) * ray.inv_dir[i];
+    double t1 = (hi - ray.origin[i]) * ray.inv_dir[i];
+    if (t0 > t1) std::swap(t0, t1);
+    if (t0 > t_min) t_min = t0;
+    if (t1 < t_max) t_max = t1;
+    if (t_min > t_max) return false;
+  }
+  t_entry = t_min;
+  return true;
+}
+
+inline double CompactBVH::box_dist_sqr(const Box& box,
+                                       const double point[3]) {
+  double result = 0.0;
+  for (int i = 0; i < 3; i++) {
+    double d = 0.0;
+    if (point[i] < box.lower[i])
+      d = box.lower[i] - point[i];
+    else if (point[i] > box.upper[i])
+      d = point[i] - box.upper[i];
+    result += d * d;
+  }
+  return result;
+}
+
+template <class Visitor>
+void CompactBVH::traverse(const FacetBVH::Ray& ray, double t_min,
+                          double& t_max, Visitor& visit,
+                          FacetBVH::TraversalOrder order,
+                          FacetBVH::TraversalStats* stats) const {
+  if (empty()) return;
+
+  // the box of a child is decoded from that of its parent, so both children
+  // are tested when their parent is reached and the stack holds the boxes
+  struct Entry {
+    uint32_t node;
+    double t_entry;
+    Box box;
+  };
+  Entry stack[FacetBVH::MAX_DEPTH];
+  int top = 0;
+  Box box;
+  double t_entry;
+  decode(nodes[0], root, box);
+  if (stats) stats->node_tests++;
+  if (!ray_box(box, ray, t_min, t_max, t_entry)) return;
+  uint32_t current = 0;
+  while (true) {
+    const Node& node = nodes[current];
+    if (node.is_leaf()) {
+      if (stats) {
+        stats->leaves_visited++;
+        stats->triangle_tests += node.count;
+      }
+      for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+        double tri[9];
+        triangle_coords(i, tri);
+        visit(i, tri, t_max);
+      }
+    } else {
+      uint32_t near_child = current + 1, far_child = node.offset;
+      Box near_box, far_box;
+      decode(nodes[near_child], box, near_box);
+      decode(nodes[far_child], box, far_box);
+      double t_near, t_far;
+      if (stats) stats->node_tests += 2;
+      const bool hit_near = ray_box(near_box, ray, t_min, t_max, t_near);
+      const bool hit_far = ray_box(far_box, ray, t_min, t_max, t_far);
+      if (hit_near && hit_far) {
+        if (FacetBVH::ORDER_FRONT_TO_BACK == order && t_far < t_near) {
+          std::swap(near_child, far_child);
+          std::swap(near_box, far_box);
+          std::swap(t_near, t_far);
+        }
+        // in depth-first order the stacked child is only culled by its box
+        Entry& entry = stack[top++];
+        entry.node = far_child;
+        entry.t_entry =
+            FacetBVH::ORDER_FRONT_TO_BACK == order ? t_far : t_min;
+        entry.box = far_box;
+        current = near_child;
+        box = near_box;
+        continue;
+      }
+      if (hit_near || hit_far) {
+        current = hit_near ? near_child : far_child;
+        box = hit_near ? near_box : far_box;
+        continue;
+      }
+    }
+    // skip the stacked nodes entered beyond the nearest hit
+    while (top > 0 && stack[top - 1].t_entry > t_max) top--;
+    if (top == 0) break;
+    top--;
+    current = stack[top].node;
+    box = stack[top].box;
+  }
+}
+
+template <class Filter>
+bool CompactBVH::ray_fire(const FacetBVH::Ray& ray, double nonneg_ray_len,
+                          const double* neg_ray_len, const int* orientation,
+                          const Filter& skip, uint32_t& hit,
+                          double& hit_dist, uint32_t* neg_hit,
+                          double* neg_hit_dist,
+                          FacetBVH::TraversalOrder order,
+                          FacetBVH::TraversalStats* stats) const {
+  struct Nearest {
+    const FacetBVH::Ray* ray;
+    const double* neg_ray_len;
+    const int* orientation;
+    const Filter* skip;
+    bool found, found_neg;
+    uint32_t hit, neg_hit;
+    double neg_dist;
+
+    void operator()(uint32_t slot, const double tri[9], double& t_max) {
+      if ((*skip)(slot)) return;
+      double dist;
+      double limit = t_max;
+      if (!FacetBVH::intersect_triangle(tri, *ray, dist, &limit, neg_ray_len,
+                                        orientation))
+        return;
+      if (dist < 0) {
+        // keep the intersection behind the origin nearest to it
+        if (!found_neg || dist > neg_dist) {
+          found_neg = true;
+          neg_hit = slot;
+          neg_dist = dist;
+        }
+      } else {
+        found = true;
+        hit = slot;
+        t_max = dist;
+      }
+    }
+  };
+
+  Nearest nearest = {&ray,  neg_ray_len, orientation, &skip, false,
+                     false, 0,           0,           0.0};
+  double t_max = nonneg_ray_len;
+  traverse(ray, neg_ray_len ? *neg_ray_len : 0.0, t_max, nearest, order,
+           stats);
+
+  if (nearest.found) {
+    hit = nearest.hit;
+    hit_dist = t_max;
+  }
+  if (neg_hit && neg_hit_dist) {
+    *neg_hit = nearest.found_neg ? nearest.neg_hit : 0;
+    *neg_hit_dist = nearest.found_neg ? nearest.neg_dist : 0.0;
+  }
+  return nearest.found;
+}
+
+template <class Filter>
+void CompactBVH::ray_intersect_all(const FacetBVH::Ray& ray,
+                                   double nonneg_ray_len, const Filter& skip,
+                                   std::vector<uint32_t>& hits,
+                                   std::vector<double>& dists) const {
+  struct All {
+    const FacetBVH::Ray* ray;
+    const Filter* skip;
+    std::vector<uint32_t>* hits;
+    std::vector<double>* dists;
+    double limit;
+
+    void operator()(uint32_t slot, const double tri[9], double&) {
+      if ((*skip)(slot)) return;
+      double dist;
+      if (FacetBVH::intersect_triangle(tri, *ray, dist, &limit, NULL, NULL)) {
+        hits->push_back(slot);
+        dists->push_back(dist);
+      }
+    }
+  };
+
+  hits.clear();
+  dists.clear();
+  All all = {&ray, &skip, &hits, &dists, nonneg_ray_len};
+  double t_max = nonneg_ray_len;
+  traverse(ray, 0.0, t_max, all, FacetBVH::ORDER_DEPTH_FIRST, NULL);
+}
+
+template <class Filter>
+bool CompactBVH::closest_triangle(const double point[3], const Filter& skip,
+                                  uint32_t& nearest, double& dist) const {
+  if (empty()) return false;
+
+  bool found = false;
+  double best = std::numeric_limits<double>::max();
+  uint32_t best_slot = 0;
+
+  struct Entry {
+    uint32_t node;
+    Box box;
+  };
+  Entry stack[FacetBVH::MAX_DEPTH];
+  int top = 0;
+  uint32_t current = 0;
+  Box box;
+  decode(nodes[0], root, box);
+  while (true) {
+    const Node& node = nodes[current];
+    if (box_dist_sqr(box, point) < best) {
+      if (node.is_leaf()) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+          if (skip(i)) continue;
+          double tri[9], closest[3];
+          triangle_coords(i, tri);
+          FacetBVH::closest_point_on_triangle(tri, point, closest);
+          double d2 = 0.0;
+          for (int j = 0; j < 3; j++)
+            d2 += (closest[j] - point[j]) * (closest[j] - point[j]);
+          if (d2 < best) {
+            best = d2;
+            best_slot = i;
+            found = true;
+          }
+        }
+      } else {
+        // descend into the nearer child first
+        uint32_t first = current + 1, second = node.offset;
+        Box first_box, second_box;
+        decode(nodes[first], box, first_box);
+        decode(nodes[second], box, second_box);
+        if (box_dist_sqr(second_box, point) <
+            box_dist_sqr(first_box, point)) {
+          std::swap(first, second);
+          std::swap(first_box, second_box);
+        }
+        stack[top].node = second;
+        stack[top].box = second_box;
+        top++;
+        current = first;
+        box = first_box;
+        continue;
+      }
+    }
+    if (top == 0) break;
+    top--;
+    current = stack[top].node;
+    box = stack[top].box;
+  }
+
+  if (found) {
+    nearest = best_slot;
+    dist = sqrt(best);
+  }
+  return found;
+}
+
+}  // namespace moab
+
+#endif
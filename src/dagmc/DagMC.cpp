@@ -7,17 +7,33 @@
 #include <string.h>
 
 #include <algorithm>
+#include <chrono>
 #include <climits>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <numeric>
 #include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #ifndef M_PI /* windows */
 #define M_PI 3.14159265358979323846
 #endif
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "BVHRayTracer.hpp"
+#include "IdIndex.hpp"
+#include "QueryProfiler.hpp"
+#include "RayLog.hpp"
+#include "RayOrder.hpp"
+#include "SafetyGrid.hpp"
+#include "VolumeGrid.hpp"
+
 #ifdef DOUBLE_DOWN
 #include "MOABRay.h"
 #include "RTI.hpp"
@@ -25,6 +41,9 @@
 
 #define MB_OBB_TREE_TAG_NAME "OBB_TREE"
 #define FACETING_TOL_TAG_NAME "FACETING_TOL"
+#define INSTANCE_OF_TAG_NAME "DAGMC_INSTANCE_OF"
+#define INSTANCE_TRANSFORM_TAG_NAME "DAGMC_INSTANCE_TRANSFORM"
+#define MEASURE_TAG_NAME "DAGMC_MEASURE"
 static const int null_delimiter_length = 1;
 
 namespace moab {
@@ -41,9 +60,19 @@ namespace moab {
 
 const bool counting = false; /* controls counts of ray casts and pt_in_vols */
 
+typedef std::chrono::steady_clock SetupClock;
+
+// wall clock seconds since start
+static double seconds_since(SetupClock::time_point start) {
+  return std::chrono::duration<double>(SetupClock::now() - start).count();
+}
+
 // Empty synonym map for DagMC::parse_metadata()
 const std::map<std::string, std::string> DagMC::no_synonyms;
 
+const double DagMC::DEFAULT_TUNE_FRACTION = 0.8;
+struct DagMC::LogRecord : RayLog::Record {};
+
 // DagMC Constructor
 DagMC::DagMC(std::shared_ptr<moab::Interface> mb_impl, double overlap_tolerance,
              double p_numerical_precision) {
@@ -147,6 +176,7 @@ ErrorCode DagMC::load_file(const char* cfile) {
 
     return rval;
   }
+  geometryFile = filename;
 
   return finish_loading();
 }
@@ -187,19 +217,327 @@ ErrorCode DagMC::setup_geometry(Range& surfs, Range& vols) {
 ErrorCode DagMC::setup_obbs() {
   ErrorCode rval;
 
+  if (ACCEL_BVH == accelType) {
+    if (!bvh_tracer) {
+      bvh_tracer.reset(new BVHRayTracer(GTT.get(), overlap_thickness(),
+                                        numerical_precision()));
+      set_ordered_traversal(orderedTraversal);
+      const BVHRayTracer::Storage storages[] = {
+          BVHRayTracer::STORAGE_FULL, BVHRayTracer::STORAGE_COMPACT,
+          BVHRayTracer::STORAGE_COMPACT_FLOAT};
+      bvh_tracer->set_storage(storages[treeStorage]);
+      bvh_tracer->set_shared_complement(sharedComplement);
+    }
+    if (bvh_tracer->have_trees()) return MB_SUCCESS;
+
+    // the compact trees and the shared complement have no dipoles for the
+    // winding number
+    if (TREES_FULL != treeStorage || sharedComplement) {
+      windingTracer.reset(new BVHRayTracer(GTT.get(), overlap_thickness(),
+                                           numerical_precision()));
+      rval = windingTracer->build_lazy();
+      MB_CHK_SET_ERR(rval, "Failed to set up the winding number trees");
+    }
+
+    rval = load_volume_instances(*bvh_tracer);
+    MB_CHK_SET_ERR(rval, "Failed to read the volume instances");
+
+    // try the cache first, keyed by the contents of the geometry file; the
+    // trees of instances, the compact trees and the shared complement are
+    // not cached
+    const bool use_cache = !accelCacheFile.empty() && !geometryFile.empty() &&
+                           !bvh_tracer->have_instances() &&
+                           TREES_FULL == treeStorage && !sharedComplement;
+    if (!accelCacheFile.empty() && bvh_tracer->have_instances())
+      std::cerr << "DagMC warning: the BVH cache is not used with volume "
+                   "instances"
+                << std::endl;
+    if (!accelCacheFile.empty() && TREES_FULL != treeStorage)
+      std::cerr << "DagMC warning: the BVH cache is not used with compact "
+                   "trees"
+                << std::endl;
+    if (!accelCacheFile.empty() && sharedComplement)
+      std::cerr << "DagMC warning: the BVH cache is not used with a shared "
+                   "implicit complement"
+                << std::endl;
+    uint64_t geometry_hash = 0;
+    if (use_cache) {
+      rval = BVHCache::file_key(geometryFile.c_str(), geometry_hash);
+      MB_CHK_SET_ERR(rval, "Failed to read " << geometryFile);
+      if (map_accel_cache(geometry_hash)) return MB_SUCCESS;
+    }
+
+    if (lazyTrees) {
+      std::cout << "BVH acceleration data structures will be built on first "
+                   "use"
+                << std::endl;
+      rval = bvh_tracer->build_lazy();
+      MB_CHK_SET_ERR(rval, "Failed to set up lazy BVH trees");
+      return MB_SUCCESS;
+    }
+
+    // of the processes of a node starting together, the first one to take
+    // the lock builds the trees and writes the cache, the others find it
+    // when they get the lock
+    std::unique_ptr<BVHCache::BuildLock> lock;
+    if (use_cache) {
+      lock.reset(new BVHCache::BuildLock(accelCacheFile.c_str()));
+      if (map_accel_cache(geometry_hash)) return MB_SUCCESS;
+    }
+
+    std::cout << "Building BVH acceleration data structures..." << std::endl;
+    rval = bvh_tracer->build(buildThreads);
+    MB_CHK_SET_ERR(rval, "Failed to build BVH trees");
+    const BVHRayTracer::BuildTimes& times = bvh_tracer->get_build_times();
+    std::cout << "Built the BVH trees on " << times.threads << " threads in "
+              << times.facets << " s (facets) + " << times.trees
+              << " s (trees)" << std::endl;
+    setupTimes.threads = times.threads;
+    setupTimes.facets = times.facets;
+    setupTimes.trees = times.trees;
+
+    if (use_cache) {
+      std::cout << "Writing BVH acceleration data structures to "
+                << accelCacheFile << std::endl;
+      rval = bvh_tracer->write_cache(accelCacheFile.c_str(), geometry_hash);
+      if (MB_SUCCESS != rval) {
+        std::cerr << "DagMC warning: failed to write " << accelCacheFile
+                  << std::endl;
+      } else {
+        // the trees just built are private; the mapped cache is shared with
+        // the other processes
+        rval = bvh_tracer->read_cache(accelCacheFile.c_str(), geometry_hash);
+        if (MB_SUCCESS != rval) {
+          rval = bvh_tracer->build(buildThreads);
+          MB_CHK_SET_ERR(rval, "Failed to build BVH trees");
+        }
+      }
+    }
+    return MB_SUCCESS;
+  }
+
+  if (lazyTrees)
+    std::cerr << "DagMC warning: lazy trees need the BVH acceleration "
+                 "structure, building all OBB trees"
+              << std::endl;
+
   // If we havent got an OBB Tree, build one.
   if (!GTT->have_obb_tree()) {
     std::cout << "Building acceleration data structures..." << std::endl;
+    SetupClock::time_point start = SetupClock::now();
 #ifdef DOUBLE_DOWN
     rval = ray_tracer->init();
 #else
     rval = GTT->construct_obb_trees();
 #endif
     MB_CHK_SET_ERR(rval, "Failed to build obb trees");
+    setupTimes.threads = 1;
+    setupTimes.trees = seconds_since(start);
+  }
+
+  // BVH trees for the winding number, only built for the volumes it is
+  // asked about
+  windingTracer.reset(new BVHRayTracer(GTT.get(), overlap_thickness(),
+                                       numerical_precision()));
+  rval = windingTracer->build_lazy();
+  MB_CHK_SET_ERR(rval, "Failed to set up the winding number trees");
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::add_volume_instance(EntityHandle instance,
+                                     EntityHandle prototype,
+                                     const double rotation[9],
+                                     const double translation[3]) {
+  if (3 != GTT->dimension(instance) || 3 != GTT->dimension(prototype))
+    MB_SET_ERR(MB_FAILURE, "Instances and prototypes must be volumes");
+  if (instance == prototype)
+    MB_SET_ERR(MB_FAILURE, "A volume cannot be an instance of itself");
+
+  Tag instance_tag, transform_tag;
+  ErrorCode rval =
+      MBI->tag_get_handle(INSTANCE_OF_TAG_NAME, 1, MB_TYPE_HANDLE,
+                          instance_tag, MB_TAG_SPARSE | MB_TAG_CREAT);
+  MB_CHK_SET_ERR(rval, "Failed to get the instance tag");
+  rval = MBI->tag_get_handle(INSTANCE_TRANSFORM_TAG_NAME, 12, MB_TYPE_DOUBLE,
+                             transform_tag, MB_TAG_SPARSE | MB_TAG_CREAT);
+  MB_CHK_SET_ERR(rval, "Failed to get the instance transform tag");
+
+  double transform[12];
+  std::copy(rotation, rotation + 9, transform);
+  std::copy(translation, translation + 3, transform + 9);
+  rval = MBI->tag_set_data(instance_tag, &instance, 1, &prototype);
+  MB_CHK_SET_ERR(rval, "Failed to tag the instance");
+  rval = MBI->tag_set_data(transform_tag, &instance, 1, transform);
+  MB_CHK_SET_ERR(rval, "Failed to tag the instance transform");
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::load_volume_instances(BVHRayTracer& tracer) {
+  // files without instances do not have the tags
+  Tag instance_tag, transform_tag;
+  if (MB_SUCCESS != MBI->tag_get_handle(INSTANCE_OF_TAG_NAME, 1,
+                                        MB_TYPE_HANDLE, instance_tag))
+    return MB_SUCCESS;
+  ErrorCode rval = MBI->tag_get_handle(INSTANCE_TRANSFORM_TAG_NAME, 12,
+                                       MB_TYPE_DOUBLE, transform_tag);
+  MB_CHK_SET_ERR(rval, "Volume instances without transforms");
+
+  Range instances;
+  rval = MBI->get_entities_by_type_and_tag(0, MBENTITYSET, &instance_tag,
+                                           NULL, 1, instances);
+  MB_CHK_SET_ERR(rval, "Failed to get the volume instances");
+  for (Range::iterator i = instances.begin(); i != instances.end(); ++i) {
+    EntityHandle instance = *i, prototype;
+    double transform[12];
+    rval = MBI->tag_get_data(instance_tag, &instance, 1, &prototype);
+    MB_CHK_SET_ERR(rval, "Failed to get the prototype of an instance");
+    rval = MBI->tag_get_data(transform_tag, &instance, 1, transform);
+    MB_CHK_SET_ERR(rval, "Failed to get the transform of an instance");
+
+    InstanceTransform placement;
+    std::copy(transform, transform + 9, placement.rotation);
+    std::copy(transform + 9, transform + 12, placement.translation);
+    rval = tracer.add_instance(instance, prototype, placement);
+    MB_CHK_ERR(rval);
+  }
+  if (!instances.empty())
+    std::cout << "Sharing BVH trees with " << instances.size()
+              << " volume instances" << std::endl;
+  return MB_SUCCESS;
+}
+
+bool DagMC::map_accel_cache(uint64_t geometry_hash) {
+  SetupClock::time_point start = SetupClock::now();
+  if (MB_SUCCESS != bvh_tracer->read_cache(accelCacheFile.c_str(),
+                                           geometry_hash))
+    return false;
+  std::cout << "Using BVH acceleration data structures from "
+            << accelCacheFile << std::endl;
+  setupTimes.trees = seconds_since(start);
+  return true;
+}
+
+ErrorCode DagMC::write_accel_cache(const char* filename) {
+  if (geometryFile.empty())
+    MB_SET_ERR(MB_FAILURE, "The BVH cache needs geometry read by load_file");
+
+  uint64_t geometry_hash;
+  ErrorCode rval = BVHCache::file_key(geometryFile.c_str(), geometry_hash);
+  MB_CHK_SET_ERR(rval, "Failed to read " << geometryFile);
+
+  // build the trees just for the cache if the OBB trees are in use, or if
+  // the BVH trees are built lazily and some may be missing
+  std::unique_ptr<BVHRayTracer> tracer;
+  BVHRayTracer* trees = bvh_tracer.get();
+  if (!trees || !trees->have_trees() || lazyTrees) {
+    tracer.reset(new BVHRayTracer(GTT.get(), overlap_thickness(),
+                                  numerical_precision()));
+    rval = tracer->tune_volumes(tunedVolumes);
+    MB_CHK_SET_ERR(rval, "Failed to tune the BVH trees");
+    rval = tracer->build(buildThreads);
+    MB_CHK_SET_ERR(rval, "Failed to build BVH trees");
+    const BVHRayTracer::BuildTimes& times = tracer->get_build_times();
+    std::cout << "Built the BVH trees on " << times.threads << " threads in "
+              << times.facets << " s (facets) + " << times.trees
+              << " s (trees)" << std::endl;
+    trees = tracer.get();
+  }
+
+  rval = trees->write_cache(filename, geometry_hash);
+  MB_CHK_SET_ERR(rval, "Failed to write the BVH cache " << filename);
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::tune_trees(double fraction) {
+  std::vector<QueryProfiler::Counts> counts;
+  query_profile().get_counts(counts);
+  std::vector<std::pair<int, double>> seconds;
+  for (unsigned i = 1; i < counts.size(); i++)
+    seconds.push_back(std::make_pair(i, counts[i].seconds()));
+  return tune_slowest_volumes(seconds, fraction);
+}
+
+ErrorCode DagMC::tune_trees_from_profile(const char* filename,
+                                         double fraction) {
+  std::ifstream str(filename);
+  if (!str) MB_SET_ERR(MB_FAILURE, "Failed to open " << filename);
+  std::vector<std::pair<int, double>> seconds;
+  if (!QueryProfiler::read_csv(str, seconds))
+    MB_SET_ERR(MB_FAILURE, filename << " is not a CSV query profile");
+  // the report is by id; the ids of other geometries get index 0
+  for (unsigned i = 0; i < seconds.size(); i++)
+    seconds[i].first = index_by_id(3, seconds[i].first);
+  return tune_slowest_volumes(seconds, fraction);
+}
+
+ErrorCode DagMC::tune_slowest_volumes(
+    std::vector<std::pair<int, double>> seconds, double fraction) {
+  if (!(fraction > 0 && fraction <= 1))
+    MB_SET_ERR(MB_FAILURE, "The tuned fraction of the query time must be in "
+                           "(0, 1]");
+  double total = 0;
+  for (unsigned i = 0; i < seconds.size(); i++) {
+    if (seconds[i].first > 0) total += seconds[i].second;
+  }
+  std::stable_sort(seconds.begin(), seconds.end(),
+                   [](const std::pair<int, double>& a,
+                      const std::pair<int, double>& b) {
+                     return a.second > b.second;
+                   });
+
+  std::vector<EntityHandle> slowest;
+  double covered = 0;
+  for (unsigned i = 0; i < seconds.size() && covered < fraction * total;
+       i++) {
+    const int index = seconds[i].first;
+    if (index <= 0 || (unsigned)index >= vol_handles().size() ||
+        seconds[i].second <= 0)
+      continue;
+    const EntityHandle volume = vol_handles()[index];
+    covered += seconds[i].second;
+    slowest.push_back(volume);
+    if (std::find(tunedVolumes.begin(), tunedVolumes.end(), volume) ==
+        tunedVolumes.end())
+      tunedVolumes.push_back(volume);
+  }
+  if (slowest.empty()) {
+    std::cerr << "DagMC warning: no query times to tune the BVH trees by"
+              << std::endl;
+    return MB_SUCCESS;
+  }
+  std::cout << "Tuning the BVH trees of " << slowest.size()
+            << " volumes, which took " << 100 * covered / total
+            << "% of the query time" << std::endl;
+
+  if (bvh_tracer) {
+    ErrorCode rval = bvh_tracer->tune_volumes(slowest);
+    MB_CHK_SET_ERR(rval, "Failed to tune the BVH trees");
   }
   return MB_SUCCESS;
 }
 
+ErrorCode DagMC::get_bvh_memory(size_t& bytes, size_t& num_facets) const {
+  if (!bvh_tracer || !bvh_tracer->have_trees())
+    MB_SET_ERR(MB_FAILURE, "The BVH trees have not been set up");
+  size_t num_trees, num_nodes;
+  bvh_tracer->get_sizes(num_trees, num_facets, num_nodes);
+  bytes = bvh_tracer->memory_use();
+  return MB_SUCCESS;
+}
+
+void DagMC::get_tree_counts(int& num_built, int& num_volumes) {
+  if (ACCEL_BVH == accelType && bvh_tracer) {
+    size_t built, volumes;
+    bvh_tracer->get_tree_counts(built, volumes);
+    num_built = built;
+    num_volumes = volumes;
+    return;
+  }
+  // the OBB trees are built for all volumes or none
+  num_volumes = num_entities(3);
+  num_built = GTT->have_obb_tree() ? num_volumes : 0;
+}
+
 // setups of the indices for the problem, builds a list of surface and volumes
 // indices
 ErrorCode DagMC::setup_indices() {
@@ -209,12 +547,29 @@ ErrorCode DagMC::setup_indices() {
   // build the various index vectors used for efficiency
   rval = build_indices(surfs, vols);
   MB_CHK_SET_ERR(rval, "Failed to build surface/volume indices");
+
+  rval = build_surface_tables();
+  MB_CHK_SET_ERR(rval, "Failed to build the surface tables");
+
+  rval = load_measures();
+  MB_CHK_SET_ERR(rval, "Failed to load the measures");
+
+  rval = build_volume_bounds();
+  MB_CHK_SET_ERR(rval, "Failed to build the volume bounds");
+
+  rval = build_volume_grid();
+  MB_CHK_SET_ERR(rval, "Failed to build the volume grid");
+
+  // the grids of a previously loaded geometry do not fit the new volumes
+  safetyGrids.clear();
   return MB_SUCCESS;
 }
 
 // initialise the obb tree
 ErrorCode DagMC::init_OBBTree() {
   ErrorCode rval;
+  setupTimes = SetupTimes();
+  SetupClock::time_point start = SetupClock::now();
 
   // find all geometry sets
   rval = GTT->find_geomsets();
@@ -223,14 +578,23 @@ ErrorCode DagMC::init_OBBTree() {
   // implicit compliment
   rval = setup_impl_compl();
   MB_CHK_SET_ERR(rval, "Failed to setup the implicit compliment");
+  setupTimes.geometry = seconds_since(start);
 
   // build obbs
   rval = setup_obbs();
   MB_CHK_SET_ERR(rval, "Failed to setup the OBBs");
 
   // setup indices
+  start = SetupClock::now();
   rval = setup_indices();
   MB_CHK_SET_ERR(rval, "Failed to setup problem indices");
+  setupTimes.indices = seconds_since(start);
+
+  // the safety grids are filled from the trees
+  start = SetupClock::now();
+  rval = build_safety_grids();
+  MB_CHK_SET_ERR(rval, "Failed to build the safety grids");
+  setupTimes.trees += seconds_since(start);
 
   return MB_SUCCESS;
 }
@@ -286,22 +650,174 @@ ErrorCode DagMC::finish_loading() {
 
 /* SECTION II: Fundamental Geometry Operations/Queries */
 
+// OBB tree nodes visited at all depths
+static uint64_t nodes_visited(const OrientedBoxTreeTool::TrvStats& stats) {
+  return std::accumulate(stats.nodes_visited().begin(),
+                         stats.nodes_visited().end(), (uint64_t)0);
+}
+
 ErrorCode DagMC::ray_fire(const EntityHandle volume, const double point[3],
                           const double dir[3], EntityHandle& next_surf,
                           double& next_surf_dist, RayHistory* history,
                           double user_dist_limit, int ray_orientation,
                           OrientedBoxTreeTool::TrvStats* stats) {
+  LogRecord* record =
+      begin_log(RayLog::RAY_FIRE, volume, point, dir, history);
+  if (record) {
+    record->dist_limit = user_dist_limit;
+    record->orientation = ray_orientation;
+  }
+  ErrorCode rval = fire_ray(volume, point, dir, next_surf, next_surf_dist,
+                            history, user_dist_limit, ray_orientation, stats);
+  end_log(record, rval, next_surf, next_surf_dist);
+  return rval;
+}
+
+ErrorCode DagMC::fire_ray(EntityHandle volume, const double point[3],
+                          const double dir[3], EntityHandle& next_surf,
+                          double& next_surf_dist, RayHistory* history,
+                          double user_dist_limit, int ray_orientation,
+                          OrientedBoxTreeTool::TrvStats* stats) {
+  if (bvh_tracer)
+    return bvh_ray_fire(volume, point, dir, next_surf, next_surf_dist,
+                        history, user_dist_limit, ray_orientation, NULL);
+
+  QueryProfiler* profiler = query_profiler();
+  std::lock_guard<std::mutex> lock(gqtMutex);
+  if (!profiler) {
+    ErrorCode rval =
+        ray_tracer->ray_fire(volume, point, dir, next_surf, next_surf_dist,
+                             history, user_dist_limit, ray_orientation, stats);
+    return rval;
+  }
+
+  // the traversal is counted from the statistics of the caller if there
+  // are any, as they are accumulated over calls
+  const int index = volume_index(volume);
+  QueryProfiler::Timer timer(profiler, index, QueryProfiler::RAY_FIRE);
+  static thread_local OrientedBoxTreeTool::TrvStats profile_stats;
+  OrientedBoxTreeTool::TrvStats* trv_stats = stats ? stats : &profile_stats;
+  if (!stats) profile_stats.reset();
+  const uint64_t nodes_before = nodes_visited(*trv_stats);
+  const uint64_t triangles_before = trv_stats->ray_tri_tests();
+  ErrorCode rval = ray_tracer->ray_fire(volume, point, dir, next_surf,
+                                        next_surf_dist, history,
+                                        user_dist_limit, ray_orientation,
+                                        trv_stats);
+  profiler->add_traversal(index, nodes_visited(*trv_stats) - nodes_before,
+                          trv_stats->ray_tri_tests() - triangles_before);
+  if (MB_SUCCESS == rval && !next_surf && user_dist_limit <= 0)
+    profiler->add_lost(index);
+  return rval;
+}
+
+template <class History>
+ErrorCode DagMC::bvh_ray_fire(EntityHandle volume, const double point[3],
+                              const double dir[3], EntityHandle& next_surf,
+                              double& next_surf_dist, History* history,
+                              double dist_limit, int ray_orientation,
+                              BVHTraversalStats* stats) {
+  QueryProfiler* profiler = query_profiler();
+  if (!profiler)
+    return bvh_tracer->ray_fire(volume, point, dir, next_surf, next_surf_dist,
+                                history, dist_limit, ray_orientation, stats);
+
+  const int index = volume_index(volume);
+  QueryProfiler::Timer timer(profiler, index, QueryProfiler::RAY_FIRE);
+  BVHTraversalStats traversal;
   ErrorCode rval =
-      ray_tracer->ray_fire(volume, point, dir, next_surf, next_surf_dist,
-                           history, user_dist_limit, ray_orientation, stats);
+      bvh_tracer->ray_fire(volume, point, dir, next_surf, next_surf_dist,
+                           history, dist_limit, ray_orientation, &traversal);
+  profiler->add_traversal(index, traversal.node_tests,
+                          traversal.triangle_tests);
+  if (stats) {
+    stats->node_tests += traversal.node_tests;
+    stats->leaves_visited += traversal.leaves_visited;
+    stats->triangle_tests += traversal.triangle_tests;
+  }
+  if (MB_SUCCESS == rval && !next_surf && dist_limit <= 0)
+    profiler->add_lost(index);
   return rval;
 }
 
+ErrorCode DagMC::ray_fire_batch(const int num_rays, const EntityHandle* volumes,
+                                const double* const ray_starts[3],
+                                const double* const ray_dirs[3],
+                                EntityHandle* next_surfs,
+                                double* next_surf_dists, RayHistory* histories,
+                                const double* dist_limits, int ray_orientation,
+                                OrientedBoxTreeTool::TrvStats* stats) {
+  std::vector<int> order;
+  std::vector<uint64_t> keys;
+  return fire_ray_batch(order, keys, num_rays, volumes, ray_starts, ray_dirs,
+                        next_surfs, next_surf_dists, histories, dist_limits,
+                        ray_orientation, stats);
+}
+
+ErrorCode DagMC::fire_ray_batch(std::vector<int>& order,
+                                std::vector<uint64_t>& keys, const int num_rays,
+                                const EntityHandle* volumes,
+                                const double* const ray_starts[3],
+                                const double* const ray_dirs[3],
+                                EntityHandle* next_surfs,
+                                double* next_surf_dists, RayHistory* histories,
+                                const double* dist_limits, int ray_orientation,
+                                OrientedBoxTreeTool::TrvStats* stats) {
+  if (num_rays <= 0) return MB_SUCCESS;
+
+  // trace the rays grouped by volume so that consecutive queries walk the
+  // same tree, and within each volume by direction octant and along a
+  // Z-order curve through the origins so that they walk the same nodes;
+  // the results are stored by the caller's index
+  order.resize(num_rays);
+  for (int i = 0; i < num_rays; i++) order[i] = i;
+  if (sortRayBatches && num_rays >= RayOrder::MIN_RAYS) {
+    RayOrder::compute_keys(num_rays, ray_starts, ray_dirs, keys);
+    std::sort(order.begin(), order.end(), [volumes, &keys](int a, int b) {
+      if (volumes[a] != volumes[b]) return volumes[a] < volumes[b];
+      if (keys[a] != keys[b]) return keys[a] < keys[b];
+      return a < b;
+    });
+  } else if (!std::is_sorted(volumes, volumes + num_rays)) {
+    std::stable_sort(order.begin(), order.end(), [volumes](int a, int b) {
+      return volumes[a] < volumes[b];
+    });
+  }
+
+  for (int n = 0; n < num_rays; n++) {
+    const int i = order[n];
+    const double point[3] = {ray_starts[0][i], ray_starts[1][i],
+                             ray_starts[2][i]};
+    const double dir[3] = {ray_dirs[0][i], ray_dirs[1][i], ray_dirs[2][i]};
+    RayHistory* history = histories ? &histories[i] : NULL;
+    double dist_limit = dist_limits ? dist_limits[i] : 0;
+
+    ErrorCode rval = ray_fire(volumes[i], point, dir, next_surfs[i],
+                              next_surf_dists[i], history, dist_limit,
+                              ray_orientation, stats);
+    MB_CHK_SET_ERR(rval, "Failed to fire ray " << i << " of the batch");
+  }
+  return MB_SUCCESS;
+}
+
 ErrorCode DagMC::point_in_volume(const EntityHandle volume, const double xyz[3],
                                  int& result, const double* uvw,
                                  const RayHistory* history) {
-  ErrorCode rval =
-      ray_tracer->point_in_volume(volume, xyz, result, uvw, history);
+  LogRecord* record =
+      begin_log(RayLog::POINT_IN_VOLUME, volume, xyz, uvw, history);
+  QueryProfiler* profiler = query_profiler();
+  QueryProfiler::Timer timer(profiler, profiler ? volume_index(volume) : 0,
+                             QueryProfiler::POINT_IN_VOLUME);
+  ErrorCode rval = MB_SUCCESS;
+  if (outside_volume_bounds(volume, xyz))
+    result = 0;
+  else if (windingPrimary)
+    rval = point_in_volume_winding(volume, xyz, result);
+  else if (bvh_tracer)
+    rval = bvh_tracer->point_in_volume(volume, xyz, result, uvw, history);
+  else
+    rval = gqt_point_in_volume(volume, xyz, result, uvw, history);
+  end_log(record, rval, 0, 0.0, result);
   return rval;
 }
 
@@ -309,73 +825,838 @@ ErrorCode DagMC::test_volume_boundary(const EntityHandle volume,
                                       const EntityHandle surface,
                                       const double xyz[3], const double uvw[3],
                                       int& result, const RayHistory* history) {
+  if (bvh_tracer)
+    return bvh_tracer->test_volume_boundary(volume, surface, xyz, uvw, result,
+                                            history);
+
+  std::lock_guard<std::mutex> lock(gqtMutex);
   ErrorCode rval = ray_tracer->test_volume_boundary(volume, surface, xyz, uvw,
                                                     result, history);
   return rval;
 }
 
+// bring the GeomQueryTool copy of the history of a context up to date: the
+// facets added since the last query are appended, and the history is only
+// copied again once facets were removed from it or it was assigned
+static void sync_obb_history(DagMC::QueryContext& context) {
+  const InlineRayHistory& history = context.history;
+  if (context.obb_version != history.version() ||
+      context.obb_history.size() > history.size()) {
+    history.copy_to(context.obb_history);
+    context.obb_version = history.version();
+    return;
+  }
+  for (int i = context.obb_history.size(); i < history.size(); i++)
+    context.obb_history.add_entity(history[i]);
+}
+
+ErrorCode DagMC::ray_fire(QueryContext& context, const EntityHandle volume,
+                          const double point[3], const double dir[3],
+                          EntityHandle& next_surf, double& next_surf_dist,
+                          double user_dist_limit, int ray_orientation) {
+  LogRecord* record =
+      begin_log(RayLog::RAY_FIRE, volume, point, dir, &context.history);
+  if (record) {
+    record->dist_limit = user_dist_limit;
+    record->orientation = ray_orientation;
+  }
+
+  ErrorCode rval;
+  if (bvh_tracer) {
+    rval = bvh_ray_fire(volume, point, dir, next_surf, next_surf_dist,
+                        &context.history, user_dist_limit, ray_orientation,
+                        context.collect_stats ? &context.bvh_stats : NULL);
+  } else {
+    // GeomQueryTool::ray_fire only appends the facet it hits to the history
+    sync_obb_history(context);
+    rval = fire_ray(volume, point, dir, next_surf, next_surf_dist,
+                    &context.obb_history, user_dist_limit, ray_orientation,
+                    context.collect_stats ? &context.stats : NULL);
+    if (MB_SUCCESS == rval &&
+        context.obb_history.size() > context.history.size()) {
+      EntityHandle facet;
+      rval = context.obb_history.get_last_intersection(facet);
+      MB_CHK_SET_ERR(rval, "Failed to get the last intersection");
+      context.history.add_entity(facet);
+    }
+  }
+  end_log(record, rval, next_surf, next_surf_dist);
+  return rval;
+}
+
+ErrorCode DagMC::ray_fire_batch(QueryContext& context, const int num_rays,
+                                const EntityHandle* volumes,
+                                const double* const ray_starts[3],
+                                const double* const ray_dirs[3],
+                                EntityHandle* next_surfs,
+                                double* next_surf_dists, RayHistory* histories,
+                                const double* dist_limits,
+                                int ray_orientation) {
+  return fire_ray_batch(context.batch_order, context.batch_keys, num_rays,
+                        volumes, ray_starts, ray_dirs, next_surfs,
+                        next_surf_dists, histories, dist_limits,
+                        ray_orientation,
+                        context.collect_stats ? &context.stats : NULL);
+}
+
+ErrorCode DagMC::point_in_volume(QueryContext& context,
+                                 const EntityHandle volume, const double xyz[3],
+                                 int& result, const double* uvw) {
+  LogRecord* record =
+      begin_log(RayLog::POINT_IN_VOLUME, volume, xyz, uvw, &context.history);
+  QueryProfiler* profiler = query_profiler();
+  QueryProfiler::Timer timer(profiler, profiler ? volume_index(volume) : 0,
+                             QueryProfiler::POINT_IN_VOLUME);
+  ErrorCode rval = MB_SUCCESS;
+  if (outside_volume_bounds(volume, xyz)) {
+    result = 0;
+  } else if (windingPrimary) {
+    rval = point_in_volume_winding(volume, xyz, result);
+  } else if (bvh_tracer) {
+    rval = bvh_tracer->point_in_volume(volume, xyz, result, uvw,
+                                       &context.history);
+  } else {
+    sync_obb_history(context);
+    rval = gqt_point_in_volume(volume, xyz, result, uvw, &context.obb_history);
+  }
+  end_log(record, rval, 0, 0.0, result);
+  return rval;
+}
+
+ErrorCode DagMC::test_volume_boundary(QueryContext& context,
+                                      const EntityHandle volume,
+                                      const EntityHandle surface,
+                                      const double xyz[3], const double uvw[3],
+                                      int& result) {
+  if (bvh_tracer)
+    return bvh_tracer->test_volume_boundary(volume, surface, xyz, uvw, result,
+                                            &context.history);
+
+  sync_obb_history(context);
+  return test_volume_boundary(volume, surface, xyz, uvw, result,
+                              &context.obb_history);
+}
+
+ErrorCode DagMC::get_angle(QueryContext& context, EntityHandle surf,
+                           const double in_pt[3], double angle[3]) {
+  if (bvh_tracer)
+    return bvh_tracer->get_normal(surf, in_pt, angle, &context.history);
+
+  sync_obb_history(context);
+  return get_angle(surf, in_pt, angle, &context.obb_history);
+}
+
+ErrorCode DagMC::gqt_point_in_volume(EntityHandle volume, const double xyz[3],
+                                     int& result, const double* uvw,
+                                     const RayHistory* history) {
+  std::lock_guard<std::mutex> lock(gqtMutex);
+  return ray_tracer->point_in_volume(volume, xyz, result, uvw, history);
+}
+
 // use spherical area test to determine inside/outside of a polyhedron.
 ErrorCode DagMC::point_in_volume_slow(EntityHandle volume, const double xyz[3],
                                       int& result) {
+  if (windingFallback) return point_in_volume_winding(volume, xyz, result);
+
+  std::lock_guard<std::mutex> lock(gqtMutex);
   ErrorCode rval = ray_tracer->point_in_volume_slow(volume, xyz, result);
   return rval;
 }
 
+ErrorCode DagMC::winding_number(EntityHandle volume, const double xyz[3],
+                                double& result) {
+  BVHRayTracer* tracer = facet_tracer();
+  if (!tracer)
+    MB_SET_ERR(MB_FAILURE, "The winding number needs init_OBBTree()");
+  return tracer->winding_number(volume, xyz, result);
+}
+
+ErrorCode DagMC::point_in_volume_winding(EntityHandle volume,
+                                         const double xyz[3], int& result) {
+  BVHRayTracer* tracer = facet_tracer();
+  if (!tracer)
+    MB_SET_ERR(MB_FAILURE, "The winding number needs init_OBBTree()");
+  return tracer->point_in_volume_winding(volume, xyz, result);
+}
+
 // detemine distance to nearest surface
 ErrorCode DagMC::closest_to_location(EntityHandle volume,
                                      const double coords[3], double& result,
                                      EntityHandle* surface) {
-  ErrorCode rval =
-      ray_tracer->closest_to_location(volume, coords, result, surface);
+  LogRecord* record =
+      begin_log(RayLog::CLOSEST_TO_LOCATION, volume, coords, NULL,
+                (const RayHistory*)NULL);
+  QueryProfiler* profiler = query_profiler();
+  QueryProfiler::Timer timer(profiler, profiler ? volume_index(volume) : 0,
+                             QueryProfiler::CLOSEST_TO_LOCATION);
+  ErrorCode rval;
+  if (bvh_tracer) {
+    rval = bvh_tracer->closest_to_location(volume, coords, result, surface);
+  } else {
+    std::lock_guard<std::mutex> lock(gqtMutex);
+    rval = ray_tracer->closest_to_location(volume, coords, result, surface);
+  }
+  end_log(record, rval, surface ? *surface : 0, result);
   return rval;
 }
 
+ErrorCode DagMC::safety_distance(EntityHandle volume, const double xyz[3],
+                                 double& distance, SafetyMode mode) {
+  if (SAFETY_CONSERVATIVE == mode) {
+    // volumes of a previously loaded geometry have no grid
+    const int index = volume_index(volume);
+    const SafetyGrid* grid = (unsigned)index < safetyGrids.size()
+                                 ? safetyGrids[index].get()
+                                 : NULL;
+    // bounds below the size of a cell are too loose to be useful
+    if (grid) {
+      distance = grid->lower_bound(xyz);
+      if (distance >= grid->cell_radius()) return MB_SUCCESS;
+    }
+  }
+  return closest_to_location(volume, xyz, distance);
+}
+
+ErrorCode DagMC::build_safety_grids() {
+  safetyGrids.clear();
+  if (safetyGridCells <= 0) return MB_SUCCESS;
+  safetyGrids.resize(vol_handles().size());
+  for (unsigned i = 1; i < safetyGrids.size(); i++) {
+    std::unique_ptr<SafetyGrid> grid(new SafetyGrid);
+    ErrorCode rval = build_safety_grid(vol_handles()[i], *grid);
+    MB_CHK_SET_ERR(rval, "Failed to build the safety grid of volume "
+                             << id_by_index(3, i));
+    // volumes without facets have no grid
+    if (!grid->empty()) safetyGrids[i] = std::move(grid);
+  }
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::build_safety_grid(EntityHandle volume, SafetyGrid& grid) {
+  grid.clear();
+
+  // bounding box of the facets of the volume
+  std::vector<EntityHandle> surfs;
+  ErrorCode rval = MBI->get_child_meshsets(volume, surfs);
+  MB_CHK_SET_ERR(rval, "Failed to get the surfaces of a volume");
+  double box[6] = {HUGE_VAL, HUGE_VAL, HUGE_VAL,
+                   -HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    Range tris, verts;
+    rval = MBI->get_entities_by_type(surfs[i], MBTRI, tris);
+    MB_CHK_SET_ERR(rval, "Failed to get the facets of a surface");
+    rval = MBI->get_connectivity(tris, verts);
+    MB_CHK_SET_ERR(rval, "Failed to get the facet vertices");
+    if (verts.empty()) continue;
+    std::vector<double> coords(3 * verts.size());
+    rval = MBI->get_coords(verts, &coords[0]);
+    MB_CHK_SET_ERR(rval, "Failed to get the vertex coordinates");
+    for (size_t j = 0; j < coords.size(); j += 3) {
+      for (int k = 0; k < 3; k++) {
+        box[k] = std::min(box[k], coords[j + k]);
+        box[3 + k] = std::max(box[3 + k], coords[j + k]);
+      }
+    }
+  }
+  // volumes without facets keep an empty grid
+  if (box[0] > box[3]) return MB_SUCCESS;
+
+  grid.setup(box, safetyGridCells);
+  for (int cell = 0; cell < grid.num_cells(); cell++) {
+    double center[3], distance;
+    grid.cell_center(cell, center);
+    // not profiled or logged as queries
+    if (bvh_tracer)
+      rval = bvh_tracer->closest_to_location(volume, center, distance);
+    else
+      rval = ray_tracer->closest_to_location(volume, center, distance);
+    MB_CHK_SET_ERR(rval, "Failed to get the distance to the volume");
+    grid.set_distance(cell, distance);
+  }
+  return MB_SUCCESS;
+}
+
 // calculate volume of polyhedron
 ErrorCode DagMC::measure_volume(EntityHandle volume, double& result) {
-  ErrorCode rval = ray_tracer->measure_volume(volume, result);
-  return rval;
+  const int index = volume_index(volume);
+  if (!index) {
+    std::lock_guard<std::mutex> lock(gqtMutex);
+    return ray_tracer->measure_volume(volume, result);
+  }
+  if (!measuresComplete) {
+    ErrorCode rval = compute_measures();
+    MB_CHK_ERR(rval);
+  }
+  result = entMeasures[vols_handle_idx][index];
+  return MB_SUCCESS;
 }
 
 // sum area of elements in surface
 ErrorCode DagMC::measure_area(EntityHandle surface, double& result) {
-  ErrorCode rval = ray_tracer->measure_area(surface, result);
-  return rval;
+  const int index = surface_table_index(surface);
+  if (!index) {
+    std::lock_guard<std::mutex> lock(gqtMutex);
+    return ray_tracer->measure_area(surface, result);
+  }
+  if (!measuresComplete) {
+    ErrorCode rval = compute_measures();
+    MB_CHK_ERR(rval);
+  }
+  result = entMeasures[surfs_handle_idx][index];
+  return MB_SUCCESS;
+}
+
+// the coordinates of the facets of a surface, 9 per triangle
+static ErrorCode get_facet_coords(Interface* mbi, EntityHandle surface,
+                                  std::vector<double>& coords) {
+  std::vector<EntityHandle> facets, conn;
+  ErrorCode rval = mbi->get_entities_by_dimension(surface, 2, facets);
+  MB_CHK_SET_ERR(rval, "Failed to get the facets of a surface");
+  coords.clear();
+  if (facets.empty()) return MB_SUCCESS;
+  rval = mbi->get_connectivity(&facets[0], facets.size(), conn);
+  MB_CHK_SET_ERR(rval, "Failed to get the facet connectivity");
+  if (conn.size() != 3 * facets.size())
+    MB_SET_ERR(MB_FAILURE, "A surface has facets that are not triangles");
+  coords.resize(3 * conn.size());
+  rval = mbi->get_coords(&conn[0], conn.size(), &coords[0]);
+  MB_CHK_SET_ERR(rval, "Failed to get the facet coordinates");
+  return MB_SUCCESS;
+}
+
+// twice the area of the triangles, and six times the signed volume of the
+// tetrahedra they form with the origin, summed as by GeomQueryTool
+static void facet_sums(const std::vector<double>& coords, double& area2,
+                       double& volume6) {
+  area2 = volume6 = 0.;
+  for (size_t j = 0; j + 9 <= coords.size(); j += 9) {
+    const CartVect v0(&coords[j]);
+    const CartVect normal =
+        (CartVect(&coords[j + 3]) - v0) * (CartVect(&coords[j + 6]) - v0);
+    area2 += normal.length();
+    volume6 += v0 % normal;
+  }
+}
+
+ErrorCode DagMC::compute_measures() {
+  std::lock_guard<std::mutex> lock(measureMutex);
+  if (measuresComplete) return MB_SUCCESS;
+
+  // the surfaces to sum: those missing an area and those of the volumes
+  // missing a volume, with the senses of the volumes
+  std::vector<EntityHandle> surfs;
+  std::unordered_map<EntityHandle, unsigned> surf_slots;
+  auto add_surface = [&](EntityHandle surf) {
+    auto it = surf_slots.insert(std::make_pair(surf, surfs.size())).first;
+    if (it->second == surfs.size()) surfs.push_back(surf);
+    return it->second;
+  };
+  std::vector<int> missing_areas, missing_vols;
+  std::vector<std::vector<unsigned>> vol_slots;
+  std::vector<std::vector<int>> vol_senses;
+  ErrorCode rval;
+  for (size_t i = 1; i < entMeasures[vols_handle_idx].size(); i++) {
+    if (!std::isnan(entMeasures[vols_handle_idx][i])) continue;
+    std::vector<EntityHandle> children;
+    rval = MBI->get_child_meshsets(entHandles[vols_handle_idx][i], children);
+    MB_CHK_SET_ERR(rval, "Failed to get the surfaces of a volume");
+    missing_vols.push_back(i);
+    vol_slots.emplace_back();
+    vol_senses.emplace_back(children.size());
+    for (unsigned j = 0; j < children.size(); j++) {
+      rval = GTT->get_sense(children[j], entHandles[vols_handle_idx][i],
+                            vol_senses.back()[j]);
+      MB_CHK_SET_ERR(rval, "Failed to get the sense of a surface");
+      vol_slots.back().push_back(add_surface(children[j]));
+    }
+  }
+  for (size_t i = 1; i < entMeasures[surfs_handle_idx].size(); i++) {
+    if (!std::isnan(entMeasures[surfs_handle_idx][i])) continue;
+    missing_areas.push_back(i);
+    add_surface(entHandles[surfs_handle_idx][i]);
+  }
+
+  // MOAB is not thread-safe: the facets are read here, and only the sums
+  // over them are computed in parallel
+  std::vector<std::vector<double>> coords(surfs.size());
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    rval = get_facet_coords(MBI, surfs[i], coords[i]);
+    MB_CHK_SET_ERR(rval, "Failed to measure the surfaces and volumes");
+  }
+  std::vector<double> area2(surfs.size()), volume6(surfs.size());
+#ifdef _OPENMP
+  const int num_threads =
+      buildThreads > 0 ? buildThreads : omp_get_max_threads();
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+#endif
+  for (long i = 0; i < (long)surfs.size(); i++)
+    facet_sums(coords[i], area2[i], volume6[i]);
+
+  for (unsigned k = 0; k < missing_areas.size(); k++) {
+    const int index = missing_areas[k];
+    entMeasures[surfs_handle_idx][index] =
+        0.5 * area2[surf_slots[entHandles[surfs_handle_idx][index]]];
+  }
+  for (unsigned k = 0; k < missing_vols.size(); k++) {
+    // surfaces with the volume on both sides do not count
+    double sum = 0.;
+    for (unsigned j = 0; j < vol_slots[k].size(); j++)
+      sum += vol_senses[k][j] * volume6[vol_slots[k][j]];
+    entMeasures[vols_handle_idx][missing_vols[k]] = sum / 6.0;
+  }
+
+  Tag measure_tag;
+  rval =
+      MBI->tag_get_handle(MEASURE_TAG_NAME, 1, MB_TYPE_DOUBLE, measure_tag,
+                          MB_TAG_SPARSE | MB_TAG_CREAT);
+  MB_CHK_SET_ERR(rval, "Failed to get the measure tag");
+  for (int dim = surfs_handle_idx; dim <= vols_handle_idx; dim++) {
+    const int count = entHandles[dim].size() - 1;
+    if (!count) continue;
+    rval = MBI->tag_set_data(measure_tag, &entHandles[dim][1], count,
+                             &entMeasures[dim][1]);
+    MB_CHK_SET_ERR(rval, "Failed to tag the measures");
+  }
+  measuresComplete = true;
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::load_measures() {
+  std::lock_guard<std::mutex> lock(measureMutex);
+  measuresComplete = false;
+  // files not written after compute_measures() do not have the tag
+  Tag measure_tag;
+  const bool tagged =
+      MB_SUCCESS == MBI->tag_get_handle(MEASURE_TAG_NAME, 1, MB_TYPE_DOUBLE,
+                                        measure_tag);
+  bool complete = true;
+  for (int dim = surfs_handle_idx; dim <= vols_handle_idx; dim++) {
+    std::vector<double>& measures = entMeasures[dim];
+    measures.assign(entHandles[dim].size(),
+                    std::numeric_limits<double>::quiet_NaN());
+    for (unsigned i = 1; i < measures.size(); i++) {
+      if (!tagged || MB_SUCCESS != MBI->tag_get_data(measure_tag,
+                                                     &entHandles[dim][i], 1,
+                                                     &measures[i]))
+        complete = false;
+    }
+  }
+  measuresComplete = complete;
+  return MB_SUCCESS;
 }
 
 // get sense of surface(s) wrt volume
 ErrorCode DagMC::surface_sense(EntityHandle volume, int num_surfaces,
                                const EntityHandle* surfaces, int* senses_out) {
-  ErrorCode rval =
-      GTT->get_surface_senses(volume, num_surfaces, surfaces, senses_out);
-  return rval;
+  for (int i = 0; i < num_surfaces; i++) {
+    ErrorCode rval = surface_sense(volume, surfaces[i], senses_out[i]);
+    if (MB_SUCCESS != rval) return rval;
+  }
+  return MB_SUCCESS;
 }
 
 // get sense of surface(s) wrt volume
 ErrorCode DagMC::surface_sense(EntityHandle volume, EntityHandle surface,
                                int& sense_out) {
-  ErrorCode rval = GTT->get_sense(surface, volume, sense_out);
-  return rval;
+  const int index = surface_table_index(surface);
+  const EntityHandle* vols = index ? &surfSenseVolumes[2 * index] : NULL;
+  if (!vols || (!vols[0] && !vols[1])) {
+    ErrorCode rval = GTT->get_sense(surface, volume, sense_out);
+    return rval;
+  }
+
+  // same conventions as GeomTopoTool::get_sense
+  if (vols[0] == volume)
+    sense_out = vols[1] == volume ? 0 : 1;
+  else if (vols[1] == volume)
+    sense_out = -1;
+  else
+    return MB_ENTITY_NOT_FOUND;
+  return MB_SUCCESS;
 }
 
 ErrorCode DagMC::get_angle(EntityHandle surf, const double in_pt[3],
                            double angle[3], const RayHistory* history) {
+  if (bvh_tracer) return bvh_tracer->get_normal(surf, in_pt, angle, history);
+
+  std::lock_guard<std::mutex> lock(gqtMutex);
   ErrorCode rval = ray_tracer->get_normal(surf, in_pt, angle, history);
   return rval;
 }
 
 ErrorCode DagMC::next_vol(EntityHandle surface, EntityHandle old_volume,
                           EntityHandle& new_volume) {
-  ErrorCode rval = GTT->next_vol(surface, old_volume, new_volume);
-  return rval;
+  QueryProfiler* profiler = query_profiler();
+  QueryProfiler::Timer timer(profiler,
+                             profiler ? volume_index(old_volume) : 0,
+                             QueryProfiler::NEXT_VOL);
+  const int index = surface_table_index(surface);
+  if (!index) {
+    ErrorCode rval = GTT->next_vol(surface, old_volume, new_volume);
+    return rval;
+  }
+
+  // same conventions as GeomTopoTool::next_vol
+  const EntityHandle* parents = &surfParentVolumes[2 * index];
+  if (!parents[0]) return MB_FAILURE;
+  if (parents[0] == old_volume)
+    new_volume = parents[1];
+  else if (parents[1] == old_volume)
+    new_volume = parents[0];
+  else
+    return MB_FAILURE;
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::find_volume(const double xyz[3], EntityHandle& volume,
+                             const double* uvw, EntityHandle hint) {
+  // an arbitrary direction that is unlikely to run along facet edges
+  static const double default_dir[3] = {0.5773502691896258,
+                                        0.5773502691896258,
+                                        0.5773502691896258};
+  const double* dir = uvw ? uvw : default_dir;
+  volume = 0;
+
+  // ignore hints that are not volumes of this geometry, such as volumes of
+  // a previously loaded one
+  if (hint && !volume_index(hint)) hint = 0;
+
+  int result = 0;
+  ErrorCode rval;
+  if (hint) {
+    rval = point_in_volume_checked(hint, xyz, dir, result);
+    MB_CHK_SET_ERR(rval, "Failed to test the hint volume");
+    if (1 == result) {
+      volume = hint;
+      return MB_SUCCESS;
+    }
+  }
+
+  uint32_t count;
+  std::vector<uint32_t> merged;
+  const uint32_t* candidates =
+      volumeGrid
+          ? volumeGrid->candidates(xyz, boundsTolerance, count, merged)
+          : NULL;
+  if (!candidates) count = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const EntityHandle candidate = gridVolumes[candidates[i]];
+    if (candidate == hint ||
+        !volumeGrid->contains(candidates[i], xyz, boundsTolerance))
+      continue;
+    rval = point_in_volume_checked(candidate, xyz, dir, result);
+    MB_CHK_SET_ERR(rval, "Failed to test volume " << get_entity_id(candidate));
+    if (1 == result) {
+      volume = candidate;
+      return MB_SUCCESS;
+    }
+  }
+
+  // the implicit complement holds every point outside the other volumes
+  EntityHandle impl_compl;
+  rval = GTT->get_implicit_complement(impl_compl);
+  if (MB_SUCCESS == rval && impl_compl && impl_compl != hint) {
+    rval = point_in_volume_checked(impl_compl, xyz, dir, result);
+    MB_CHK_SET_ERR(rval, "Failed to test the implicit complement");
+    if (1 == result) volume = impl_compl;
+  }
+  QueryProfiler* profiler = query_profiler();
+  if (!volume && profiler) profiler->add_lost(0);
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::point_in_volume_checked(EntityHandle volume,
+                                         const double xyz[3],
+                                         const double dir[3], int& result) {
+  ErrorCode rval = point_in_volume(volume, xyz, result, dir);
+  MB_CHK_ERR(rval);
+  if (1 != result) return MB_SUCCESS;
+
+  // confirm along the reverse direction, and fall back on the slow test if
+  // the two rays disagree
+  const double reverse_dir[3] = {-dir[0], -dir[1], -dir[2]};
+  int second_result;
+  rval = point_in_volume(volume, xyz, second_result, reverse_dir);
+  MB_CHK_ERR(rval);
+  if (second_result != result) {
+    QueryProfiler* profiler = query_profiler();
+    if (profiler) profiler->add_retry(volume_index(volume));
+    rval = point_in_volume_slow(volume, xyz, result);
+    MB_CHK_ERR(rval);
+  }
+  return MB_SUCCESS;
+}
+
+bool DagMC::outside_volume_bounds(EntityHandle volume, const double xyz[3]) {
+  const int index = volume_index(volume);
+  bool box_reject = false, obb_reject = false;
+  if (index && (unsigned)index < volumeBounds.size()) {
+    const VolumeBounds& bounds = volumeBounds[index];
+    const double tol = boundsTolerance;
+    box_reject = xyz[0] < bounds.box[0] - tol || xyz[1] < bounds.box[1] - tol ||
+                 xyz[2] < bounds.box[2] - tol || xyz[0] > bounds.box[3] + tol ||
+                 xyz[1] > bounds.box[4] + tol || xyz[2] > bounds.box[5] + tol;
+
+    if (!box_reject && bounds.has_obb) {
+      const double offset[3] = {xyz[0] - bounds.center[0],
+                                xyz[1] - bounds.center[1],
+                                xyz[2] - bounds.center[2]};
+      for (int i = 0; i < 3 && !obb_reject; i++) {
+        const double* axis = bounds.axes[i];
+        const double d = offset[0] * axis[0] + offset[1] * axis[1] +
+                         offset[2] * axis[2];
+        obb_reject = fabs(d) > bounds.extents[i] + tol;
+      }
+    }
+  }
+
+  // counted in the shard of this thread, so that threads testing points
+  // do not share a cache line
+  if (queryProfiler)
+    queryProfiler->add_bounds_test(index, box_reject, obb_reject);
+  return box_reject || obb_reject;
+}
+
+// the point_in_volume() bounds tests of all volumes and threads, and those
+// rejected by the boxes and by the OBBs
+static void bounds_totals(const QueryProfiler& profile,
+                          unsigned long totals[3]) {
+  std::vector<QueryProfiler::Counts> counts;
+  profile.get_counts(counts);
+  totals[0] = totals[1] = totals[2] = 0;
+  for (unsigned v = 0; v < counts.size(); v++) {
+    totals[0] += counts[v].bounds_tests;
+    totals[1] += counts[v].box_rejects;
+    totals[2] += counts[v].obb_rejects;
+  }
+}
+
+void DagMC::get_point_in_volume_counts(unsigned long& num_calls,
+                                       unsigned long& num_box_rejects,
+                                       unsigned long& num_obb_rejects) const {
+  unsigned long totals[3];
+  bounds_totals(query_profile(), totals);
+  num_calls = totals[0] - pointInVolumeBase[0];
+  num_box_rejects = totals[1] - pointInVolumeBase[1];
+  num_obb_rejects = totals[2] - pointInVolumeBase[2];
+}
+
+const QueryProfiler& DagMC::query_profile() const {
+  // the profiler is created with the indices
+  static const QueryProfiler no_queries;
+  return queryProfiler ? *queryProfiler : no_queries;
+}
+
+void DagMC::reset_query_profile() {
+  if (queryProfiler) queryProfiler->reset();
+  std::fill(pointInVolumeBase, pointInVolumeBase + 3, 0ul);
+}
+
+ErrorCode DagMC::write_query_profile(const char* filename) {
+  std::ofstream str(filename);
+  if (!str) MB_SET_ERR(MB_FAILURE, "Failed to open " << filename);
+
+  std::vector<int> ids(vol_handles().size(), 0);
+  for (unsigned i = 1; i < ids.size(); i++)
+    ids[i] = get_entity_id(vol_handles()[i]);
+  const std::string name(filename);
+  if (name.size() >= 5 && 0 == name.compare(name.size() - 5, 5, ".json"))
+    query_profile().write_json(str, ids);
+  else
+    query_profile().write_csv(str, ids);
+  if (!str) MB_SET_ERR(MB_FAILURE, "Failed to write " << filename);
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::open_ray_log(const char* filename) {
+  if (!rayLog) rayLog.reset(new RayLog);
+  if (!rayLog->open(filename))
+    MB_SET_ERR(MB_FAILURE, "Failed to open the ray log " << filename);
+  return MB_SUCCESS;
+}
+
+bool DagMC::ray_log_open() const { return rayLog && rayLog->is_open(); }
+
+ErrorCode DagMC::close_ray_log() {
+  if (rayLog && !rayLog->close())
+    MB_SET_ERR(MB_FAILURE, "Failed to write the ray log");
+  return MB_SUCCESS;
+}
+
+// the facets of a ray history, the oldest first, read from a copy of it as
+// GeomQueryTool::RayHistory only gives out its last facet
+template <class History>
+static void history_facets(const History& history,
+                           std::vector<uint64_t>& facets) {
+  History remaining(history);
+  EntityHandle facet;
+  facets.clear();
+  while (MB_SUCCESS == remaining.get_last_intersection(facet)) {
+    facets.push_back(facet);
+    remaining.rollback_last_intersection();
+  }
+  std::reverse(facets.begin(), facets.end());
+}
+
+template <class History>
+DagMC::LogRecord* DagMC::begin_log(int query, EntityHandle volume,
+                                   const double xyz[3], const double* dir,
+                                   const History* history) {
+  if (!ray_log_open()) return NULL;
+
+  // reused by the queries of this thread, so that the history does not
+  // allocate once it has grown
+  static thread_local LogRecord record;
+  record.query = static_cast<RayLog::Query>(query);
+  record.volume = volume_index(volume);
+  record.has_direction = dir != NULL;
+  for (int k = 0; k < 3; k++) {
+    record.point[k] = xyz[k];
+    record.direction[k] = dir ? dir[k] : 0.0;
+  }
+  record.dist_limit = 0;
+  record.orientation = 1;
+  if (history)
+    history_facets(*history, record.history);
+  else
+    record.history.clear();
+  return &record;
+}
+
+void DagMC::end_log(LogRecord* record, ErrorCode rval,
+                    EntityHandle surface, double distance, int inside) {
+  if (!record) return;
+  record->status = rval;
+  record->surface =
+      MB_SUCCESS == rval && surface ? index_by_handle(surface) : 0;
+  record->distance = distance;
+  record->inside = inside;
+  rayLog->write(*record);
+}
+
+void DagMC::reset_point_in_volume_counts() {
+  // the counts are shared with the query profile, which is left alone
+  bounds_totals(query_profile(), pointInVolumeBase);
+}
+
+ErrorCode DagMC::build_volume_bounds() {
+  volumeBounds.clear();
+  volumeBounds.resize(vol_handles().size());
+
+  // bounding box of each surface, from the vertices of its facets
+  std::map<EntityHandle, std::vector<double>> surf_boxes;
+  ErrorCode rval;
+  for (unsigned i = 1; i < surf_handles().size(); i++) {
+    const EntityHandle surf = surf_handles()[i];
+    Range tris, verts;
+    rval = MBI->get_entities_by_type(surf, MBTRI, tris);
+    MB_CHK_SET_ERR(rval, "Failed to get the facets of a surface");
+    rval = MBI->get_connectivity(tris, verts);
+    MB_CHK_SET_ERR(rval, "Failed to get the facet vertices");
+    if (verts.empty()) continue;
+    std::vector<double> coords(3 * verts.size());
+    rval = MBI->get_coords(verts, &coords[0]);
+    MB_CHK_SET_ERR(rval, "Failed to get the vertex coordinates");
+
+    std::vector<double>& box = surf_boxes[surf];
+    box.assign(coords.begin(), coords.begin() + 3);
+    box.insert(box.end(), coords.begin(), coords.begin() + 3);
+    for (size_t j = 3; j < coords.size(); j += 3) {
+      for (int k = 0; k < 3; k++) {
+        box[k] = std::min(box[k], coords[j + k]);
+        box[3 + k] = std::max(box[3 + k], coords[j + k]);
+      }
+    }
+  }
+
+  // the bounds of a volume cover its surfaces; outside_volume_bounds()
+  // grows them by the tolerances of the point in volume test so that
+  // points on the boundary are not rejected. The implicit complement
+  // extends to infinity.
+  const bool use_obbs = ACCEL_OBB_TREE == accelType && GTT->have_obb_tree();
+  for (unsigned i = 1; i < vol_handles().size(); i++) {
+    const EntityHandle vol = vol_handles()[i];
+    if (is_implicit_complement(vol)) continue;
+    std::vector<EntityHandle> surfs;
+    rval = MBI->get_child_meshsets(vol, surfs);
+    MB_CHK_SET_ERR(rval, "Failed to get the surfaces of a volume");
+
+    double box[6] = {HUGE_VAL, HUGE_VAL, HUGE_VAL,
+                     -HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+    for (unsigned j = 0; j < surfs.size(); j++) {
+      auto it = surf_boxes.find(surfs[j]);
+      if (it == surf_boxes.end()) continue;
+      for (int k = 0; k < 3; k++) {
+        box[k] = std::min(box[k], it->second[k]);
+        box[3 + k] = std::max(box[3 + k], it->second[3 + k]);
+      }
+    }
+    if (box[0] > box[3]) continue;
+
+    VolumeBounds& bounds = volumeBounds[i];
+    std::copy(box, box + 6, bounds.box);
+
+    // the OBB of the root of the volume tree, with unit axes; flat boxes
+    // are left to the axis-aligned box
+    if (!use_obbs) continue;
+    double axes[3][3];
+    rval = GTT->get_obb(vol, bounds.center, axes[0], axes[1], axes[2]);
+    if (MB_SUCCESS != rval) continue;
+    bounds.has_obb = true;
+    for (int j = 0; j < 3; j++) {
+      const double length = sqrt(axes[j][0] * axes[j][0] +
+                                 axes[j][1] * axes[j][1] +
+                                 axes[j][2] * axes[j][2]);
+      if (length <= 0.) {
+        bounds.has_obb = false;
+        break;
+      }
+      for (int k = 0; k < 3; k++) bounds.axes[j][k] = axes[j][k] / length;
+      bounds.extents[j] = length;
+    }
+  }
+  return MB_SUCCESS;
+}
+
+ErrorCode DagMC::build_volume_grid() {
+  volumeGrid.reset(new VolumeGrid);
+  gridVolumes.clear();
+
+  // the grid covers the volumes with finite bounds; find_volume() grows
+  // them like outside_volume_bounds() does, so that the grid follows
+  // changes of the tolerances without being rebuilt
+  std::vector<double> boxes;
+  for (unsigned i = 1; i < volumeBounds.size(); i++) {
+    const double* box = volumeBounds[i].box;
+    if (box[0] == -HUGE_VAL) continue;
+    boxes.insert(boxes.end(), box, box + 6);
+    gridVolumes.push_back(vol_handles()[i]);
+  }
+
+  volumeGrid->build(boxes.empty() ? NULL : &boxes[0], gridVolumes.size());
+  return MB_SUCCESS;
 }
 
 /* SECTION III */
 
+// whether the IDs of a dimension are in the tables of build_indices()
+static bool has_id_table(int dimension, const std::vector<int>* ent_ids) {
+  return (surfs_handle_idx == dimension || vols_handle_idx == dimension) &&
+         !ent_ids[dimension].empty();
+}
+
 EntityHandle DagMC::entity_by_id(int dimension, int id) {
-  return GTT->entity_by_id(dimension, id);
+  if (!has_id_table(dimension, entIds))
+    return GTT->entity_by_id(dimension, id);
+  // index 0 holds handle 0
+  return entHandles[dimension][idIndices[dimension]->find(id)];
 }
 
 int DagMC::id_by_index(int dimension, int index) {
+  if (has_id_table(dimension, entIds) &&
+      (unsigned)index < entIds[dimension].size())
+    return entIds[dimension][index];
+
   EntityHandle h = entity_by_index(dimension, index);
   if (!h) return 0;
 
@@ -384,7 +1665,23 @@ int DagMC::id_by_index(int dimension, int index) {
   return result;
 }
 
+int DagMC::index_by_id(int dimension, int id) {
+  if (has_id_table(dimension, entIds)) return idIndices[dimension]->find(id);
+  EntityHandle h = GTT->entity_by_id(dimension, id);
+  return h ? index_by_handle(h) : 0;
+}
+
 int DagMC::get_entity_id(EntityHandle this_ent) {
+  // a surface or volume is found at its index in its list of handles
+  if (this_ent >= setOffset && this_ent - setOffset < entIndices.size()) {
+    const int index = entIndices[this_ent - setOffset];
+    for (int dim = surfs_handle_idx; dim <= vols_handle_idx; dim++) {
+      if (has_id_table(dim, entIds) &&
+          (unsigned)index < entHandles[dim].size() &&
+          entHandles[dim][index] == this_ent)
+        return entIds[dim][index];
+    }
+  }
   return GTT->global_id(this_ent);
 }
 
@@ -426,6 +1723,19 @@ ErrorCode DagMC::build_indices(Range& surfs, Range& vols) {
   idx = 1;
   for (Range::iterator rit = vols.begin(); rit != vols.end(); ++rit)
     entIndices[*rit - setOffset] = idx++;
+  if (!queryProfiler) queryProfiler.reset(new QueryProfiler);
+  queryProfiler->setup(vols.size());
+  std::fill(pointInVolumeBase, pointInVolumeBase + 3, 0ul);
+
+  // the IDs of the surfaces and volumes, and their indices by ID
+  for (int dim = surfs_handle_idx; dim <= vols_handle_idx; dim++) {
+    std::vector<int>& ids = entIds[dim];
+    ids.assign(entHandles[dim].size(), 0);
+    for (unsigned i = 1; i < ids.size(); i++)
+      ids[i] = GTT->global_id(entHandles[dim][i]);
+    idIndices[dim].reset(new IdIndex);
+    idIndices[dim]->build(ids);
+  }
 
   // get group handles
   Tag category_tag = get_tag(CATEGORY_TAG_NAME, CATEGORY_TAG_SIZE,
@@ -445,6 +1755,52 @@ ErrorCode DagMC::build_indices(Range& surfs, Range& vols) {
   return MB_SUCCESS;
 }
 
+int DagMC::volume_index(EntityHandle volume) const {
+  const std::vector<EntityHandle>& vols = entHandles[vols_handle_idx];
+  if (volume < setOffset || volume - setOffset >= entIndices.size()) return 0;
+  const int index = entIndices[volume - setOffset];
+  if (index <= 0 || (unsigned)index >= vols.size() || vols[index] != volume)
+    return 0;
+  return index;
+}
+
+ErrorCode DagMC::build_surface_tables() {
+  // index 0 stays empty, like the handle lists
+  const size_t num_surfs = surf_handles().size();
+  surfSenseVolumes.assign(2 * num_surfs, 0);
+  surfParentVolumes.assign(2 * num_surfs, 0);
+  for (unsigned i = 1; i < num_surfs; i++) {
+    const EntityHandle surf = surf_handles()[i];
+    // surfaces without senses keep null volumes and are left to GTT
+    EntityHandle forward, reverse;
+    if (MB_SUCCESS == GTT->get_surface_senses(surf, forward, reverse)) {
+      surfSenseVolumes[2 * i] = forward;
+      surfSenseVolumes[2 * i + 1] = reverse;
+    }
+
+    std::vector<EntityHandle> parents;
+    ErrorCode rval = MBI->get_parent_meshsets(surf, parents);
+    MB_CHK_SET_ERR(rval, "Failed to get the volumes of surface "
+                             << get_entity_id(surf));
+    if (2 == parents.size()) {
+      surfParentVolumes[2 * i] = parents[0];
+      surfParentVolumes[2 * i + 1] = parents[1];
+    }
+  }
+  return MB_SUCCESS;
+}
+
+int DagMC::surface_table_index(EntityHandle surface) const {
+  if (surface < setOffset || surface - setOffset >= entIndices.size())
+    return 0;
+  const int index = entIndices[surface - setOffset];
+  const std::vector<EntityHandle>& surfs = entHandles[surfs_handle_idx];
+  if (index <= 0 || 2 * (size_t)index >= surfSenseVolumes.size() ||
+      surfs[index] != surface)
+    return 0;
+  return index;
+}
+
 /* SECTION IV */
 
 double DagMC::overlap_thickness() {
@@ -457,10 +1813,29 @@ double DagMC::numerical_precision() {
 
 void DagMC::set_overlap_thickness(double new_thickness) {
   ray_tracer->set_overlap_thickness(new_thickness);
+  if (bvh_tracer) bvh_tracer->set_overlap_thickness(overlap_thickness());
+  if (windingTracer)
+    windingTracer->set_overlap_thickness(overlap_thickness());
+  update_bounds_tolerance();
+}
+
+void DagMC::set_ordered_traversal(bool ordered) {
+  orderedTraversal = ordered;
+  if (bvh_tracer)
+    bvh_tracer->set_traversal_order(ordered ? FacetBVH::ORDER_FRONT_TO_BACK
+                                            : FacetBVH::ORDER_DEPTH_FIRST);
 }
 
 void DagMC::set_numerical_precision(double new_precision) {
   ray_tracer->set_numerical_precision(new_precision);
+  if (bvh_tracer) bvh_tracer->set_numerical_precision(numerical_precision());
+  if (windingTracer)
+    windingTracer->set_numerical_precision(numerical_precision());
+  update_bounds_tolerance();
+}
+
+void DagMC::update_bounds_tolerance() {
+  boundsTolerance = numerical_precision() + overlap_thickness();
 }
 
 ErrorCode DagMC::write_mesh(const char* ffile, const int flen) {
@@ -478,6 +1853,15 @@ ErrorCode DagMC::write_mesh(const char* ffile, const int flen) {
   return MB_SUCCESS;
 }
 
+ErrorCode DagMC::getobb(EntityHandle volume, double minPt[3],
+                        double maxPt[3]) {
+  if (bvh_tracer) return bvh_tracer->get_bounds(volume, minPt, maxPt);
+
+  ErrorCode rval = GTT->get_bounding_coords(volume, minPt, maxPt);
+  MB_CHK_SET_ERR(rval, "Failed to get obb for volume");
+  return MB_SUCCESS;
+}
+
 /* SECTION V: Metadata handling */
 
 ErrorCode DagMC::get_group_name(EntityHandle group_set, std::string& name) {
@@ -2,14 +2,19 @@
 #define MOABMC_HPP
 
 #include <assert.h>
+#include <math.h>
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "BVHTraversalStats.hpp"
 #include "DagMCVersion.hpp"
+#include "InlineRayHistory.hpp"
 #include "MBTagConventions.hpp"
 #include "moab/CartVect.hpp"
 #include "moab/Core.hpp"
@@ -40,6 +45,12 @@ static const int groups_handle_idx = 4;
 
 class CartVect;
 class GeomQueryTool;
+class BVHRayTracer;
+class IdIndex;
+class QueryProfiler;
+class RayLog;
+class SafetyGrid;
+class VolumeGrid;
 
 /**\brief
  *
@@ -150,10 +161,206 @@ class DagMC {
   /**\brief constructs obb trees for all surfaces and volumes
    *
    * Very thin wrapper around GTT->construct_obb_trees().
-   * Constructs obb trees for all surfaces and volumes in the geometry.
+   * Constructs obb trees for all surfaces and volumes in the geometry, or the
+   * native BVH trees of all volumes if that acceleration structure has been
+   * selected.
    */
   ErrorCode setup_obbs();
 
+  /** acceleration structures available for the geometry queries */
+  enum AccelType {
+    /** MOAB OBB trees (or double-down, if DAGMC was built with it) */
+    ACCEL_OBB_TREE,
+    /** native BVH trees, see FacetBVH */
+    ACCEL_BVH
+  };
+
+  /**\brief select the acceleration structure used by the geometry queries
+   *
+   * Must be called before setup_obbs() or init_OBBTree(). The BVH trees
+   * answer ray_fire, point_in_volume, test_volume_boundary,
+   * closest_to_location and get_angle without building the OBB trees;
+   * traversal statistics are only collected by the OBB trees, and by the
+   * BVH trees in QueryContext::bvh_stats.
+   */
+  void set_accel_type(AccelType type) { accelType = type; }
+  AccelType accel_type() const { return accelType; }
+
+  /**\brief number of threads used to build the BVH trees
+   *
+   * 0, the default, uses the OpenMP default. Only the BVH trees of
+   * ACCEL_BVH and compute_measures() use these threads: the OBB trees of
+   * the default ACCEL_OBB are built by MOAB on the calling thread, one
+   * after the other, whatever this is set to.
+   */
+  void set_build_threads(int num_threads) { buildThreads = num_threads; }
+
+  /**\brief build the BVH trees of the volumes on first use
+   *
+   * With ACCEL_BVH selected, setup_obbs() only registers the volumes, and
+   * the first query on a volume (ray_fire, point_in_volume,
+   * closest_to_location, ...) builds its tree, once, even if several
+   * threads query it at the same time. Runs that only reach part of the
+   * geometry skip the trees they never need, and never read their facets:
+   * a tree reads the facets of its volume from MOAB when it is built, one
+   * volume at a time, and drops them once it is built. A valid cache file
+   * is still used instead, but the lazily built trees are not written to
+   * the cache. The OBB trees are always built up front, since MOAB cannot
+   * build them while other threads query it.
+   */
+  void set_lazy_trees(bool lazy) { lazyTrees = lazy; }
+  bool lazy_trees() const { return lazyTrees; }
+
+  /**\brief visit the BVH nodes hit by a ray front to back
+   *
+   * With ACCEL_BVH selected, ray_fire visits the child the ray enters first
+   * and skips the other child if a closer hit, or the distance limit, is
+   * nearer than the entry of the ray into it. On by default; turning it off
+   * visits the children in tree order, culled only by their own box. The
+   * OBB tree traversal is MOAB's and is not affected.
+   */
+  void set_ordered_traversal(bool ordered);
+  bool ordered_traversal() const { return orderedTraversal; }
+
+  /** storage of the BVH trees, see BVHRayTracer::Storage */
+  enum TreeStorage {
+    /** FacetBVH trees */
+    TREES_FULL,
+    /** CompactBVH trees with quantized boxes and shared double vertices */
+    TREES_COMPACT,
+    /** CompactBVH trees with float vertices, the ray_fire distances
+     *  refined on the facets in double precision */
+    TREES_COMPACT_FLOAT
+  };
+
+  /**\brief store the BVH trees in a compact form
+   *
+   * Must be called before setup_obbs(). The compact trees take a fraction
+   * of the memory of the full trees for a slower traversal, see
+   * get_bvh_memory(). They are not written to or read from the cache file,
+   * and winding_number() uses trees of its own built on demand. TREES_FULL
+   * by default; the OBB trees are not affected.
+   */
+  void set_tree_storage(TreeStorage storage) { treeStorage = storage; }
+  TreeStorage tree_storage() const { return treeStorage; }
+
+  /**\brief query the implicit complement through the BVH trees of the
+   * volumes it borders
+   *
+   * Must be called before setup_obbs(). The implicit complement then has no
+   * BVH tree of its own, which is the largest tree of the model and the last
+   * one to be built; its queries find the neighbouring volumes a ray can
+   * reach and search their trees instead, see
+   * BVHRayTracer::set_shared_complement(). The cache file is not used, and
+   * winding_number() uses trees of its own built on demand. Off by default;
+   * the OBB trees are not affected.
+   */
+  void set_shared_complement(bool shared) { sharedComplement = shared; }
+  bool shared_complement() const { return sharedComplement; }
+
+  /** bytes used by the BVH trees of the queries and the number of facets
+   *  they hold; fails unless they have been set up */
+  ErrorCode get_bvh_memory(size_t& bytes, size_t& num_facets) const;
+
+  /** trace the rays of a batch in Morton order, see ray_fire_batch(); on by
+   *  default, off traces the rays of each volume in the caller's order */
+  void set_sort_ray_batches(bool sort) { sortRayBatches = sort; }
+  bool sort_ray_batches() const { return sortRayBatches; }
+
+  /**\brief query a volume through the BVH tree of a congruent prototype
+   *
+   * Tags the instance volume with its prototype and the rigid transform
+   * placing the prototype on it (a row major rotation, then a translation),
+   * so that the placement is saved with the geometry. With ACCEL_BVH
+   * selected, setup_obbs() builds only the tree of the prototype and maps
+   * the facets of the instance onto it, which fails if they are not
+   * congruent. The instance keeps its own surfaces and facets, so
+   * next_vol(), the senses and the tallies are not affected. Only the
+   * memory of the BVH trees is saved: the file and MOAB still hold every
+   * facet of the instance, the OBB trees are still built per volume, and
+   * the BVH cache is not used with instances. The dagmc_dedupe tool finds
+   * and tags the congruent volumes of a model.
+   */
+  ErrorCode add_volume_instance(EntityHandle instance, EntityHandle prototype,
+                                const double rotation[9],
+                                const double translation[3]);
+
+  /** number of volumes whose trees have been built, of all volumes */
+  void get_tree_counts(int& num_built, int& num_volumes);
+
+  /** wall clock seconds spent in the phases of init_OBBTree() */
+  struct SetupTimes {
+    SetupTimes()
+        : threads(0), geometry(0.), facets(0.), trees(0.), indices(0.) {}
+
+    /** threads used to build the trees */
+    int threads;
+    /** finding the geometry sets and the implicit complement */
+    double geometry;
+    /** gathering the facets of the surfaces for the BVH trees */
+    double facets;
+    /** building the trees, or mapping them from the cache */
+    double trees;
+    /** building the surface and volume indices */
+    double indices;
+  };
+
+  const SetupTimes& setup_times() const { return setupTimes; }
+
+  /**\brief use a memory-mapped cache file of the BVH trees
+   *
+   * With ACCEL_BVH selected, setup_obbs() maps the trees from this file
+   * instead of building them if it was written for the file given to
+   * load_file(), as it is now (see BVHCache::file_key()), and its facet and
+   * surface handles match the loaded mesh. Otherwise the trees are built
+   * and the cache file is rewritten for the next run. Processes on the same
+   * node mapping the same cache share its memory: the processes starting
+   * together wait for the first one to write the cache instead of building
+   * the trees each (see BVHCache::BuildLock), and that one maps the cache
+   * in place of its own trees once it is written. A file under /dev/shm
+   * keeps the trees in node-local shared memory. The MOAB mesh itself is
+   * still read by every process.
+   */
+  void set_accel_cache(const std::string& filename) {
+    accelCacheFile = filename;
+  }
+
+  /**\brief write the BVH trees of the geometry to a cache file
+   *
+   * Can be called after init_OBBTree() with either acceleration structure;
+   * the BVH trees are built for the cache if they have not been. Requires
+   * the geometry to have been read with load_file().
+   */
+  ErrorCode write_accel_cache(const char* filename);
+
+  /** share of the query time of the volumes whose trees tune_trees() tunes
+   *  by default */
+  static const double DEFAULT_TUNE_FRACTION;
+
+  /**\brief tune the BVH trees of the volumes that took most of the query
+   * time
+   *
+   * Picks the volumes from the counts of set_profile_queries(), typically
+   * of a short pilot run, the slowest first until they took the given
+   * fraction of the time of all queries, and builds their trees for speed
+   * over build time (see BVHRayTracer::tune_volumes()). Their built trees
+   * are rebuilt, so no other thread may query meanwhile; the trees built
+   * for them later are also tuned, including those of write_accel_cache(),
+   * so that build_obb can store the tuned trees for the production runs.
+   * Only the BVH trees are tuned.
+   */
+  ErrorCode tune_trees(double fraction = DEFAULT_TUNE_FRACTION);
+
+  /** tune_trees() from the volume times of a CSV report of
+   *  write_query_profile(), e.g. of a pilot run or of dagmc_replay -P */
+  ErrorCode tune_trees_from_profile(const char* filename,
+                                    double fraction = DEFAULT_TUNE_FRACTION);
+
+  /** the volumes whose trees are tuned */
+  const std::vector<EntityHandle>& tuned_volumes() const {
+    return tunedVolumes;
+  }
+
   /**\brief thin wrapper around build_indices()
    *
    * Very thin wrapper around build_indices().
@@ -172,19 +379,180 @@ class DagMC {
 
   typedef GeomQueryTool::RayHistory RayHistory;
 
+  /**\brief per-thread state for geometry queries
+   *
+   * Once init_OBBTree() has returned, the loaded geometry and its trees are
+   * only read by the query methods, so one DagMC instance can be shared by
+   * any number of threads (lazily built BVH trees are built under a lock of
+   * their own, see set_lazy_trees()). Everything a query writes lives in a
+   * QueryContext instead: each thread owns one and passes it to the
+   * context overloads of the query methods below.
+   *
+   * Only the BVH trees answer queries from several threads at once. MOAB
+   * is not thread-safe, so with the OBB trees the queries that go through
+   * GeomQueryTool take turns under a lock: they are safe, but serial.
+   */
+  class QueryContext {
+   public:
+    QueryContext() : collect_stats(false), obb_version(0) {}
+
+    /** clear the ray history and the traversal statistics */
+    void reset() {
+      history.reset();
+      stats.reset();
+      bvh_stats.reset();
+    }
+
+    /** history of the particle tracked with this context; it is stored
+     *  inline, so copying it to and from particle banks does not allocate */
+    InlineRayHistory history;
+    /** traversal statistics of the OBB trees and of the BVH trees,
+     *  accumulated only if collect_stats is set */
+    OrientedBoxTreeTool::TrvStats stats;
+    BVHTraversalStats bvh_stats;
+    bool collect_stats;
+
+    /** scratch space for ray_fire_batch */
+    std::vector<int> batch_order;
+    std::vector<uint64_t> batch_keys;
+    /** copy of history passed to the OBB tree queries, which only take a
+     *  GeomQueryTool history; it is kept in step by appending the new
+     *  facets, and copied again only once history.version() changes */
+    RayHistory obb_history;
+    unsigned long obb_version;
+  };
+
   ErrorCode ray_fire(const EntityHandle volume, const double ray_start[3],
                      const double ray_dir[3], EntityHandle& next_surf,
                      double& next_surf_dist, RayHistory* history = NULL,
                      double dist_limit = 0, int ray_orientation = 1,
                      OrientedBoxTreeTool::TrvStats* stats = NULL);
 
+  /**\brief fire a batch of rays in a single call
+   *
+   * Equivalent to calling ray_fire once per ray, but the rays are traced
+   * grouped by volume so that consecutive queries reuse the same tree while
+   * it is still resident in cache. Within a volume, batches of at least
+   * RayOrder::MIN_RAYS rays are traced by direction octant and Morton code
+   * of their origin (see set_sort_ray_batches()), and the results are
+   * written back in the caller's order. Ray data is passed as
+   * structure-of-arrays.
+   *\param num_rays number of rays in the batch
+   *\param volumes volume to fire each ray in (num_rays entries)
+   *\param ray_starts x, y and z arrays of the ray start points
+   *\param ray_dirs x, y and z arrays of the (normalized) ray directions
+   *\param next_surfs output, surface hit by each ray or 0 if none
+   *\param next_surf_dists output, distance to the surface hit by each ray
+   *\param histories optional array of num_rays ray histories
+   *\param dist_limits optional array of num_rays distance limits
+   *\param ray_orientation orientation used for every ray in the batch
+   *\param stats optional traversal statistics accumulated over the batch
+   */
+  ErrorCode ray_fire_batch(const int num_rays, const EntityHandle* volumes,
+                           const double* const ray_starts[3],
+                           const double* const ray_dirs[3],
+                           EntityHandle* next_surfs, double* next_surf_dists,
+                           RayHistory* histories = NULL,
+                           const double* dist_limits = NULL,
+                           int ray_orientation = 1,
+                           OrientedBoxTreeTool::TrvStats* stats = NULL);
+
+  /**\brief test whether a point is inside a volume
+   *
+   * Points outside the bounding box of the volume, or outside the OBB of
+   * its tree when the OBB trees are used, are rejected before any ray is
+   * fired; see get_point_in_volume_counts(). The boxes are grown by the
+   * current numerical precision and overlap thickness, so that points on
+   * the boundary are still tested.
+   */
   ErrorCode point_in_volume(const EntityHandle volume, const double xyz[3],
                             int& result, const double* uvw = NULL,
                             const RayHistory* history = NULL);
 
+  /**\brief number of point_in_volume() calls since the counts were reset,
+   * and of the calls answered by the bounding box and by the OBB of the
+   * volume without firing a ray
+   *
+   * The calls are counted per thread in the query profile, whether or not
+   * the queries are profiled, so reset_query_profile() resets them too.
+   */
+  void get_point_in_volume_counts(unsigned long& num_calls,
+                                  unsigned long& num_box_rejects,
+                                  unsigned long& num_obb_rejects) const;
+  void reset_point_in_volume_counts();
+
+  /* Thread-safe overloads: the ray history, traversal statistics and
+   * scratch space are taken from the caller's QueryContext.
+   * closest_to_location() keeps no state between calls and is safe to call
+   * from several threads as it is. With the OBB trees, all of them are
+   * serialized; see QueryContext. */
+
+  ErrorCode ray_fire(QueryContext& context, const EntityHandle volume,
+                     const double ray_start[3], const double ray_dir[3],
+                     EntityHandle& next_surf, double& next_surf_dist,
+                     double dist_limit = 0, int ray_orientation = 1);
+
+  ErrorCode ray_fire_batch(QueryContext& context, const int num_rays,
+                           const EntityHandle* volumes,
+                           const double* const ray_starts[3],
+                           const double* const ray_dirs[3],
+                           EntityHandle* next_surfs, double* next_surf_dists,
+                           RayHistory* histories = NULL,
+                           const double* dist_limits = NULL,
+                           int ray_orientation = 1);
+
+  ErrorCode point_in_volume(QueryContext& context, const EntityHandle volume,
+                            const double xyz[3], int& result,
+                            const double* uvw = NULL);
+
+  ErrorCode test_volume_boundary(QueryContext& context,
+                                 const EntityHandle volume,
+                                 const EntityHandle surface,
+                                 const double xyz[3], const double uvw[3],
+                                 int& result);
+
+  ErrorCode get_angle(QueryContext& context, EntityHandle surf,
+                      const double xyz[3], double angle[3]);
+
+  /**\brief test whether a point is inside a volume without rays
+   *
+   * Uses MOAB's spherical area test, or point_in_volume_winding() if
+   * set_winding_number_fallback() is set. This is the test find_volume()
+   * falls back on when two ray tests disagree.
+   */
   ErrorCode point_in_volume_slow(const EntityHandle volume, const double xyz[3],
                                  int& result);
 
+  /**\brief generalized winding number of the boundary of a volume around a
+   * point
+   *
+   * The solid angles of the facets near the point are summed exactly, and
+   * the facets of distant BVH nodes are approximated by a dipole per node, so
+   * the cost grows with the logarithm of the number of facets. The result is
+   * close to 1 inside the volume and 0 outside. With the OBB trees, the BVH
+   * tree of a volume is built for it on the first call.
+   */
+  ErrorCode winding_number(EntityHandle volume, const double xyz[3],
+                           double& result);
+
+  /**\brief point containment from winding_number(), with result 1 if it
+   * is above 1/2
+   *
+   * Needs no ray direction and is not affected by nearly degenerate rays,
+   * but points on the boundary are not resolved by a direction.
+   */
+  ErrorCode point_in_volume_winding(EntityHandle volume, const double xyz[3],
+                                    int& result);
+
+  /** answer point_in_volume() with point_in_volume_winding(); the ray
+   *  direction and history are then ignored */
+  void set_winding_number_primary(bool primary) { windingPrimary = primary; }
+
+  /** answer point_in_volume_slow() with point_in_volume_winding() */
+  void set_winding_number_fallback(bool fallback) {
+    windingFallback = fallback;
+  }
+
   ErrorCode test_volume_boundary(const EntityHandle volume,
                                  const EntityHandle surface,
                                  const double xyz[3], const double uvw[3],
@@ -193,10 +561,65 @@ class DagMC {
   ErrorCode closest_to_location(EntityHandle volume, const double point[3],
                                 double& result, EntityHandle* surface = 0);
 
+  /** how safety_distance() computes the distance */
+  enum SafetyMode {
+    /** the distance to the nearest facet, from closest_to_location() */
+    SAFETY_EXACT,
+    /** a lower bound on that distance, from the safety grid of the volume */
+    SAFETY_CONSERVATIVE
+  };
+
+  /**\brief distance a particle can move in any direction without leaving
+   * the volume
+   *
+   * SAFETY_EXACT returns the distance from the point to the nearest facet of
+   * the volume. SAFETY_CONSERVATIVE returns a lower bound on it, which is
+   * all that the safety of a transport code needs: the bound is looked up in
+   * a grid of distances over the bounding box of the volume (see SafetyGrid)
+   * built by init_OBBTree(), and only points within about one cell of the
+   * surfaces fall back on the exact distance. Without grids, see
+   * set_safety_grid_cells(), conservative queries are exact.
+   * Both modes accept points on either side of the surfaces of the volume.
+   */
+  ErrorCode safety_distance(EntityHandle volume, const double xyz[3],
+                            double& distance,
+                            SafetyMode mode = SAFETY_EXACT);
+
+  /**\brief number of cells of the safety grid of each volume
+   *
+   * The grids are optional: 0, the default, builds none, so that
+   * conservative queries are exact. Otherwise init_OBBTree() builds the
+   * grids of all volumes on the calling thread, so it must be called
+   * before. Finer grids give tighter bounds closer to the surfaces, but
+   * take longer to build; a few thousand cells, such as 4096, suit most
+   * volumes.
+   */
+  void set_safety_grid_cells(int num_cells) { safetyGridCells = num_cells; }
+
+  /**\brief volume enclosed by the surfaces of a volume
+   *
+   * The measures of all surfaces and volumes are computed together by the
+   * first call to measure_volume() or measure_area(), unless the file has
+   * them from compute_measures(), and are looked up after that. Entity sets
+   * that are not indexed by setup_indices() are measured on every call.
+   */
   ErrorCode measure_volume(EntityHandle volume, double& result);
 
+  /**\brief area of the facets of a surface; see measure_volume() */
   ErrorCode measure_area(EntityHandle surface, double& result);
 
+  /**\brief measure all surfaces and volumes, and tag them with their
+   * measures
+   *
+   * The measures missing from the DAGMC_MEASURE tags are computed, and
+   * every surface and volume is tagged with its area or volume. The facets
+   * are read on the calling thread; only the sums over them run in
+   * parallel, with the threads of set_build_threads(). Files written
+   * afterwards, as by build_obb, keep the tags, so that loading them skips
+   * the computation. Facets moved after setup_indices() are not measured again.
+   */
+  ErrorCode compute_measures();
+
   ErrorCode surface_sense(EntityHandle volume, int num_surfaces,
                           const EntityHandle* surfaces, int* senses_out);
 
@@ -209,6 +632,156 @@ class DagMC {
   ErrorCode next_vol(EntityHandle surface, EntityHandle old_volume,
                      EntityHandle& new_volume);
 
+  /**\brief find the volume containing a point
+   *
+   * Only the volumes whose bounding boxes contain the point are tested: the
+   * hint first (typically the volume found by the previous call), then the
+   * candidates from a grid over the volume boxes built by init_OBBTree(),
+   * in index order, and finally the implicit complement. A volume is
+   * accepted if point_in_volume() finds the point inside it along uvw and
+   * along -uvw or, if the two tests disagree, if point_in_volume_slow()
+   * does. Sets volume to 0 if no volume contains the point.
+   *
+   * \param xyz the point
+   * \param volume the volume containing the point, or 0
+   * \param uvw direction used to resolve points on a boundary; a fixed
+   *        direction is used if NULL
+   * \param hint volume to test first, or 0
+   */
+  ErrorCode find_volume(const double xyz[3], EntityHandle& volume,
+                        const double* uvw = NULL, EntityHandle hint = 0);
+
+  /**\brief record the calls and the time of the queries per volume
+   *
+   * With profiling on, ray_fire, point_in_volume, closest_to_location and
+   * next_vol record their calls and wall clock time against the volume
+   * they query, ray_fire also the tree nodes and triangles it tests and the
+   * rays without a distance limit that hit no surface, and find_volume the
+   * points whose two ray tests disagree and the points found in no volume
+   * (against volume 0). Each thread counts into its own QueryProfiler
+   * shard, without locks. Off by default; on, a query also reads the clock
+   * twice.
+   */
+  void set_profile_queries(bool profile) { profileQueries = profile; }
+  bool profile_queries() const { return profileQueries; }
+
+  /** the counts recorded with set_profile_queries(), by volume index; see
+   *  QueryProfiler.hpp */
+  const QueryProfiler& query_profile() const;
+  void reset_query_profile();
+
+  /** write the counts recorded with set_profile_queries() by volume id,
+   *  the slowest volumes first; as JSON if the file name ends in .json, and
+   *  as CSV otherwise */
+  ErrorCode write_query_profile(const char* filename);
+
+  /**\brief record every query in a binary log, for dagmc_replay
+   *
+   * While the log is open, every ray_fire, point_in_volume and
+   * closest_to_location call is written to it with its inputs, including
+   * the facets of the ray history, and its results, so that the queries of
+   * a transport run can be replayed and timed without the physics code (see
+   * RayLog). The calls made by find_volume and ray_fire_batch are recorded
+   * one by one. Each thread buffers its own records, so the log must be
+   * closed, or DagMC destroyed, once the other threads stop querying.
+   */
+  ErrorCode open_ray_log(const char* filename);
+  ErrorCode close_ray_log();
+  bool ray_log_open() const;
+
+ private:
+  /** the profiler the queries record into, or NULL if profiling is off */
+  QueryProfiler* query_profiler() {
+    return profileQueries ? queryProfiler.get() : NULL;
+  }
+
+  /** tune the trees of the slowest volumes
+   * \param seconds the query seconds of volumes by index; index 0 is
+   *        skipped */
+  ErrorCode tune_slowest_volumes(std::vector<std::pair<int, double>> seconds,
+                                 double fraction);
+
+  /** point_in_volume() of GeomQueryTool, under gqtMutex */
+  ErrorCode gqt_point_in_volume(EntityHandle volume, const double xyz[3],
+                                int& result, const double* uvw,
+                                const RayHistory* history);
+
+  /** ray_fire() without the ray log */
+  ErrorCode fire_ray(EntityHandle volume, const double point[3],
+                     const double dir[3], EntityHandle& next_surf,
+                     double& next_surf_dist, RayHistory* history,
+                     double dist_limit, int ray_orientation,
+                     OrientedBoxTreeTool::TrvStats* stats);
+
+  /** a RayLog::Record, defined in DagMC.cpp */
+  struct LogRecord;
+
+  /** the record of a query of this thread with its inputs filled in, or
+   *  NULL if no ray log is open; query is a RayLog::Query */
+  template <class History>
+  LogRecord* begin_log(int query, EntityHandle volume, const double xyz[3],
+                       const double* dir, const History* history);
+
+  /** add the results to a record from begin_log() and write it */
+  void end_log(LogRecord* record, ErrorCode rval, EntityHandle surface,
+               double distance, int inside = 0);
+
+  /** ray_fire() on the BVH trees, recorded in the profile */
+  template <class History>
+  ErrorCode bvh_ray_fire(EntityHandle volume, const double point[3],
+                         const double dir[3], EntityHandle& next_surf,
+                         double& next_surf_dist, History* history,
+                         double dist_limit, int ray_orientation,
+                         BVHTraversalStats* stats);
+
+  /** the BVH trees answering winding_number(): the BVH trees of the queries
+   *  if they are full trees, or else trees built on demand */
+  BVHRayTracer* facet_tracer() {
+    return windingTracer ? windingTracer.get() : bvh_tracer.get();
+  }
+
+  /** replace the BVH trees by those of the cache file, if it matches */
+  bool map_accel_cache(uint64_t geometry_hash);
+
+  /** register the volumes tagged by add_volume_instance() */
+  ErrorCode load_volume_instances(BVHRayTracer& tracer);
+
+  /** point_in_volume() along dir, checked along -dir as in find_volume() */
+  ErrorCode point_in_volume_checked(EntityHandle volume, const double xyz[3],
+                                    const double dir[3], int& result);
+
+  /** whether a point is outside the bounds of a volume, counting the
+   *  rejections */
+  bool outside_volume_bounds(EntityHandle volume, const double xyz[3]);
+
+  /** build the bounding boxes and OBBs of the volumes */
+  ErrorCode build_volume_bounds();
+
+  /** build the grid over the volume bounding boxes used by find_volume() */
+  ErrorCode build_volume_grid();
+
+  /** grow the volume bounds and the boxes of the volume grid by the
+   *  current numerical precision and overlap thickness */
+  void update_bounds_tolerance();
+
+  /** build the safety grids of all volumes, if set_safety_grid_cells()
+   *  asked for any */
+  ErrorCode build_safety_grids();
+
+  /** fill the safety grid of a volume */
+  ErrorCode build_safety_grid(EntityHandle volume, SafetyGrid& grid);
+
+  /** ray_fire_batch using the given scratch vectors for the ray ordering */
+  ErrorCode fire_ray_batch(std::vector<int>& order,
+                           std::vector<uint64_t>& keys, const int num_rays,
+                           const EntityHandle* volumes,
+                           const double* const ray_starts[3],
+                           const double* const ray_dirs[3],
+                           EntityHandle* next_surfs, double* next_surf_dists,
+                           RayHistory* histories, const double* dist_limits,
+                           int ray_orientation,
+                           OrientedBoxTreeTool::TrvStats* stats);
+
   /* SECTION III: Indexing & Cross-referencing */
  public:
   /** Most calling apps refer to geometric entities with a combination of
@@ -217,13 +790,21 @@ class DagMC {
    * entity. These method provide ways to translate from one to the other.
    */
 
+  /* For surfaces and volumes, the translations from and to global IDs look
+   * up tables built with the indices (see IdIndex), and take constant time;
+   * they see the IDs the entities had when init_OBBTree() or
+   * setup_indices() was called. Other entities are looked up through
+   * GeomTopoTool. */
+
   /** map from dimension & global ID to EntityHandle */
   EntityHandle entity_by_id(int dimension, int id);
   /** map from dimension & base-1 ordinal index to EntityHandle */
   EntityHandle entity_by_index(int dimension, int index);
   /** map from dimension & base-1 ordinal index to global ID */
   int id_by_index(int dimension, int index);
-  /** PPHW: Missing dim & global ID ==> base-1 ordinal index */
+  /** map from dimension & global ID to base-1 ordinal index, 0 if no surface
+   *  or volume has the ID */
+  int index_by_id(int dimension, int id);
   /** map from EntityHandle to base-1 ordinal index */
   int index_by_handle(EntityHandle handle);
   /** map from EntityHandle to global ID */
@@ -243,6 +824,20 @@ class DagMC {
   /** build internal index vectors that speed up handle-by-id, etc. */
   ErrorCode build_indices(Range& surfs, Range& vols);
 
+  /** build the per-surface volume tables used by next_vol and surface_sense
+   */
+  ErrorCode build_surface_tables();
+
+  /** index of a surface in the surface tables, or 0 if it is not in them */
+  int surface_table_index(EntityHandle surface) const;
+
+  /** index of a volume, or 0 if it is not a volume of this geometry */
+  int volume_index(EntityHandle volume) const;
+
+  /** read the measures of the surfaces and volumes from their tags, for
+   *  compute_measures() to fill in the rest */
+  ErrorCode load_measures();
+
   /* SECTION IV: Handling DagMC settings */
  public:
   /** retrieve overlap thickness */
@@ -253,11 +848,14 @@ class DagMC {
   double faceting_tolerance() { return facetingTolerance; }
 
   /** Attempt to set a new overlap thickness tolerance, first checking for
-   * sanity */
+   * sanity. The volume grid is not rebuilt; find_volume() applies the new
+   * tolerance to it. Not to be called while other threads query. */
   void set_overlap_thickness(double new_overlap_thickness);
 
   /** Attempt to set a new numerical precision , first checking for sanity
    *  Use of this function is discouraged; see top of DagMC.cpp
+   *  Like set_overlap_thickness(), not to be called while other threads
+   *  query.
    */
   void set_numerical_precision(double new_precision);
 
@@ -454,8 +1052,25 @@ class DagMC {
   EntityHandle setOffset;
   /** entity index (contiguous 1-N indices); indexed like rootSets */
   std::vector<int> entIndices;
+  /** global IDs of the surfaces and volumes by index, and their indices by
+   *  ID */
+  std::vector<int> entIds[5];
+  std::unique_ptr<IdIndex> idIndices[5];
+  /** area of each surface and volume of each volume by index, NaN until
+   *  measured; written under measureMutex */
+  std::vector<double> entMeasures[5];
+  std::atomic<bool> measuresComplete{false};
+  std::mutex measureMutex;
+  /** serializes the queries through ray_tracer, as MOAB is not
+   *  thread-safe */
+  std::mutex gqtMutex;
   /** corresponding geometric entities; also indexed like rootSets */
   std::vector<RefEntity*> geomEntities;
+  /** forward and reverse volume of each surface, two per surface index */
+  std::vector<EntityHandle> surfSenseVolumes;
+  /** the two parent volumes of each surface, two per surface index; zero if
+   *  the surface does not have exactly two */
+  std::vector<EntityHandle> surfParentVolumes;
 
   /* metadata */
   /** empty synonym map to provide as a default argument to parse_properties()
@@ -468,10 +1083,64 @@ class DagMC {
 
   double facetingTolerance;
 
-  /** vectors for point_in_volume: */
-  std::vector<double> disList;
-  std::vector<int> dirList;
-  std::vector<EntityHandle> surList, facList;
+  AccelType accelType = ACCEL_OBB_TREE;
+  /** native BVH trees, only created if ACCEL_BVH is selected */
+  std::unique_ptr<BVHRayTracer> bvh_tracer;
+  /** lazily built BVH trees for winding_number() with the OBB trees */
+  std::unique_ptr<BVHRayTracer> windingTracer;
+  bool windingPrimary = false;
+  bool windingFallback = false;
+  int buildThreads = 0;
+  bool lazyTrees = false;
+  bool orderedTraversal = true;
+  bool sortRayBatches = true;
+  TreeStorage treeStorage = TREES_FULL;
+  bool sharedComplement = false;
+  /** bounds of a volume used to reject points in point_in_volume() */
+  struct VolumeBounds {
+    VolumeBounds() : has_obb(false) {
+      for (int i = 0; i < 3; i++) {
+        box[i] = -HUGE_VAL;
+        box[3 + i] = HUGE_VAL;
+      }
+    }
+
+    /** axis-aligned box; infinite for the implicit complement */
+    double box[6];
+    bool has_obb;
+    /** center, unit axes and half extents of the OBB */
+    double center[3];
+    double axes[3][3];
+    double extents[3];
+  };
+  /** bounds of each volume, indexed like the volume handles; they are
+   *  grown by boundsTolerance when tested, so that they follow changes of
+   *  the tolerances after they are built */
+  std::vector<VolumeBounds> volumeBounds;
+  double boundsTolerance = 0.;
+  /** the point_in_volume() counts at the last
+   *  reset_point_in_volume_counts() */
+  unsigned long pointInVolumeBase[3] = {0, 0, 0};
+  /** grid over the bounding boxes of the volumes other than the implicit
+   *  complement, and the volume of each box; the boxes are grown by
+   *  boundsTolerance at lookup */
+  std::unique_ptr<VolumeGrid> volumeGrid;
+  std::vector<EntityHandle> gridVolumes;
+  /** safety grid of each volume, indexed like the volume handles; NULL for
+   *  the volumes without facets, empty without grids */
+  std::vector<std::unique_ptr<SafetyGrid>> safetyGrids;
+  int safetyGridCells = 0;
+  SetupTimes setupTimes;
+  bool profileQueries = false;
+  /** counts of the queries per volume index, created by build_indices() */
+  std::unique_ptr<QueryProfiler> queryProfiler;
+  /** created by the first open_ray_log() */
+  std::unique_ptr<RayLog> rayLog;
+  /** file given to load_file(), whose BVHCache::file_key() keys the BVH
+   *  cache */
+  std::string geometryFile;
+  std::string accelCacheFile;
+  std::vector<EntityHandle> tunedVolumes;
 };
 
 inline EntityHandle DagMC::entity_by_index(int dimension, int index) {
@@ -490,13 +1159,6 @@ inline unsigned int DagMC::num_entities(int dimension) {
   return entHandles[dimension].size() - 1;
 }
 
-inline ErrorCode DagMC::getobb(EntityHandle volume, double minPt[3],
-                               double maxPt[3]) {
-  ErrorCode rval = GTT->get_bounding_coords(volume, minPt, maxPt);
-  MB_CHK_SET_ERR(rval, "Failed to get obb for volume");
-  return MB_SUCCESS;
-}
-
 inline ErrorCode DagMC::getobb(EntityHandle volume, double center[3],
                                double axis1[3], double axis2[3],
                                double axis3[3]) {
@@ -0,0 +1,641 @@
+// plucker_test is the scalar reference of the kernels in FacetBVHKernels.cpp
+// and must round the same way, so floating point contraction is disabled
+// here as well: a fused multiply-add would change its decisions.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "FacetBVH.hpp"
+
+#include <assert.h>
+
+#ifndef M_PI /* windows */
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace moab {
+
+namespace {
+
+// Plucker coordinates smaller than this are treated as zero
+const double PLUCKER_ZERO = 1e-14;
+
+/* Plucker coordinates of a triangle edge are computed from the
+   lexicographically smaller vertex so that the two triangles sharing an edge
+   get bit-identical values: a ray through the edge hits exactly one of them */
+inline bool first(const double* a, const double* b) {
+  if (a[0] != b[0]) return a[0] < b[0];
+  if (a[1] != b[1]) return a[1] < b[1];
+  return a[2] < b[2];
+}
+
+inline double plucker_edge_test(const double* vertexa, const double* vertexb,
+                                const double ray[3],
+                                const double ray_normal[3]) {
+  double pip;
+  const double* a = vertexa;
+  const double* b = vertexb;
+  bool swapped = !first(vertexa, vertexb);
+  if (swapped) std::swap(a, b);
+
+  const double edge[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  const double edge_normal[3] = {edge[1] * a[2] - edge[2] * a[1],
+                                 edge[2] * a[0] - edge[0] * a[2],
+                                 edge[0] * a[1] - edge[1] * a[0]};
+  pip = (ray[0] * edge_normal[0] + ray[1] * edge_normal[1] +
+         ray[2] * edge_normal[2]) +
+        (ray_normal[0] * edge[0] + ray_normal[1] * edge[1] +
+         ray_normal[2] * edge[2]);
+  if (swapped) pip = -pip;
+
+  if (PLUCKER_ZERO > fabs(pip)) pip = 0.0;
+
+  return pip;
+}
+
+/* round outward when storing double bounds in single precision */
+inline float round_down(double value) {
+  float f = static_cast<float>(value);
+  if (f > value) f = nextafterf(f, -std::numeric_limits<float>::max());
+  return f;
+}
+
+inline float round_up(double value) {
+  float f = static_cast<float>(value);
+  if (f < value) f = nextafterf(f, std::numeric_limits<float>::max());
+  return f;
+}
+
+inline double surface_area(const double lower[3], const double upper[3]) {
+  const double dx = upper[0] - lower[0];
+  const double dy = upper[1] - lower[1];
+  const double dz = upper[2] - lower[2];
+  return 2.0 * (dx * dy + dy * dz + dz * dx);
+}
+
+struct Bounds {
+  double lower[3];
+  double upper[3];
+
+  Bounds() {
+    for (int i = 0; i < 3; i++) {
+      lower[i] = std::numeric_limits<double>::max();
+      upper[i] = -std::numeric_limits<double>::max();
+    }
+  }
+
+  void extend(const double lo[3], const double hi[3]) {
+    for (int i = 0; i < 3; i++) {
+      lower[i] = std::min(lower[i], lo[i]);
+      upper[i] = std::max(upper[i], hi[i]);
+    }
+  }
+
+  double area() const {
+    return lower[0] > upper[0] ? 0.0 : surface_area(lower, upper);
+  }
+};
+
+// number of bins used to evaluate the surface area heuristic
+const int NUM_BINS = 16;
+// cost of a node traversal relative to a triangle test
+const double TRAVERSAL_COST = 1.0;
+
+}  // namespace
+
+const uint32_t FacetBVH::UNUSED_SLOT;
+const double FacetBVH::WINDING_ACCURACY = 2.0;
+
+FacetBVH::Ray::Ray(const double p_origin[3], const double p_dir[3],
+                   double p_tolerance)
+    : tolerance(p_tolerance) {
+  for (int i = 0; i < 3; i++) {
+    origin[i] = p_origin[i];
+    dir[i] = p_dir[i];
+    inv_dir[i] = 1.0 / p_dir[i];
+  }
+  moment[0] = dir[1] * origin[2] - dir[2] * origin[1];
+  moment[1] = dir[2] * origin[0] - dir[0] * origin[2];
+  moment[2] = dir[0] * origin[1] - dir[1] * origin[0];
+}
+
+FacetBVH::FacetBVH() {}
+
+void FacetBVH::clear() {
+  // release the memory too, for the trees replaced by their compact form
+  std::vector<Node>().swap(nodes);
+  std::vector<double>().swap(coords);
+  std::vector<double>().swap(packed);
+  std::vector<uint32_t>().swap(tri_index);
+  view = Arrays();
+}
+
+void FacetBVH::attach(const Arrays& arrays) {
+  clear();
+  view = arrays;
+}
+
+void FacetBVH::build(const double* tri_coords, size_t num_triangles,
+                     int max_leaf_size, BuildMethod method) {
+  clear();
+  if (0 == num_triangles) return;
+  if (max_leaf_size < 1) max_leaf_size = 1;
+
+  std::vector<BuildItem> items(num_triangles);
+  std::vector<uint32_t> order(num_triangles);
+  for (size_t t = 0; t < num_triangles; t++) {
+    const double* tri = tri_coords + 9 * t;
+    BuildItem& item = items[t];
+    for (int i = 0; i < 3; i++) {
+      item.lower[i] = std::min(std::min(tri[i], tri[3 + i]), tri[6 + i]);
+      item.upper[i] = std::max(std::max(tri[i], tri[3 + i]), tri[6 + i]);
+      item.centroid[i] = 0.5 * (item.lower[i] + item.upper[i]);
+    }
+    order[t] = t;
+  }
+
+  nodes.reserve(2 * num_triangles / max_leaf_size + 1);
+  build_node(order, items, 0, num_triangles, 0, max_leaf_size, method);
+
+  // copy the triangles into leaf order, starting each leaf on a new block
+  size_t num_slots = 0;
+  for (size_t n = 0; n < nodes.size(); n++) {
+    if (nodes[n].is_leaf())
+      num_slots += (nodes[n].count + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+  }
+  tri_index.assign(num_slots, UNUSED_SLOT);
+  coords.assign(9 * num_slots, 0.0);
+  uint32_t slot = 0;
+  for (size_t n = 0; n < nodes.size(); n++) {
+    Node& node = nodes[n];
+    if (!node.is_leaf()) continue;
+    for (uint32_t i = 0; i < node.count; i++) {
+      const uint32_t t = order[node.offset + i];
+      tri_index[slot + i] = t;
+      std::copy(tri_coords + 9 * t, tri_coords + 9 * t + 9,
+                &coords[9 * (slot + i)]);
+    }
+    node.offset = slot;
+    slot += (node.count + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+  }
+
+  packed.resize(9 * num_slots);
+  for (size_t s = 0; s < num_slots; s++) {
+    double* block = &packed[BLOCK_DOUBLES * (s / BLOCK_SIZE)];
+    for (int k = 0; k < 9; k++)
+      block[k * BLOCK_SIZE + s % BLOCK_SIZE] = coords[9 * s + k];
+  }
+
+  view.nodes = &nodes[0];
+  view.num_nodes = nodes.size();
+  view.coords = &coords[0];
+  view.packed = &packed[0];
+  view.tri_index = &tri_index[0];
+  view.num_slots = num_slots;
+  view.num_triangles = num_triangles;
+}
+
+void FacetBVH::build_node(std::vector<uint32_t>& order,
+                          const std::vector<BuildItem>& items, uint32_t begin,
+                          uint32_t end, int depth, int max_leaf_size,
+                          BuildMethod method) {
+  const uint32_t node_index = nodes.size();
+  nodes.push_back(Node());
+
+  Bounds bounds, centroids;
+  for (uint32_t i = begin; i < end; i++) {
+    const BuildItem& item = items[order[i]];
+    bounds.extend(item.lower, item.upper);
+    centroids.extend(item.centroid, item.centroid);
+  }
+  for (int i = 0; i < 3; i++) {
+    nodes[node_index].lower[i] = round_down(bounds.lower[i]);
+    nodes[node_index].upper[i] = round_up(bounds.upper[i]);
+  }
+
+  const uint32_t count = end - begin;
+  bool make_leaf = (count <= (uint32_t)max_leaf_size || depth >= MAX_DEPTH - 1);
+
+  // evaluate the surface area heuristic for binned splits on each axis
+  int best_axis = -1;
+  int best_bin = 0;
+  double best_cost = std::numeric_limits<double>::max();
+  if (!make_leaf && BUILD_BINNED == method) {
+    for (int axis = 0; axis < 3; axis++) {
+      const double extent = centroids.upper[axis] - centroids.lower[axis];
+      if (extent <= 0.0) continue;
+      const double scale = NUM_BINS / extent;
+
+      Bounds bin_bounds[NUM_BINS];
+      uint32_t bin_count[NUM_BINS] = {0};
+      for (uint32_t i = begin; i < end; i++) {
+        const BuildItem& item = items[order[i]];
+        int bin = (int)((item.centroid[axis] - centroids.lower[axis]) * scale);
+        bin = std::min(bin, NUM_BINS - 1);
+        bin_bounds[bin].extend(item.lower, item.upper);
+        bin_count[bin]++;
+      }
+
+      // sweep from the right to get the cost of every right-hand side
+      double right_area[NUM_BINS];
+      uint32_t right_count[NUM_BINS];
+      Bounds right;
+      uint32_t n = 0;
+      for (int b = NUM_BINS - 1; b > 0; b--) {
+        right.extend(bin_bounds[b].lower, bin_bounds[b].upper);
+        n += bin_count[b];
+        right_area[b] = right.area();
+        right_count[b] = n;
+      }
+
+      Bounds left;
+      n = 0;
+      for (int b = 0; b < NUM_BINS - 1; b++) {
+        left.extend(bin_bounds[b].lower, bin_bounds[b].upper);
+        n += bin_count[b];
+        if (0 == n || 0 == right_count[b + 1]) continue;
+        double cost =
+            left.area() * n + right_area[b + 1] * right_count[b + 1];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = b;
+        }
+      }
+    }
+  }
+
+  // or between every two items in centroid order, with equal centroids
+  // ordered by index so that every sort gives the same order; best_bin is
+  // then the number of items on the left
+  int sort_axis = 0;
+  auto centroid_less = [&](uint32_t a, uint32_t b) {
+    const double ca = items[a].centroid[sort_axis];
+    const double cb = items[b].centroid[sort_axis];
+    return ca < cb || (ca == cb && a < b);
+  };
+  if (!make_leaf && BUILD_SWEEP == method) {
+    std::vector<uint32_t> sorted(order.begin() + begin, order.begin() + end);
+    std::vector<double> right_area(count);
+    for (int axis = 0; axis < 3; axis++) {
+      if (centroids.upper[axis] <= centroids.lower[axis]) continue;
+      sort_axis = axis;
+      std::sort(sorted.begin(), sorted.end(), centroid_less);
+
+      Bounds right;
+      for (uint32_t i = count - 1; i > 0; i--) {
+        right.extend(items[sorted[i]].lower, items[sorted[i]].upper);
+        right_area[i] = right.area();
+      }
+
+      Bounds left;
+      for (uint32_t i = 1; i < count; i++) {
+        left.extend(items[sorted[i - 1]].lower, items[sorted[i - 1]].upper);
+        double cost = left.area() * i + right_area[i] * (count - i);
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = i;
+        }
+      }
+    }
+  }
+
+  if (!make_leaf && best_axis >= 0) {
+    // a split is only worth making if it is cheaper than testing every
+    // triangle, unless the leaf would be much too large
+    const double parent_area = bounds.area();
+    double split_cost =
+        parent_area > 0.0 ? TRAVERSAL_COST + best_cost / parent_area : 0.0;
+    if (split_cost >= count && count <= 4 * (uint32_t)max_leaf_size)
+      make_leaf = true;
+  }
+
+  uint32_t middle = begin;
+  if (!make_leaf) {
+    if (best_axis >= 0 && BUILD_SWEEP == method) {
+      sort_axis = best_axis;
+      middle = begin + best_bin;
+      std::nth_element(order.begin() + begin, order.begin() + middle,
+                       order.begin() + end, centroid_less);
+    } else if (best_axis >= 0) {
+      const double extent =
+          centroids.upper[best_axis] - centroids.lower[best_axis];
+      const double scale = NUM_BINS / extent;
+      const double lower = centroids.lower[best_axis];
+      middle = std::partition(order.begin() + begin, order.begin() + end,
+                              [&](uint32_t t) {
+                                int bin =
+                                    (int)((items[t].centroid[best_axis] -
+                                           lower) *
+                                          scale);
+                                return std::min(bin, NUM_BINS - 1) <=
+                                       best_bin;
+                              }) -
+               order.begin();
+    } else {
+      // all centroids coincide: split the range in half
+      best_axis = 0;
+      middle = begin + count / 2;
+    }
+    if (middle == begin || middle == end) middle = begin + count / 2;
+  }
+
+  if (make_leaf) {
+    nodes[node_index].offset = begin;
+    nodes[node_index].count = count;
+    return;
+  }
+
+  build_node(order, items, begin, middle, depth + 1, max_leaf_size, method);
+  nodes[node_index].offset = nodes.size();
+  nodes[node_index].count = INTERIOR_FLAG | best_axis;
+  build_node(order, items, middle, end, depth + 1, max_leaf_size, method);
+}
+
+size_t FacetBVH::memory_use() const {
+  return nodes.capacity() * sizeof(Node) +
+         (coords.capacity() + packed.capacity()) * sizeof(double) +
+         tri_index.capacity() * sizeof(uint32_t);
+}
+
+void FacetBVH::get_bounds(double lower[3], double upper[3]) const {
+  for (int i = 0; i < 3; i++) {
+    lower[i] = empty() ? 0.0 : view.nodes[0].lower[i];
+    upper[i] = empty() ? 0.0 : view.nodes[0].upper[i];
+  }
+}
+
+bool FacetBVH::intersect_triangle(const double tri[9], const Ray& ray,
+                                  double& dist, const double* nonneg_ray_len,
+                                  const double* neg_ray_len,
+                                  const int* orientation) {
+  double plucker[3];
+  return plucker_test(tri, ray, orientation, plucker) &&
+         plucker_distance(tri, ray, plucker, dist, nonneg_ray_len,
+                          neg_ray_len);
+}
+
+bool FacetBVH::plucker_test(const double tri[9], const Ray& ray,
+                            const int* orientation, double plucker[3]) {
+  const double* v0 = tri;
+  const double* v1 = tri + 3;
+  const double* v2 = tri + 6;
+
+  const double plucker_coord0 =
+      plucker_edge_test(v0, v1, ray.dir, ray.moment);
+  if (orientation && (*orientation) * plucker_coord0 > 0) return false;
+
+  const double plucker_coord1 =
+      plucker_edge_test(v1, v2, ray.dir, ray.moment);
+  if (orientation) {
+    if ((*orientation) * plucker_coord1 > 0) return false;
+  } else if ((0.0 < plucker_coord0 && 0.0 > plucker_coord1) ||
+             (0.0 > plucker_coord0 && 0.0 < plucker_coord1)) {
+    return false;
+  }
+
+  const double plucker_coord2 =
+      plucker_edge_test(v2, v0, ray.dir, ray.moment);
+  if (orientation) {
+    if ((*orientation) * plucker_coord2 > 0) return false;
+  } else if ((0.0 < plucker_coord1 && 0.0 > plucker_coord2) ||
+             (0.0 > plucker_coord1 && 0.0 < plucker_coord2) ||
+             (0.0 < plucker_coord0 && 0.0 > plucker_coord2) ||
+             (0.0 > plucker_coord0 && 0.0 < plucker_coord2)) {
+    return false;
+  }
+
+  // the ray is coplanar with the triangle
+  if (0.0 == plucker_coord0 && 0.0 == plucker_coord1 && 0.0 == plucker_coord2)
+    return false;
+
+  plucker[0] = plucker_coord0;
+  plucker[1] = plucker_coord1;
+  plucker[2] = plucker_coord2;
+  return true;
+}
+
+bool FacetBVH::plucker_distance(const double tri[9], const Ray& ray,
+                                const double plucker[3], double& dist_out,
+                                const double* nonneg_ray_len,
+                                const double* neg_ray_len) {
+  const double* v0 = tri;
+  const double* v1 = tri + 3;
+  const double* v2 = tri + 6;
+  const double plucker_coord0 = plucker[0];
+  const double plucker_coord1 = plucker[1];
+  const double plucker_coord2 = plucker[2];
+
+  // barycentric intersection point
+  const double inverse_sum =
+      1.0 / (plucker_coord0 + plucker_coord1 + plucker_coord2);
+  assert(0.0 != inverse_sum);
+  double intersection[3];
+  for (int i = 0; i < 3; i++) {
+    intersection[i] = plucker_coord0 * inverse_sum * v2[i] +
+                      plucker_coord1 * inverse_sum * v0[i] +
+                      plucker_coord2 * inverse_sum * v1[i];
+  }
+
+  // use the largest direction component to minimize numerical error
+  int idx = 0;
+  double max_abs_dir = 0;
+  for (int i = 0; i < 3; i++) {
+    if (fabs(ray.dir[i]) > max_abs_dir) {
+      idx = i;
+      max_abs_dir = fabs(ray.dir[i]);
+    }
+  }
+  const double dist = (intersection[idx] - ray.origin[idx]) / ray.dir[idx];
+
+  if ((nonneg_ray_len && *nonneg_ray_len < dist) ||
+      (neg_ray_len && *neg_ray_len >= dist) || (!neg_ray_len && 0 > dist))
+    return false;
+
+  dist_out = dist;
+  return true;
+}
+
+void FacetBVH::triangle_normal(const double tri[9], double normal[3]) {
+  const double e1[3] = {tri[3] - tri[0], tri[4] - tri[1], tri[5] - tri[2]};
+  const double e2[3] = {tri[6] - tri[0], tri[7] - tri[1], tri[8] - tri[2]};
+  normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+void FacetBVH::closest_point_on_triangle(const double tri[9],
+                                         const double p[3],
+                                         double result[3]) {
+  const double* a = tri;
+  const double* b = tri + 3;
+  const double* c = tri + 6;
+  double ab[3], ac[3], ap[3];
+  for (int i = 0; i < 3; i++) {
+    ab[i] = b[i] - a[i];
+    ac[i] = c[i] - a[i];
+    ap[i] = p[i] - a[i];
+  }
+
+  // Voronoi region tests, see Ericson, Real-Time Collision Detection 5.1.5
+  const double d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+  const double d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+  if (d1 <= 0.0 && d2 <= 0.0) {
+    std::copy(a, a + 3, result);
+    return;
+  }
+
+  double bp[3];
+  for (int i = 0; i < 3; i++) bp[i] = p[i] - b[i];
+  const double d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+  const double d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+  if (d3 >= 0.0 && d4 <= d3) {
+    std::copy(b, b + 3, result);
+    return;
+  }
+
+  const double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+    const double v = d1 / (d1 - d3);
+    for (int i = 0; i < 3; i++) result[i] = a[i] + v * ab[i];
+    return;
+  }
+
+  double cp[3];
+  for (int i = 0; i < 3; i++) cp[i] = p[i] - c[i];
+  const double d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+  const double d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+  if (d6 >= 0.0 && d5 <= d6) {
+    std::copy(c, c + 3, result);
+    return;
+  }
+
+  const double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+    const double w = d2 / (d2 - d6);
+    for (int i = 0; i < 3; i++) result[i] = a[i] + w * ac[i];
+    return;
+  }
+
+  const double va = d3 * d6 - d5 * d4;
+  if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) {
+    const double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    for (int i = 0; i < 3; i++) result[i] = b[i] + w * (c[i] - b[i]);
+    return;
+  }
+
+  const double denom = 1.0 / (va + vb + vc);
+  const double v = vb * denom;
+  const double w = vc * denom;
+  for (int i = 0; i < 3; i++) result[i] = a[i] + ab[i] * v + ac[i] * w;
+}
+
+double FacetBVH::solid_angle(const double tri[9], const double point[3]) {
+  // Van Oosterom and Strackee, IEEE Trans. Biomed. Eng. 30 (1983) 125
+  double a[3], b[3], c[3];
+  for (int i = 0; i < 3; i++) {
+    a[i] = tri[i] - point[i];
+    b[i] = tri[3 + i] - point[i];
+    c[i] = tri[6 + i] - point[i];
+  }
+  const double la = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+  const double lb = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+  const double lc = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+  const double det = a[0] * (b[1] * c[2] - b[2] * c[1]) +
+                     a[1] * (b[2] * c[0] - b[0] * c[2]) +
+                     a[2] * (b[0] * c[1] - b[1] * c[0]);
+  const double ab = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+  const double bc = b[0] * c[0] + b[1] * c[1] + b[2] * c[2];
+  const double ca = c[0] * a[0] + c[1] * a[1] + c[2] * a[2];
+  return 2.0 * atan2(det, la * lb * lc + ab * lc + bc * la + ca * lb);
+}
+
+void FacetBVH::build_dipoles(std::vector<Dipole>& dipoles) const {
+  dipoles.assign(view.num_nodes, Dipole());
+  std::vector<double> areas(view.num_nodes, 0.0);
+
+  // children follow their parent in the array, so a reverse sweep visits
+  // them first
+  for (size_t n = view.num_nodes; n-- > 0;) {
+    const Node& node = view.nodes[n];
+    Dipole& dipole = dipoles[n];
+    double weighted[3] = {0.0, 0.0, 0.0};
+    for (int i = 0; i < 3; i++) dipole.normal[i] = 0.0;
+    if (node.is_leaf()) {
+      for (uint32_t t = node.offset; t < node.offset + node.count; t++) {
+        const double* tri = triangle_coords(t);
+        double normal[3];
+        triangle_normal(tri, normal);
+        const double area = 0.5 * sqrt(normal[0] * normal[0] +
+                                       normal[1] * normal[1] +
+                                       normal[2] * normal[2]);
+        for (int i = 0; i < 3; i++) {
+          dipole.normal[i] += 0.5 * normal[i];
+          weighted[i] += area * (tri[i] + tri[3 + i] + tri[6 + i]) / 3.0;
+        }
+        areas[n] += area;
+      }
+    } else {
+      const size_t children[2] = {n + 1, node.offset};
+      for (int c = 0; c < 2; c++) {
+        const Dipole& child = dipoles[children[c]];
+        for (int i = 0; i < 3; i++) {
+          dipole.normal[i] += child.normal[i];
+          weighted[i] += areas[children[c]] * child.center[i];
+        }
+        areas[n] += areas[children[c]];
+      }
+    }
+
+    // the radius covers the node box, which contains all its triangles
+    double radius2 = 0.0;
+    for (int i = 0; i < 3; i++) {
+      dipole.center[i] = areas[n] > 0.0
+                             ? weighted[i] / areas[n]
+                             : 0.5 * (node.lower[i] + node.upper[i]);
+      const double d = std::max(dipole.center[i] - node.lower[i],
+                                node.upper[i] - dipole.center[i]);
+      radius2 += d * d;
+    }
+    dipole.radius = sqrt(radius2);
+  }
+}
+
+double FacetBVH::winding_number(const double point[3], const Dipole* dipoles,
+                                double accuracy) const {
+  if (empty()) return 0.0;
+
+  double sum = 0.0;
+  uint32_t stack[MAX_DEPTH];
+  int top = 0;
+  uint32_t current = 0;
+  while (true) {
+    const Node& node = view.nodes[current];
+    const Dipole& dipole = dipoles[current];
+    double offset[3];
+    for (int i = 0; i < 3; i++) offset[i] = dipole.center[i] - point[i];
+    const double dist2 =
+        offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2];
+    const double limit = accuracy * dipole.radius;
+    if (dist2 > limit * limit) {
+      sum += (dipole.normal[0] * offset[0] + dipole.normal[1] * offset[1] +
+              dipole.normal[2] * offset[2]) /
+             (dist2 * sqrt(dist2));
+    } else if (node.is_leaf()) {
+      for (uint32_t t = node.offset; t < node.offset + node.count; t++)
+        sum += solid_angle(triangle_coords(t), point);
+    } else {
+      stack[top++] = node.offset;
+      current = current + 1;
+      continue;
+    }
+    if (top == 0) break;
+    current = stack[--top];
+  }
+  return sum / (4.0 * M_PI);
+}
+
+}  // namespace moab
@@ -0,0 +1,653 @@
+#ifndef DAGMC_FACET_BVH_HPP
+#define DAGMC_FACET_BVH_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "BVHTraversalStats.hpp"
+
+namespace moab {
+
+/**\brief bounding volume hierarchy over a set of triangles
+ *
+ * FacetBVH is a self-contained acceleration structure that does not depend on
+ * MOAB: it is built from a flat array of triangle coordinates and answers ray
+ * and closest point queries.
+ *
+ * The tree is built with a binned surface area heuristic and stored as a
+ * single contiguous array of 32 byte nodes in depth-first order, so the first
+ * child of an interior node is always the next node in the array. The
+ * triangle coordinates are copied into leaf order so that the triangles of a
+ * leaf are contiguous in memory. Queries identify triangles by their slot in
+ * this order; triangle() maps a slot back to the position of the triangle in
+ * the array given to build(). Queries walk the tree iteratively with a fixed
+ * size stack; the build limits the depth of the tree accordingly.
+ *
+ * The ray/triangle test is the watertight Plucker coordinate test used by
+ * MOAB's GeomUtil::plucker_ray_tri_intersect so that the hit/miss decisions
+ * match the OBB tree path. Each leaf starts on a block of BLOCK_SIZE slots
+ * whose vertex coordinates are also stored packed by coordinate, so that the
+ * Plucker edge tests of a whole block run in one vectorized kernel; the
+ * kernel is chosen at runtime from the SIMD instructions the processor
+ * supports. Every kernel computes the Plucker coordinates with the same
+ * operations in the same order as the scalar test, so all of them make
+ * bit-identical hit/miss decisions.
+ *
+ * The generalized winding number of the triangles around a point (the sum of
+ * their signed solid angles over 4 pi) is computed hierarchically: nodes far
+ * enough from the point contribute the dipole approximation of their
+ * triangles, and only the nearby triangles are summed exactly. The dipoles
+ * are kept outside the tree, see build_dipoles().
+ */
+class FacetBVH {
+ public:
+  /** maximum depth of the tree, which is also the traversal stack size */
+  static const int MAX_DEPTH = 64;
+
+  /** flag marking interior nodes in Node::count */
+  static const uint32_t INTERIOR_FLAG = 0x80000000u;
+
+  /** triangle index of the slots that pad a leaf */
+  static const uint32_t UNUSED_SLOT = 0xffffffffu;
+
+  /** number of triangle slots in a packed block */
+  static const int BLOCK_SIZE = 8;
+
+  /** doubles in a packed block: 9 coordinates of BLOCK_SIZE triangles */
+  static const int BLOCK_DOUBLES = 9 * BLOCK_SIZE;
+
+  /** instruction sets available for the leaf kernel */
+  enum SimdLevel { SIMD_SCALAR, SIMD_SSE4, SIMD_AVX2, SIMD_AVX512 };
+
+  /** how build() chooses the splits */
+  enum BuildMethod {
+    /** surface area heuristic evaluated at the borders of 16 bins of the
+     *  centroids on each axis */
+    BUILD_BINNED,
+    /** surface area heuristic evaluated between every two neighbouring
+     *  centroids on each axis; takes a few times longer than BUILD_BINNED
+     *  and gives trees whose rays test fewer nodes and triangles */
+    BUILD_SWEEP
+  };
+
+  /** order in which the children of a node hit by a ray are visited */
+  enum TraversalOrder {
+    /** first child first, with the second child tested when it is popped */
+    ORDER_DEPTH_FIRST,
+    /** the child the ray enters first first; the other child is skipped
+     *  if the nearest hit found meanwhile is closer than its entry */
+    ORDER_FRONT_TO_BACK
+  };
+
+  /** work done by ray traversals, accumulated over any number of rays */
+  typedef BVHTraversalStats TraversalStats;
+
+  /** flattened tree node, two of which share a cache line */
+  struct Node {
+    float lower[3];
+    float upper[3];
+    /** first slot of a leaf or the second child of an interior node */
+    uint32_t offset;
+    /** number of triangles in a leaf, or INTERIOR_FLAG | split axis */
+    uint32_t count;
+
+    bool is_leaf() const { return !(count & INTERIOR_FLAG); }
+    int axis() const { return count & 3; }
+  };
+
+  /** a ray with the quantities shared by all box and triangle tests */
+  struct Ray {
+    Ray(const double origin[3], const double dir[3], double tolerance);
+
+    double origin[3];
+    double dir[3];
+    double inv_dir[3];
+    /** Plucker moment of the ray, dir x origin */
+    double moment[3];
+    /** amount by which the node boxes are grown for the box tests */
+    double tolerance;
+  };
+
+  /** the arrays of a tree, which may be owned by the tree or attached */
+  struct Arrays {
+    Arrays()
+        : nodes(NULL),
+          num_nodes(0),
+          coords(NULL),
+          packed(NULL),
+          tri_index(NULL),
+          num_slots(0),
+          num_triangles(0) {}
+
+    const Node* nodes;
+    size_t num_nodes;
+    /** 9 coordinates per slot */
+    const double* coords;
+    /** BLOCK_DOUBLES coordinates per block of BLOCK_SIZE slots */
+    const double* packed;
+    const uint32_t* tri_index;
+    size_t num_slots;
+    size_t num_triangles;
+  };
+
+  FacetBVH();
+
+  /**\brief build the tree
+   *
+   * \param coords the coordinates of each triangle, 9 values per triangle
+   * \param num_triangles the number of triangles
+   * \param max_leaf_size the preferred maximum number of triangles in a leaf
+   * \param method how the splits are chosen
+   */
+  void build(const double* coords, size_t num_triangles,
+             int max_leaf_size = 8, BuildMethod method = BUILD_BINNED);
+
+  /**\brief use a tree stored elsewhere
+   *
+   * Replaces the tree by arrays that were saved from get_arrays() of a built
+   * tree, e.g. in a memory-mapped file. The arrays are not copied and must
+   * outlive this tree or the next call to build(), attach() or clear().
+   */
+  void attach(const Arrays& arrays);
+
+  /** the arrays used by the queries */
+  const Arrays& get_arrays() const { return view; }
+
+  /** remove the tree and the triangles */
+  void clear();
+
+  bool empty() const { return 0 == view.num_nodes; }
+  size_t num_triangles() const { return view.num_triangles; }
+  size_t num_nodes() const { return view.num_nodes; }
+  const Node* get_nodes() const { return view.nodes; }
+
+  /** number of slots, including the unused slots that pad each leaf to a
+   *  whole number of blocks */
+  size_t num_slots() const { return view.num_slots; }
+
+  /** index, in the array given to build(), of the triangle in leaf slot i,
+   *  or UNUSED_SLOT for padding */
+  uint32_t triangle(uint32_t i) const { return view.tri_index[i]; }
+
+  /** coordinates of the triangle in leaf slot i */
+  const double* triangle_coords(uint32_t i) const {
+    return view.coords + 9 * i;
+  }
+
+  /** packed coordinates of block b: for vertex v and coordinate c, the
+   *  values of the BLOCK_SIZE slots start at (3 * v + c) * BLOCK_SIZE */
+  const double* block(uint32_t b) const {
+    return view.packed + BLOCK_DOUBLES * b;
+  }
+
+  /** bytes used by the nodes, triangle coordinates and index map owned by
+   *  the tree; attached arrays are not counted */
+  size_t memory_use() const;
+
+  /** bounding box of all triangles */
+  void get_bounds(double lower[3], double upper[3]) const;
+
+  /**\brief Plucker coordinate ray/triangle test
+   *
+   * Mirrors GeomUtil::plucker_ray_tri_intersect. Intersections beyond
+   * nonneg_ray_len, at or behind neg_ray_len (a negative value) or, if
+   * neg_ray_len is NULL, behind the ray origin are rejected. If orientation is
+   * given only intersections where the ray exits (1) or enters (-1) the
+   * triangle, taken as counter-clockwise outward facing, are accepted.
+   */
+  static bool intersect_triangle(const double tri[9], const Ray& ray,
+                                 double& dist, const double* nonneg_ray_len,
+                                 const double* neg_ray_len,
+                                 const int* orientation);
+
+  /** the edge tests of intersect_triangle: computes the Plucker coordinates
+   *  of the three edges and returns whether the ray passes through the
+   *  triangle with the requested orientation */
+  static bool plucker_test(const double tri[9], const Ray& ray,
+                           const int* orientation, double plucker[3]);
+
+  /** the distance part of intersect_triangle, for a triangle that passed
+   *  plucker_test */
+  static bool plucker_distance(const double tri[9], const Ray& ray,
+                               const double plucker[3], double& dist,
+                               const double* nonneg_ray_len,
+                               const double* neg_ray_len);
+
+  /**\brief Plucker edge tests of all slots of a packed block
+   *
+   * An orientation of 0 tests both orientations, like a NULL orientation in
+   * plucker_test.
+   * \return bit mask of the slots that pass plucker_test; the Plucker
+   * coordinates of edge e of slot i are stored in plucker[e][i]
+   */
+  typedef unsigned (*BlockTest)(const double* block, const Ray& ray,
+                                int orientation,
+                                double plucker[3][BLOCK_SIZE]);
+
+  /** highest SIMD level supported by both the compiler and the processor */
+  static SimdLevel best_simd_level();
+
+  /** select the leaf kernel, limited to best_simd_level(); not to be called
+   *  while other threads are running queries */
+  static void set_simd_level(SimdLevel level);
+
+  static SimdLevel simd_level() { return simdLevel; }
+
+  /** unnormalized normal (v1 - v0) x (v2 - v0) of a triangle */
+  static void triangle_normal(const double tri[9], double normal[3]);
+
+  /** closest point to p on the triangle */
+  static void closest_point_on_triangle(const double tri[9], const double p[3],
+                                        double result[3]);
+
+  /**\brief find the nearest intersection of a ray with the triangles
+   *
+   * Triangles for which skip(slot) is true are ignored. The window and
+   * orientation arguments are those of intersect_triangle. If the window
+   * extends behind the ray origin, the nearest intersection behind the origin
+   * is reported separately in neg_hit. The traversal work is added to stats
+   * if it is given.
+   *
+   * \return whether an intersection in front of the origin was found
+   */
+  template <class Filter>
+  bool ray_fire(const Ray& ray, double nonneg_ray_len,
+                const double* neg_ray_len, const int* orientation,
+                const Filter& skip, uint32_t& hit, double& hit_dist,
+                uint32_t* neg_hit = NULL, double* neg_hit_dist = NULL,
+                TraversalOrder order = ORDER_FRONT_TO_BACK,
+                TraversalStats* stats = NULL) const;
+
+  /** find all intersections of a ray within the search window */
+  template <class Filter>
+  void ray_intersect_all(const Ray& ray, double nonneg_ray_len,
+                         const Filter& skip, std::vector<uint32_t>& hits,
+                         std::vector<double>& dists) const;
+
+  /**\brief find the triangle closest to a point
+   *
+   * \return false if every triangle was skipped
+   */
+  template <class Filter>
+  bool closest_triangle(const double point[3], const Filter& skip,
+                        uint32_t& nearest, double& dist) const;
+
+  /** far field approximation of the solid angle of the triangles of a
+   *  node, indexed like the nodes */
+  struct Dipole {
+    /** area weighted centroid of the triangles */
+    double center[3];
+    /** sum of the area weighted normals of the triangles */
+    double normal[3];
+    /** distance from the center to the farthest corner of the node box */
+    double radius;
+  };
+
+  /** default ratio of the distance to a node over its radius beyond which
+   *  the node contributes its dipole */
+  static const double WINDING_ACCURACY;
+
+  /** compute the dipole of every node, for winding_number() */
+  void build_dipoles(std::vector<Dipole>& dipoles) const;
+
+  /**\brief generalized winding number of the triangles around a point
+   *
+   * Close to 1 inside a closed surface whose triangles are counter-clockwise
+   * seen from outside and close to 0 outside; it jumps across the surface,
+   * so points on the surface get either value. Needs no ray, so it does not
+   * depend on a direction and is not affected by rays grazing edges or
+   * vertices.
+   * \param dipoles the dipoles from build_dipoles()
+   * \param accuracy nodes farther than accuracy times their radius from the
+   *        point contribute their dipole; larger values are more accurate
+   */
+  double winding_number(const double point[3], const Dipole* dipoles,
+                        double accuracy = WINDING_ACCURACY) const;
+
+  /** signed solid angle of a triangle seen from a point, positive from
+   *  behind the triangle */
+  static double solid_angle(const double tri[9], const double point[3]);
+
+  /** filter that accepts every triangle */
+  struct NoFilter {
+    bool operator()(uint32_t) const { return false; }
+  };
+
+ private:
+  struct BuildItem {
+    double lower[3];
+    double upper[3];
+    double centroid[3];
+  };
+
+  /** recursively build the subtree over items [begin, end) of order */
+  void build_node(std::vector<uint32_t>& order,
+                  const std::vector<BuildItem>& items, uint32_t begin,
+                  uint32_t end, int depth, int max_leaf_size,
+                  BuildMethod method);
+
+  // not copyable: the view points into the vectors
+  FacetBVH(const FacetBVH&);
+  FacetBVH& operator=(const FacetBVH&);
+
+  /** traverse the nodes hit by a ray, calling visit(block, lanes, t_max) for
+   *  every block of the leaves it hits, where lanes masks the used slots of
+   *  the block; visit may shrink t_max to cull the remaining nodes */
+  template <class Visitor>
+  void traverse(const Ray& ray, double t_min, double& t_max, Visitor& visit,
+                TraversalOrder order, TraversalStats* stats) const;
+
+  /** visit the blocks of a leaf */
+  template <class Visitor>
+  void visit_leaf(const Node& node, double& t_max, Visitor& visit,
+                  TraversalStats* stats) const;
+
+  /** whether the ray hits the box of a node within [t_min, t_max], and if
+   *  so the distance at which it enters the box, at least t_min */
+  static bool ray_box(const Node& node, const Ray& ray, double t_min,
+                      double t_max, double& t_entry);
+
+  static double box_dist_sqr(const Node& node, const double point[3]);
+
+  /** the arrays used by the queries, pointing to the vectors below unless
+   *  the tree was attached */
+  Arrays view;
+
+  std::vector<Node> nodes;
+  /** triangle coordinates in leaf order, 9 per slot */
+  std::vector<double> coords;
+  /** the same coordinates packed by block */
+  std::vector<double> packed;
+  /** original index of the triangle in each leaf slot */
+  std::vector<uint32_t> tri_index;
+
+  static SimdLevel simdLevel;
+  static BlockTest blockTest;
+};
+
+inline bool FacetBVH::ray_box(const Node& node, const Ray& ray, double t_min,
+                              double t_max, double& t_entry) {
+  for (int i = 0; i < 3; i++) {
+    const double lo = node.lower[i] - ray.tolerance;
+    const double hi = node.upper[i] + ray.tolerance;
+    if (ray.dir[i] == 0.0) {
+      if (ray.origin[i] < lo || ray.origin[i] > hi) return false;
+      continue;
+    }
+    double t0 = (lo - ray.origin[i]) * ray.inv_dir[i];
+    double t1 = (hi - ray.origin[i]) * ray.inv_dir[i];
+    if (t0 > t1) std::swap(t0, t1);
+    if (t0 > t_min) t_min = t0;
+    if (t1 < t_max) t_max = t1;
+    if (t_min > t_max) return false;
+  }
+  t_entry = t_min;
+  return true;
+}
+
+inline double FacetBVH::box_dist_sqr(const Node& node, const double point[3]) {
+  double result = 0.0;
+  for (int i = 0; i < 3; i++) {
+    double d = 0.0;
+    if (point[i] < node.lower[i])
+      d = node.lower[i] - point[i];
+    else if (point[i] > node.upper[i])
+      d = point[i] - node.upper[i];
+    result += d * d;
+  }
+  return result;
+}
+
+template <class Visitor>
+void FacetBVH::visit_leaf(const Node& node, double& t_max, Visitor& visit,
+                          TraversalStats* stats) const {
+  if (stats) {
+    stats->leaves_visited++;
+    stats->triangle_tests += node.count;
+  }
+  uint32_t b = node.offset / BLOCK_SIZE;
+  for (uint32_t n = node.count; n > 0; b++) {
+    const uint32_t lanes = n < BLOCK_SIZE ? n : BLOCK_SIZE;
+    visit(b, (1u << lanes) - 1, t_max);
+    n -= lanes;
+  }
+}
+
+template <class Visitor>
+void FacetBVH::traverse(const Ray& ray, double t_min, double& t_max,
+                        Visitor& visit, TraversalOrder order,
+                        TraversalStats* stats) const {
+  if (empty()) return;
+
+  double t_entry;
+  if (ORDER_DEPTH_FIRST == order) {
+    uint32_t stack[MAX_DEPTH];
+    int top = 0;
+    uint32_t current = 0;
+    while (true) {
+      const Node& node = view.nodes[current];
+      if (stats) stats->node_tests++;
+      if (ray_box(node, ray, t_min, t_max, t_entry)) {
+        if (node.is_leaf()) {
+          visit_leaf(node, t_max, visit, stats);
+        } else {
+          stack[top++] = node.offset;
+          current = current + 1;
+          continue;
+        }
+      }
+      if (top == 0) break;
+      current = stack[--top];
+    }
+    return;
+  }
+
+  // front to back: both children are tested when their parent is reached,
+  // the nearer one is visited and the farther one is stacked with its entry
+  // distance, so that it is dropped if a closer hit has been found by the
+  // time it is popped
+  struct Entry {
+    uint32_t node;
+    double t_entry;
+  };
+  Entry stack[MAX_DEPTH];
+  int top = 0;
+  if (stats) stats->node_tests++;
+  if (!ray_box(view.nodes[0], ray, t_min, t_max, t_entry)) return;
+  uint32_t current = 0;
+  while (true) {
+    const Node& node = view.nodes[current];
+    if (node.is_leaf()) {
+      visit_leaf(node, t_max, visit, stats);
+    } else {
+      uint32_t near_child = current + 1, far_child = node.offset;
+      double t_near, t_far;
+      if (stats) stats->node_tests += 2;
+      const bool hit_near =
+          ray_box(view.nodes[near_child], ray, t_min, t_max, t_near);
+      const bool hit_far =
+          ray_box(view.nodes[far_child], ray, t_min, t_max, t_far);
+      if (hit_near && hit_far) {
+        if (t_far < t_near) {
+          std::swap(near_child, far_child);
+          std::swap(t_near, t_far);
+        }
+        stack[top].node = far_child;
+        stack[top].t_entry = t_far;
+        top++;
+        current = near_child;
+        continue;
+      }
+      if (hit_near || hit_far) {
+        current = hit_near ? near_child : far_child;
+        continue;
+      }
+    }
+    // skip the stacked nodes entered beyond the nearest hit
+    while (top > 0 && stack[top - 1].t_entry > t_max) top--;
+    if (top == 0) break;
+    current = stack[--top].node;
+  }
+}
+
+template <class Filter>
+bool FacetBVH::ray_fire(const Ray& ray, double nonneg_ray_len,
+                        const double* neg_ray_len, const int* orientation,
+                        const Filter& skip, uint32_t& hit, double& hit_dist,
+                        uint32_t* neg_hit, double* neg_hit_dist,
+                        TraversalOrder order, TraversalStats* stats) const {
+  struct Nearest {
+    const FacetBVH* tree;
+    const Ray* ray;
+    const double* neg_ray_len;
+    const int* orientation;
+    const Filter* skip;
+    bool found, found_neg;
+    uint32_t hit, neg_hit;
+    double neg_dist;
+
+    void operator()(uint32_t b, unsigned lanes, double& t_max) {
+      double plucker[3][BLOCK_SIZE];
+      unsigned mask = lanes & blockTest(tree->block(b), *ray,
+                                        orientation ? *orientation : 0,
+                                        plucker);
+      for (int i = 0; mask; i++, mask >>= 1) {
+        if (!(mask & 1)) continue;
+        const uint32_t slot = b * BLOCK_SIZE + i;
+        if ((*skip)(slot)) continue;
+        const double pc[3] = {plucker[0][i], plucker[1][i], plucker[2][i]};
+        double dist;
+        double limit = t_max;
+        if (!plucker_distance(tree->triangle_coords(slot), *ray, pc, dist,
+                              &limit, neg_ray_len))
+          continue;
+        if (dist < 0) {
+          // keep the intersection behind the origin nearest to it
+          if (!found_neg || dist > neg_dist) {
+            found_neg = true;
+            neg_hit = slot;
+            neg_dist = dist;
+          }
+        } else {
+          found = true;
+          hit = slot;
+          t_max = dist;
+        }
+      }
+    }
+  };
+
+  Nearest nearest = {this, &ray, neg_ray_len, orientation, &skip, false,
+                     false, 0, 0, 0.0};
+  double t_max = nonneg_ray_len;
+  traverse(ray, neg_ray_len ? *neg_ray_len : 0.0, t_max, nearest, order,
+           stats);
+
+  if (nearest.found) {
+    hit = nearest.hit;
+    hit_dist = t_max;
+  }
+  if (neg_hit && neg_hit_dist) {
+    *neg_hit = nearest.found_neg ? nearest.neg_hit : 0;
+    *neg_hit_dist = nearest.found_neg ? nearest.neg_dist : 0.0;
+  }
+  return nearest.found;
+}
+
+template <class Filter>
+void FacetBVH::ray_intersect_all(const Ray& ray, double nonneg_ray_len,
+                                 const Filter& skip,
+                                 std::vector<uint32_t>& hits,
+                                 std::vector<double>& dists) const {
+  struct All {
+    const FacetBVH* tree;
+    const Ray* ray;
+    const Filter* skip;
+    std::vector<uint32_t>* hits;
+    std::vector<double>* dists;
+    double limit;
+
+    void operator()(uint32_t b, unsigned lanes, double&) {
+      double plucker[3][BLOCK_SIZE];
+      unsigned mask = lanes & blockTest(tree->block(b), *ray, 0, plucker);
+      for (int i = 0; mask; i++, mask >>= 1) {
+        if (!(mask & 1)) continue;
+        const uint32_t slot = b * BLOCK_SIZE + i;
+        if ((*skip)(slot)) continue;
+        const double pc[3] = {plucker[0][i], plucker[1][i], plucker[2][i]};
+        double dist;
+        if (plucker_distance(tree->triangle_coords(slot), *ray, pc, dist,
+                             &limit, NULL)) {
+          hits->push_back(slot);
+          dists->push_back(dist);
+        }
+      }
+    }
+  };
+
+  hits.clear();
+  dists.clear();
+  All all = {this, &ray, &skip, &hits, &dists, nonneg_ray_len};
+  double t_max = nonneg_ray_len;
+  // every hit is kept, so the order does not matter
+  traverse(ray, 0.0, t_max, all, ORDER_DEPTH_FIRST, NULL);
+}
+
+template <class Filter>
+bool FacetBVH::closest_triangle(const double point[3], const Filter& skip,
+                                uint32_t& nearest, double& dist) const {
+  if (empty()) return false;
+
+  bool found = false;
+  double best = std::numeric_limits<double>::max();
+  uint32_t best_slot = 0;
+
+  uint32_t stack[MAX_DEPTH];
+  int top = 0;
+  uint32_t current = 0;
+  while (true) {
+    const Node& node = view.nodes[current];
+    if (box_dist_sqr(node, point) < best) {
+      if (node.is_leaf()) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+          if (skip(i)) continue;
+          double closest[3];
+          closest_point_on_triangle(triangle_coords(i), point, closest);
+          double d2 = 0.0;
+          for (int j = 0; j < 3; j++)
+            d2 += (closest[j] - point[j]) * (closest[j] - point[j]);
+          if (d2 < best) {
+            best = d2;
+            best_slot = i;
+            found = true;
+          }
+        }
+      } else {
+        // descend into the nearer child first
+        uint32_t first = current + 1, second = node.offset;
+        if (box_dist_sqr(view.nodes[second], point) <
+            box_dist_sqr(view.nodes[first], point))
+          std::swap(first, second);
+        stack[top++] = second;
+        current = first;
+        continue;
+      }
+    }
+    if (top == 0) break;
+    current = stack[--top];
+  }
+
+  if (found) {
+    nearest = best_slot;
+    dist = sqrt(best);
+  }
+  return found;
+}
+
+}  // namespace moab
+
+#endif
@@ -0,0 +1,356 @@
+// Vectorized Plucker edge tests for the packed leaf blocks of FacetBVH.
+//
+// Every kernel evaluates the Plucker coordinates with the same operations in
+// the same order as FacetBVH::plucker_test, so that all of them make
+// bit-identical decisions. Floating point contraction must therefore stay
+// disabled in this file: a fused multiply-add rounds differently.
+
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "FacetBVH.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DAGMC_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define DAGMC_X86_SIMD 0
+#endif
+
+namespace moab {
+
+namespace {
+
+// must match PLUCKER_ZERO in FacetBVH.cpp
+const double PLUCKER_ZERO = 1e-14;
+
+unsigned block_test_scalar(const double* block, const FacetBVH::Ray& ray,
+                           int orientation,
+                           double plucker[3][FacetBVH::BLOCK_SIZE]) {
+  unsigned mask = 0;
+  for (int i = 0; i < FacetBVH::BLOCK_SIZE; i++) {
+    double tri[9], pc[3];
+    for (int k = 0; k < 9; k++) tri[k] = block[k * FacetBVH::BLOCK_SIZE + i];
+    if (!FacetBVH::plucker_test(tri, ray, orientation ? &orientation : NULL,
+                                pc))
+      continue;
+    for (int e = 0; e < 3; e++) plucker[e][i] = pc[e];
+    mask |= 1u << i;
+  }
+  return mask;
+}
+
+#if DAGMC_X86_SIMD
+
+/* Each kernel has an edge function returning the Plucker coordinate of the
+   edge from vertex va to vertex vb for the lanes starting at slot i, and a
+   block function combining the three edges as plucker_test does. */
+
+__attribute__((target("sse4.1"))) inline __m128d sse4_edge(
+    const double* block, int va, int vb, int i, const FacetBVH::Ray& ray) {
+  const int n = FacetBVH::BLOCK_SIZE;
+  __m128d a[3], b[3], lo[3], edge[3];
+  for (int c = 0; c < 3; c++) {
+    a[c] = _mm_loadu_pd(block + (3 * va + c) * n + i);
+    b[c] = _mm_loadu_pd(block + (3 * vb + c) * n + i);
+  }
+
+  // lexicographic comparison of the two vertices
+  const __m128d first = _mm_or_pd(
+      _mm_cmplt_pd(a[0], b[0]),
+      _mm_and_pd(_mm_cmpeq_pd(a[0], b[0]),
+                 _mm_or_pd(_mm_cmplt_pd(a[1], b[1]),
+                           _mm_and_pd(_mm_cmpeq_pd(a[1], b[1]),
+                                      _mm_cmplt_pd(a[2], b[2])))));
+  for (int c = 0; c < 3; c++) {
+    lo[c] = _mm_blendv_pd(b[c], a[c], first);
+    edge[c] = _mm_sub_pd(_mm_blendv_pd(a[c], b[c], first), lo[c]);
+  }
+
+  const __m128d en0 = _mm_sub_pd(_mm_mul_pd(edge[1], lo[2]),
+                                 _mm_mul_pd(edge[2], lo[1]));
+  const __m128d en1 = _mm_sub_pd(_mm_mul_pd(edge[2], lo[0]),
+                                 _mm_mul_pd(edge[0], lo[2]));
+  const __m128d en2 = _mm_sub_pd(_mm_mul_pd(edge[0], lo[1]),
+                                 _mm_mul_pd(edge[1], lo[0]));
+  const __m128d d0 = _mm_set1_pd(ray.dir[0]);
+  const __m128d d1 = _mm_set1_pd(ray.dir[1]);
+  const __m128d d2 = _mm_set1_pd(ray.dir[2]);
+  const __m128d m0 = _mm_set1_pd(ray.moment[0]);
+  const __m128d m1 = _mm_set1_pd(ray.moment[1]);
+  const __m128d m2 = _mm_set1_pd(ray.moment[2]);
+  __m128d pip = _mm_add_pd(
+      _mm_add_pd(_mm_add_pd(_mm_mul_pd(d0, en0), _mm_mul_pd(d1, en1)),
+                 _mm_mul_pd(d2, en2)),
+      _mm_add_pd(_mm_add_pd(_mm_mul_pd(m0, edge[0]), _mm_mul_pd(m1, edge[1])),
+                 _mm_mul_pd(m2, edge[2])));
+
+  const __m128d sign = _mm_set1_pd(-0.0);
+  pip = _mm_xor_pd(pip, _mm_andnot_pd(first, sign));
+  const __m128d small =
+      _mm_cmplt_pd(_mm_andnot_pd(sign, pip), _mm_set1_pd(PLUCKER_ZERO));
+  return _mm_andnot_pd(small, pip);
+}
+
+__attribute__((target("sse4.1"))) unsigned block_test_sse4(
+    const double* block, const FacetBVH::Ray& ray, int orientation,
+    double plucker[3][FacetBVH::BLOCK_SIZE]) {
+  const __m128d zero = _mm_setzero_pd();
+  unsigned mask = 0;
+  for (int i = 0; i < FacetBVH::BLOCK_SIZE; i += 2) {
+    const __m128d pc0 = sse4_edge(block, 0, 1, i, ray);
+    const __m128d pc1 = sse4_edge(block, 1, 2, i, ray);
+    const __m128d pc2 = sse4_edge(block, 2, 0, i, ray);
+    _mm_storeu_pd(plucker[0] + i, pc0);
+    _mm_storeu_pd(plucker[1] + i, pc1);
+    _mm_storeu_pd(plucker[2] + i, pc2);
+
+    __m128d reject;
+    if (orientation) {
+      const __m128d o = _mm_set1_pd(orientation);
+      reject = _mm_or_pd(
+          _mm_or_pd(_mm_cmpgt_pd(_mm_mul_pd(o, pc0), zero),
+                    _mm_cmpgt_pd(_mm_mul_pd(o, pc1), zero)),
+          _mm_cmpgt_pd(_mm_mul_pd(o, pc2), zero));
+    } else {
+      const __m128d pos0 = _mm_cmpgt_pd(pc0, zero);
+      const __m128d neg0 = _mm_cmplt_pd(pc0, zero);
+      const __m128d pos1 = _mm_cmpgt_pd(pc1, zero);
+      const __m128d neg1 = _mm_cmplt_pd(pc1, zero);
+      const __m128d pos2 = _mm_cmpgt_pd(pc2, zero);
+      const __m128d neg2 = _mm_cmplt_pd(pc2, zero);
+      reject = _mm_or_pd(
+          _mm_or_pd(_mm_or_pd(_mm_and_pd(pos0, neg1), _mm_and_pd(neg0, pos1)),
+                    _mm_or_pd(_mm_and_pd(pos1, neg2), _mm_and_pd(neg1, pos2))),
+          _mm_or_pd(_mm_and_pd(pos0, neg2), _mm_and_pd(neg0, pos2)));
+    }
+    // the ray is coplanar with the triangle
+    reject = _mm_or_pd(
+        reject, _mm_and_pd(_mm_and_pd(_mm_cmpeq_pd(pc0, zero),
+                                      _mm_cmpeq_pd(pc1, zero)),
+                           _mm_cmpeq_pd(pc2, zero)));
+    mask |= (unsigned)(~_mm_movemask_pd(reject) & 0x3) << i;
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"))) inline __m256d avx2_edge(
+    const double* block, int va, int vb, int i, const FacetBVH::Ray& ray) {
+  const int n = FacetBVH::BLOCK_SIZE;
+  __m256d a[3], b[3], lo[3], edge[3];
+  for (int c = 0; c < 3; c++) {
+    a[c] = _mm256_loadu_pd(block + (3 * va + c) * n + i);
+    b[c] = _mm256_loadu_pd(block + (3 * vb + c) * n + i);
+  }
+
+  // lexicographic comparison of the two vertices
+  const __m256d first = _mm256_or_pd(
+      _mm256_cmp_pd(a[0], b[0], _CMP_LT_OQ),
+      _mm256_and_pd(
+          _mm256_cmp_pd(a[0], b[0], _CMP_EQ_OQ),
+          _mm256_or_pd(_mm256_cmp_pd(a[1], b[1], _CMP_LT_OQ),
+                       _mm256_and_pd(_mm256_cmp_pd(a[1], b[1], _CMP_EQ_OQ),
+                                     _mm256_cmp_pd(a[2], b[2], _CMP_LT_OQ)))));
+  for (int c = 0; c < 3; c++) {
+    lo[c] = _mm256_blendv_pd(b[c], a[c], first);
+    edge[c] = _mm256_sub_pd(_mm256_blendv_pd(a[c], b[c], first), lo[c]);
+  }
+
+  const __m256d en0 = _mm256_sub_pd(_mm256_mul_pd(edge[1], lo[2]),
+                                    _mm256_mul_pd(edge[2], lo[1]));
+  const __m256d en1 = _mm256_sub_pd(_mm256_mul_pd(edge[2], lo[0]),
+                                    _mm256_mul_pd(edge[0], lo[2]));
+  const __m256d en2 = _mm256_sub_pd(_mm256_mul_pd(edge[0], lo[1]),
+                                    _mm256_mul_pd(edge[1], lo[0]));
+  const __m256d d0 = _mm256_set1_pd(ray.dir[0]);
+  const __m256d d1 = _mm256_set1_pd(ray.dir[1]);
+  const __m256d d2 = _mm256_set1_pd(ray.dir[2]);
+  const __m256d m0 = _mm256_set1_pd(ray.moment[0]);
+  const __m256d m1 = _mm256_set1_pd(ray.moment[1]);
+  const __m256d m2 = _mm256_set1_pd(ray.moment[2]);
+  __m256d pip = _mm256_add_pd(
+      _mm256_add_pd(
+          _mm256_add_pd(_mm256_mul_pd(d0, en0), _mm256_mul_pd(d1, en1)),
+          _mm256_mul_pd(d2, en2)),
+      _mm256_add_pd(
+          _mm256_add_pd(_mm256_mul_pd(m0, edge[0]), _mm256_mul_pd(m1, edge[1])),
+          _mm256_mul_pd(m2, edge[2])));
+
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  pip = _mm256_xor_pd(pip, _mm256_andnot_pd(first, sign));
+  const __m256d small = _mm256_cmp_pd(
+      _mm256_andnot_pd(sign, pip), _mm256_set1_pd(PLUCKER_ZERO), _CMP_LT_OQ);
+  return _mm256_andnot_pd(small, pip);
+}
+
+__attribute__((target("avx2"))) unsigned block_test_avx2(
+    const double* block, const FacetBVH::Ray& ray, int orientation,
+    double plucker[3][FacetBVH::BLOCK_SIZE]) {
+  const __m256d zero = _mm256_setzero_pd();
+  unsigned mask = 0;
+  for (int i = 0; i < FacetBVH::BLOCK_SIZE; i += 4) {
+    const __m256d pc0 = avx2_edge(block, 0, 1, i, ray);
+    const __m256d pc1 = avx2_edge(block, 1, 2, i, ray);
+    const __m256d pc2 = avx2_edge(block, 2, 0, i, ray);
+    _mm256_storeu_pd(plucker[0] + i, pc0);
+    _mm256_storeu_pd(plucker[1] + i, pc1);
+    _mm256_storeu_pd(plucker[2] + i, pc2);
+
+    __m256d reject;
+    if (orientation) {
+      const __m256d o = _mm256_set1_pd(orientation);
+      reject = _mm256_or_pd(
+          _mm256_or_pd(_mm256_cmp_pd(_mm256_mul_pd(o, pc0), zero, _CMP_GT_OQ),
+                       _mm256_cmp_pd(_mm256_mul_pd(o, pc1), zero, _CMP_GT_OQ)),
+          _mm256_cmp_pd(_mm256_mul_pd(o, pc2), zero, _CMP_GT_OQ));
+    } else {
+      const __m256d pos0 = _mm256_cmp_pd(pc0, zero, _CMP_GT_OQ);
+      const __m256d neg0 = _mm256_cmp_pd(pc0, zero, _CMP_LT_OQ);
+      const __m256d pos1 = _mm256_cmp_pd(pc1, zero, _CMP_GT_OQ);
+      const __m256d neg1 = _mm256_cmp_pd(pc1, zero, _CMP_LT_OQ);
+      const __m256d pos2 = _mm256_cmp_pd(pc2, zero, _CMP_GT_OQ);
+      const __m256d neg2 = _mm256_cmp_pd(pc2, zero, _CMP_LT_OQ);
+      reject = _mm256_or_pd(
+          _mm256_or_pd(
+              _mm256_or_pd(_mm256_and_pd(pos0, neg1),
+                           _mm256_and_pd(neg0, pos1)),
+              _mm256_or_pd(_mm256_and_pd(pos1, neg2),
+                           _mm256_and_pd(neg1, pos2))),
+          _mm256_or_pd(_mm256_and_pd(pos0, neg2), _mm256_and_pd(neg0, pos2)));
+    }
+    // the ray is coplanar with the triangle
+    reject = _mm256_or_pd(
+        reject,
+        _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(pc0, zero, _CMP_EQ_OQ),
+                                    _mm256_cmp_pd(pc1, zero, _CMP_EQ_OQ)),
+                      _mm256_cmp_pd(pc2, zero, _CMP_EQ_OQ)));
+    mask |= (unsigned)(~_mm256_movemask_pd(reject) & 0xf) << i;
+  }
+  return mask;
+}
+
+__attribute__((target("avx512f"))) inline __m512d avx512_edge(
+    const double* block, int va, int vb, const FacetBVH::Ray& ray) {
+  const int n = FacetBVH::BLOCK_SIZE;
+  __m512d a[3], b[3], lo[3], edge[3];
+  for (int c = 0; c < 3; c++) {
+    a[c] = _mm512_loadu_pd(block + (3 * va + c) * n);
+    b[c] = _mm512_loadu_pd(block + (3 * vb + c) * n);
+  }
+
+  // lexicographic comparison of the two vertices
+  const __mmask8 first =
+      _mm512_cmp_pd_mask(a[0], b[0], _CMP_LT_OQ) |
+      (_mm512_cmp_pd_mask(a[0], b[0], _CMP_EQ_OQ) &
+       (_mm512_cmp_pd_mask(a[1], b[1], _CMP_LT_OQ) |
+        (_mm512_cmp_pd_mask(a[1], b[1], _CMP_EQ_OQ) &
+         _mm512_cmp_pd_mask(a[2], b[2], _CMP_LT_OQ))));
+  for (int c = 0; c < 3; c++) {
+    lo[c] = _mm512_mask_blend_pd(first, b[c], a[c]);
+    edge[c] = _mm512_sub_pd(_mm512_mask_blend_pd(first, a[c], b[c]), lo[c]);
+  }
+
+  const __m512d en0 = _mm512_sub_pd(_mm512_mul_pd(edge[1], lo[2]),
+                                    _mm512_mul_pd(edge[2], lo[1]));
+  const __m512d en1 = _mm512_sub_pd(_mm512_mul_pd(edge[2], lo[0]),
+                                    _mm512_mul_pd(edge[0], lo[2]));
+  const __m512d en2 = _mm512_sub_pd(_mm512_mul_pd(edge[0], lo[1]),
+                                    _mm512_mul_pd(edge[1], lo[0]));
+  const __m512d d0 = _mm512_set1_pd(ray.dir[0]);
+  const __m512d d1 = _mm512_set1_pd(ray.dir[1]);
+  const __m512d d2 = _mm512_set1_pd(ray.dir[2]);
+  const __m512d m0 = _mm512_set1_pd(ray.moment[0]);
+  const __m512d m1 = _mm512_set1_pd(ray.moment[1]);
+  const __m512d m2 = _mm512_set1_pd(ray.moment[2]);
+  __m512d pip = _mm512_add_pd(
+      _mm512_add_pd(
+          _mm512_add_pd(_mm512_mul_pd(d0, en0), _mm512_mul_pd(d1, en1)),
+          _mm512_mul_pd(d2, en2)),
+      _mm512_add_pd(
+          _mm512_add_pd(_mm512_mul_pd(m0, edge[0]), _mm512_mul_pd(m1, edge[1])),
+          _mm512_mul_pd(m2, edge[2])));
+
+  // flip the sign bit of the lanes whose vertices were swapped
+  const __m512i bits = _mm512_castpd_si512(pip);
+  pip = _mm512_castsi512_pd(_mm512_mask_xor_epi64(
+      bits, (__mmask8)~first, bits, _mm512_set1_epi64(INT64_MIN)));
+  const __mmask8 small = _mm512_cmp_pd_mask(
+      _mm512_abs_pd(pip), _mm512_set1_pd(PLUCKER_ZERO), _CMP_LT_OQ);
+  return _mm512_mask_mov_pd(pip, small, _mm512_setzero_pd());
+}
+
+__attribute__((target("avx512f"))) unsigned block_test_avx512(
+    const double* block, const FacetBVH::Ray& ray, int orientation,
+    double plucker[3][FacetBVH::BLOCK_SIZE]) {
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d pc0 = avx512_edge(block, 0, 1, ray);
+  const __m512d pc1 = avx512_edge(block, 1, 2, ray);
+  const __m512d pc2 = avx512_edge(block, 2, 0, ray);
+  _mm512_storeu_pd(plucker[0], pc0);
+  _mm512_storeu_pd(plucker[1], pc1);
+  _mm512_storeu_pd(plucker[2], pc2);
+
+  __mmask8 reject;
+  if (orientation) {
+    const __m512d o = _mm512_set1_pd(orientation);
+    reject = _mm512_cmp_pd_mask(_mm512_mul_pd(o, pc0), zero, _CMP_GT_OQ) |
+             _mm512_cmp_pd_mask(_mm512_mul_pd(o, pc1), zero, _CMP_GT_OQ) |
+             _mm512_cmp_pd_mask(_mm512_mul_pd(o, pc2), zero, _CMP_GT_OQ);
+  } else {
+    const __mmask8 pos0 = _mm512_cmp_pd_mask(pc0, zero, _CMP_GT_OQ);
+    const __mmask8 neg0 = _mm512_cmp_pd_mask(pc0, zero, _CMP_LT_OQ);
+    const __mmask8 pos1 = _mm512_cmp_pd_mask(pc1, zero, _CMP_GT_OQ);
+    const __mmask8 neg1 = _mm512_cmp_pd_mask(pc1, zero, _CMP_LT_OQ);
+    const __mmask8 pos2 = _mm512_cmp_pd_mask(pc2, zero, _CMP_GT_OQ);
+    const __mmask8 neg2 = _mm512_cmp_pd_mask(pc2, zero, _CMP_LT_OQ);
+    reject = (pos0 & neg1) | (neg0 & pos1) | (pos1 & neg2) | (neg1 & pos2) |
+             (pos0 & neg2) | (neg0 & pos2);
+  }
+  // the ray is coplanar with the triangle
+  reject |= _mm512_cmp_pd_mask(pc0, zero, _CMP_EQ_OQ) &
+            _mm512_cmp_pd_mask(pc1, zero, _CMP_EQ_OQ) &
+            _mm512_cmp_pd_mask(pc2, zero, _CMP_EQ_OQ);
+  return (unsigned)(~reject & 0xff);
+}
+
+#endif
+
+FacetBVH::BlockTest block_test(FacetBVH::SimdLevel level) {
+  switch (level) {
+#if DAGMC_X86_SIMD
+    case FacetBVH::SIMD_AVX512:
+      return block_test_avx512;
+    case FacetBVH::SIMD_AVX2:
+      return block_test_avx2;
+    case FacetBVH::SIMD_SSE4:
+      return block_test_sse4;
+#endif
+    default:
+      return block_test_scalar;
+  }
+}
+
+}  // namespace
+
+FacetBVH::SimdLevel FacetBVH::best_simd_level() {
+#if DAGMC_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE4;
+#endif
+  return SIMD_SCALAR;
+}
+
+void FacetBVH::set_simd_level(SimdLevel level) {
+  simdLevel = std::min(level, best_simd_level());
+  blockTest = block_test(simdLevel);
+}
+
+FacetBVH::SimdLevel FacetBVH::simdLevel = FacetBVH::best_simd_level();
+FacetBVH::BlockTest FacetBVH::blockTest = block_test(FacetBVH::simdLevel);
+
+}  // namespace moab
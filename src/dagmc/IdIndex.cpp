@@ -0,0 +1,54 @@
+#include "IdIndex.hpp"
+
+#include <algorithm>
+
+namespace moab {
+
+const int IdIndex::MAX_DENSE_SPREAD = 4;
+
+IdIndex::IdIndex() : minId(0), mask(0), shift(64) {}
+
+void IdIndex::clear() {
+  std::vector<int>().swap(denseIndices);
+  std::vector<Slot>().swap(slots);
+  minId = 0;
+  mask = 0;
+  shift = 64;
+}
+
+void IdIndex::build(const std::vector<int>& ids) {
+  clear();
+  if (ids.size() < 2) return;
+
+  const int64_t lowest = *std::min_element(ids.begin() + 1, ids.end());
+  const int64_t highest = *std::max_element(ids.begin() + 1, ids.end());
+  const uint64_t num_ids = ids.size() - 1;
+  if ((uint64_t)(highest - lowest) < MAX_DENSE_SPREAD * num_ids) {
+    minId = lowest;
+    denseIndices.assign(highest - lowest + 1, 0);
+    // the lowest index wins, so the entities are stored from the last one
+    for (size_t i = ids.size() - 1; i > 0; i--)
+      denseIndices[ids[i] - lowest] = i;
+    return;
+  }
+
+  int bits = 1;
+  while (((uint64_t)1 << bits) < 2 * num_ids) bits++;
+  shift = 64 - bits;
+  slots.assign((size_t)1 << bits, Slot());
+  mask = slots.size() - 1;
+  for (size_t i = 1; i < ids.size(); i++) {
+    uint64_t s = slot_of(ids[i]);
+    while (slots[s].index && slots[s].id != ids[i]) s = (s + 1) & mask;
+    if (slots[s].index) continue;
+    slots[s].id = ids[i];
+    slots[s].index = i;
+  }
+}
+
+size_t IdIndex::memory_use() const {
+  return denseIndices.capacity() * sizeof(int) +
+         slots.capacity() * sizeof(Slot);
+}
+
+}  // namespace moab
@@ -0,0 +1,82 @@
+#ifndef DAGMC_ID_INDEX_HPP
+#define DAGMC_ID_INDEX_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace moab {
+
+/**\brief map from the global IDs of the entities of one dimension to their
+ * indices
+ *
+ * A lookup is one array access when the IDs are dense, as they are in
+ * files written by the CAD exporters: the indices are stored by ID, from
+ * the lowest ID on. Sparse IDs go into an open addressing hash table with
+ * linear probing, kept at most half full, so that a lookup probes one or
+ * two slots on average. Either way a lookup takes constant time, where
+ * GeomTopoTool::entity_by_id() searches the geometry sets.
+ *
+ * DagMC keeps one for the surfaces and one for the volumes, see
+ * DagMC::entity_by_id().
+ */
+class IdIndex {
+ public:
+  /** the IDs are stored densely if they span at most this many IDs per
+   *  entity */
+  static const int MAX_DENSE_SPREAD;
+
+  IdIndex();
+
+  /**\brief index the IDs
+   * \param ids the ID of each index; ids[0] is not indexed, since index 0
+   *        stands for no entity. Of the entities sharing an ID, the one with
+   *        the lowest index is found.
+   */
+  void build(const std::vector<int>& ids);
+
+  void clear();
+
+  /** index of the entity with an ID, or 0 if there is none */
+  int find(int id) const {
+    if (!denseIndices.empty()) {
+      const uint64_t offset = (int64_t)id - minId;
+      return offset < denseIndices.size() ? denseIndices[offset] : 0;
+    }
+    if (slots.empty()) return 0;
+    for (uint64_t s = slot_of(id);; s = (s + 1) & mask) {
+      if (!slots[s].index) return 0;
+      if (slots[s].id == id) return slots[s].index;
+    }
+  }
+
+  bool is_dense() const { return !denseIndices.empty(); }
+
+  /** bytes taken by the tables */
+  size_t memory_use() const;
+
+ private:
+  struct Slot {
+    int id;
+    /** 0 if the slot is empty */
+    int index;
+  };
+
+  /** first slot probed for an ID, from Fibonacci hashing */
+  uint64_t slot_of(int id) const {
+    return ((uint64_t)(uint32_t)id * 0x9E3779B97F4A7C15ull) >> shift;
+  }
+
+  int64_t minId;
+  /** index of each ID from minId on, 0 for the IDs without an entity */
+  std::vector<int> denseIndices;
+  /** the hash table of sparse IDs; its size is a power of two */
+  std::vector<Slot> slots;
+  uint64_t mask;
+  int shift;
+};
+
+}  // namespace moab
+
+#endif
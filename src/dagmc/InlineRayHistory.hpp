@@ -0,0 +1,148 @@
+#ifndef DAGMC_INLINE_RAY_HISTORY_HPP
+#define DAGMC_INLINE_RAY_HISTORY_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include "moab/GeomQueryTool.hpp"
+#include "moab/Types.hpp"
+
+namespace moab {
+
+/**\brief ray history that does not allocate for short histories
+ *
+ * Same interface and behavior as GeomQueryTool::RayHistory, but the first
+ * INLINE_CAPACITY facets are stored in the object itself; only longer
+ * histories spill the remaining facets into a vector. Particle histories
+ * rarely hold more than a few facets, since they are reset to the last
+ * intersection at every collision, so copying, banking and restoring them
+ * does not touch the heap. Moving a history moves the overflow vector.
+ *
+ * version() changes whenever facets are removed or the history is assigned,
+ * but not when one is added, so that a copy kept in step with add_entity()
+ * can tell whether it is still a prefix of the history.
+ */
+class InlineRayHistory {
+ public:
+  /** number of facets stored without allocating */
+  static const int INLINE_CAPACITY = 8;
+
+  InlineRayHistory() : count(0), edits(0) {}
+
+  InlineRayHistory(const InlineRayHistory& other)
+      : count(other.count), edits(other.edits), overflow(other.overflow) {
+    std::copy(other.facets, other.facets + inline_count(), facets);
+  }
+
+  InlineRayHistory(InlineRayHistory&& other) noexcept
+      : count(other.count),
+        edits(other.edits),
+        overflow(std::move(other.overflow)) {
+    std::copy(other.facets, other.facets + inline_count(), facets);
+    other.count = 0;
+    other.edits++;
+  }
+
+  InlineRayHistory& operator=(const InlineRayHistory& other) {
+    if (this == &other) return *this;
+    count = other.count;
+    edits = std::max(edits, other.edits) + 1;
+    std::copy(other.facets, other.facets + inline_count(), facets);
+    // assigning keeps the capacity of the overflow vector
+    overflow.assign(other.overflow.begin(), other.overflow.end());
+    return *this;
+  }
+
+  InlineRayHistory& operator=(InlineRayHistory&& other) noexcept {
+    if (this == &other) return *this;
+    count = other.count;
+    edits = std::max(edits, other.edits) + 1;
+    std::copy(other.facets, other.facets + inline_count(), facets);
+    overflow.swap(other.overflow);
+    other.overflow.clear();
+    other.count = 0;
+    other.edits++;
+    return *this;
+  }
+
+  /** clear the history */
+  void reset() {
+    count = 0;
+    edits++;
+    overflow.clear();
+  }
+
+  /** clear all facets but the last one */
+  void reset_to_last_intersection() {
+    if (count > 1) {
+      facets[0] = back();
+      count = 1;
+      overflow.clear();
+      edits++;
+    }
+  }
+
+  /** remove the last facet */
+  void rollback_last_intersection() {
+    if (count > INLINE_CAPACITY) overflow.pop_back();
+    if (count) count--;
+    edits++;
+  }
+
+  ErrorCode get_last_intersection(EntityHandle& last_facet_hit) const {
+    if (!count) return MB_ENTITY_NOT_FOUND;
+    last_facet_hit = back();
+    return MB_SUCCESS;
+  }
+
+  int size() const { return count; }
+
+  /** the i-th facet, from the oldest */
+  EntityHandle operator[](int i) const {
+    return i < INLINE_CAPACITY ? facets[i] : overflow[i - INLINE_CAPACITY];
+  }
+
+  unsigned long version() const { return edits; }
+
+  bool in_history(EntityHandle ent) const {
+    return std::find(facets, facets + inline_count(), ent) !=
+               facets + inline_count() ||
+           std::find(overflow.begin(), overflow.end(), ent) != overflow.end();
+  }
+
+  void add_entity(EntityHandle ent) {
+    if (count < INLINE_CAPACITY)
+      facets[count] = ent;
+    else
+      overflow.push_back(ent);
+    count++;
+  }
+
+  /** replace the contents of a GeomQueryTool history by this history */
+  void copy_to(GeomQueryTool::RayHistory& history) const {
+    history.reset();
+    for (int i = 0; i < inline_count(); i++) history.add_entity(facets[i]);
+    for (unsigned i = 0; i < overflow.size(); i++)
+      history.add_entity(overflow[i]);
+  }
+
+ private:
+  int inline_count() const {
+    return count < INLINE_CAPACITY ? count : INLINE_CAPACITY;
+  }
+
+  EntityHandle back() const {
+    return count > INLINE_CAPACITY ? overflow.back() : facets[count - 1];
+  }
+
+  int count;
+  /** number of removals and assignments, see version() */
+  unsigned long edits;
+  EntityHandle facets[INLINE_CAPACITY];
+  /** facets beyond the first INLINE_CAPACITY */
+  std::vector<EntityHandle> overflow;
+};
+
+}  // namespace moab
+
+#endif
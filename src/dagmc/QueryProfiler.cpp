@@ -0,0 +1,267 @@
+#include "QueryProfiler.hpp"
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace moab {
+
+struct QueryProfiler::Shard {
+  Shard(size_t size) : thread(std::this_thread::get_id()), size(size) {
+    counters.reset(new std::atomic<uint64_t>[size]);
+    for (size_t i = 0; i < size; i++)
+      counters[i].store(0, std::memory_order_relaxed);
+  }
+
+  std::thread::id thread;
+  size_t size;
+  std::unique_ptr<std::atomic<uint64_t>[]> counters;
+};
+
+namespace {
+
+// the shard a thread last recorded into, and the profiler it belongs to
+struct LocalShard {
+  uint64_t serial;
+  void* shard;
+};
+
+thread_local LocalShard local = {0, NULL};
+
+std::atomic<uint64_t> next_serial(1);
+
+double to_seconds(uint64_t nanoseconds) { return 1e-9 * nanoseconds; }
+
+}  // namespace
+
+const char* QueryProfiler::query_name(Query query) {
+  switch (query) {
+    case RAY_FIRE:
+      return "ray_fire";
+    case POINT_IN_VOLUME:
+      return "point_in_volume";
+    case CLOSEST_TO_LOCATION:
+      return "closest_to_location";
+    case NEXT_VOL:
+      return "next_vol";
+    default:
+      return "unknown";
+  }
+}
+
+QueryProfiler::Counts::Counts()
+    : nodes(0),
+      triangles(0),
+      lost(0),
+      retries(0),
+      bounds_tests(0),
+      box_rejects(0),
+      obb_rejects(0) {
+  for (int q = 0; q < NUM_QUERIES; q++) calls[q] = nanoseconds[q] = 0;
+}
+
+double QueryProfiler::Counts::seconds() const {
+  uint64_t total = 0;
+  for (int q = 0; q < NUM_QUERIES; q++) total += nanoseconds[q];
+  return to_seconds(total);
+}
+
+QueryProfiler::QueryProfiler() : numVolumes(0), serial(0) { setup(0); }
+
+QueryProfiler::~QueryProfiler() {}
+
+void QueryProfiler::setup(int num_volumes) {
+  std::lock_guard<std::mutex> lock(shardMutex);
+  numVolumes = std::max(0, num_volumes);
+  // the shards of the previous setup are dropped, and the threads holding
+  // them see the new serial
+  serial = next_serial.fetch_add(1);
+  shards.clear();
+}
+
+QueryProfiler::Shard& QueryProfiler::local_shard() {
+  if (local.serial == serial) return *static_cast<Shard*>(local.shard);
+
+  // first query of this thread since the setup, or since it recorded into
+  // another profiler
+  std::lock_guard<std::mutex> lock(shardMutex);
+  const std::thread::id thread = std::this_thread::get_id();
+  Shard* shard = NULL;
+  for (unsigned i = 0; i < shards.size() && !shard; i++)
+    if (shards[i]->thread == thread) shard = shards[i].get();
+  if (!shard) {
+    shards.emplace_back(new Shard((numVolumes + 1) * NUM_FIELDS));
+    shard = shards.back().get();
+  }
+  local.serial = serial;
+  local.shard = shard;
+  return *shard;
+}
+
+void QueryProfiler::add(int volume, int field, uint64_t value) {
+  if (volume < 0 || volume > numVolumes) volume = 0;
+  // only this thread writes the counter, so it needs no atomic increment
+  std::atomic<uint64_t>& counter =
+      local_shard().counters[volume * NUM_FIELDS + field];
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+void QueryProfiler::record(int volume, Query query, uint64_t nanoseconds) {
+  add(volume, query, 1);
+  add(volume, NUM_QUERIES + query, nanoseconds);
+}
+
+void QueryProfiler::add_traversal(int volume, uint64_t nodes,
+                                  uint64_t triangles) {
+  add(volume, NODES, nodes);
+  add(volume, TRIANGLES, triangles);
+}
+
+void QueryProfiler::add_lost(int volume) { add(volume, LOST, 1); }
+
+void QueryProfiler::add_retry(int volume) { add(volume, RETRIES, 1); }
+
+void QueryProfiler::add_bounds_test(int volume, bool box_reject,
+                                    bool obb_reject) {
+  add(volume, BOUNDS_TESTS, 1);
+  if (box_reject) add(volume, BOX_REJECTS, 1);
+  if (obb_reject) add(volume, OBB_REJECTS, 1);
+}
+
+void QueryProfiler::get_counts(std::vector<Counts>& result) const {
+  result.assign(numVolumes + 1, Counts());
+  std::lock_guard<std::mutex> lock(shardMutex);
+  for (unsigned s = 0; s < shards.size(); s++) {
+    const std::atomic<uint64_t>* counters = shards[s]->counters.get();
+    for (int v = 0; v <= numVolumes; v++) {
+      const std::atomic<uint64_t>* c = counters + v * NUM_FIELDS;
+      Counts& counts = result[v];
+      for (int q = 0; q < NUM_QUERIES; q++) {
+        counts.calls[q] += c[q].load(std::memory_order_relaxed);
+        counts.nanoseconds[q] +=
+            c[NUM_QUERIES + q].load(std::memory_order_relaxed);
+      }
+      counts.nodes += c[NODES].load(std::memory_order_relaxed);
+      counts.triangles += c[TRIANGLES].load(std::memory_order_relaxed);
+      counts.lost += c[LOST].load(std::memory_order_relaxed);
+      counts.retries += c[RETRIES].load(std::memory_order_relaxed);
+      counts.bounds_tests += c[BOUNDS_TESTS].load(std::memory_order_relaxed);
+      counts.box_rejects += c[BOX_REJECTS].load(std::memory_order_relaxed);
+      counts.obb_rejects += c[OBB_REJECTS].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void QueryProfiler::reset() {
+  std::lock_guard<std::mutex> lock(shardMutex);
+  for (unsigned s = 0; s < shards.size(); s++)
+    for (size_t i = 0; i < shards[s]->size; i++)
+      shards[s]->counters[i].store(0, std::memory_order_relaxed);
+}
+
+// the volumes with any queries, the slowest first, and the sum of all of
+// them
+static void report_order(const std::vector<QueryProfiler::Counts>& counts,
+                         std::vector<int>& order,
+                         QueryProfiler::Counts& total) {
+  order.clear();
+  for (unsigned v = 0; v < counts.size(); v++) {
+    const QueryProfiler::Counts& c = counts[v];
+    uint64_t calls = 0;
+    for (int q = 0; q < QueryProfiler::NUM_QUERIES; q++) {
+      calls += c.calls[q];
+      total.calls[q] += c.calls[q];
+      total.nanoseconds[q] += c.nanoseconds[q];
+    }
+    total.nodes += c.nodes;
+    total.triangles += c.triangles;
+    total.lost += c.lost;
+    total.retries += c.retries;
+    if (calls || c.lost || c.retries) order.push_back(v);
+  }
+  std::stable_sort(order.begin(), order.end(), [&counts](int a, int b) {
+    return counts[a].seconds() > counts[b].seconds();
+  });
+}
+
+static void write_json_counts(std::ostream& str,
+                              const QueryProfiler::Counts& c) {
+  str << "\"seconds\": " << c.seconds();
+  for (int q = 0; q < QueryProfiler::NUM_QUERIES; q++) {
+    str << ", \"" << QueryProfiler::query_name((QueryProfiler::Query)q)
+        << "\": {\"calls\": " << c.calls[q]
+        << ", \"seconds\": " << to_seconds(c.nanoseconds[q]) << "}";
+  }
+  str << ", \"nodes\": " << c.nodes << ", \"triangles\": " << c.triangles
+      << ", \"lost\": " << c.lost << ", \"retries\": " << c.retries;
+}
+
+void QueryProfiler::write_json(std::ostream& str,
+                               const std::vector<int>& ids) const {
+  std::vector<Counts> counts;
+  get_counts(counts);
+  std::vector<int> order;
+  Counts total;
+  report_order(counts, order, total);
+
+  str << "{" << std::endl << "  \"total\": {";
+  write_json_counts(str, total);
+  str << "}," << std::endl << "  \"volumes\": [";
+  for (unsigned i = 0; i < order.size(); i++) {
+    const int v = order[i];
+    str << (i ? "," : "") << std::endl
+        << "    {\"id\": " << ((unsigned)v < ids.size() ? ids[v] : 0) << ", ";
+    write_json_counts(str, counts[v]);
+    str << "}";
+  }
+  str << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
+
+void QueryProfiler::write_csv(std::ostream& str,
+                              const std::vector<int>& ids) const {
+  std::vector<Counts> counts;
+  get_counts(counts);
+  std::vector<int> order;
+  Counts total;
+  report_order(counts, order, total);
+
+  str << "id,seconds";
+  for (int q = 0; q < NUM_QUERIES; q++) {
+    const char* name = query_name((Query)q);
+    str << "," << name << "_calls," << name << "_seconds";
+  }
+  str << ",nodes,triangles,lost,retries" << std::endl;
+  for (unsigned i = 0; i < order.size(); i++) {
+    const int v = order[i];
+    const Counts& c = counts[v];
+    str << ((unsigned)v < ids.size() ? ids[v] : 0) << "," << c.seconds();
+    for (int q = 0; q < NUM_QUERIES; q++)
+      str << "," << c.calls[q] << "," << to_seconds(c.nanoseconds[q]);
+    str << "," << c.nodes << "," << c.triangles << "," << c.lost << ","
+        << c.retries << std::endl;
+  }
+}
+
+bool QueryProfiler::read_csv(std::istream& str,
+                             std::vector<std::pair<int, double>>& seconds) {
+  seconds.clear();
+  std::string line;
+  if (!std::getline(str, line) || 0 != line.find("id,seconds,")) return false;
+  while (std::getline(str, line)) {
+    if (line.empty()) continue;
+    std::istringstream fields(line);
+    int id;
+    char comma;
+    double volume_seconds;
+    if (!(fields >> id >> comma >> volume_seconds) || ',' != comma)
+      return false;
+    seconds.push_back(std::make_pair(id, volume_seconds));
+  }
+  return true;
+}
+
+}  // namespace moab
@@ -0,0 +1,166 @@
+#ifndef DAGMC_QUERY_PROFILER_HPP
+#define DAGMC_QUERY_PROFILER_HPP
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace moab {
+
+/**\brief per-volume counts and times of the geometry queries
+ *
+ * Each thread counts into a shard of its own, so recording a query takes
+ * no lock and touches no cache line shared with other threads; the shards
+ * are only summed when the counts are read. A thread finds its shard
+ * through a thread-local pointer, and only takes a lock the first time it
+ * records into a profiler.
+ *
+ * The volumes are numbered from 1 like the DagMC indices; volume 0 collects
+ * the queries on volumes without an index, such as a failed find_volume().
+ * DagMC records its queries in one when profiling is on, see
+ * DagMC::set_profile_queries().
+ */
+class QueryProfiler {
+ public:
+  /** the queries whose calls and times are recorded */
+  enum Query {
+    RAY_FIRE,
+    POINT_IN_VOLUME,
+    CLOSEST_TO_LOCATION,
+    NEXT_VOL,
+    NUM_QUERIES
+  };
+
+  /** name of a query in the reports */
+  static const char* query_name(Query query);
+
+  /** the counts of one volume, summed over the threads */
+  struct Counts {
+    Counts();
+
+    /** seconds spent in all queries */
+    double seconds() const;
+
+    uint64_t calls[NUM_QUERIES];
+    uint64_t nanoseconds[NUM_QUERIES];
+    /** tree nodes and triangles tested by ray_fire */
+    uint64_t nodes;
+    uint64_t triangles;
+    /** rays without a distance limit that hit no surface */
+    uint64_t lost;
+    /** point containment tests repeated because two rays disagreed */
+    uint64_t retries;
+    /** points tested against the bounds of the volume by point_in_volume(),
+     *  and those rejected by its bounding box and by its OBB */
+    uint64_t bounds_tests;
+    uint64_t box_rejects;
+    uint64_t obb_rejects;
+  };
+
+  QueryProfiler();
+  ~QueryProfiler();
+
+  /**\brief clear the counts and size them for volumes 0 to num_volumes
+   *
+   * Must not be called while other threads record queries.
+   */
+  void setup(int num_volumes);
+
+  int num_volumes() const { return numVolumes; }
+
+  /* Volumes outside 0 to num_volumes() are counted as volume 0. */
+
+  void record(int volume, Query query, uint64_t nanoseconds);
+  void add_traversal(int volume, uint64_t nodes, uint64_t triangles);
+  void add_lost(int volume);
+  void add_retry(int volume);
+  void add_bounds_test(int volume, bool box_reject, bool obb_reject);
+
+  /** counts of volumes 0 to num_volumes(), summed over the threads */
+  void get_counts(std::vector<Counts>& result) const;
+
+  /** zero the counts; counts recorded at the same time may be lost */
+  void reset();
+
+  /**\brief write the counts of the volumes with any queries, the slowest
+   * first, and their totals
+   * \param ids id reported for each volume, 0 to num_volumes()
+   */
+  void write_json(std::ostream& str, const std::vector<int>& ids) const;
+  void write_csv(std::ostream& str, const std::vector<int>& ids) const;
+
+  /**\brief read the total seconds of the volumes from a report of
+   * write_csv()
+   * \param seconds the id and the seconds of each volume of the report, in
+   *        the order of the report
+   * \return false if the stream does not hold such a report
+   */
+  static bool read_csv(std::istream& str,
+                       std::vector<std::pair<int, double>>& seconds);
+
+  /** records the time from its construction to its destruction as a call
+   *  of a query; does nothing if the profiler is NULL */
+  class Timer {
+   public:
+    Timer(QueryProfiler* profiler, int volume, Query query)
+        : profiler(profiler), volume(volume), query(query) {
+      if (profiler) start = std::chrono::steady_clock::now();
+    }
+    ~Timer() {
+      if (!profiler) return;
+      const std::chrono::nanoseconds elapsed =
+          std::chrono::steady_clock::now() - start;
+      profiler->record(volume, query, elapsed.count());
+    }
+
+   private:
+    Timer(const Timer&);
+    Timer& operator=(const Timer&);
+
+    QueryProfiler* profiler;
+    int volume;
+    Query query;
+    std::chrono::steady_clock::time_point start;
+  };
+
+ private:
+  QueryProfiler(const QueryProfiler&);
+  QueryProfiler& operator=(const QueryProfiler&);
+
+  /** counters of a volume: the calls and the times of each query, then the
+   *  fields of Counts that follow them */
+  enum Field {
+    NODES = 2 * NUM_QUERIES,
+    TRIANGLES,
+    LOST,
+    RETRIES,
+    BOUNDS_TESTS,
+    BOX_REJECTS,
+    OBB_REJECTS,
+    NUM_FIELDS
+  };
+
+  /** the counters of one thread; only that thread writes them, the others
+   *  read them */
+  struct Shard;
+
+  Shard& local_shard();
+  void add(int volume, int field, uint64_t value);
+
+  int numVolumes;
+  /** distinguishes this profiler and its setup from any other in the
+   *  thread-local pointers */
+  uint64_t serial;
+  mutable std::mutex shardMutex;
+  std::vector<std::unique_ptr<Shard>> shards;
+};
+
+}  // namespace moab
+
+#endif
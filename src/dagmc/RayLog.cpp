@@ -0,0 +1,229 @@
+#include "RayLog.hpp"
+
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+namespace moab {
+
+const char RayLog::MAGIC[8] = {'D', 'A', 'G', 'R', 'A', 'Y', 'L', 'G'};
+const uint32_t RayLog::VERSION;
+const size_t RayLog::BUFFER_SIZE;
+
+struct RayLog::Buffer {
+  Buffer() : thread(std::this_thread::get_id()), records(0) {
+    data.reserve(BUFFER_SIZE + 1024);
+  }
+
+  std::thread::id thread;
+  std::vector<char> data;
+  uint64_t records;
+};
+
+namespace {
+
+// the buffer a thread last wrote into, and the log it belongs to
+struct LocalBuffer {
+  uint64_t serial;
+  void* buffer;
+};
+
+thread_local LocalBuffer local = {0, NULL};
+
+std::atomic<uint64_t> next_serial(1);
+
+// record layout: query, flags, status and a spare byte, then the volume
+// and the number of history facets, the point, the direction if there is
+// one, the distance limit and orientation of a ray, the facets, and the
+// results of the query
+enum { HAS_DIRECTION = 1 };
+
+template <class T>
+void put(std::vector<char>& data, const T& value) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+template <class T>
+bool get(std::istream& in, T& value) {
+  return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+}  // namespace
+
+RayLog::Record::Record()
+    : query(RAY_FIRE),
+      status(0),
+      volume(0),
+      has_direction(false),
+      dist_limit(0),
+      orientation(1),
+      surface(0),
+      distance(0),
+      inside(0) {
+  for (int k = 0; k < 3; k++) point[k] = direction[k] = 0;
+}
+
+RayLog::RayLog()
+    : isOpen(false), serial(0), numRecords(0), writeFailed(false) {}
+
+RayLog::~RayLog() { close(); }
+
+bool RayLog::open(const char* filename) {
+  close();
+  std::lock_guard<std::mutex> lock(bufferMutex);
+  out.open(filename, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+  const uint32_t header[2] = {VERSION, 0};
+  out.write(MAGIC, sizeof(MAGIC));
+  out.write(reinterpret_cast<const char*>(header), sizeof(header));
+  if (!out) {
+    out.close();
+    return false;
+  }
+  // the buffers of a previous log are dropped, and the threads holding them
+  // see the new serial
+  serial = next_serial.fetch_add(1);
+  buffers.clear();
+  numRecords = 0;
+  writeFailed = false;
+  isOpen = true;
+  return true;
+}
+
+bool RayLog::close() {
+  if (!isOpen) return true;
+  std::lock_guard<std::mutex> lock(bufferMutex);
+  for (unsigned i = 0; i < buffers.size(); i++) flush(*buffers[i]);
+  buffers.clear();
+  isOpen = false;
+  out.close();
+  return !writeFailed && !out.fail();
+}
+
+uint64_t RayLog::num_records() const {
+  std::lock_guard<std::mutex> lock(bufferMutex);
+  return numRecords;
+}
+
+RayLog::Buffer& RayLog::local_buffer() {
+  if (local.serial == serial) return *static_cast<Buffer*>(local.buffer);
+
+  // first record of this thread since the log was opened, or since it
+  // recorded into another log
+  std::lock_guard<std::mutex> lock(bufferMutex);
+  const std::thread::id thread = std::this_thread::get_id();
+  Buffer* buffer = NULL;
+  for (unsigned i = 0; i < buffers.size() && !buffer; i++)
+    if (buffers[i]->thread == thread) buffer = buffers[i].get();
+  if (!buffer) {
+    buffers.emplace_back(new Buffer());
+    buffer = buffers.back().get();
+  }
+  local.serial = serial;
+  local.buffer = buffer;
+  return *buffer;
+}
+
+void RayLog::flush(Buffer& buffer) {
+  if (buffer.data.empty()) return;
+  out.write(&buffer.data[0], buffer.data.size());
+  if (!out) writeFailed = true;
+  numRecords += buffer.records;
+  buffer.data.clear();
+  buffer.records = 0;
+}
+
+void RayLog::write(const Record& record) {
+  if (!isOpen) return;
+  Buffer& buffer = local_buffer();
+  std::vector<char>& data = buffer.data;
+  const bool has_direction = RAY_FIRE == record.query || record.has_direction;
+  put(data, (uint8_t)record.query);
+  put(data, (uint8_t)(has_direction ? HAS_DIRECTION : 0));
+  put(data, (uint8_t)record.status);
+  put(data, (uint8_t)0);
+  put(data, (int32_t)record.volume);
+  put(data, (uint32_t)record.history.size());
+  for (int k = 0; k < 3; k++) put(data, record.point[k]);
+  if (has_direction)
+    for (int k = 0; k < 3; k++) put(data, record.direction[k]);
+  if (RAY_FIRE == record.query) {
+    put(data, record.dist_limit);
+    put(data, (int32_t)record.orientation);
+  }
+  for (unsigned i = 0; i < record.history.size(); i++)
+    put(data, record.history[i]);
+  if (POINT_IN_VOLUME == record.query) {
+    put(data, (int32_t)record.inside);
+  } else {
+    put(data, (int32_t)record.surface);
+    put(data, record.distance);
+  }
+  buffer.records++;
+
+  if (data.size() >= BUFFER_SIZE) {
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    flush(buffer);
+  }
+}
+
+bool RayLog::Reader::open(const char* filename) {
+  isTruncated = false;
+  in.close();
+  in.clear();
+  in.open(filename, std::ios::binary);
+  char magic[8];
+  uint32_t header[2];
+  if (!in.read(magic, sizeof(magic)) || 0 != memcmp(magic, MAGIC, 8))
+    return false;
+  return get(in, header) && VERSION == header[0];
+}
+
+bool RayLog::Reader::read(Record& record) {
+  uint8_t query;
+  if (!get(in, query)) return false;
+
+  // any field missing from here on is a truncated record
+  isTruncated = true;
+  uint8_t flags, status, spare;
+  int32_t volume;
+  uint32_t num_facets;
+  if (!get(in, flags) || !get(in, status) || !get(in, spare) ||
+      !get(in, volume) || !get(in, num_facets) || !get(in, record.point))
+    return false;
+  if (query < RAY_FIRE || query > CLOSEST_TO_LOCATION) return false;
+  record.query = (Query)query;
+  record.status = status;
+  record.volume = volume;
+  record.has_direction = flags & HAS_DIRECTION;
+  if (record.has_direction && !get(in, record.direction)) return false;
+  record.dist_limit = 0;
+  record.orientation = 1;
+  if (RAY_FIRE == record.query) {
+    int32_t orientation;
+    if (!get(in, record.dist_limit) || !get(in, orientation)) return false;
+    record.orientation = orientation;
+  }
+  record.history.resize(num_facets);
+  if (num_facets &&
+      !in.read(reinterpret_cast<char*>(&record.history[0]),
+               num_facets * sizeof(uint64_t)))
+    return false;
+  record.surface = record.inside = 0;
+  record.distance = 0;
+  if (POINT_IN_VOLUME == record.query) {
+    int32_t inside;
+    if (!get(in, inside)) return false;
+    record.inside = inside;
+  } else {
+    int32_t surface;
+    if (!get(in, surface) || !get(in, record.distance)) return false;
+    record.surface = surface;
+  }
+  isTruncated = false;
+  return true;
+}
+
+}  // namespace moab
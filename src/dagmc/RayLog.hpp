@@ -0,0 +1,137 @@
+#ifndef DAGMC_RAY_LOG_HPP
+#define DAGMC_RAY_LOG_HPP
+
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace moab {
+
+/**\brief binary log of geometry queries and their results
+ *
+ * While a log is open, DagMC writes a record for every ray_fire,
+ * point_in_volume and closest_to_location call (see DagMC::open_ray_log()),
+ * and dagmc_replay reads the records back to repeat the calls on another
+ * acceleration structure or number of threads and compare the results.
+ * A record holds all inputs of its call, including the facets of the ray
+ * history, so the records can be replayed in any order.
+ *
+ * The file is a 16 byte header followed by the records, in the byte order
+ * of the machine that wrote it. Volumes and surfaces are stored by index
+ * and facets by handle, which only identify them in the geometry file the
+ * log was recorded with. A ray_fire record takes 84 bytes and 8 more per
+ * facet of its history.
+ *
+ * Each thread writes its records into a buffer of its own, so recording
+ * takes no lock until the buffer is full and appended to the file; the
+ * records of different threads are interleaved in blocks.
+ */
+class RayLog {
+ public:
+  static const char MAGIC[8];
+  static const uint32_t VERSION = 1;
+  /** bytes a thread buffers before appending them to the file */
+  static const size_t BUFFER_SIZE = 1 << 16;
+
+  enum Query { RAY_FIRE = 1, POINT_IN_VOLUME, CLOSEST_TO_LOCATION };
+
+  /** one call and its results */
+  struct Record {
+    Record();
+
+    Query query;
+    /** error code returned by the call */
+    int status;
+    int volume;
+    double point[3];
+    /** the ray direction; point_in_volume is not always given one */
+    bool has_direction;
+    double direction[3];
+    /** distance limit and orientation of ray_fire */
+    double dist_limit;
+    int orientation;
+    /** facets of the ray history given to the call, the oldest first */
+    std::vector<uint64_t> history;
+    /** surface hit by ray_fire, or nearest to closest_to_location if the
+     *  caller asked for it; 0 if none */
+    int surface;
+    /** distance to that surface */
+    double distance;
+    /** result of point_in_volume */
+    int inside;
+  };
+
+  RayLog();
+  /** closes the log */
+  ~RayLog();
+
+  /**\brief create a log, replacing any file of that name
+   *
+   * Closes any log that is already open. Returns false if the file cannot
+   * be written.
+   */
+  bool open(const char* filename);
+
+  bool is_open() const { return isOpen; }
+
+  /**\brief append the buffers of all threads to the file and close it
+   *
+   * Must not be called while other threads record. Returns false if a
+   * write failed.
+   */
+  bool close();
+
+  /** records appended to the file since it was opened; the records still
+   *  in the buffers of the threads are counted once appended */
+  uint64_t num_records() const;
+
+  /** record a call; does nothing if the log is not open */
+  void write(const Record& record);
+
+  /** the records of a log, in the order they were written */
+  class Reader {
+   public:
+    Reader() : isTruncated(false) {}
+
+    /** returns false if the file cannot be read or is not a log */
+    bool open(const char* filename);
+
+    /** the next record; false at the end of the log, and also sets
+     *  truncated() if the log ends within a record */
+    bool read(Record& record);
+
+    bool truncated() const { return isTruncated; }
+
+   private:
+    std::ifstream in;
+    bool isTruncated;
+  };
+
+ private:
+  RayLog(const RayLog&);
+  RayLog& operator=(const RayLog&);
+
+  /** the records buffered by one thread */
+  struct Buffer;
+
+  Buffer& local_buffer();
+  /** append a buffer to the file, with the mutex held */
+  void flush(Buffer& buffer);
+
+  bool isOpen;
+  /** distinguishes this log and its opening from any other in the
+   *  thread-local pointers */
+  uint64_t serial;
+  uint64_t numRecords;
+  std::ofstream out;
+  bool writeFailed;
+  mutable std::mutex bufferMutex;
+  std::vector<std::unique_ptr<Buffer>> buffers;
+};
+
+}  // namespace moab
+
+#endif
@@ -0,0 +1,54 @@
+#include "RayOrder.hpp"
+
+#include <algorithm>
+
+namespace moab {
+
+const int RayOrder::MORTON_BITS;
+const int RayOrder::MIN_RAYS;
+
+// spread the low 10 bits of v two bits apart
+static uint32_t spread_bits(uint32_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+uint32_t RayOrder::morton_code(uint32_t x, uint32_t y, uint32_t z) {
+  return spread_bits(x) | (spread_bits(y) << 1) | (spread_bits(z) << 2);
+}
+
+uint32_t RayOrder::octant(const double dir[3]) {
+  return (dir[0] < 0) | ((dir[1] < 0) << 1) | ((dir[2] < 0) << 2);
+}
+
+void RayOrder::compute_keys(int num_rays, const double* const starts[3],
+                            const double* const dirs[3],
+                            std::vector<uint64_t>& keys) {
+  keys.resize(num_rays);
+  if (num_rays <= 0) return;
+
+  double lower[3], scale[3];
+  for (int k = 0; k < 3; k++) {
+    const double* s = starts[k];
+    lower[k] = *std::min_element(s, s + num_rays);
+    const double extent = *std::max_element(s, s + num_rays) - lower[k];
+    const double cells = (double)(1u << MORTON_BITS);
+    // origins at the upper bound fall in the last cell
+    scale[k] = extent > 0 ? (cells - 1) / extent : 0;
+  }
+
+  for (int i = 0; i < num_rays; i++) {
+    uint32_t cell[3];
+    for (int k = 0; k < 3; k++)
+      cell[k] = (uint32_t)((starts[k][i] - lower[k]) * scale[k]);
+    const double dir[3] = {dirs[0][i], dirs[1][i], dirs[2][i]};
+    keys[i] = ((uint64_t)octant(dir) << (3 * MORTON_BITS)) |
+              morton_code(cell[0], cell[1], cell[2]);
+  }
+}
+
+}  // namespace moab
@@ -0,0 +1,51 @@
+#ifndef DAGMC_RAY_ORDER_HPP
+#define DAGMC_RAY_ORDER_HPP
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace moab {
+
+/**\brief coherent tracing order of a batch of rays
+ *
+ * Rays that start close together and point the same way walk the same nodes
+ * of a tree, so tracing them one after the other keeps those nodes in cache.
+ * RayOrder gives each ray of a batch a key: the octant of its direction
+ * above the Morton code of its origin, MORTON_BITS bits per axis, within the
+ * bounding box of the origins of the batch. Sorting the rays by key groups
+ * them by direction octant and, within an octant, along a Z-order curve
+ * through their origins.
+ *
+ * DagMC::ray_fire_batch() sorts the rays of each volume by these keys
+ * before tracing them.
+ */
+class RayOrder {
+ public:
+  /** bits of the Morton code per axis */
+  static const int MORTON_BITS = 10;
+
+  /** batches smaller than this are not worth sorting */
+  static const int MIN_RAYS = 16;
+
+  /** interleave the low MORTON_BITS bits of x, y and z, x lowest */
+  static uint32_t morton_code(uint32_t x, uint32_t y, uint32_t z);
+
+  /** octant of a direction, one bit per negative component */
+  static uint32_t octant(const double dir[3]);
+
+  /**\brief the keys of a batch of rays
+   *
+   * \param num_rays number of rays
+   * \param starts x, y and z arrays of the ray origins
+   * \param dirs u, v and w arrays of the ray directions
+   * \param keys set to the key of each ray
+   */
+  static void compute_keys(int num_rays, const double* const starts[3],
+                           const double* const dirs[3],
+                           std::vector<uint64_t>& keys);
+};
+
+}  // namespace moab
+
+#endif
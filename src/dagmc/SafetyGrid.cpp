@@ -0,0 +1,114 @@
+#include "SafetyGrid.hpp"
+
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+
+namespace moab {
+
+SafetyGrid::SafetyGrid() : cellRadius(0.) {
+  for (int i = 0; i < 3; i++) {
+    lower[i] = upper[i] = 0.;
+    cellSize[i] = 0.;
+    divisions[i] = 0;
+  }
+}
+
+void SafetyGrid::clear() {
+  distances.clear();
+  for (int i = 0; i < 3; i++) divisions[i] = 0;
+  cellRadius = 0.;
+}
+
+void SafetyGrid::setup(const double box[6], int max_cells) {
+  clear();
+  if (max_cells < 1) max_cells = 1;
+
+  // cubic cells over the axes along which the box is not flat
+  double extent[3], max_extent = 0.;
+  for (int i = 0; i < 3; i++) {
+    lower[i] = box[i];
+    upper[i] = std::max(box[i], box[3 + i]);
+    extent[i] = upper[i] - lower[i];
+    max_extent = std::max(max_extent, extent[i]);
+  }
+  double cell_volume = 1.;
+  int num_axes = 0;
+  for (int i = 0; i < 3; i++) {
+    if (extent[i] > 1e-6 * max_extent) {
+      cell_volume *= extent[i];
+      num_axes++;
+    }
+  }
+  const double size =
+      num_axes ? pow(cell_volume / max_cells, 1. / num_axes) : 0.;
+
+  // rounding the divisions down keeps their product within max_cells
+  double radius2 = 0.;
+  for (int i = 0; i < 3; i++) {
+    divisions[i] = 1;
+    if (extent[i] > 1e-6 * max_extent && size > 0.)
+      divisions[i] = std::max((int)(extent[i] / size), 1);
+    cellSize[i] = extent[i] / divisions[i];
+    radius2 += 0.25 * cellSize[i] * cellSize[i];
+  }
+  cellRadius = sqrt(radius2);
+  distances.assign(divisions[0] * divisions[1] * divisions[2], 0.f);
+}
+
+void SafetyGrid::cell_center(int cell, double xyz[3]) const {
+  const int index[3] = {cell % divisions[0],
+                        (cell / divisions[0]) % divisions[1],
+                        cell / (divisions[0] * divisions[1])};
+  for (int i = 0; i < 3; i++)
+    xyz[i] = lower[i] + (index[i] + 0.5) * cellSize[i];
+}
+
+void SafetyGrid::set_distance(int cell, double distance) {
+  float value = 0.f;
+  if (distance >= FLT_MAX) {
+    value = FLT_MAX;
+  } else if (distance > 0.) {
+    value = (float)distance;
+    if (value > distance) value = nextafterf(value, 0.f);
+  }
+  distances[cell] = value;
+}
+
+double SafetyGrid::lower_bound(const double xyz[3]) const {
+  if (distances.empty()) return 0.;
+
+  // the nearest cell, and the distances from the point to the box and to
+  // the center of that cell; points that are not a number get no bound
+  int index[3];
+  double box_dist2 = 0., center_dist2 = 0.;
+  for (int i = 0; i < 3; i++) {
+    index[i] = 0;
+    if (cellSize[i] > 0.) {
+      const double offset = (xyz[i] - lower[i]) / cellSize[i];
+      if (offset >= divisions[i])
+        index[i] = divisions[i] - 1;
+      else if (offset > 0.)
+        index[i] = (int)offset;
+    }
+    if (xyz[i] < lower[i])
+      box_dist2 += (lower[i] - xyz[i]) * (lower[i] - xyz[i]);
+    else if (xyz[i] > upper[i])
+      box_dist2 += (xyz[i] - upper[i]) * (xyz[i] - upper[i]);
+    const double center = lower[i] + (index[i] + 0.5) * cellSize[i];
+    center_dist2 += (xyz[i] - center) * (xyz[i] - center);
+  }
+  if (!(center_dist2 >= 0.)) return 0.;
+
+  const int cell =
+      (index[2] * divisions[1] + index[1]) * divisions[0] + index[0];
+  const double cell_bound = distances[cell] - sqrt(center_dist2);
+  return std::max(sqrt(box_dist2), std::max(cell_bound, 0.));
+}
+
+size_t SafetyGrid::memory_use() const {
+  return sizeof(*this) + distances.capacity() * sizeof(float);
+}
+
+}  // namespace moab
@@ -0,0 +1,70 @@
+#ifndef DAGMC_SAFETY_GRID_HPP
+#define DAGMC_SAFETY_GRID_HPP
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace moab {
+
+/**\brief conservative distance field over the bounding box of a volume
+ *
+ * SafetyGrid divides the bounding box of the facets of a volume into cubic
+ * cells and stores, for the center of each cell, the distance to the
+ * nearest facet. The distance to the nearest facet changes no faster than
+ * the point moves, so the distance stored for the cell of a point, less the
+ * distance from the point to the center of the cell, is a lower bound on
+ * the distance from the point to the nearest facet. Points outside the box
+ * are also bounded by their distance to the box. The bound takes a few
+ * arithmetic operations, and is only loose near the surfaces, within about
+ * one cell_radius() of them.
+ *
+ * The distances are set by the caller; DagMC::init_OBBTree() fills a grid
+ * per volume from closest_to_location() at the cell centers.
+ */
+class SafetyGrid {
+ public:
+  SafetyGrid();
+
+  /**\brief divide a box into at most max_cells cubic cells
+   *
+   * The distances of the cells are zero until they are set.
+   * \param box lower and upper corners of the box
+   * \param max_cells maximum number of cells
+   */
+  void setup(const double box[6], int max_cells);
+
+  void clear();
+
+  bool empty() const { return distances.empty(); }
+  int num_cells() const { return distances.size(); }
+
+  /** center of a cell, whose distance set_distance() should be given */
+  void cell_center(int cell, double xyz[3]) const;
+
+  /** set the distance from the center of a cell to the nearest facet;
+   *  it is stored in single precision, rounded down */
+  void set_distance(int cell, double distance);
+
+  /** half the diagonal of a cell */
+  double cell_radius() const { return cellRadius; }
+
+  /** lower bound on the distance from a point to the nearest facet */
+  double lower_bound(const double xyz[3]) const;
+
+  /** bytes used by the grid */
+  size_t memory_use() const;
+
+ private:
+  double lower[3];
+  double upper[3];
+  double cellSize[3];
+  int divisions[3];
+  double cellRadius;
+  /** distance from the center of each cell to the nearest facet, x fastest */
+  std::vector<float> distances;
+};
+
+}  // namespace moab
+
+#endif
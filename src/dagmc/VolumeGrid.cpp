@@ -0,0 +1,175 @@
+#include "VolumeGrid.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace moab {
+
+const int VolumeGrid::MAX_DIVISIONS;
+const int VolumeGrid::CELLS_PER_BOX;
+
+VolumeGrid::VolumeGrid() {
+  for (int i = 0; i < 3; i++) {
+    lower[i] = 0.;
+    cellSize[i] = 1.;
+    divisions[i] = 0;
+  }
+}
+
+void VolumeGrid::clear() {
+  boxes.clear();
+  cellStart.clear();
+  cellBoxes.clear();
+  for (int i = 0; i < 3; i++) divisions[i] = 0;
+}
+
+void VolumeGrid::build(const double* box_coords, uint32_t num_boxes) {
+  clear();
+  if (!num_boxes) return;
+  boxes.assign(box_coords, box_coords + 6 * num_boxes);
+
+  double upper[3];
+  for (int i = 0; i < 3; i++) {
+    lower[i] = boxes[i];
+    upper[i] = boxes[3 + i];
+  }
+  for (uint32_t b = 1; b < num_boxes; b++) {
+    for (int i = 0; i < 3; i++) {
+      lower[i] = std::min(lower[i], boxes[6 * b + i]);
+      upper[i] = std::max(upper[i], boxes[6 * b + 3 + i]);
+    }
+  }
+
+  // cubic cells sized for about CELLS_PER_BOX cells per box; flat or
+  // degenerate extents get a single cell along that axis
+  double extent[3], max_extent = 0.;
+  for (int i = 0; i < 3; i++) {
+    extent[i] = upper[i] - lower[i];
+    max_extent = std::max(max_extent, extent[i]);
+  }
+  const double target_cells = (double)CELLS_PER_BOX * num_boxes;
+  double cell_volume = 1.;
+  int num_axes = 0;
+  for (int i = 0; i < 3; i++) {
+    if (extent[i] > 1e-6 * max_extent) {
+      cell_volume *= extent[i];
+      num_axes++;
+    }
+  }
+  const double size =
+      num_axes ? pow(cell_volume / target_cells, 1. / num_axes) : 1.;
+  for (int i = 0; i < 3; i++) {
+    divisions[i] = 1;
+    if (extent[i] > 1e-6 * max_extent && size > 0.) {
+      divisions[i] =
+          (int)std::min<double>(ceil(extent[i] / size), MAX_DIVISIONS);
+      divisions[i] = std::max(divisions[i], 1);
+    }
+    cellSize[i] = extent[i] > 0. ? extent[i] / divisions[i] : 1.;
+  }
+
+  // count the boxes of each cell, then fill the lists in box order so that
+  // every list is sorted
+  const uint32_t num_cells = divisions[0] * divisions[1] * divisions[2];
+  cellStart.assign(num_cells + 1, 0);
+  for (int pass = 0; pass < 2; pass++) {
+    for (uint32_t b = 0; b < num_boxes; b++) {
+      int first[3], last[3];
+      for (int i = 0; i < 3; i++)
+        cell_range(i, boxes[6 * b + i], boxes[6 * b + 3 + i], first[i],
+                   last[i]);
+      for (int z = first[2]; z <= last[2]; z++) {
+        for (int y = first[1]; y <= last[1]; y++) {
+          for (int x = first[0]; x <= last[0]; x++) {
+            const uint32_t cell = (z * divisions[1] + y) * divisions[0] + x;
+            if (pass == 0)
+              cellStart[cell + 1]++;
+            else
+              cellBoxes[cellStart[cell]++] = b;
+          }
+        }
+      }
+    }
+    if (pass == 0) {
+      for (uint32_t c = 0; c < num_cells; c++)
+        cellStart[c + 1] += cellStart[c];
+      cellBoxes.resize(cellStart[num_cells]);
+    } else {
+      // the fill advanced each start to the start of the next cell
+      for (uint32_t c = num_cells; c > 0; c--) cellStart[c] = cellStart[c - 1];
+      cellStart[0] = 0;
+    }
+  }
+}
+
+void VolumeGrid::cell_range(int axis, double lo, double hi, int& first,
+                            int& last) const {
+  first = (int)floor((lo - lower[axis]) / cellSize[axis]);
+  last = (int)floor((hi - lower[axis]) / cellSize[axis]);
+  first = std::min(std::max(first, 0), divisions[axis] - 1);
+  last = std::min(std::max(last, 0), divisions[axis] - 1);
+}
+
+const uint32_t* VolumeGrid::candidates(const double xyz[3],
+                                       uint32_t& count) const {
+  count = 0;
+  if (cellStart.empty()) return NULL;
+
+  int cell[3];
+  for (int i = 0; i < 3; i++) {
+    const double offset = (xyz[i] - lower[i]) / cellSize[i];
+    // outside the grid, or not a number
+    if (!(offset >= 0. && offset <= divisions[i])) return NULL;
+    cell[i] = std::min((int)offset, divisions[i] - 1);
+  }
+  const uint32_t c =
+      (cell[2] * divisions[1] + cell[1]) * divisions[0] + cell[0];
+  count = cellStart[c + 1] - cellStart[c];
+  return cellBoxes.data() + cellStart[c];
+}
+
+const uint32_t* VolumeGrid::candidates(const double xyz[3], double tol,
+                                       uint32_t& count,
+                                       std::vector<uint32_t>& merged) const {
+  count = 0;
+  if (cellStart.empty()) return NULL;
+
+  int first[3], last[3];
+  for (int i = 0; i < 3; i++) {
+    const double lo = (xyz[i] - tol - lower[i]) / cellSize[i];
+    const double hi = (xyz[i] + tol - lower[i]) / cellSize[i];
+    // outside the grid, or not a number
+    if (!(hi >= 0. && lo <= divisions[i])) return NULL;
+    cell_range(i, xyz[i] - tol, xyz[i] + tol, first[i], last[i]);
+  }
+  if (first[0] == last[0] && first[1] == last[1] && first[2] == last[2]) {
+    const uint32_t c =
+        (first[2] * divisions[1] + first[1]) * divisions[0] + first[0];
+    count = cellStart[c + 1] - cellStart[c];
+    return cellBoxes.data() + cellStart[c];
+  }
+
+  // near the side of a cell: merge the lists, keeping them sorted
+  merged.clear();
+  for (int z = first[2]; z <= last[2]; z++) {
+    for (int y = first[1]; y <= last[1]; y++) {
+      for (int x = first[0]; x <= last[0]; x++) {
+        const uint32_t c = (z * divisions[1] + y) * divisions[0] + x;
+        merged.insert(merged.end(), cellBoxes.begin() + cellStart[c],
+                      cellBoxes.begin() + cellStart[c + 1]);
+      }
+    }
+  }
+  std::sort(merged.begin(), merged.end());
+  merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+  count = merged.size();
+  return merged.data();
+}
+
+size_t VolumeGrid::memory_use() const {
+  return sizeof(*this) + boxes.capacity() * sizeof(double) +
+         (cellStart.capacity() + cellBoxes.capacity()) * sizeof(uint32_t);
+}
+
+}  // namespace moab
@@ -0,0 +1,93 @@
+#ifndef DAGMC_VOLUME_GRID_HPP
+#define DAGMC_VOLUME_GRID_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace moab {
+
+/**\brief uniform grid of candidate lists over a set of boxes
+ *
+ * VolumeGrid locates the axis-aligned boxes that contain a point without
+ * testing every box. The bounding box of all boxes is divided into a coarse
+ * grid of cells, and each cell lists the boxes overlapping it in increasing
+ * order. A point is located by computing its cell and testing only the boxes
+ * in the list of that cell. The number of cells grows with the number of
+ * boxes, so that each list holds a few boxes for typical geometries.
+ *
+ * DagMC::find_volume() looks up the point in a grid over the bounding boxes
+ * of the volumes, and only tests the volumes listed in its cell.
+ */
+class VolumeGrid {
+ public:
+  /** maximum number of cells along each axis */
+  static const int MAX_DIVISIONS = 128;
+
+  /** target number of cells per box */
+  static const int CELLS_PER_BOX = 8;
+
+  VolumeGrid();
+
+  /**\brief build the grid
+   *
+   * \param boxes lower and upper corners of each box, 6 values per box
+   * \param num_boxes number of boxes
+   */
+  void build(const double* boxes, uint32_t num_boxes);
+
+  void clear();
+
+  bool empty() const { return cellStart.empty(); }
+  uint32_t num_boxes() const { return boxes.size() / 6; }
+  uint32_t num_cells() const {
+    return cellStart.empty() ? 0 : cellStart.size() - 1;
+  }
+
+  /**\brief the boxes that may contain a point
+   *
+   * Returns a pointer to the indices of the boxes overlapping the cell of the
+   * point, in increasing order, and sets count to their number. Points
+   * outside the grid have no candidates.
+   */
+  const uint32_t* candidates(const double xyz[3], uint32_t& count) const;
+
+  /**\brief the boxes that may contain a point, with the boxes grown by tol
+   *
+   * As above, but the boxes overlapping any cell within tol of the point
+   * are returned. When those cells are more than one, their lists are
+   * merged into the merged buffer, which the result then points into. The
+   * tolerance is applied at lookup, so the grid is not rebuilt when it
+   * changes.
+   */
+  const uint32_t* candidates(const double xyz[3], double tol, uint32_t& count,
+                             std::vector<uint32_t>& merged) const;
+
+  /** whether a box, grown by tol, contains a point, boundary included */
+  bool contains(uint32_t box, const double xyz[3], double tol = 0.) const {
+    const double* b = &boxes[6 * box];
+    return xyz[0] >= b[0] - tol && xyz[1] >= b[1] - tol &&
+           xyz[2] >= b[2] - tol && xyz[0] <= b[3] + tol &&
+           xyz[1] <= b[4] + tol && xyz[2] <= b[5] + tol;
+  }
+
+  /** bytes used by the grid */
+  size_t memory_use() const;
+
+ private:
+  /** cell range along an axis overlapped by the interval [lo, hi] */
+  void cell_range(int axis, double lo, double hi, int& first, int& last) const;
+
+  std::vector<double> boxes;
+  double lower[3];
+  double cellSize[3];
+  int divisions[3];
+  /** start of the candidate list of each cell in cellBoxes, plus the end */
+  std::vector<uint32_t> cellStart;
+  std::vector<uint32_t> cellBoxes;
+};
+
+}  // namespace moab
+
+#endif
@@ -0,0 +1,232 @@
+#include "VolumeInstance.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+namespace moab {
+
+InstanceTransform::InstanceTransform() {
+  for (int i = 0; i < 9; i++) rotation[i] = (i % 4 == 0) ? 1.0 : 0.0;
+  for (int i = 0; i < 3; i++) translation[i] = 0.0;
+}
+
+void InstanceTransform::to_instance(const double p[3],
+                                    double result[3]) const {
+  for (int i = 0; i < 3; i++)
+    result[i] = rotation[3 * i] * p[0] + rotation[3 * i + 1] * p[1] +
+                rotation[3 * i + 2] * p[2] + translation[i];
+}
+
+void InstanceTransform::to_prototype(const double p[3],
+                                     double result[3]) const {
+  const double d[3] = {p[0] - translation[0], p[1] - translation[1],
+                       p[2] - translation[2]};
+  rotate_to_prototype(d, result);
+}
+
+void InstanceTransform::rotate_to_prototype(const double v[3],
+                                            double result[3]) const {
+  // the inverse of a rotation is its transpose
+  for (int i = 0; i < 3; i++)
+    result[i] = rotation[i] * v[0] + rotation[3 + i] * v[1] +
+                rotation[6 + i] * v[2];
+}
+
+// area weighted centroid of the triangles, and the principal axes of their
+// centroids as the columns of axes, by decreasing moment
+static void principal_frame(const double* coords, uint32_t num_triangles,
+                            double centroid[3], double axes[9]) {
+  double total = 0.0;
+  std::vector<double> areas(num_triangles);
+  for (int k = 0; k < 3; k++) centroid[k] = 0.0;
+  for (uint32_t t = 0; t < num_triangles; t++) {
+    const double* v = coords + 9 * t;
+    const double a[3] = {v[3] - v[0], v[4] - v[1], v[5] - v[2]};
+    const double b[3] = {v[6] - v[0], v[7] - v[1], v[8] - v[2]};
+    const double n[3] = {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+                         a[0] * b[1] - a[1] * b[0]};
+    areas[t] = 0.5 * sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    total += areas[t];
+    for (int k = 0; k < 3; k++)
+      centroid[k] += areas[t] * (v[k] + v[3 + k] + v[6 + k]) / 3.0;
+  }
+  if (total > 0)
+    for (int k = 0; k < 3; k++) centroid[k] /= total;
+
+  double m[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  for (uint32_t t = 0; t < num_triangles; t++) {
+    const double* v = coords + 9 * t;
+    double g[3];
+    for (int k = 0; k < 3; k++)
+      g[k] = (v[k] + v[3 + k] + v[6 + k]) / 3.0 - centroid[k];
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++) m[i][j] += areas[t] * g[i] * g[j];
+  }
+
+  // cyclic Jacobi rotations diagonalize the symmetric moment matrix
+  double e[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  for (int sweep = 0; sweep < 50; sweep++) {
+    const double off = fabs(m[0][1]) + fabs(m[0][2]) + fabs(m[1][2]);
+    if (off <= 1e-15 * (fabs(m[0][0]) + fabs(m[1][1]) + fabs(m[2][2])))
+      break;
+    for (int p = 0; p < 2; p++) {
+      for (int q = p + 1; q < 3; q++) {
+        if (m[p][q] == 0.0) continue;
+        const double theta = (m[q][q] - m[p][p]) / (2.0 * m[p][q]);
+        const double t = (theta >= 0 ? 1.0 : -1.0) /
+                         (fabs(theta) + sqrt(theta * theta + 1.0));
+        const double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+        for (int k = 0; k < 3; k++) {
+          const double mkp = m[k][p], mkq = m[k][q];
+          m[k][p] = c * mkp - s * mkq;
+          m[k][q] = s * mkp + c * mkq;
+        }
+        for (int k = 0; k < 3; k++) {
+          const double mpk = m[p][k], mqk = m[q][k];
+          m[p][k] = c * mpk - s * mqk;
+          m[q][k] = s * mpk + c * mqk;
+        }
+        for (int k = 0; k < 3; k++) {
+          const double ekp = e[k][p], ekq = e[k][q];
+          e[k][p] = c * ekp - s * ekq;
+          e[k][q] = s * ekp + c * ekq;
+        }
+      }
+    }
+  }
+
+  int order[3] = {0, 1, 2};
+  std::sort(order, order + 3,
+            [&m](int a, int b) { return m[a][a] > m[b][b]; });
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) axes[3 * i + j] = e[i][order[j]];
+}
+
+FacetMatcher::FacetMatcher(const double* triangle_coords,
+                           uint32_t num_triangles, double tol)
+    : tolerance(tol > 0 ? tol : 1e-12),
+      coords(triangle_coords, triangle_coords + 9 * num_triangles) {
+  const int none[3] = {0, 0, 0};
+  for (uint32_t t = 0; t < num_triangles; t++) {
+    const double* v = &coords[9 * t];
+    const double g[3] = {(v[0] + v[3] + v[6]) / 3.0,
+                         (v[1] + v[4] + v[7]) / 3.0,
+                         (v[2] + v[5] + v[8]) / 3.0};
+    cells[cell_key(g, none)].push_back(t);
+  }
+  principal_frame(coords.data(), num_triangles, centroid, axes);
+}
+
+uint64_t FacetMatcher::cell_key(const double p[3],
+                                const int offset[3]) const {
+  // 21 bits per axis; cells that wrap around share a key, which only costs
+  // a few extra comparisons
+  uint64_t key = 0;
+  for (int k = 0; k < 3; k++) {
+    const int64_t cell = (int64_t)floor(p[k] / tolerance) + offset[k];
+    key = (key << 21) | ((uint64_t)cell & 0x1fffff);
+  }
+  return key;
+}
+
+bool FacetMatcher::same_triangle(uint32_t a, const double b[9]) const {
+  const double* v = &coords[9 * a];
+  const double tol2 = tolerance * tolerance;
+  for (int shift = 0; shift < 3; shift++) {
+    bool same = true;
+    for (int i = 0; i < 3 && same; i++) {
+      const double* p = v + 3 * ((i + shift) % 3);
+      const double* q = b + 3 * i;
+      const double d2 = (p[0] - q[0]) * (p[0] - q[0]) +
+                        (p[1] - q[1]) * (p[1] - q[1]) +
+                        (p[2] - q[2]) * (p[2] - q[2]);
+      same = d2 <= tol2;
+    }
+    if (same) return true;
+  }
+  return false;
+}
+
+bool FacetMatcher::match(const double* copy_coords, uint32_t num_copy,
+                         const InstanceTransform& transform,
+                         std::vector<uint32_t>& result) const {
+  if (num_copy != num_triangles()) return false;
+  result.assign(num_copy, 0);
+  std::vector<bool> used(num_copy, false);
+  for (uint32_t t = 0; t < num_copy; t++) {
+    double mapped[9];
+    for (int i = 0; i < 3; i++)
+      transform.to_prototype(copy_coords + 9 * t + 3 * i, mapped + 3 * i);
+    const double g[3] = {(mapped[0] + mapped[3] + mapped[6]) / 3.0,
+                         (mapped[1] + mapped[4] + mapped[7]) / 3.0,
+                         (mapped[2] + mapped[5] + mapped[8]) / 3.0};
+
+    // the centroid moves by less than the tolerance, so the prototype
+    // triangle is in a neighbouring cell
+    bool found = false;
+    int offset[3];
+    for (offset[0] = -1; offset[0] <= 1 && !found; offset[0]++) {
+      for (offset[1] = -1; offset[1] <= 1 && !found; offset[1]++) {
+        for (offset[2] = -1; offset[2] <= 1 && !found; offset[2]++) {
+          auto it = cells.find(cell_key(g, offset));
+          if (it == cells.end()) continue;
+          for (unsigned j = 0; j < it->second.size() && !found; j++) {
+            const uint32_t a = it->second[j];
+            if (used[a] || !same_triangle(a, mapped)) continue;
+            used[a] = true;
+            result[t] = a;
+            found = true;
+          }
+        }
+      }
+    }
+    if (!found) return false;
+  }
+  return true;
+}
+
+bool FacetMatcher::find_transform(const double* copy_coords,
+                                  uint32_t num_copy,
+                                  InstanceTransform& result) const {
+  if (num_copy != num_triangles()) return false;
+  double copy_centroid[3], copy_axes[9];
+  principal_frame(copy_coords, num_copy, copy_centroid, copy_axes);
+
+  std::vector<uint32_t> matches;
+  for (int candidate = -1; candidate < 8; candidate++) {
+    InstanceTransform transform;
+    if (candidate >= 0) {
+      // rotation = copy_axes * diag(signs) * axes^T, proper rotations only
+      const double signs[3] = {candidate & 1 ? -1.0 : 1.0,
+                               candidate & 2 ? -1.0 : 1.0,
+                               candidate & 4 ? -1.0 : 1.0};
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          double sum = 0.0;
+          for (int k = 0; k < 3; k++)
+            sum += copy_axes[3 * i + k] * signs[k] * axes[3 * j + k];
+          transform.rotation[3 * i + j] = sum;
+        }
+      }
+      const double* r = transform.rotation;
+      const double det = r[0] * (r[4] * r[8] - r[5] * r[7]) -
+                         r[1] * (r[3] * r[8] - r[5] * r[6]) +
+                         r[2] * (r[3] * r[7] - r[4] * r[6]);
+      if (det < 0) continue;
+    }
+    // the centroids map onto each other
+    double rotated[3];
+    transform.to_instance(centroid, rotated);
+    for (int k = 0; k < 3; k++)
+      transform.translation[k] = copy_centroid[k] - rotated[k];
+
+    if (match(copy_coords, num_copy, transform, matches)) {
+      result = transform;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace moab
@@ -0,0 +1,98 @@
+#ifndef DAGMC_VOLUME_INSTANCE_HPP
+#define DAGMC_VOLUME_INSTANCE_HPP
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace moab {
+
+/**\brief rigid transform placing an instance of a prototype volume
+ *
+ * Maps a point p of the prototype to rotation * p + translation in the
+ * instance; the rotation is stored row major.
+ */
+struct InstanceTransform {
+  /** the identity */
+  InstanceTransform();
+
+  void to_instance(const double p[3], double result[3]) const;
+  void to_prototype(const double p[3], double result[3]) const;
+  /** rotate a direction from the instance to the prototype */
+  void rotate_to_prototype(const double v[3], double result[3]) const;
+
+  double rotation[9];
+  double translation[3];
+};
+
+/**\brief matches the triangles of a congruent copy to those of a prototype
+ *
+ * The triangles of the prototype are hashed by centroid on a grid of cells
+ * the size of the tolerance. A triangle of a copy matches a prototype
+ * triangle if, mapped to the prototype, each of its vertices is within the
+ * tolerance of a vertex of the prototype triangle in the same cyclic order,
+ * so that both triangles face the same way.
+ *
+ * The triangles are plain coordinate arrays. BVHRayTracer matches the
+ * facets of each instance to the triangles of its prototype's tree, and the
+ * dagmc_dedupe tool finds the congruent volumes of a model with it.
+ */
+class FacetMatcher {
+ public:
+  /**\brief index the triangles of a prototype
+   *
+   * \param coords 9 coordinates per triangle
+   * \param num_triangles number of triangles
+   * \param tolerance distance within which vertices are considered equal
+   */
+  FacetMatcher(const double* coords, uint32_t num_triangles,
+               double tolerance);
+
+  uint32_t num_triangles() const { return coords.size() / 9; }
+
+  /**\brief the prototype triangle of every triangle of a copy
+   *
+   * \param coords 9 coordinates per triangle of the copy
+   * \param num_triangles number of triangles of the copy
+   * \param transform placement of the copy
+   * \param result set to the index of the prototype triangle of each
+   *        triangle of the copy
+   * \return whether every triangle of the copy matched a prototype triangle
+   *         of its own, and every prototype triangle was matched
+   */
+  bool match(const double* coords, uint32_t num_triangles,
+             const InstanceTransform& transform,
+             std::vector<uint32_t>& result) const;
+
+  /**\brief find the placement of a copy of the prototype
+   *
+   * Tries the translation between the centroids first, then the rotations
+   * between the principal axes of the prototype and of the copy, and keeps
+   * the first one for which match() succeeds. Copies of shapes with
+   * repeated principal moments (cylinders, cubes) are only found if they are
+   * translated, since their principal axes are not unique.
+   */
+  bool find_transform(const double* coords, uint32_t num_triangles,
+                      InstanceTransform& result) const;
+
+ private:
+  /** key of the cell of a point, offset by the given number of cells */
+  uint64_t cell_key(const double p[3], const int offset[3]) const;
+
+  /** whether triangle a of the prototype and the mapped triangle b are the
+   *  same triangle */
+  bool same_triangle(uint32_t a, const double b[9]) const;
+
+  double tolerance;
+  std::vector<double> coords;
+  /** prototype triangles by the cell of their centroid */
+  std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+  /** area weighted centroid and principal axes, as the columns of axes */
+  double centroid[3];
+  double axes[9];
+};
+
+}  // namespace moab
+
+#endif
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "BoxBVH.hpp"
+#include "dagmc_test_random.hpp"
+
+using moab::BoxBVH;
+using moab::FacetBVH;
+
+// slab test of a ray against a box, without tolerance
+static bool enters_box(const double* box, const double origin[3],
+                       const double dir[3], double& t_entry) {
+  double t_min = 0.0, t_max = std::numeric_limits<double>::max();
+  for (int k = 0; k < 3; k++) {
+    if (dir[k] == 0.0) {
+      if (origin[k] < box[k] || origin[k] > box[3 + k]) return false;
+      continue;
+    }
+    double t0 = (box[k] - origin[k]) / dir[k];
+    double t1 = (box[3 + k] - origin[k]) / dir[k];
+    if (t0 > t1) std::swap(t0, t1);
+    t_min = std::max(t_min, t0);
+    t_max = std::min(t_max, t1);
+    if (t_min > t_max) return false;
+  }
+  t_entry = t_min;
+  return true;
+}
+
+static double dist_sqr_to_box(const double* box, const double point[3]) {
+  double result = 0.0;
+  for (int k = 0; k < 3; k++) {
+    const double d = std::max(std::max(box[k] - point[k], 0.0),
+                              point[k] - box[3 + k]);
+    result += d * d;
+  }
+  return result;
+}
+
+TEST(BoxBVHTest, box_bvh_ray_traverse) {
+  TestRandom random;
+  const uint32_t num_boxes = 500;
+  const std::vector<double> corners = random.boxes(num_boxes);
+  BoxBVH tree;
+  tree.build(&corners[0], num_boxes);
+  EXPECT_EQ(2 * num_boxes - 1, tree.num_nodes());
+
+  struct All {
+    std::vector<uint32_t> boxes;
+    void operator()(uint32_t box, double, double&) { boxes.push_back(box); }
+  };
+  // stops at the entry of the nearest box seen so far
+  struct Nearest {
+    const double* corners;
+    const double* origin;
+    const double* dir;
+    bool found;
+    double entry;
+    void operator()(uint32_t b, double, double& t_max) {
+      double t_entry;
+      if (!enters_box(corners + 6 * b, origin, dir, t_entry) ||
+          t_entry > t_max)
+        return;
+      found = true;
+      entry = t_max = t_entry;
+    }
+  };
+
+  FacetBVH::TraversalStats all_stats, nearest_stats;
+  for (int i = 0; i < 2000; i++) {
+    double origin[3], dir[3];
+    random.point(70.0, origin);
+    random.direction(dir);
+    const FacetBVH::Ray ray(origin, dir, 0.0);
+
+    std::vector<uint32_t> expected;
+    bool found = false;
+    double nearest_entry = 0.0;
+    for (uint32_t b = 0; b < num_boxes; b++) {
+      double t_entry;
+      if (!enters_box(&corners[6 * b], origin, dir, t_entry)) continue;
+      expected.push_back(b);
+      if (!found || t_entry < nearest_entry) {
+        found = true;
+        nearest_entry = t_entry;
+      }
+    }
+
+    // every box the ray enters is visited once; boxes it only grazes
+    // within rounding may be visited too
+    All all;
+    tree.ray_traverse(ray, 0.0, std::numeric_limits<double>::max(), all,
+                      &all_stats);
+    std::sort(all.boxes.begin(), all.boxes.end());
+    EXPECT_TRUE(std::adjacent_find(all.boxes.begin(), all.boxes.end()) ==
+                all.boxes.end());
+    EXPECT_TRUE(std::includes(all.boxes.begin(), all.boxes.end(),
+                              expected.begin(), expected.end()));
+
+    Nearest nearest = {&corners[0], origin, dir, false, 0.0};
+    tree.ray_traverse(ray, 0.0, std::numeric_limits<double>::max(), nearest,
+                      &nearest_stats);
+    ASSERT_EQ(found, nearest.found);
+    if (found) {
+      EXPECT_EQ(nearest_entry, nearest.entry);
+    }
+  }
+  // shrinking t_max skips the boxes behind the nearest one
+  EXPECT_LT(nearest_stats.node_tests, all_stats.node_tests);
+}
+
+TEST(BoxBVHTest, box_bvh_closest_traverse) {
+  TestRandom random(54321);
+  const uint32_t num_boxes = 500;
+  const std::vector<double> corners = random.boxes(num_boxes);
+  BoxBVH tree;
+  tree.build(&corners[0], num_boxes);
+
+  struct Closest {
+    const double* corners;
+    const double* point;
+    int visits;
+    double best;
+    void operator()(uint32_t b, double dist_sqr, double& best_sqr) {
+      visits++;
+      EXPECT_EQ(dist_sqr_to_box(corners + 6 * b, point), dist_sqr);
+      if (dist_sqr < best_sqr) best_sqr = best = dist_sqr;
+    }
+  };
+
+  int total_visits = 0;
+  for (int i = 0; i < 2000; i++) {
+    double point[3];
+    random.point(70.0, point);
+    double expected = std::numeric_limits<double>::max();
+    for (uint32_t b = 0; b < num_boxes; b++)
+      expected = std::min(expected, dist_sqr_to_box(&corners[6 * b], point));
+
+    Closest closest = {&corners[0], point, 0,
+                       std::numeric_limits<double>::max()};
+    tree.closest_traverse(point, std::numeric_limits<double>::max(), closest);
+    EXPECT_EQ(expected, closest.best);
+    total_visits += closest.visits;
+  }
+  // the boxes farther than the nearest one are mostly skipped
+  EXPECT_LT(total_visits, 2000 * 10);
+
+  double lower[3], upper[3];
+  tree.get_bounds(lower, upper);
+  for (uint32_t b = 0; b < num_boxes; b++) {
+    for (int k = 0; k < 3; k++) {
+      EXPECT_LE(lower[k], corners[6 * b + k]);
+      EXPECT_GE(upper[k], corners[6 * b + 3 + k]);
+    }
+  }
+}
+
+TEST(BoxBVHTest, box_bvh_empty) {
+  BoxBVH tree;
+  tree.build(NULL, 0);
+  EXPECT_TRUE(tree.empty());
+  struct Fail {
+    void operator()(uint32_t, double, double&) { ADD_FAILURE(); }
+  } fail;
+  const double origin[3] = {0, 0, 0}, dir[3] = {1, 0, 0};
+  tree.ray_traverse(FacetBVH::Ray(origin, dir, 0.0), 0.0, 1.0, fail);
+  tree.closest_traverse(origin, 1.0, fail);
+}
@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "CompactBVH.hpp"
+#include "FacetBVH.hpp"
+#include "dagmc_test_random.hpp"
+
+using moab::CompactBVH;
+using moab::FacetBVH;
+
+// faceted sphere with outward-facing triangles
+static void make_sphere(int num_theta, int num_phi, double radius,
+                        const double center[3], std::vector<double>& coords) {
+  coords.clear();
+  for (int i = 0; i < num_theta; i++) {
+    for (int j = 0; j < num_phi; j++) {
+      double v[4][3];
+      for (int k = 0; k < 4; k++) {
+        const double theta = M_PI * (i + (k == 1 || k == 2)) / num_theta;
+        const double phi = 2 * M_PI * (j + (k >= 2)) / num_phi;
+        v[k][0] = center[0] + radius * sin(theta) * cos(phi);
+        v[k][1] = center[1] + radius * sin(theta) * sin(phi);
+        v[k][2] = center[2] + radius * cos(theta);
+      }
+      const int tris[2][3] = {{0, 1, 2}, {0, 2, 3}};
+      for (int t = 0; t < 2; t++) {
+        for (int k = 0; k < 3; k++)
+          coords.insert(coords.end(), v[tris[t][k]], v[tris[t][k]] + 3);
+      }
+    }
+  }
+}
+
+class CompactBVHTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // off the origin, so that rounding to floats moves the vertices
+    const double center[3] = {101.3, -47.9, 12.7};
+    make_sphere(40, 80, 5.0, center, coords);
+    bvh.build(&coords[0], coords.size() / 9);
+  }
+
+  // random rays through the sphere, from inside and outside
+  static void random_ray(TestRandom& random, double origin[3],
+                         double dir[3]) {
+    const double center[3] = {101.3, -47.9, 12.7};
+    random.point(8.0, origin);
+    for (int k = 0; k < 3; k++) origin[k] += center[k];
+    random.direction(dir);
+  }
+
+  std::vector<double> coords;
+  FacetBVH bvh;
+};
+
+TEST_F(CompactBVHTest, compact_bvh_layout) {
+  CompactBVH compact;
+  std::vector<uint32_t> slots;
+  compact.build(bvh, CompactBVH::PRECISION_DOUBLE, slots);
+  EXPECT_EQ(16u, sizeof(CompactBVH::Node));
+  EXPECT_EQ(bvh.num_triangles(), compact.num_triangles());
+  EXPECT_EQ(bvh.num_nodes(), compact.num_nodes());
+  ASSERT_EQ(compact.num_slots(), slots.size());
+
+  // every slot holds the triangle of its FacetBVH slot, and the vertices
+  // shared by neighbouring triangles are pooled
+  for (uint32_t i = 0; i < slots.size(); i++) {
+    double tri[9];
+    compact.triangle_coords(i, tri);
+    for (int k = 0; k < 9; k++)
+      EXPECT_EQ(bvh.triangle_coords(slots[i])[k], tri[k]);
+  }
+  EXPECT_LT(compact.num_vertices(), compact.num_triangles());
+
+  // the box of the root is exact
+  double lower[3], upper[3];
+  compact.get_bounds(lower, upper);
+  for (int k = 0; k < 3; k++) {
+    double min = coords[k], max = coords[k];
+    for (size_t j = k; j < coords.size(); j += 3) {
+      min = std::min(min, coords[j]);
+      max = std::max(max, coords[j]);
+    }
+    EXPECT_EQ(min, lower[k]);
+    EXPECT_EQ(max, upper[k]);
+  }
+
+  // the compact form takes less than a quarter of the memory
+  EXPECT_LT(4 * compact.memory_use(), bvh.memory_use());
+  CompactBVH compact_float;
+  compact_float.build(bvh, CompactBVH::PRECISION_FLOAT, slots);
+  EXPECT_LT(compact_float.memory_use(), compact.memory_use());
+}
+
+TEST_F(CompactBVHTest, compact_bvh_matches_full) {
+  CompactBVH compact;
+  std::vector<uint32_t> slots;
+  compact.build(bvh, CompactBVH::PRECISION_DOUBLE, slots);
+
+  // the same triangles with the same test give the same hits
+  TestRandom random;
+  for (int i = 0; i < 5000; i++) {
+    double origin[3], dir[3];
+    random_ray(random, origin, dir);
+    const FacetBVH::Ray ray(origin, dir, 1e-6);
+    const double neg_len = -1.0;
+    uint32_t hit = 0, neg_hit = 0, compact_hit = 0, compact_neg_hit = 0;
+    double dist = 0, neg_dist = 0, compact_dist = 0, compact_neg_dist = 0;
+    const bool found =
+        bvh.ray_fire(ray, 100.0, &neg_len, NULL, FacetBVH::NoFilter(), hit,
+                     dist, &neg_hit, &neg_dist);
+    const bool compact_found = compact.ray_fire(
+        ray, 100.0, &neg_len, NULL, FacetBVH::NoFilter(), compact_hit,
+        compact_dist, &compact_neg_hit, &compact_neg_dist);
+    ASSERT_EQ(found, compact_found);
+    if (found) {
+      EXPECT_EQ(hit, slots[compact_hit]);
+      EXPECT_EQ(dist, compact_dist);
+    }
+    EXPECT_EQ(neg_dist, compact_neg_dist);
+
+    std::vector<uint32_t> hits, compact_hits;
+    std::vector<double> dists, compact_dists;
+    bvh.ray_intersect_all(ray, 100.0, FacetBVH::NoFilter(), hits, dists);
+    compact.ray_intersect_all(ray, 100.0, FacetBVH::NoFilter(), compact_hits,
+                              compact_dists);
+    EXPECT_EQ(hits.size(), compact_hits.size());
+
+    uint32_t nearest, compact_nearest;
+    double near_dist, compact_near_dist;
+    ASSERT_TRUE(bvh.closest_triangle(origin, FacetBVH::NoFilter(), nearest,
+                                     near_dist));
+    ASSERT_TRUE(compact.closest_triangle(origin, FacetBVH::NoFilter(),
+                                         compact_nearest,
+                                         compact_near_dist));
+    EXPECT_EQ(near_dist, compact_near_dist);
+  }
+}
+
+TEST_F(CompactBVHTest, compact_bvh_float_refined) {
+  CompactBVH compact;
+  std::vector<uint32_t> slots;
+  compact.build(bvh, CompactBVH::PRECISION_FLOAT, slots);
+
+  // the rounded triangles are still watertight, and refining the distance
+  // on the original triangle recovers the double precision distance
+  TestRandom random(4321);
+  double max_error = 0.0, max_refined_error = 0.0;
+  for (int i = 0; i < 5000; i++) {
+    double origin[3], dir[3];
+    random_ray(random, origin, dir);
+    const FacetBVH::Ray ray(origin, dir, 1e-6);
+    uint32_t hit = 0, compact_hit = 0;
+    double dist = 0, compact_dist = 0;
+    const bool found = bvh.ray_fire(ray, 100.0, NULL, NULL,
+                                    FacetBVH::NoFilter(), hit, dist);
+    ASSERT_EQ(found, compact.ray_fire(ray, 100.0, NULL, NULL,
+                                      FacetBVH::NoFilter(), compact_hit,
+                                      compact_dist));
+    if (!found) continue;
+    max_error = std::max(max_error, fabs(dist - compact_dist));
+    CompactBVH::refine_distance(bvh.triangle_coords(slots[compact_hit]),
+                                origin, dir, compact_dist);
+    max_refined_error = std::max(max_refined_error, fabs(dist - compact_dist));
+  }
+  EXPECT_LT(max_error, 1e-4);
+  EXPECT_LT(max_refined_error, 1e-9);
+}
@@ -0,0 +1,281 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#include "FacetBVH.hpp"
+#include "dagmc_test_random.hpp"
+
+using moab::FacetBVH;
+
+// faceted sphere with outward-facing triangles
+static void make_sphere(int num_theta, int num_phi, double radius,
+                        std::vector<double>& coords) {
+  coords.clear();
+  for (int i = 0; i < num_theta; i++) {
+    for (int j = 0; j < num_phi; j++) {
+      double v[4][3];
+      for (int k = 0; k < 4; k++) {
+        const double theta = M_PI * (i + (k == 1 || k == 2)) / num_theta;
+        const double phi = 2 * M_PI * (j + (k >= 2)) / num_phi;
+        v[k][0] = radius * sin(theta) * cos(phi);
+        v[k][1] = radius * sin(theta) * sin(phi);
+        v[k][2] = radius * cos(theta);
+      }
+      const int tris[2][3] = {{0, 1, 2}, {0, 2, 3}};
+      for (int t = 0; t < 2; t++) {
+        for (int k = 0; k < 3; k++)
+          coords.insert(coords.end(), v[tris[t][k]], v[tris[t][k]] + 3);
+      }
+    }
+  }
+}
+
+class FacetBVHTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    make_sphere(30, 60, 5.0, coords);
+    bvh.build(&coords[0], coords.size() / 9);
+  }
+  virtual void TearDown() {
+    FacetBVH::set_simd_level(FacetBVH::best_simd_level());
+  }
+
+  std::vector<double> coords;
+  FacetBVH bvh;
+};
+
+TEST_F(FacetBVHTest, facet_bvh_leaf_blocks) {
+  EXPECT_EQ(coords.size() / 9, bvh.num_triangles());
+  EXPECT_EQ(0u, bvh.num_slots() % FacetBVH::BLOCK_SIZE);
+
+  // every triangle is in exactly one slot, and its coordinates are also in
+  // the packed block of the slot
+  std::vector<int> found(bvh.num_triangles(), 0);
+  for (uint32_t slot = 0; slot < bvh.num_slots(); slot++) {
+    const uint32_t index = bvh.triangle(slot);
+    if (FacetBVH::UNUSED_SLOT == index) continue;
+    ASSERT_LT(index, bvh.num_triangles());
+    found[index]++;
+    const double* block = bvh.block(slot / FacetBVH::BLOCK_SIZE);
+    for (int k = 0; k < 9; k++) {
+      EXPECT_EQ(coords[9 * index + k], bvh.triangle_coords(slot)[k]);
+      EXPECT_EQ(coords[9 * index + k],
+                block[k * FacetBVH::BLOCK_SIZE + slot % FacetBVH::BLOCK_SIZE]);
+    }
+  }
+  for (size_t i = 0; i < found.size(); i++) EXPECT_EQ(1, found[i]);
+}
+
+TEST_F(FacetBVHTest, facet_bvh_simd_matches_scalar) {
+  // random rays and rays aimed at vertices and edges, where the watertight
+  // test depends on exact Plucker coordinates
+  TestRandom random;
+  const size_t num_vertices = coords.size() / 3;
+  std::vector<double> rays;
+  for (int i = 0; i < 5000; i++) {
+    double origin[3], dir[3];
+    const double* a = &coords[3 * random.index(num_vertices)];
+    const double* b = &coords[3 * random.index(num_vertices)];
+    const double t = (i % 3 == 0) ? 0.0 : (i % 3 == 1 ? 0.5 : 0.25);
+    for (int j = 0; j < 3; j++) {
+      origin[j] = (i % 5 == 0) ? 0.0 : random.uniform(-2.0, 2.0);
+      dir[j] = (i % 4 == 3) ? random.uniform(-0.5, 0.5)
+                            : a[j] + t * (b[j] - a[j]) - origin[j];
+    }
+    rays.insert(rays.end(), origin, origin + 3);
+    rays.insert(rays.end(), dir, dir + 3);
+  }
+
+  std::vector<std::vector<uint32_t> > hits(FacetBVH::SIMD_AVX512 + 1);
+  std::vector<std::vector<double> > dists(FacetBVH::SIMD_AVX512 + 1);
+  const FacetBVH::SimdLevel best = FacetBVH::best_simd_level();
+  for (int level = FacetBVH::SIMD_SCALAR; level <= best; level++) {
+    FacetBVH::set_simd_level((FacetBVH::SimdLevel)level);
+    ASSERT_EQ(level, FacetBVH::simd_level());
+    for (size_t r = 0; r < rays.size(); r += 6) {
+      FacetBVH::Ray ray(&rays[r], &rays[r + 3], 1e-3);
+      for (int orientation = -1; orientation <= 1; orientation++) {
+        uint32_t hit = FacetBVH::UNUSED_SLOT;
+        double dist = -1.0;
+        if (!bvh.ray_fire(ray, HUGE_VAL, NULL,
+                          orientation ? &orientation : NULL,
+                          FacetBVH::NoFilter(), hit, dist)) {
+          hit = FacetBVH::UNUSED_SLOT;
+          dist = -1.0;
+        }
+        hits[level].push_back(hit);
+        dists[level].push_back(dist);
+      }
+      std::vector<uint32_t> all_hits;
+      std::vector<double> all_dists;
+      bvh.ray_intersect_all(ray, HUGE_VAL, FacetBVH::NoFilter(), all_hits,
+                            all_dists);
+      hits[level].insert(hits[level].end(), all_hits.begin(), all_hits.end());
+      dists[level].insert(dists[level].end(), all_dists.begin(),
+                          all_dists.end());
+    }
+  }
+
+  for (int level = FacetBVH::SIMD_SCALAR + 1; level <= best; level++) {
+    ASSERT_EQ(hits[0].size(), hits[level].size());
+    for (size_t i = 0; i < hits[0].size(); i++) {
+      EXPECT_EQ(hits[0][i], hits[level][i]);
+      // distances must be bit-identical, not just close
+      EXPECT_EQ(0, memcmp(&dists[0][i], &dists[level][i], sizeof(double)));
+    }
+  }
+}
+
+TEST_F(FacetBVHTest, facet_bvh_watertight) {
+  // rays from the center must leave the closed sphere at every SIMD level
+  TestRandom random(54321);
+  const double center[3] = {0.0, 0.0, 0.0};
+  const FacetBVH::SimdLevel best = FacetBVH::best_simd_level();
+  for (int level = FacetBVH::SIMD_SCALAR; level <= best; level++) {
+    FacetBVH::set_simd_level((FacetBVH::SimdLevel)level);
+    int misses = 0;
+    for (int i = 0; i < 10000; i++) {
+      double dir[3];
+      random.direction(dir);
+      FacetBVH::Ray ray(center, dir, 1e-3);
+      const int orientation = 1;
+      uint32_t hit;
+      double dist;
+      if (!bvh.ray_fire(ray, HUGE_VAL, NULL, &orientation,
+                        FacetBVH::NoFilter(), hit, dist))
+        misses++;
+    }
+    EXPECT_EQ(0, misses);
+  }
+}
+
+TEST_F(FacetBVHTest, facet_bvh_front_to_back) {
+  // rays from outside the sphere find the same nearest hit in either order,
+  // testing fewer triangles front to back
+  TestRandom random(13579);
+  FacetBVH::TraversalStats depth_first, front_to_back;
+  for (int i = 0; i < 5000; i++) {
+    double origin[3], dir[3];
+    for (int j = 0; j < 3; j++) {
+      origin[j] = random.uniform(-0.5, 0.5);
+      dir[j] = random.uniform(-0.5, 0.5);
+    }
+    const double r = sqrt(origin[0] * origin[0] + origin[1] * origin[1] +
+                          origin[2] * origin[2]);
+    const double len =
+        sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    for (int j = 0; j < 3; j++) {
+      origin[j] *= 8.0 / r;
+      dir[j] /= len;
+    }
+    FacetBVH::Ray ray(origin, dir, 1e-3);
+    uint32_t hit[2] = {0, 0};
+    double dist[2] = {0.0, 0.0};
+    const bool found_df = bvh.ray_fire(
+        ray, HUGE_VAL, NULL, NULL, FacetBVH::NoFilter(), hit[0], dist[0], NULL,
+        NULL, FacetBVH::ORDER_DEPTH_FIRST, &depth_first);
+    const bool found_fb = bvh.ray_fire(
+        ray, HUGE_VAL, NULL, NULL, FacetBVH::NoFilter(), hit[1], dist[1], NULL,
+        NULL, FacetBVH::ORDER_FRONT_TO_BACK, &front_to_back);
+    ASSERT_EQ(found_df, found_fb);
+    if (found_df) {
+      EXPECT_EQ(hit[0], hit[1]);
+      EXPECT_EQ(dist[0], dist[1]);
+    }
+  }
+  EXPECT_LT(0u, front_to_back.triangle_tests);
+  EXPECT_LT(front_to_back.triangle_tests, depth_first.triangle_tests);
+  EXPECT_LE(front_to_back.leaves_visited, depth_first.leaves_visited);
+
+  // a distance limit short of the sphere culls the whole tree
+  FacetBVH::TraversalStats limited;
+  const double origin[3] = {0.0, 0.0, 8.0}, dir[3] = {0.0, 0.0, -1.0};
+  FacetBVH::Ray ray(origin, dir, 1e-3);
+  uint32_t hit;
+  double dist;
+  EXPECT_FALSE(bvh.ray_fire(ray, 2.0, NULL, NULL, FacetBVH::NoFilter(), hit,
+                            dist, NULL, NULL, FacetBVH::ORDER_FRONT_TO_BACK,
+                            &limited));
+  EXPECT_EQ(0u, limited.leaves_visited);
+}
+
+TEST_F(FacetBVHTest, facet_bvh_sweep_build) {
+  // the full sweep build holds every triangle once and finds the same hits
+  // as the binned build
+  FacetBVH sweep;
+  sweep.build(&coords[0], coords.size() / 9, 4, FacetBVH::BUILD_SWEEP);
+  ASSERT_EQ(bvh.num_triangles(), sweep.num_triangles());
+  std::vector<int> found(sweep.num_triangles(), 0);
+  for (uint32_t slot = 0; slot < sweep.num_slots(); slot++) {
+    const uint32_t index = sweep.triangle(slot);
+    if (FacetBVH::UNUSED_SLOT == index) continue;
+    ASSERT_LT(index, sweep.num_triangles());
+    found[index]++;
+  }
+  for (size_t i = 0; i < found.size(); i++) EXPECT_EQ(1, found[i]);
+  // leaves only exceed the preferred size if no split is cheaper
+  const FacetBVH::Node* nodes = sweep.get_nodes();
+  for (size_t n = 0; n < sweep.num_nodes(); n++) {
+    if (nodes[n].is_leaf()) {
+      EXPECT_GE(16u, nodes[n].count);
+    }
+  }
+
+  TestRandom random(24680);
+  FacetBVH::TraversalStats binned_stats, sweep_stats;
+  for (int i = 0; i < 5000; i++) {
+    double origin[3], dir[3];
+    random.point(2.0, origin);
+    random.direction(dir);
+    FacetBVH::Ray ray(origin, dir, 1e-3);
+    uint32_t hit[2] = {0, 0};
+    double dist[2] = {0.0, 0.0};
+    const bool found_binned = bvh.ray_fire(
+        ray, HUGE_VAL, NULL, NULL, FacetBVH::NoFilter(), hit[0], dist[0], NULL,
+        NULL, FacetBVH::ORDER_FRONT_TO_BACK, &binned_stats);
+    const bool found_sweep = sweep.ray_fire(
+        ray, HUGE_VAL, NULL, NULL, FacetBVH::NoFilter(), hit[1], dist[1], NULL,
+        NULL, FacetBVH::ORDER_FRONT_TO_BACK, &sweep_stats);
+    ASSERT_EQ(found_binned, found_sweep);
+    if (found_binned) {
+      EXPECT_EQ(bvh.triangle(hit[0]), sweep.triangle(hit[1]));
+      EXPECT_EQ(dist[0], dist[1]);
+    }
+  }
+  // with the smaller leaves, the rays test fewer triangles
+  EXPECT_LT(sweep_stats.triangle_tests, binned_stats.triangle_tests);
+}
+
+TEST_F(FacetBVHTest, facet_bvh_winding_number) {
+  std::vector<FacetBVH::Dipole> dipoles;
+  bvh.build_dipoles(dipoles);
+  ASSERT_EQ(bvh.num_nodes(), dipoles.size());
+
+  // the root dipole of a closed surface vanishes
+  for (int i = 0; i < 3; i++) EXPECT_NEAR(0.0, dipoles[0].normal[i], 1e-9);
+
+  TestRandom random(13579);
+  for (int i = 0; i < 2000; i++) {
+    double point[3];
+    random.point(12.0, point);
+    const double r = sqrt(point[0] * point[0] + point[1] * point[1] +
+                          point[2] * point[2]);
+    // leave the points between the sphere and its facets to the tolerances
+    if (fabs(r - 5.0) < 0.1) continue;
+
+    // the exact sum over every triangle
+    double exact = 0.0;
+    for (uint32_t slot = 0; slot < bvh.num_slots(); slot++) {
+      if (FacetBVH::UNUSED_SLOT == bvh.triangle(slot)) continue;
+      exact += FacetBVH::solid_angle(bvh.triangle_coords(slot), point);
+    }
+    exact /= 4.0 * M_PI;
+    EXPECT_NEAR(r < 5.0 ? 1.0 : 0.0, exact, 1e-9);
+
+    const double winding = bvh.winding_number(point, &dipoles[0]);
+    EXPECT_NEAR(exact, winding, 0.1);
+    EXPECT_EQ(r < 5.0, winding > 0.5);
+  }
+}
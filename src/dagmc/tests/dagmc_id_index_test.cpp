@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <vector>
+
+#include "IdIndex.hpp"
+#include "dagmc_test_random.hpp"
+
+using moab::IdIndex;
+
+// every ID finds its lowest index, and other IDs find none
+static void check_index(const IdIndex& index, const std::vector<int>& ids) {
+  std::map<int, int> expected;
+  for (unsigned i = 1; i < ids.size(); i++)
+    expected.insert(std::make_pair(ids[i], i));
+  for (std::map<int, int>::const_iterator it = expected.begin();
+       it != expected.end(); ++it) {
+    EXPECT_EQ(it->second, index.find(it->first));
+    if (!expected.count(it->first + 1)) {
+      EXPECT_EQ(0, index.find(it->first + 1));
+    }
+  }
+}
+
+TEST(IdIndexTest, id_index_dense) {
+  // IDs from a CAD exporter: nearly consecutive, in any order
+  std::vector<int> ids(1, 0);
+  for (int i = 0; i < 1000; i++) ids.push_back(5000 - 2 * i);
+  ids.push_back(3000);
+  IdIndex index;
+  index.build(ids);
+  EXPECT_TRUE(index.is_dense());
+  check_index(index, ids);
+  EXPECT_EQ(0, index.find(0));
+  EXPECT_EQ(0, index.find(-2147483647 - 1));
+  EXPECT_EQ(0, index.find(2147483647));
+  EXPECT_LE(index.memory_use(), 4 * ids.size() * sizeof(int));
+
+  index.clear();
+  EXPECT_EQ(0, index.find(5000));
+  index.build(std::vector<int>(1, 7));
+  EXPECT_EQ(0, index.find(7));
+}
+
+TEST(IdIndexTest, id_index_sparse) {
+  // IDs spread over the whole range, including negative ones
+  TestRandom random(2468);
+  std::vector<int> ids(1, 0);
+  for (int i = 0; i < 100000; i++)
+    ids.push_back((int)(random.index(0xffffffffu) * 2654435761u));
+  ids.push_back(ids[10]);
+  IdIndex index;
+  index.build(ids);
+  EXPECT_FALSE(index.is_dense());
+  check_index(index, ids);
+  EXPECT_EQ(10, index.find(ids[10]));
+}
@@ -1,8 +1,16 @@
 #include <gtest/gtest.h>
 
+#include <stdlib.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "DagMC.hpp"
+#include "dagmc_test_random.hpp"
 #include "moab/Core.hpp"
 #include "moab/Interface.hpp"
 
@@ -19,6 +27,14 @@ class DagmcPointInVolTest : public ::testing::Test {
   virtual void SetUp() {
     // Create new DAGMC instance
     DAG = std::make_shared<moab::DagMC>();
+    // Select the native BVH trees, full or compact, if requested
+    const std::string accel = getenv("DAGMC_ACCEL") ? getenv("DAGMC_ACCEL")
+                                                     : "";
+    if (0 == accel.compare(0, 3, "bvh")) DAG->set_accel_type(DagMC::ACCEL_BVH);
+    if (accel == "bvh_compact")
+      DAG->set_tree_storage(DagMC::TREES_COMPACT);
+    else if (accel == "bvh_compact_float")
+      DAG->set_tree_storage(DagMC::TREES_COMPACT_FLOAT);
     // Load mesh from file
     rloadval = DAG->load_file(input_file);
     assert(rloadval == moab::MB_SUCCESS);
@@ -232,3 +248,150 @@ TEST_F(DagmcPointInVolTest, dagmc_point_on_corner_8) {
 
   EXPECT_EQ(expected_result, result);
 }
+
+TEST_F(DagmcPointInVolTest, dagmc_find_volume) {
+  // find_volume must agree with testing every volume in index order
+  TestRandom random;
+  const int num_vols = DAG->num_entities(3);
+  EntityHandle hint = 0;
+  for (int i = 0; i < 1000; i++) {
+    double xyz[3], dir[3];
+    random.point(10.0, xyz);
+    random.direction(dir);
+
+    EntityHandle expected = 0;
+    for (int j = 1; j <= num_vols && !expected; j++) {
+      int result;
+      EntityHandle vol = DAG->entity_by_index(3, j);
+      ErrorCode rval = DAG->point_in_volume(vol, xyz, result, dir);
+      EXPECT_EQ(MB_SUCCESS, rval);
+      if (result == 1) expected = vol;
+    }
+
+    EntityHandle volume;
+    ErrorCode rval = DAG->find_volume(xyz, volume, dir, hint);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_EQ(expected, volume);
+    hint = volume;
+  }
+
+  // the hint is only a hint
+  double origin[3] = {0.0, 0.0, 0.0};
+  EntityHandle volume;
+  ErrorCode rval = DAG->find_volume(origin, volume, NULL,
+                                    DAG->entity_by_index(3, num_vols));
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_EQ(DAG->entity_by_index(3, 1), volume);
+}
+
+TEST_F(DagmcPointInVolTest, dagmc_point_in_bounds) {
+  // points outside the cube of side 10 are rejected by its bounds
+  EntityHandle vol_h = DAG->entity_by_index(3, 1);
+  DAG->reset_point_in_volume_counts();
+  unsigned long num_calls, num_box_rejects, num_obb_rejects;
+  DAG->get_point_in_volume_counts(num_calls, num_box_rejects,
+                                  num_obb_rejects);
+  TestRandom random;
+  for (int i = 0; i < 1000; i++) {
+    double xyz[3], inside = 0.0;
+    random.point(8.0, xyz);
+    for (int k = 0; k < 3; k++) inside = std::max(inside, fabs(xyz[k]));
+    // leave the points on the surface to the other tests
+    if (fabs(inside - 5.0) < 1e-3) continue;
+
+    int result;
+    ErrorCode rval = DAG->point_in_volume(vol_h, xyz, result);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_EQ(inside < 5.0 ? 1 : 0, result);
+
+    // every point outside the box is rejected without firing a ray
+    unsigned long num_rejects = num_box_rejects + num_obb_rejects;
+    DAG->get_point_in_volume_counts(num_calls, num_box_rejects,
+                                    num_obb_rejects);
+    if (inside > 5.01) {
+      EXPECT_EQ(num_rejects + 1, num_box_rejects + num_obb_rejects);
+    }
+  }
+  EXPECT_LT(0u, num_calls);
+  EXPECT_LT(0u, num_box_rejects);
+
+  DAG->reset_point_in_volume_counts();
+  DAG->get_point_in_volume_counts(num_calls, num_box_rejects,
+                                  num_obb_rejects);
+  EXPECT_EQ(0u, num_calls);
+}
+
+TEST_F(DagmcPointInVolTest, dagmc_point_in_bounds_tolerance) {
+  // the bounds follow an overlap thickness set after the trees are built
+  EntityHandle vol_h = DAG->entity_by_index(3, 1);
+  double xyz[3] = {5.2, 0.0, 0.0};
+  unsigned long num_calls, num_box_rejects, num_obb_rejects;
+  int result;
+
+  DAG->reset_point_in_volume_counts();
+  EXPECT_EQ(MB_SUCCESS, DAG->point_in_volume(vol_h, xyz, result));
+  DAG->get_point_in_volume_counts(num_calls, num_box_rejects,
+                                  num_obb_rejects);
+  EXPECT_EQ(1u, num_calls);
+  EXPECT_EQ(1u, num_box_rejects + num_obb_rejects);
+
+  DAG->set_overlap_thickness(0.5);
+  DAG->reset_point_in_volume_counts();
+  EXPECT_EQ(MB_SUCCESS, DAG->point_in_volume(vol_h, xyz, result));
+  DAG->get_point_in_volume_counts(num_calls, num_box_rejects,
+                                  num_obb_rejects);
+  EXPECT_EQ(1u, num_calls);
+  EXPECT_EQ(0u, num_box_rejects + num_obb_rejects);
+}
+
+TEST_F(DagmcPointInVolTest, dagmc_point_in_winding) {
+  // the winding number agrees with the spherical area test of
+  // point_in_volume_slow for every volume, and is timed against it
+  TestRandom random;
+  std::vector<std::array<double, 3>> points;
+  while (points.size() < 200) {
+    std::array<double, 3> xyz;
+    double inside = 0.0;
+    random.point(8.0, xyz.data());
+    for (int k = 0; k < 3; k++) inside = std::max(inside, fabs(xyz[k]));
+    if (fabs(inside - 5.0) > 1e-3) points.push_back(xyz);
+  }
+
+  const int num_vols = DAG->num_entities(3);
+  std::vector<int> slow(num_vols * points.size());
+  std::vector<int> winding(slow.size());
+  double seconds[2];
+  for (int method = 0; method < 2; method++) {
+    std::vector<int>& results = method == 0 ? slow : winding;
+    auto start = std::chrono::steady_clock::now();
+    for (int v = 0; v < num_vols; v++) {
+      EntityHandle vol_h = DAG->entity_by_index(3, v + 1);
+      for (unsigned i = 0; i < points.size(); i++) {
+        int& result = results[v * points.size() + i];
+        ErrorCode rval =
+            method == 0
+                ? DAG->point_in_volume_slow(vol_h, points[i].data(), result)
+                : DAG->point_in_volume_winding(vol_h, points[i].data(),
+                                               result);
+        EXPECT_EQ(MB_SUCCESS, rval);
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    seconds[method] = std::chrono::duration<double>(end - start).count();
+  }
+  EXPECT_EQ(slow, winding);
+  std::cout << "point_in_volume_slow: " << seconds[0]
+            << " s, point_in_volume_winding: " << seconds[1] << " s for "
+            << slow.size() << " tests" << std::endl;
+
+  // the winding number answers point_in_volume when it is primary
+  EntityHandle vol_h = DAG->entity_by_index(3, 1);
+  DAG->set_winding_number_primary(true);
+  for (unsigned i = 0; i < points.size(); i++) {
+    int result;
+    ErrorCode rval = DAG->point_in_volume(vol_h, points[i].data(), result);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_EQ(winding[i], result);
+  }
+  DAG->set_winding_number_primary(false);
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "QueryProfiler.hpp"
+
+using moab::QueryProfiler;
+
+TEST(QueryProfilerTest, query_profiler_threads) {
+  // the shards of the threads add up to the counts of every call
+  QueryProfiler profiler;
+  profiler.setup(4);
+  const int num_threads = 8, num_calls = 10000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&profiler, t]() {
+      for (int i = 0; i < num_calls; i++) {
+        const int volume = 1 + i % 4;
+        profiler.record(volume, QueryProfiler::RAY_FIRE, 10);
+        profiler.add_traversal(volume, 3, 2);
+        if (0 == i % 100) profiler.add_lost(volume);
+      }
+      profiler.record(t % 5, QueryProfiler::NEXT_VOL, 1);
+    }));
+  }
+  for (unsigned t = 0; t < threads.size(); t++) threads[t].join();
+
+  std::vector<QueryProfiler::Counts> counts;
+  profiler.get_counts(counts);
+  ASSERT_EQ(5u, counts.size());
+  uint64_t next_vol_calls = 0;
+  for (int v = 1; v <= 4; v++) {
+    const QueryProfiler::Counts& c = counts[v];
+    EXPECT_EQ((uint64_t)num_threads * num_calls / 4,
+              c.calls[QueryProfiler::RAY_FIRE]);
+    EXPECT_EQ(10 * c.calls[QueryProfiler::RAY_FIRE],
+              c.nanoseconds[QueryProfiler::RAY_FIRE]);
+    EXPECT_EQ(3 * c.calls[QueryProfiler::RAY_FIRE], c.nodes);
+    EXPECT_EQ(2 * c.calls[QueryProfiler::RAY_FIRE], c.triangles);
+    EXPECT_EQ(0u, c.calls[QueryProfiler::POINT_IN_VOLUME]);
+    EXPECT_EQ(0u, c.retries);
+    next_vol_calls += c.calls[QueryProfiler::NEXT_VOL];
+  }
+  next_vol_calls += counts[0].calls[QueryProfiler::NEXT_VOL];
+  EXPECT_EQ((uint64_t)num_threads, next_vol_calls);
+  EXPECT_EQ((uint64_t)num_threads * num_calls / 100,
+            counts[1].lost + counts[2].lost + counts[3].lost + counts[4].lost);
+
+  // volumes out of range are counted as volume 0
+  profiler.add_retry(17);
+  profiler.add_retry(-1);
+  profiler.get_counts(counts);
+  EXPECT_EQ(2u, counts[0].retries);
+
+  profiler.reset();
+  profiler.get_counts(counts);
+  for (int v = 0; v <= 4; v++) {
+    EXPECT_EQ(0u, counts[v].calls[QueryProfiler::RAY_FIRE]);
+    EXPECT_EQ(0u, counts[v].nodes);
+  }
+
+  // a new setup drops the shards of the threads that have since exited
+  profiler.setup(2);
+  profiler.record(2, QueryProfiler::CLOSEST_TO_LOCATION, 5);
+  profiler.get_counts(counts);
+  ASSERT_EQ(3u, counts.size());
+  EXPECT_EQ(1u, counts[2].calls[QueryProfiler::CLOSEST_TO_LOCATION]);
+}
+
+TEST(QueryProfilerTest, query_profiler_reports) {
+  QueryProfiler profiler;
+  profiler.setup(3);
+  profiler.record(1, QueryProfiler::RAY_FIRE, 1000);
+  profiler.record(3, QueryProfiler::POINT_IN_VOLUME, 5000);
+  profiler.record(3, QueryProfiler::RAY_FIRE, 2000);
+  std::vector<int> ids = {0, 10, 20, 30};
+
+  // the volumes with queries, the slowest first
+  std::ostringstream csv;
+  profiler.write_csv(csv, ids);
+  std::istringstream lines(csv.str());
+  std::string header, first, second, extra;
+  std::getline(lines, header);
+  std::getline(lines, first);
+  std::getline(lines, second);
+  EXPECT_FALSE(std::getline(lines, extra));
+  EXPECT_EQ(0u, header.find("id,seconds,ray_fire_calls,ray_fire_seconds,"));
+  EXPECT_EQ(0u, first.find("30,7e-06,1,2e-06,1,5e-06,"));
+  EXPECT_EQ(0u, second.find("10,1e-06,1,1e-06,0,0,"));
+
+  // the seconds of the volumes read back from the report
+  std::istringstream report(csv.str());
+  std::vector<std::pair<int, double>> seconds;
+  ASSERT_TRUE(QueryProfiler::read_csv(report, seconds));
+  ASSERT_EQ(2u, seconds.size());
+  EXPECT_EQ(30, seconds[0].first);
+  EXPECT_DOUBLE_EQ(7e-6, seconds[0].second);
+  EXPECT_EQ(10, seconds[1].first);
+  EXPECT_DOUBLE_EQ(1e-6, seconds[1].second);
+  std::istringstream other("volume,calls\n1,2\n");
+  EXPECT_FALSE(QueryProfiler::read_csv(other, seconds));
+
+  std::ostringstream json;
+  profiler.write_json(json, ids);
+  const std::string text = json.str();
+  EXPECT_NE(std::string::npos,
+            text.find("\"total\": {\"seconds\": 8e-06, \"ray_fire\": "
+                      "{\"calls\": 2, \"seconds\": 3e-06}"));
+  const size_t slowest = text.find("{\"id\": 30,");
+  const size_t fastest = text.find("{\"id\": 10,");
+  EXPECT_NE(std::string::npos, slowest);
+  EXPECT_NE(std::string::npos, fastest);
+  EXPECT_LT(slowest, fastest);
+  EXPECT_EQ(std::string::npos, text.find("{\"id\": 20,"));
+}
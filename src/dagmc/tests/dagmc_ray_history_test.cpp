@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+
+#include "InlineRayHistory.hpp"
+
+using moab::EntityHandle;
+using moab::InlineRayHistory;
+
+// fill a history past the inline storage
+static void fill(InlineRayHistory& history, int num_facets) {
+  for (int i = 1; i <= num_facets; i++) history.add_entity(100 + i);
+}
+
+TEST(InlineRayHistoryTest, ray_history_inline) {
+  InlineRayHistory history;
+  EntityHandle last = 0;
+  EXPECT_EQ(0, history.size());
+  EXPECT_EQ(moab::MB_ENTITY_NOT_FOUND, history.get_last_intersection(last));
+
+  fill(history, 3);
+  EXPECT_EQ(3, history.size());
+  EXPECT_TRUE(history.in_history(102));
+  EXPECT_FALSE(history.in_history(104));
+  EXPECT_EQ(moab::MB_SUCCESS, history.get_last_intersection(last));
+  EXPECT_EQ(103u, last);
+
+  history.rollback_last_intersection();
+  EXPECT_EQ(2, history.size());
+  EXPECT_FALSE(history.in_history(103));
+
+  history.reset_to_last_intersection();
+  EXPECT_EQ(1, history.size());
+  EXPECT_TRUE(history.in_history(102));
+  EXPECT_FALSE(history.in_history(101));
+
+  history.reset();
+  EXPECT_EQ(0, history.size());
+  history.rollback_last_intersection();
+  EXPECT_EQ(0, history.size());
+}
+
+TEST(InlineRayHistoryTest, ray_history_overflow) {
+  const int num_facets = 3 * InlineRayHistory::INLINE_CAPACITY;
+  InlineRayHistory history;
+  fill(history, num_facets);
+  EXPECT_EQ(num_facets, history.size());
+  for (int i = 1; i <= num_facets; i++)
+    EXPECT_TRUE(history.in_history(100 + i));
+
+  // roll back across the end of the inline storage
+  EntityHandle last = 0;
+  for (int i = num_facets; i > 1; i--) {
+    EXPECT_EQ(moab::MB_SUCCESS, history.get_last_intersection(last));
+    EXPECT_EQ((EntityHandle)(100 + i), last);
+    history.rollback_last_intersection();
+    EXPECT_FALSE(history.in_history(100 + i));
+  }
+  EXPECT_EQ(1, history.size());
+
+  fill(history, num_facets);
+  history.reset_to_last_intersection();
+  EXPECT_EQ(1, history.size());
+  EXPECT_EQ(moab::MB_SUCCESS, history.get_last_intersection(last));
+  EXPECT_EQ((EntityHandle)(100 + num_facets), last);
+  history.add_entity(7);
+  EXPECT_EQ(2, history.size());
+  EXPECT_TRUE(history.in_history(7));
+}
+
+TEST(InlineRayHistoryTest, ray_history_copy_move) {
+  const int num_facets = InlineRayHistory::INLINE_CAPACITY + 2;
+  InlineRayHistory history;
+  fill(history, num_facets);
+
+  InlineRayHistory copy(history);
+  EXPECT_EQ(num_facets, copy.size());
+  copy.rollback_last_intersection();
+  EXPECT_EQ(num_facets, history.size());
+  EXPECT_TRUE(history.in_history(100 + num_facets));
+
+  // banking histories in a growing vector moves them
+  std::vector<InlineRayHistory> bank;
+  for (int i = 0; i < 20; i++) bank.push_back(history);
+  for (unsigned i = 0; i < bank.size(); i++) {
+    EXPECT_EQ(num_facets, bank[i].size());
+    EXPECT_TRUE(bank[i].in_history(100 + num_facets));
+  }
+
+  InlineRayHistory moved(std::move(bank.back()));
+  EXPECT_EQ(num_facets, moved.size());
+  EXPECT_EQ(0, bank.back().size());
+
+  copy = moved;
+  EXPECT_EQ(num_facets, copy.size());
+  copy = std::move(moved);
+  EXPECT_EQ(num_facets, copy.size());
+  EXPECT_EQ(0, moved.size());
+  EXPECT_FALSE(moved.in_history(101));
+}
+
+TEST(InlineRayHistoryTest, ray_history_version) {
+  // adding facets keeps the version, removing them or assigning changes it
+  InlineRayHistory history;
+  fill(history, InlineRayHistory::INLINE_CAPACITY + 2);
+  unsigned long version = history.version();
+  history.add_entity(7);
+  EXPECT_EQ(version, history.version());
+  EXPECT_EQ(7u, history[history.size() - 1]);
+  EXPECT_EQ(101u, history[0]);
+
+  history.rollback_last_intersection();
+  EXPECT_NE(version, history.version());
+  version = history.version();
+  history.reset_to_last_intersection();
+  EXPECT_NE(version, history.version());
+  version = history.version();
+  history.reset();
+  EXPECT_NE(version, history.version());
+
+  // a history assigned a copy of itself has another version than before
+  InlineRayHistory copy(history);
+  EXPECT_EQ(history.version(), copy.version());
+  fill(copy, 2);
+  version = history.version();
+  history = copy;
+  EXPECT_LT(version, history.version());
+  EXPECT_LT(copy.version(), history.version());
+}
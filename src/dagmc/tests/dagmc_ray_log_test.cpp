@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "RayLog.hpp"
+
+using moab::RayLog;
+
+// a record whose fields all follow from its number
+static RayLog::Record make_record(int n) {
+  RayLog::Record record;
+  record.query = (RayLog::Query)(1 + n % 3);
+  record.status = n % 5 ? 0 : 1;
+  record.volume = n;
+  for (int k = 0; k < 3; k++) {
+    record.point[k] = n + 0.1 * k;
+    record.direction[k] = -n - 0.2 * k;
+  }
+  record.has_direction = RayLog::POINT_IN_VOLUME != record.query || n % 2;
+  record.dist_limit = 0.5 * n;
+  record.orientation = n % 2 ? 1 : -1;
+  for (int i = 0; i < n % 4; i++) record.history.push_back(1000 * n + i);
+  record.surface = 2 * n;
+  record.distance = 0.25 * n;
+  record.inside = n % 2;
+  return record;
+}
+
+static void expect_record(int n, const RayLog::Record& record) {
+  const RayLog::Record expected = make_record(n);
+  EXPECT_EQ(expected.query, record.query);
+  EXPECT_EQ(expected.status, record.status);
+  EXPECT_EQ(expected.volume, record.volume);
+  EXPECT_EQ(expected.has_direction, record.has_direction);
+  for (int k = 0; k < 3; k++) {
+    EXPECT_EQ(expected.point[k], record.point[k]);
+    if (expected.has_direction) {
+      EXPECT_EQ(expected.direction[k], record.direction[k]);
+    }
+  }
+  EXPECT_EQ(expected.history, record.history);
+  if (RayLog::RAY_FIRE == expected.query) {
+    EXPECT_EQ(expected.dist_limit, record.dist_limit);
+    EXPECT_EQ(expected.orientation, record.orientation);
+  }
+  if (RayLog::POINT_IN_VOLUME == expected.query) {
+    EXPECT_EQ(expected.inside, record.inside);
+  } else {
+    EXPECT_EQ(expected.surface, record.surface);
+    EXPECT_EQ(expected.distance, record.distance);
+  }
+}
+
+TEST(RayLogTest, ray_log_threads) {
+  // the records of every thread are written whole, and those of one thread
+  // in order
+  const char* filename = "ray_log_threads.bin";
+  RayLog log;
+  ASSERT_TRUE(log.open(filename));
+  const int num_threads = 4, num_records = 5000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&log, t]() {
+      for (int i = 0; i < num_records; i++)
+        log.write(make_record(t * num_records + i));
+    }));
+  }
+  for (unsigned t = 0; t < threads.size(); t++) threads[t].join();
+  EXPECT_TRUE(log.close());
+  EXPECT_EQ((uint64_t)num_threads * num_records, log.num_records());
+
+  RayLog::Reader reader;
+  ASSERT_TRUE(reader.open(filename));
+  RayLog::Record record;
+  std::vector<int> last(num_threads, -1);
+  int count = 0;
+  while (reader.read(record)) {
+    const int n = record.volume, t = n / num_records;
+    ASSERT_TRUE(t >= 0 && t < num_threads);
+    EXPECT_LT(last[t], n);
+    last[t] = n;
+    expect_record(n, record);
+    count++;
+  }
+  EXPECT_FALSE(reader.truncated());
+  EXPECT_EQ(num_threads * num_records, count);
+  remove(filename);
+}
+
+TEST(RayLogTest, ray_log_truncated) {
+  const char* filename = "ray_log_truncated.bin";
+  RayLog log;
+  ASSERT_TRUE(log.open(filename));
+  for (int n = 0; n < 3; n++) log.write(make_record(n));
+  EXPECT_TRUE(log.close());
+  // nothing is written once the log is closed
+  log.write(make_record(3));
+  EXPECT_EQ(3u, log.num_records());
+
+  // cut the last record short
+  std::ifstream in(filename, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+  in.close();
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(&bytes[0], bytes.size() - 4);
+  out.close();
+
+  RayLog::Reader reader;
+  ASSERT_TRUE(reader.open(filename));
+  RayLog::Record record;
+  for (int n = 0; n < 2; n++) {
+    ASSERT_TRUE(reader.read(record));
+    expect_record(n, record);
+  }
+  EXPECT_FALSE(reader.read(record));
+  EXPECT_TRUE(reader.truncated());
+
+  // other files are not logs
+  out.open(filename, std::ios::binary | std::ios::trunc);
+  out << "not a ray log";
+  out.close();
+  EXPECT_FALSE(reader.open(filename));
+  remove(filename);
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "RayOrder.hpp"
+#include "dagmc_test_random.hpp"
+
+using moab::RayOrder;
+
+TEST(RayOrderTest, ray_order_morton_code) {
+  EXPECT_EQ(0u, RayOrder::morton_code(0, 0, 0));
+  EXPECT_EQ(1u, RayOrder::morton_code(1, 0, 0));
+  EXPECT_EQ(2u, RayOrder::morton_code(0, 1, 0));
+  EXPECT_EQ(4u, RayOrder::morton_code(0, 0, 1));
+  EXPECT_EQ(7u, RayOrder::morton_code(1, 1, 1));
+  EXPECT_EQ(8u, RayOrder::morton_code(2, 0, 0));
+  // all 30 bits, and nothing above MORTON_BITS
+  EXPECT_EQ((1u << 30) - 1, RayOrder::morton_code(1023, 1023, 1023));
+  EXPECT_EQ(RayOrder::morton_code(5, 6, 7),
+            RayOrder::morton_code(1024 + 5, 2048 + 6, 7));
+
+  const double dir[3] = {-1.0, 0.5, -0.5};
+  EXPECT_EQ(5u, RayOrder::octant(dir));
+}
+
+TEST(RayOrderTest, ray_order_keys) {
+  // rays sorted by key are grouped by octant, and consecutive origins are
+  // much closer than in the random order
+  TestRandom random;
+  const int num_rays = 10000;
+  std::vector<double> coords[6];
+  for (int k = 0; k < 6; k++) {
+    coords[k].resize(num_rays);
+    for (int i = 0; i < num_rays; i++)
+      coords[k][i] = (k < 3 ? 50.0 : 0.5) * random.uniform(-1.0, 1.0);
+  }
+  const double* starts[3] = {&coords[0][0], &coords[1][0], &coords[2][0]};
+  const double* dirs[3] = {&coords[3][0], &coords[4][0], &coords[5][0]};
+  std::vector<uint64_t> keys;
+  RayOrder::compute_keys(num_rays, starts, dirs, keys);
+  ASSERT_EQ((size_t)num_rays, keys.size());
+
+  std::vector<int> order(num_rays);
+  for (int i = 0; i < num_rays; i++) order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [&keys](int a, int b) { return keys[a] < keys[b]; });
+
+  int octant_changes = 0;
+  double random_path = 0.0, sorted_path = 0.0;
+  for (int n = 1; n < num_rays; n++) {
+    const int a = order[n - 1], b = order[n];
+    const double da[3] = {dirs[0][a], dirs[1][a], dirs[2][a]};
+    const double db[3] = {dirs[0][b], dirs[1][b], dirs[2][b]};
+    if (RayOrder::octant(da) != RayOrder::octant(db)) octant_changes++;
+    double d_sorted = 0.0, d_random = 0.0;
+    for (int k = 0; k < 3; k++) {
+      d_sorted += pow(starts[k][b] - starts[k][a], 2);
+      d_random += pow(starts[k][n] - starts[k][n - 1], 2);
+    }
+    sorted_path += sqrt(d_sorted);
+    random_path += sqrt(d_random);
+  }
+  EXPECT_EQ(7, octant_changes);
+  EXPECT_LT(4 * sorted_path, random_path);
+
+  // origins at a single point all get Morton code 0
+  const double zero[3] = {0.0, 0.0, 0.0};
+  const double* same[3] = {zero, zero + 1, zero + 2};
+  const double d0[3] = {dirs[0][0], dirs[1][0], dirs[2][0]};
+  RayOrder::compute_keys(1, same, dirs, keys);
+  EXPECT_EQ((uint64_t)RayOrder::octant(d0) << (3 * RayOrder::MORTON_BITS),
+            keys[0]);
+}
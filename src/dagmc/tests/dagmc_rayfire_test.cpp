@@ -1,8 +1,23 @@
 #include <gtest/gtest.h>
 
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "DagMC.hpp"
+#include "QueryProfiler.hpp"
+#include "RayLog.hpp"
+#include "dagmc_test_random.hpp"
 #include "moab/Core.hpp"
 #include "moab/GeomQueryTool.hpp"
 #include "moab/Interface.hpp"
@@ -21,6 +36,14 @@ class DagmcRayFireTest : public ::testing::Test {
   virtual void SetUp() {
     // Create new DAGMC instance
     DAG = std::make_shared<moab::DagMC>();
+    // Select the native BVH trees, full or compact, if requested
+    const std::string accel = getenv("DAGMC_ACCEL") ? getenv("DAGMC_ACCEL")
+                                                     : "";
+    if (0 == accel.compare(0, 3, "bvh")) DAG->set_accel_type(DagMC::ACCEL_BVH);
+    if (accel == "bvh_compact")
+      DAG->set_tree_storage(DagMC::TREES_COMPACT);
+    else if (accel == "bvh_compact_float")
+      DAG->set_tree_storage(DagMC::TREES_COMPACT_FLOAT);
     // Load mesh from file
     rloadval = DAG->load_file(input_file);
     assert(rloadval == moab::MB_SUCCESS);
@@ -35,6 +58,47 @@ class DagmcRayFireTest : public ::testing::Test {
   moab::ErrorCode rval;
 };
 
+// random rays, as 6 doubles each: an origin in the cube of the given half
+// width about the origin and a unit direction; the same on every call
+static std::vector<double> random_rays(int num_rays, double half_width) {
+  std::vector<double> rays(6 * num_rays);
+  TestRandom random;
+  for (int r = 0; r < num_rays; r++) {
+    random.point(half_width, &rays[6 * r]);
+    random.direction(&rays[6 * r + 3]);
+  }
+  return rays;
+}
+
+// fire the same random rays in every volume of two instances of the same
+// geometry, which must find the same surfaces at distances within tol and
+// place the origins alike
+static void expect_same_hits(DagMC& dag0, DagMC& dag1, int rays_per_volume,
+                             double tol = 0.0) {
+  const int num_vols = dag0.num_entities(3);
+  const std::vector<double> rays = random_rays(rays_per_volume * num_vols, 2.0);
+  for (int r = 0; r < rays_per_volume * num_vols; r++) {
+    const int index = 1 + r % num_vols;
+    const double* origin = &rays[6 * r];
+    EntityHandle surf[2];
+    double dist[2];
+    int inside[2];
+    DagMC* dags[2] = {&dag0, &dag1};
+    for (int d = 0; d < 2; d++) {
+      const EntityHandle vol = dags[d]->entity_by_index(3, index);
+      EXPECT_EQ(MB_SUCCESS,
+                dags[d]->ray_fire(vol, origin, origin + 3, surf[d], dist[d]));
+      EXPECT_EQ(MB_SUCCESS, dags[d]->point_in_volume(vol, origin, inside[d]));
+    }
+    EXPECT_EQ(surf[0] == 0, surf[1] == 0);
+    if (surf[0] != 0 && surf[1] != 0) {
+      EXPECT_EQ(dag0.index_by_handle(surf[0]), dag1.index_by_handle(surf[1]));
+      EXPECT_NEAR(dist[0], dist[1], tol);
+    }
+    EXPECT_EQ(inside[0], inside[1]);
+  }
+}
+
 TEST_F(DagmcRayFireTest, dagmc_setup_test) {
   ErrorCode rval = DAG->load_file(input_file);
   EXPECT_EQ(rval, MB_SUCCESS);
@@ -153,3 +217,721 @@ TEST_F(DagmcRayFireTest, dagmc_outside_face_rayfire_history) {
   EntityHandle ZERO = 0;
   EXPECT_EQ(ZERO, next_surf);
 }
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_batch) {
+  // a batch of rays through every volume must give the same answers as
+  // firing each ray on its own
+  const int num_rays = 6;
+  int num_vols = DAG->num_entities(3);
+  double dirs[num_rays][3] = {{1.0, 0.0, 0.0},  {-1.0, 0.0, 0.0},
+                              {0.0, 1.0, 0.0},  {0.0, -1.0, 0.0},
+                              {0.0, 0.0, 1.0},  {0.0, 0.0, -1.0}};
+
+  std::vector<EntityHandle> volumes;
+  std::vector<double> x, y, z, u, v, w;
+  for (int i = num_vols; i >= 1; i--) {
+    for (int j = 0; j < num_rays; j++) {
+      volumes.push_back(DAG->entity_by_index(3, i));
+      x.push_back(0.1 * j);
+      y.push_back(0.2);
+      z.push_back(-0.3);
+      u.push_back(dirs[j][0]);
+      v.push_back(dirs[j][1]);
+      w.push_back(dirs[j][2]);
+    }
+  }
+
+  int batch_size = volumes.size();
+  const double* starts[3] = {x.data(), y.data(), z.data()};
+  const double* batch_dirs[3] = {u.data(), v.data(), w.data()};
+  std::vector<EntityHandle> next_surfs(batch_size);
+  std::vector<double> next_surf_dists(batch_size);
+  std::vector<DagMC::RayHistory> histories(batch_size);
+
+  ErrorCode rval =
+      DAG->ray_fire_batch(batch_size, volumes.data(), starts, batch_dirs,
+                          next_surfs.data(), next_surf_dists.data(),
+                          histories.data());
+  EXPECT_EQ(MB_SUCCESS, rval);
+
+  for (int i = 0; i < batch_size; i++) {
+    double point[3] = {x[i], y[i], z[i]};
+    double dir[3] = {u[i], v[i], w[i]};
+    EntityHandle next_surf;
+    double next_surf_dist;
+    DagMC::RayHistory history;
+    rval = DAG->ray_fire(volumes[i], point, dir, next_surf, next_surf_dist,
+                         &history);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_EQ(next_surf, next_surfs[i]);
+    if (next_surf != 0) {
+      EXPECT_NEAR(next_surf_dist, next_surf_dists[i], eps);
+      EXPECT_EQ(history.size(), histories[i].size());
+    }
+  }
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_accel_consistency) {
+  // the OBB and BVH trees must find the same surfaces at the same distances
+  std::shared_ptr<DagMC> obb_dag = std::make_shared<DagMC>();
+  std::shared_ptr<DagMC> bvh_dag = std::make_shared<DagMC>();
+  bvh_dag->set_accel_type(DagMC::ACCEL_BVH);
+  ErrorCode rval = obb_dag->load_file(input_file);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = obb_dag->init_OBBTree();
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = bvh_dag->load_file(input_file);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = bvh_dag->init_OBBTree();
+  EXPECT_EQ(MB_SUCCESS, rval);
+
+  expect_same_hits(*obb_dag, *bvh_dag, 100, eps);
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_bvh_cache) {
+  static const char cache_file[] = "test_geom_rayfire.bvh";
+  remove(cache_file);
+
+  // the first run builds the trees and writes the cache, the second one maps
+  // the trees from the cache
+  std::shared_ptr<DagMC> dags[2];
+  for (int i = 0; i < 2; i++) {
+    dags[i] = std::make_shared<DagMC>();
+    dags[i]->set_accel_type(DagMC::ACCEL_BVH);
+    dags[i]->set_accel_cache(cache_file);
+    ErrorCode rval = dags[i]->load_file(input_file);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    rval = dags[i]->init_OBBTree();
+    EXPECT_EQ(MB_SUCCESS, rval);
+  }
+
+  expect_same_hits(*dags[0], *dags[1], 100);
+
+  // a cache written for other geometry is rebuilt, not used
+  dags[1].reset();
+  std::shared_ptr<DagMC> other = std::make_shared<DagMC>();
+  ErrorCode rval = other->load_file("test_dagmc.h5m");
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = other->init_OBBTree();
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = other->write_accel_cache(cache_file);
+  EXPECT_EQ(MB_SUCCESS, rval);
+
+  std::shared_ptr<DagMC> rebuilt = std::make_shared<DagMC>();
+  rebuilt->set_accel_type(DagMC::ACCEL_BVH);
+  rebuilt->set_accel_cache(cache_file);
+  rval = rebuilt->load_file(input_file);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = rebuilt->init_OBBTree();
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EntityHandle surf;
+  double dist;
+  const double origin[3] = {0.0, 0.0, 0.0};
+  const double dir[3] = {1.0, 0.0, 0.0};
+  rval = rebuilt->ray_fire(rebuilt->entity_by_index(3, 1), origin, dir, surf,
+                           dist);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_NEAR(5.0, dist, eps);
+
+  // the same file loaded after another facet has other facet handles, so
+  // the cache is rebuilt, not used
+  rebuilt.reset();
+  std::shared_ptr<Interface> mbi = std::make_shared<Core>();
+  const double coords[9] = {0., 0., 0., 1., 0., 0., 0., 1., 0.};
+  EntityHandle verts[3], tri;
+  for (int k = 0; k < 3; k++)
+    ASSERT_EQ(MB_SUCCESS, mbi->create_vertex(coords + 3 * k, verts[k]));
+  ASSERT_EQ(MB_SUCCESS, mbi->create_element(MBTRI, verts, 3, tri));
+  std::shared_ptr<DagMC> shifted = std::make_shared<DagMC>(mbi);
+  shifted->set_accel_type(DagMC::ACCEL_BVH);
+  shifted->set_accel_cache(cache_file);
+  EXPECT_EQ(MB_SUCCESS, shifted->load_file(input_file));
+  EXPECT_EQ(MB_SUCCESS, shifted->init_OBBTree());
+  EXPECT_LT(0, shifted->setup_times().threads);
+
+  remove(cache_file);
+}
+
+#ifdef __linux__
+// resident and proportional set size in kB of the mappings of a file
+static void mapped_size(const char* filename, long& rss, long& pss) {
+  rss = pss = 0;
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  bool in_file = false;
+  while (std::getline(smaps, line)) {
+    const std::string key = line.substr(0, line.find(' '));
+    if (key.empty() || ':' != key[key.size() - 1]) {
+      // the first line of a mapping: address range, flags, ..., path
+      in_file = std::string::npos != line.find(filename);
+    } else if (in_file && "Rss:" == key) {
+      rss += atol(line.c_str() + key.size());
+    } else if (in_file && "Pss:" == key) {
+      pss += atol(line.c_str() + key.size());
+    }
+  }
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_bvh_cache_shared) {
+  static const char cache_file[] = "test_geom_rayfire_shared.bvh";
+  static const int num_procs = 4;
+  static const int num_rays = 1000;
+  remove(cache_file);
+
+  // reference hits from the trees of this process
+  int num_vols = DAG->num_entities(3);
+  const std::vector<double> rays = random_rays(num_rays, 2.0);
+  std::vector<int> vols(num_rays), ref_surfs(num_rays);
+  std::vector<double> ref_dists(num_rays);
+  for (int j = 0; j < num_rays; j++) {
+    vols[j] = 1 + j % num_vols;
+    EntityHandle surf;
+    ErrorCode rval = DAG->ray_fire(DAG->entity_by_index(3, vols[j]),
+                                   &rays[6 * j], &rays[6 * j + 3], surf,
+                                   ref_dists[j]);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    ref_surfs[j] = surf ? DAG->index_by_handle(surf) : 0;
+  }
+
+  // the processes of a node start together; one builds the cache and all of
+  // them map it
+  struct Result {
+    int ok;
+    int built;
+    int mismatches;
+    long rss;
+    long pss;
+  };
+  int ready[2], go[2], results[2];
+  ASSERT_EQ(0, pipe(ready));
+  ASSERT_EQ(0, pipe(go));
+  ASSERT_EQ(0, pipe(results));
+  std::vector<pid_t> pids;
+  for (int p = 0; p < num_procs; p++) {
+    pid_t pid = fork();
+    ASSERT_LE(0, pid);
+    if (pid) {
+      pids.push_back(pid);
+      continue;
+    }
+
+    Result result = {0, 0, 0, 0, 0};
+    DagMC dag;
+    dag.set_accel_type(DagMC::ACCEL_BVH);
+    dag.set_accel_cache(cache_file);
+    if (MB_SUCCESS == dag.load_file(input_file) &&
+        MB_SUCCESS == dag.init_OBBTree()) {
+      result.ok = 1;
+      result.built = dag.setup_times().threads > 0;
+      for (int j = 0; j < num_rays; j++) {
+        EntityHandle surf;
+        double dist;
+        ErrorCode rval = dag.ray_fire(dag.entity_by_index(3, vols[j]),
+                                      &rays[6 * j], &rays[6 * j + 3], surf,
+                                      dist);
+        int index = surf ? dag.index_by_handle(surf) : 0;
+        if (MB_SUCCESS != rval || index != ref_surfs[j] ||
+            (surf && fabs(dist - ref_dists[j]) > eps))
+          result.mismatches++;
+      }
+    }
+
+    // measure once every process has mapped the cache
+    char c = 0;
+    if (1 != write(ready[1], &c, 1) || 1 != read(go[0], &c, 1)) _exit(1);
+    mapped_size(cache_file, result.rss, result.pss);
+    if (sizeof(result) != write(results[1], &result, sizeof(result)))
+      _exit(1);
+    _exit(0);
+  }
+  close(ready[1]);
+  close(results[1]);
+
+  for (int p = 0; p < num_procs; p++) {
+    char c;
+    ASSERT_EQ(1, read(ready[0], &c, 1));
+  }
+  const std::string start(num_procs, 'x');
+  ASSERT_EQ(num_procs, write(go[1], start.data(), num_procs));
+
+  int num_built = 0;
+  for (int p = 0; p < num_procs; p++) {
+    Result result;
+    ASSERT_EQ((ssize_t)sizeof(result),
+              read(results[0], &result, sizeof(result)));
+    EXPECT_EQ(1, result.ok);
+    EXPECT_EQ(0, result.mismatches);
+    num_built += result.built;
+    // every process has the trees of the cache mapped, and their pages are
+    // shared with the other processes rather than held by each
+    EXPECT_LT(0, result.rss);
+    EXPECT_LE(2 * result.pss, result.rss);
+  }
+  EXPECT_EQ(1, num_built);
+  for (unsigned p = 0; p < pids.size(); p++) {
+    int status;
+    EXPECT_EQ(pids[p], waitpid(pids[p], &status, 0));
+    EXPECT_TRUE(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+  }
+  close(ready[0]);
+  close(go[0]);
+  close(go[1]);
+  close(results[0]);
+
+  remove(cache_file);
+  remove((std::string(cache_file) + ".lock").c_str());
+}
+#endif
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_query_context_threads) {
+  // threads sharing one DagMC, each with a context of its own, answer as a
+  // single thread does; only the BVH trees answer them in parallel
+  const int num_points = 400, num_threads = 4;
+  DagMC dag;
+  dag.set_accel_type(DagMC::ACCEL_BVH);
+  ASSERT_EQ(MB_SUCCESS, dag.load_file(input_file));
+  ASSERT_EQ(MB_SUCCESS, dag.init_OBBTree());
+  EntityHandle vol_h = dag.entity_by_index(3, 1);
+  const std::vector<double> rays = random_rays(num_points, 4.0);
+
+  // answers of the single thread in [0], of the threads in [1]
+  std::vector<EntityHandle> surfs[2];
+  std::vector<double> dists[2], closest[2];
+  std::vector<int> inside[2];
+  for (int r = 0; r < 2; r++) {
+    surfs[r].resize(num_points);
+    dists[r].resize(num_points);
+    closest[r].resize(num_points);
+    inside[r].resize(num_points);
+  }
+  auto query = [&](int r, int first, int stride) {
+    DagMC::QueryContext context;
+    for (int i = first; i < num_points; i += stride) {
+      const double* xyz = &rays[6 * i];
+      context.reset();
+      EXPECT_EQ(MB_SUCCESS, dag.ray_fire(context, vol_h, xyz, xyz + 3,
+                                         surfs[r][i], dists[r][i]));
+      EXPECT_EQ(MB_SUCCESS,
+                dag.point_in_volume(context, vol_h, xyz, inside[r][i]));
+      EXPECT_EQ(MB_SUCCESS,
+                dag.closest_to_location(vol_h, xyz, closest[r][i]));
+    }
+  };
+
+  query(0, 0, 1);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++)
+    threads.emplace_back(query, 1, t, num_threads);
+  for (unsigned t = 0; t < threads.size(); t++) threads[t].join();
+
+  for (int i = 0; i < num_points; i++) {
+    EXPECT_EQ(surfs[0][i], surfs[1][i]);
+    EXPECT_EQ(dists[0][i], dists[1][i]);
+    EXPECT_EQ(inside[0][i], inside[1][i]);
+    EXPECT_EQ(closest[0][i], closest[1][i]);
+  }
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_context_history) {
+  // the history of a context is kept in step with the GeomQueryTool history
+  // of the OBB trees as facets are added, rolled back and the history is
+  // assigned, so a context answers as the history of the caller does
+  DagMC dag;
+  ASSERT_EQ(MB_SUCCESS, dag.load_file(input_file));
+  ASSERT_EQ(MB_SUCCESS, dag.init_OBBTree());
+  const EntityHandle vol = dag.entity_by_index(3, 1);
+  const double dir[3] = {1.0, 0.0, 0.0};
+  double xyz[3] = {0.0, 0.0, 0.0};
+  DagMC::QueryContext context;
+  DagMC::RayHistory history;
+  EntityHandle surf[2];
+  double dist[2];
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(MB_SUCCESS, dag.ray_fire(context, vol, xyz, dir, surf[0],
+                                       dist[0]));
+    EXPECT_EQ(MB_SUCCESS,
+              dag.ray_fire(vol, xyz, dir, surf[1], dist[1], &history));
+    EXPECT_EQ(surf[1], surf[0]);
+    EXPECT_EQ(dist[1], dist[0]);
+    EXPECT_EQ(history.size(), context.history.size());
+    if (i == 1) {
+      // step back onto the surface just crossed
+      context.history.rollback_last_intersection();
+      history.rollback_last_intersection();
+    } else if (i == 2) {
+      // a banked copy of the history, restored
+      const InlineRayHistory banked = context.history;
+      context.history.reset();
+      EXPECT_EQ(MB_SUCCESS, dag.ray_fire(context, vol, xyz, dir, surf[0],
+                                         dist[0]));
+      context.history = banked;
+    }
+  }
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_bvh_threads) {
+  // trees built on one thread and on several threads must be identical
+  std::shared_ptr<DagMC> dags[2];
+  for (int i = 0; i < 2; i++) {
+    dags[i] = std::make_shared<DagMC>();
+    dags[i]->set_accel_type(DagMC::ACCEL_BVH);
+    dags[i]->set_build_threads(i == 0 ? 1 : 4);
+    ErrorCode rval = dags[i]->load_file(input_file);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    rval = dags[i]->init_OBBTree();
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_LE(0.0, dags[i]->setup_times().trees);
+  }
+
+  expect_same_hits(*dags[0], *dags[1], 100);
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_bvh_lazy) {
+  // lazily built trees are only built for the volumes that are queried, and
+  // must give the same results as the trees built up front
+  std::shared_ptr<DagMC> dags[2];
+  for (int i = 0; i < 2; i++) {
+    dags[i] = std::make_shared<DagMC>();
+    dags[i]->set_accel_type(DagMC::ACCEL_BVH);
+    dags[i]->set_lazy_trees(i == 1);
+    ErrorCode rval = dags[i]->load_file(input_file);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    rval = dags[i]->init_OBBTree();
+    EXPECT_EQ(MB_SUCCESS, rval);
+  }
+
+  int num_built, num_volumes;
+  dags[1]->get_tree_counts(num_built, num_volumes);
+  EXPECT_EQ(0, num_built);
+  EXPECT_LT(1, num_volumes);
+
+  double origin[3] = {0.0, 0.0, 0.0};
+  double dir[3] = {-1.0, 0.0, 0.0};
+  EntityHandle next_surf;
+  double next_surf_dist;
+  ErrorCode rval = dags[1]->ray_fire(dags[1]->entity_by_index(3, 1), origin,
+                                     dir, next_surf, next_surf_dist);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_NEAR(5.0, next_surf_dist, eps);
+  dags[1]->get_tree_counts(num_built, num_volumes);
+  EXPECT_EQ(1, num_built);
+
+  // only the queried volume holds facets and memory
+  size_t bytes[2], num_facets[2];
+  for (int i = 0; i < 2; i++)
+    EXPECT_EQ(MB_SUCCESS, dags[i]->get_bvh_memory(bytes[i], num_facets[i]));
+  EXPECT_LT(0u, num_facets[1]);
+  EXPECT_LT(num_facets[1], num_facets[0]);
+  EXPECT_LT(bytes[1], bytes[0]);
+
+  // first queries of the same volumes from several threads at once
+  int num_vols = dags[0]->num_entities(3);
+  const std::vector<double> rays = random_rays(100 * num_vols, 2.0);
+  std::vector<EntityHandle> surfs[2];
+  std::vector<double> dists[2];
+  for (int d = 0; d < 2; d++) {
+    surfs[d].resize(rays.size() / 6);
+    dists[d].resize(rays.size() / 6);
+    int failures = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+ : failures)
+    for (int r = 0; r < (int)surfs[d].size(); r++) {
+      EntityHandle vol = dags[d]->entity_by_index(3, 1 + r % num_vols);
+      if (MB_SUCCESS != dags[d]->ray_fire(vol, &rays[6 * r], &rays[6 * r + 3],
+                                          surfs[d][r], dists[d][r]))
+        failures++;
+    }
+    EXPECT_EQ(0, failures);
+  }
+  for (size_t r = 0; r < surfs[0].size(); r++) {
+    EXPECT_EQ(surfs[0][r] == 0, surfs[1][r] == 0);
+    if (surfs[0][r] != 0 && surfs[1][r] != 0) {
+      EXPECT_EQ(dags[0]->index_by_handle(surfs[0][r]),
+                dags[1]->index_by_handle(surfs[1][r]));
+      EXPECT_EQ(dists[0][r], dists[1][r]);
+    }
+  }
+  dags[1]->get_tree_counts(num_built, num_volumes);
+  EXPECT_EQ(num_vols, num_built);
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_bvh_compact) {
+  // each storage takes less memory than the one before and finds the same
+  // surfaces at the same distances
+  const DagMC::TreeStorage storages[3] = {DagMC::TREES_FULL,
+                                          DagMC::TREES_COMPACT,
+                                          DagMC::TREES_COMPACT_FLOAT};
+  std::shared_ptr<DagMC> dags[3];
+  size_t bytes[3], num_facets[3];
+  for (int i = 0; i < 3; i++) {
+    dags[i] = std::make_shared<DagMC>();
+    dags[i]->set_accel_type(DagMC::ACCEL_BVH);
+    dags[i]->set_tree_storage(storages[i]);
+    ErrorCode rval = dags[i]->load_file(input_file);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    rval = dags[i]->init_OBBTree();
+    EXPECT_EQ(MB_SUCCESS, rval);
+    rval = dags[i]->get_bvh_memory(bytes[i], num_facets[i]);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_EQ(num_facets[0], num_facets[i]);
+  }
+  EXPECT_LT(bytes[1], bytes[0]);
+  EXPECT_LT(bytes[2], bytes[1]);
+
+  for (int i = 1; i < 3; i++) expect_same_hits(*dags[0], *dags[i], 100, eps);
+
+  // the winding number does not need the full trees of the queries
+  double winding;
+  const double origin[3] = {0.0, 0.0, 0.0};
+  ErrorCode rval =
+      dags[1]->winding_number(dags[1]->entity_by_index(3, 1), origin, winding);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_NEAR(1.0, winding, 1e-6);
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_bvh_shared_complement) {
+  // the implicit complement queried through the trees of its neighbours,
+  // built up front or on first use, finds the same surfaces at the same
+  // distances as its own tree, and takes less memory
+  std::shared_ptr<DagMC> dags[3];
+  size_t bytes[3], num_facets[3];
+  for (int i = 0; i < 3; i++) {
+    dags[i] = std::make_shared<DagMC>();
+    dags[i]->set_accel_type(DagMC::ACCEL_BVH);
+    dags[i]->set_shared_complement(i > 0);
+    dags[i]->set_lazy_trees(i == 2);
+    ErrorCode rval = dags[i]->load_file(input_file);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    rval = dags[i]->init_OBBTree();
+    EXPECT_EQ(MB_SUCCESS, rval);
+  }
+  int impl_compl = 0;
+  const int num_vols = dags[0]->num_entities(3);
+  for (int v = 1; v <= num_vols; v++) {
+    if (dags[0]->is_implicit_complement(dags[0]->entity_by_index(3, v)))
+      impl_compl = v;
+  }
+  ASSERT_NE(0, impl_compl);
+
+  const std::vector<double> rays = random_rays(1000, 12.0);
+  for (int j = 0; j < 1000; j++) {
+    const double *origin = &rays[6 * j], *dir = origin + 3;
+    const int orientation = j % 2 ? 1 : -1;
+
+    EntityHandle surfs[3], closest_surfs[3];
+    double dists[3], closest[3];
+    int inside[3];
+    for (int i = 0; i < 3; i++) {
+      const EntityHandle vol = dags[i]->entity_by_index(3, impl_compl);
+      ErrorCode rval = dags[i]->ray_fire(vol, origin, dir, surfs[i], dists[i],
+                                         NULL, 0, orientation);
+      EXPECT_EQ(MB_SUCCESS, rval);
+      rval = dags[i]->point_in_volume(vol, origin, inside[i], dir);
+      EXPECT_EQ(MB_SUCCESS, rval);
+      rval = dags[i]->closest_to_location(vol, origin, closest[i],
+                                          &closest_surfs[i]);
+      EXPECT_EQ(MB_SUCCESS, rval);
+    }
+    for (int i = 1; i < 3; i++) {
+      EXPECT_EQ(surfs[0] == 0, surfs[i] == 0);
+      if (surfs[0] != 0 && surfs[i] != 0) {
+        EXPECT_EQ(dags[0]->index_by_handle(surfs[0]),
+                  dags[i]->index_by_handle(surfs[i]));
+        EXPECT_NEAR(dists[0], dists[i], eps);
+      }
+      EXPECT_EQ(inside[0], inside[i]);
+      EXPECT_NEAR(closest[0], closest[i], eps);
+    }
+  }
+
+  for (int i = 0; i < 3; i++) {
+    ErrorCode rval = dags[i]->get_bvh_memory(bytes[i], num_facets[i]);
+    EXPECT_EQ(MB_SUCCESS, rval);
+  }
+  EXPECT_LT(bytes[1], bytes[0]);
+  EXPECT_LT(num_facets[1], num_facets[0]);
+
+  // the winding number does not need the tree of the complement
+  double winding;
+  const double origin[3] = {0.0, 0.0, 0.0};
+  ErrorCode rval = dags[1]->winding_number(
+      dags[1]->entity_by_index(3, impl_compl), origin, winding);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_NEAR(0.0, winding, 1e-6);
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_profile) {
+  // every ray is counted against its volume, whatever the acceleration
+  // structure, and the rays leaving the geometry are lost
+  DAG->set_profile_queries(true);
+  int num_vols = DAG->num_entities(3);
+  const std::vector<double> random = random_rays(100 * num_vols, 2.0);
+  std::vector<uint64_t> rays(num_vols + 1, 0), lost(num_vols + 1, 0);
+  for (int r = 0; r < 100 * num_vols; r++) {
+    const int index = 1 + r % num_vols;
+    EntityHandle surf;
+    double dist;
+    ErrorCode rval = DAG->ray_fire(DAG->entity_by_index(3, index),
+                                   &random[6 * r], &random[6 * r + 3], surf,
+                                   dist);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    rays[index]++;
+    if (!surf) lost[index]++;
+  }
+  DagMC::QueryContext context;
+  const double origin[3] = {0.0, 0.0, 0.0};
+  int result;
+  ErrorCode rval =
+      DAG->point_in_volume(context, DAG->entity_by_index(3, 1), origin, result);
+  EXPECT_EQ(MB_SUCCESS, rval);
+
+  std::vector<QueryProfiler::Counts> counts;
+  DAG->query_profile().get_counts(counts);
+  ASSERT_EQ((size_t)num_vols + 1, counts.size());
+  for (int v = 1; v <= num_vols; v++) {
+    EXPECT_EQ(rays[v], counts[v].calls[QueryProfiler::RAY_FIRE]);
+    EXPECT_EQ(lost[v], counts[v].lost);
+    EXPECT_LT(0u, counts[v].nodes);
+  }
+  EXPECT_EQ(1u, counts[1].calls[QueryProfiler::POINT_IN_VOLUME]);
+
+  const char* filename = "dagmc_rayfire_profile.json";
+  rval = DAG->write_query_profile(filename);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  std::ifstream str(filename);
+  std::string first_line;
+  std::getline(str, first_line);
+  EXPECT_EQ("{", first_line);
+  remove(filename);
+
+  DAG->reset_query_profile();
+  DAG->query_profile().get_counts(counts);
+  EXPECT_EQ(0u, counts[1].calls[QueryProfiler::RAY_FIRE]);
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_tuned) {
+  // a pilot run that only queries the first volume tunes its tree
+  std::shared_ptr<DagMC> pilot = std::make_shared<DagMC>();
+  pilot->set_accel_type(DagMC::ACCEL_BVH);
+  ASSERT_EQ(MB_SUCCESS, pilot->load_file(input_file));
+  ASSERT_EQ(MB_SUCCESS, pilot->init_OBBTree());
+  pilot->set_profile_queries(true);
+  const EntityHandle hot = pilot->entity_by_index(3, 1);
+  const double origin[3] = {0.1, 0.2, 0.3};
+  for (int r = 0; r < 100; r++) {
+    const double dir[3] = {cos(0.1 * r), sin(0.1 * r), 0.0};
+    EntityHandle surf;
+    double dist;
+    EXPECT_EQ(MB_SUCCESS, pilot->ray_fire(hot, origin, dir, surf, dist));
+  }
+  const char* profile_file = "dagmc_rayfire_tuned.csv";
+  ASSERT_EQ(MB_SUCCESS, pilot->write_query_profile(profile_file));
+  ASSERT_EQ(MB_SUCCESS, pilot->tune_trees());
+  ASSERT_EQ(1u, pilot->tuned_volumes().size());
+  EXPECT_EQ(hot, pilot->tuned_volumes()[0]);
+  EXPECT_NE(MB_SUCCESS, pilot->tune_trees(0.0));
+
+  // as build_obb does, the OBB trees and the profile give a cache of tuned
+  // BVH trees
+  static const char cache_file[] = "dagmc_rayfire_tuned.bvh";
+  std::shared_ptr<DagMC> builder = std::make_shared<DagMC>();
+  ASSERT_EQ(MB_SUCCESS, builder->load_file(input_file));
+  ASSERT_EQ(MB_SUCCESS, builder->init_OBBTree());
+  ASSERT_EQ(MB_SUCCESS, builder->tune_trees_from_profile(profile_file));
+  EXPECT_EQ(1u, builder->tuned_volumes().size());
+  ASSERT_EQ(MB_SUCCESS, builder->write_accel_cache(cache_file));
+  remove(profile_file);
+
+  std::shared_ptr<DagMC> production = std::make_shared<DagMC>();
+  production->set_accel_type(DagMC::ACCEL_BVH);
+  production->set_accel_cache(cache_file);
+  ASSERT_EQ(MB_SUCCESS, production->load_file(input_file));
+  ASSERT_EQ(MB_SUCCESS, production->init_OBBTree());
+  for (int r = 0; r < 100; r++) {
+    const double dir[3] = {cos(0.1 * r), sin(0.1 * r), 0.0};
+    EntityHandle surf[3];
+    double dist[3];
+    EXPECT_EQ(MB_SUCCESS, pilot->ray_fire(hot, origin, dir, surf[0], dist[0]));
+    EXPECT_EQ(MB_SUCCESS,
+              production->ray_fire(production->entity_by_index(3, 1), origin,
+                                   dir, surf[1], dist[1]));
+    EXPECT_EQ(MB_SUCCESS, DAG->ray_fire(DAG->entity_by_index(3, 1), origin,
+                                        dir, surf[2], dist[2]));
+    EXPECT_EQ(dist[0], dist[1]);
+    EXPECT_NEAR(dist[2], dist[0], eps);
+    EXPECT_EQ(pilot->index_by_handle(surf[0]),
+              production->index_by_handle(surf[1]));
+    EXPECT_EQ(pilot->index_by_handle(surf[0]), DAG->index_by_handle(surf[2]));
+  }
+  remove(cache_file);
+}
+
+TEST_F(DagmcRayFireTest, dagmc_rayfire_log) {
+  // every query is logged with its history and results, and repeating the
+  // logged queries gives the same results
+  const char* filename = "dagmc_rayfire_log.bin";
+  ErrorCode rval = DAG->open_ray_log(filename);
+  ASSERT_EQ(MB_SUCCESS, rval);
+  EntityHandle vol = DAG->entity_by_index(3, 1);
+  DagMC::QueryContext context;
+  double dir[3] = {1.0, 0.0, 0.0};
+  double xyz[3] = {-10.0, 0.0, 0.0};
+  std::vector<EntityHandle> surfs;
+  std::vector<double> dists;
+  for (int i = 0; i < 3; i++) {
+    EntityHandle surf;
+    double dist;
+    rval = DAG->ray_fire(context, vol, xyz, dir, surf, dist);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    surfs.push_back(surf);
+    dists.push_back(dist);
+    if (surf)
+      for (int k = 0; k < 3; k++) xyz[k] += dist * dir[k];
+  }
+  const double origin[3] = {0.0, 0.0, 0.0};
+  int result;
+  rval = DAG->point_in_volume(vol, origin, result);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  double closest;
+  EntityHandle closest_surf;
+  rval = DAG->closest_to_location(vol, origin, closest, &closest_surf);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = DAG->close_ray_log();
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_FALSE(DAG->ray_log_open());
+
+  RayLog::Reader reader;
+  ASSERT_TRUE(reader.open(filename));
+  RayLog::Record record;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(reader.read(record));
+    EXPECT_EQ(RayLog::RAY_FIRE, record.query);
+    EXPECT_EQ(1, record.volume);
+    EXPECT_EQ((size_t)i, record.history.size());
+    EXPECT_EQ(surfs[i] ? DAG->index_by_handle(surfs[i]) : 0, record.surface);
+    if (surfs[i]) {
+      EXPECT_EQ(dists[i], record.distance);
+    }
+
+    // the logged history excludes the same facets again
+    DagMC::QueryContext replay;
+    for (unsigned f = 0; f < record.history.size(); f++)
+      replay.history.add_entity(record.history[f]);
+    EntityHandle surf;
+    double dist;
+    rval = DAG->ray_fire(replay, DAG->entity_by_index(3, record.volume),
+                         record.point, record.direction, surf, dist);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_EQ(surfs[i], surf);
+  }
+  ASSERT_TRUE(reader.read(record));
+  EXPECT_EQ(RayLog::POINT_IN_VOLUME, record.query);
+  EXPECT_FALSE(record.has_direction);
+  EXPECT_EQ(result, record.inside);
+  ASSERT_TRUE(reader.read(record));
+  EXPECT_EQ(RayLog::CLOSEST_TO_LOCATION, record.query);
+  EXPECT_EQ(closest, record.distance);
+  EXPECT_EQ(DAG->index_by_handle(closest_surf), record.surface);
+  EXPECT_FALSE(reader.read(record));
+  EXPECT_FALSE(reader.truncated());
+  remove(filename);
+}
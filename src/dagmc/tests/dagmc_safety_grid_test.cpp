@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "SafetyGrid.hpp"
+#include "dagmc_test_random.hpp"
+
+using moab::SafetyGrid;
+
+// distance from a point to a sphere of radius 10 centered at the origin
+static double sphere_distance(const double xyz[3]) {
+  return fabs(sqrt(xyz[0] * xyz[0] + xyz[1] * xyz[1] + xyz[2] * xyz[2]) -
+              10.0);
+}
+
+static void fill(SafetyGrid& grid) {
+  for (int cell = 0; cell < grid.num_cells(); cell++) {
+    double center[3];
+    grid.cell_center(cell, center);
+    grid.set_distance(cell, sphere_distance(center));
+  }
+}
+
+TEST(SafetyGridTest, safety_grid_bound) {
+  const double box[6] = {-10.0, -10.0, -10.0, 10.0, 10.0, 10.0};
+  SafetyGrid grid;
+  EXPECT_TRUE(grid.empty());
+  const int max_cells = 4096;
+  grid.setup(box, max_cells);
+  EXPECT_FALSE(grid.empty());
+  EXPECT_GE(max_cells, grid.num_cells());
+  EXPECT_LT(max_cells / 2, grid.num_cells());
+  fill(grid);
+
+  // the bound never exceeds the distance, inside or outside the box, and
+  // is within two cells of it
+  TestRandom random;
+  for (int i = 0; i < 20000; i++) {
+    double xyz[3];
+    random.point(20.0, xyz);
+    const double distance = sphere_distance(xyz);
+    const double bound = grid.lower_bound(xyz);
+    EXPECT_LE(bound, distance);
+    EXPECT_GE(bound, 0.0);
+    if (fabs(xyz[0]) < 10.0 && fabs(xyz[1]) < 10.0 && fabs(xyz[2]) < 10.0) {
+      EXPECT_GE(bound, distance - 4.0 * grid.cell_radius());
+    }
+  }
+
+  // the center of the sphere is far from any facet
+  const double center[3] = {0.0, 0.0, 0.0};
+  EXPECT_GT(grid.lower_bound(center), grid.cell_radius());
+
+  // points that are not a number get no bound
+  const double nan_point[3] = {NAN, 0.0, 0.0};
+  EXPECT_EQ(0.0, grid.lower_bound(nan_point));
+}
+
+TEST(SafetyGridTest, safety_grid_flat_box) {
+  // a flat box gets cells along its other two axes only
+  const double box[6] = {-10.0, -10.0, 0.0, 10.0, 10.0, 0.0};
+  SafetyGrid grid;
+  grid.setup(box, 100);
+  EXPECT_GE(100, grid.num_cells());
+  EXPECT_LT(50, grid.num_cells());
+
+  // a square plate: the distance to the plate, which is also the distance
+  // to the box
+  for (int cell = 0; cell < grid.num_cells(); cell++)
+    grid.set_distance(cell, 0.0);
+  const double above[3] = {0.0, 0.0, 3.0};
+  EXPECT_DOUBLE_EQ(3.0, grid.lower_bound(above));
+  const double on[3] = {1.0, 2.0, 0.0};
+  EXPECT_EQ(0.0, grid.lower_bound(on));
+}
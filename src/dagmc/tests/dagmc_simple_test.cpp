@@ -1,9 +1,16 @@
 #include <gtest/gtest.h>
 
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
 #include <iostream>
 
 #include "DagMC.hpp"
+#include "dagmc_test_random.hpp"
 #include "moab/Core.hpp"
+#include "moab/GeomQueryTool.hpp"
 #include "moab/Interface.hpp"
 
 using namespace moab;
@@ -234,6 +241,60 @@ TEST_F(DagmcSimpleTest, dagmc_closest_to) {
   EXPECT_NEAR(expect_distance, distance, eps);
 }
 
+TEST_F(DagmcSimpleTest, dagmc_safety_distance) {
+  const double eps = 1e-6;
+  // without safety grids, the default, the bounds are exact
+  EntityHandle vol_h = DAG->entity_by_index(3, 1);
+  double xyz[3] = {1.0, 2.0, 3.0};
+  double exact, bound;
+  ErrorCode rval = DAG->safety_distance(vol_h, xyz, exact);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  rval = DAG->safety_distance(vol_h, xyz, bound, DagMC::SAFETY_CONSERVATIVE);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_EQ(exact, bound);
+
+  // the grids are built with the trees
+  std::shared_ptr<DagMC> dag = std::make_shared<DagMC>();
+  dag->set_safety_grid_cells(4096);
+  ASSERT_EQ(MB_SUCCESS, dag->load_file(input_file));
+  ASSERT_EQ(MB_SUCCESS, dag->init_OBBTree());
+  vol_h = dag->entity_by_index(3, 1);
+
+  // the cube of side 10 is 5 from its center
+  xyz[0] = xyz[1] = xyz[2] = 0.0;
+  rval = dag->safety_distance(vol_h, xyz, exact, DagMC::SAFETY_EXACT);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_NEAR(5.0, exact, eps);
+  rval = dag->safety_distance(vol_h, xyz, bound, DagMC::SAFETY_CONSERVATIVE);
+  EXPECT_EQ(MB_SUCCESS, rval);
+  EXPECT_LE(bound, exact);
+  EXPECT_GT(bound, 4.0);
+
+  // the bound never exceeds the distance, inside or outside the cube, and
+  // is exact near the surfaces
+  TestRandom random;
+  for (int i = 0; i < 2000; i++) {
+    double inside = 0.0, outside = 0.0;
+    random.point(8.0, xyz);
+    for (int k = 0; k < 3; k++) {
+      inside = std::max(inside, fabs(xyz[k]));
+      outside += std::max(fabs(xyz[k]) - 5.0, 0.0) *
+                 std::max(fabs(xyz[k]) - 5.0, 0.0);
+    }
+    const double expected = inside < 5.0 ? 5.0 - inside : sqrt(outside);
+
+    rval = dag->safety_distance(vol_h, xyz, exact);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_NEAR(expected, exact, eps);
+    rval = dag->safety_distance(vol_h, xyz, bound, DagMC::SAFETY_CONSERVATIVE);
+    EXPECT_EQ(MB_SUCCESS, rval);
+    EXPECT_LE(bound, exact + eps);
+    if (expected < 0.1) {
+      EXPECT_NEAR(exact, bound, eps);
+    }
+  }
+}
+
 TEST_F(DagmcSimpleTest, dagmc_test_boundary) {
   int vol_idx = 1;
   EntityHandle vol_h = DAG->entity_by_index(3, vol_idx);
@@ -250,3 +311,97 @@ TEST_F(DagmcSimpleTest, dagmc_test_boundary) {
   // check ray leaving volume
   EXPECT_EQ(expect_result, result);
 }
+
+TEST_F(DagmcSimpleTest, dagmc_surface_tables) {
+  // the surface tables must answer like the topology sets and sense tags
+  std::shared_ptr<GeomTopoTool> gtt = DAG->geom_tool();
+  for (unsigned s = 1; s <= DAG->num_entities(2); s++) {
+    EntityHandle surf_h = DAG->entity_by_index(2, s);
+    for (unsigned v = 1; v <= DAG->num_entities(3); v++) {
+      EntityHandle vol_h = DAG->entity_by_index(3, v);
+
+      EntityHandle next = 0, expect_next = 0;
+      ErrorCode rval = DAG->next_vol(surf_h, vol_h, next);
+      ErrorCode expect_rval = gtt->next_vol(surf_h, vol_h, expect_next);
+      EXPECT_EQ(expect_rval, rval);
+      EXPECT_EQ(expect_next, next);
+
+      int sense = 2, expect_sense = 2;
+      rval = DAG->surface_sense(vol_h, surf_h, sense);
+      expect_rval = gtt->get_sense(surf_h, vol_h, expect_sense);
+      EXPECT_EQ(expect_rval, rval);
+      EXPECT_EQ(expect_sense, sense);
+    }
+  }
+}
+
+TEST_F(DagmcSimpleTest, dagmc_id_tables) {
+  // the ID tables must answer like the geometry sets
+  std::shared_ptr<GeomTopoTool> gtt = DAG->geom_tool();
+  for (int dim = 2; dim <= 3; dim++) {
+    for (unsigned i = 1; i <= DAG->num_entities(dim); i++) {
+      EntityHandle h = DAG->entity_by_index(dim, i);
+      const int id = gtt->global_id(h);
+      EXPECT_EQ(id, DAG->id_by_index(dim, i));
+      EXPECT_EQ(id, DAG->get_entity_id(h));
+      EXPECT_EQ(gtt->entity_by_id(dim, id), DAG->entity_by_id(dim, id));
+      EXPECT_EQ(DAG->index_by_handle(gtt->entity_by_id(dim, id)),
+                DAG->index_by_id(dim, id));
+    }
+  }
+  EXPECT_EQ(0u, DAG->entity_by_id(3, 1000000));
+  EXPECT_EQ(0, DAG->index_by_id(2, -5));
+}
+
+TEST_F(DagmcSimpleTest, dagmc_measures) {
+  // the cached measures are those computed from the facets
+  GeomQueryTool gqt(DAG->geom_tool().get());
+  for (unsigned i = 1; i <= DAG->num_entities(3); i++) {
+    EntityHandle vol = DAG->entity_by_index(3, i);
+    double expected, measure;
+    EXPECT_EQ(MB_SUCCESS, gqt.measure_volume(vol, expected));
+    EXPECT_EQ(MB_SUCCESS, DAG->measure_volume(vol, measure));
+    EXPECT_DOUBLE_EQ(expected, measure);
+  }
+  for (unsigned i = 1; i <= DAG->num_entities(2); i++) {
+    EntityHandle surf = DAG->entity_by_index(2, i);
+    double expected, measure;
+    EXPECT_EQ(MB_SUCCESS, gqt.measure_area(surf, expected));
+    EXPECT_EQ(MB_SUCCESS, DAG->measure_area(surf, measure));
+    EXPECT_DOUBLE_EQ(expected, measure);
+  }
+
+  // files written afterwards keep the measures in tags
+  const char* filename = "dagmc_measures.h5m";
+  ASSERT_EQ(MB_SUCCESS, DAG->write_mesh(filename, strlen(filename)));
+  std::shared_ptr<DagMC> dagmc = std::make_shared<DagMC>();
+  ASSERT_EQ(MB_SUCCESS, dagmc->load_file(filename));
+  remove(filename);
+  Tag measure_tag;
+  ASSERT_EQ(MB_SUCCESS,
+            dagmc->moab_instance()->tag_get_handle(
+                "DAGMC_MEASURE", 1, MB_TYPE_DOUBLE, measure_tag));
+  ASSERT_EQ(MB_SUCCESS, dagmc->init_OBBTree());
+  for (unsigned i = 1; i <= dagmc->num_entities(3); i++) {
+    EntityHandle vol = dagmc->entity_by_index(3, i);
+    if (dagmc->is_implicit_complement(vol)) continue;
+    double expected, tagged;
+    EXPECT_EQ(MB_SUCCESS,
+              DAG->measure_volume(
+                  DAG->entity_by_id(3, dagmc->id_by_index(3, i)), expected));
+    EXPECT_EQ(MB_SUCCESS, dagmc->moab_instance()->tag_get_data(
+                              measure_tag, &vol, 1, &tagged));
+    EXPECT_DOUBLE_EQ(expected, tagged);
+  }
+
+  // and the measures are looked up, not computed again
+  const double altered = 42;
+  EntityHandle vol = dagmc->entity_by_index(3, 1);
+  EXPECT_EQ(MB_SUCCESS, dagmc->moab_instance()->tag_set_data(measure_tag,
+                                                             &vol, 1,
+                                                             &altered));
+  ASSERT_EQ(MB_SUCCESS, dagmc->setup_indices());
+  double measure;
+  EXPECT_EQ(MB_SUCCESS, dagmc->measure_volume(vol, measure));
+  EXPECT_EQ(altered, measure);
+}
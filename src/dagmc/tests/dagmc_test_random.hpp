@@ -0,0 +1,64 @@
+#ifndef DAGMC_TEST_RANDOM_HPP
+#define DAGMC_TEST_RANDOM_HPP
+
+#include <math.h>
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+/**\brief reproducible random samples for the unit tests
+ *
+ * Each test draws from its own generator, seeded with a fixed value, so
+ * that its samples are the same on every run and platform whatever the
+ * other tests draw.
+ */
+class TestRandom {
+ public:
+  explicit TestRandom(unsigned seed = 12345) : engine(seed) {}
+
+  /** uniform in [lo, hi] */
+  double uniform(double lo = 0.0, double hi = 1.0) {
+    return lo + (hi - lo) * (double)(engine() - engine.min()) /
+                    (double)(engine.max() - engine.min());
+  }
+
+  /** uniform integer in [0, n) */
+  uint32_t index(uint32_t n) { return engine() % n; }
+
+  /** point in the cube of the given half width about the origin */
+  void point(double half_width, double xyz[3]) {
+    for (int k = 0; k < 3; k++) xyz[k] = uniform(-half_width, half_width);
+  }
+
+  /** unit direction */
+  void direction(double dir[3]) {
+    double norm = 0.0;
+    for (int k = 0; k < 3; k++) {
+      dir[k] = uniform(-1.0, 1.0);
+      norm += dir[k] * dir[k];
+    }
+    norm = sqrt(norm);
+    for (int k = 0; k < 3; k++) dir[k] /= norm;
+  }
+
+  /** corners of boxes of very different sizes in the cube of half width
+   *  50, some of them flat, 6 values per box */
+  std::vector<double> boxes(uint32_t num_boxes) {
+    std::vector<double> corners(6 * num_boxes);
+    for (uint32_t b = 0; b < num_boxes; b++) {
+      const double size = (b % 10 == 0) ? 50.0 : 2.0;
+      for (uint32_t k = 0; k < 3; k++) {
+        corners[6 * b + k] = uniform(-50.0, 50.0);
+        corners[6 * b + 3 + k] =
+            corners[6 * b + k] + (b % 7 == k ? 0.0 : uniform(0.0, size));
+      }
+    }
+    return corners;
+  }
+
+ private:
+  std::mt19937 engine;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "VolumeGrid.hpp"
+#include "dagmc_test_random.hpp"
+
+using moab::VolumeGrid;
+
+TEST(VolumeGridTest, volume_grid_candidates) {
+  TestRandom random;
+  const uint32_t num_boxes = 500;
+  const std::vector<double> corners = random.boxes(num_boxes);
+
+  VolumeGrid grid;
+  grid.build(&corners[0], num_boxes);
+  EXPECT_EQ(num_boxes, grid.num_boxes());
+  EXPECT_LT(1u, grid.num_cells());
+
+  // every box containing a point must be a candidate, and the candidates
+  // must be sorted
+  for (int i = 0; i < 20000; i++) {
+    double xyz[3];
+    random.point(70.0, xyz);
+    // also hit box corners exactly
+    if (i % 4 == 0) {
+      const uint32_t b = random.index(num_boxes);
+      for (int k = 0; k < 3; k++) xyz[k] = corners[6 * b + (i % 8 ? 3 : 0) + k];
+    }
+
+    uint32_t count;
+    const uint32_t* candidates = grid.candidates(xyz, count);
+    std::vector<uint32_t> expected;
+    for (uint32_t b = 0; b < num_boxes; b++) {
+      if (grid.contains(b, xyz)) expected.push_back(b);
+    }
+    std::vector<uint32_t> found;
+    for (uint32_t j = 0; j < count; j++) {
+      if (j > 0) {
+        EXPECT_LT(candidates[j - 1], candidates[j]);
+      }
+      if (grid.contains(candidates[j], xyz)) found.push_back(candidates[j]);
+    }
+    EXPECT_EQ(expected, found);
+  }
+}
+
+TEST(VolumeGridTest, volume_grid_tolerance) {
+  // touching boxes on a line, so that many points are near a cell side
+  const uint32_t num_boxes = 64;
+  std::vector<double> corners(6 * num_boxes);
+  for (uint32_t b = 0; b < num_boxes; b++) {
+    const double box[6] = {1.0 * b, 0.0, 0.0, 1.0 * b + 1.0, 1.0, 1.0};
+    for (int k = 0; k < 6; k++) corners[6 * b + k] = box[k];
+  }
+  VolumeGrid grid;
+  grid.build(&corners[0], num_boxes);
+
+  // the boxes grown by the tolerance that contain a point are candidates
+  TestRandom random;
+  const double tols[3] = {0.0, 1e-3, 0.7};
+  std::vector<uint32_t> merged;
+  for (int t = 0; t < 3; t++) {
+    for (int i = 0; i < 2000; i++) {
+      const double xyz[3] = {random.uniform(-1.0, 65.0),
+                             random.uniform(-1.0, 2.0),
+                             random.uniform(-1.0, 2.0)};
+      uint32_t count;
+      const uint32_t* candidates =
+          grid.candidates(xyz, tols[t], count, merged);
+      std::vector<uint32_t> expected, found;
+      for (uint32_t b = 0; b < num_boxes; b++) {
+        if (grid.contains(b, xyz, tols[t])) expected.push_back(b);
+      }
+      for (uint32_t j = 0; j < count; j++) {
+        if (j > 0) {
+          EXPECT_LT(candidates[j - 1], candidates[j]);
+        }
+        if (grid.contains(candidates[j], xyz, tols[t]))
+          found.push_back(candidates[j]);
+      }
+      EXPECT_EQ(expected, found);
+    }
+  }
+}
+
+TEST(VolumeGridTest, volume_grid_empty) {
+  VolumeGrid grid;
+  grid.build(NULL, 0);
+  EXPECT_TRUE(grid.empty());
+  const double xyz[3] = {0.0, 0.0, 0.0};
+  uint32_t count = 1;
+  grid.candidates(xyz, count);
+  EXPECT_EQ(0u, count);
+
+  // a single degenerate box
+  const double box[6] = {1.0, 2.0, 3.0, 1.0, 2.0, 3.0};
+  grid.build(box, 1);
+  EXPECT_EQ(1u, grid.num_cells());
+  const uint32_t* candidates = grid.candidates(box, count);
+  ASSERT_EQ(1u, count);
+  EXPECT_EQ(0u, candidates[0]);
+  grid.candidates(xyz, count);
+  EXPECT_EQ(0u, count);
+}
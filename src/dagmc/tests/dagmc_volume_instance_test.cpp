@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "VolumeInstance.hpp"
+
+using moab::FacetMatcher;
+using moab::InstanceTransform;
+
+// faceted ellipsoid with outward-facing triangles and distinct principal
+// axes
+static void make_ellipsoid(int num_theta, int num_phi, const double radii[3],
+                           std::vector<double>& coords) {
+  coords.clear();
+  for (int i = 0; i < num_theta; i++) {
+    for (int j = 0; j < num_phi; j++) {
+      double v[4][3];
+      for (int k = 0; k < 4; k++) {
+        const double theta = M_PI * (i + (k == 1 || k == 2)) / num_theta;
+        const double phi = 2 * M_PI * (j + (k >= 2)) / num_phi;
+        v[k][0] = radii[0] * sin(theta) * cos(phi);
+        v[k][1] = radii[1] * sin(theta) * sin(phi);
+        v[k][2] = radii[2] * cos(theta);
+      }
+      // skip the degenerate triangles at the poles
+      const int tris[2][3] = {{0, 1, 2}, {0, 2, 3}};
+      for (int t = 0; t < 2; t++) {
+        if ((i == 0 && t == 1) || (i == num_theta - 1 && t == 0)) continue;
+        for (int k = 0; k < 3; k++)
+          coords.insert(coords.end(), v[tris[t][k]], v[tris[t][k]] + 3);
+      }
+    }
+  }
+}
+
+// rotation about a unit axis
+static InstanceTransform make_transform(const double axis[3], double angle,
+                                        const double translation[3]) {
+  InstanceTransform result;
+  const double c = cos(angle), s = sin(angle), t = 1 - c;
+  const double x = axis[0], y = axis[1], z = axis[2];
+  const double r[9] = {t * x * x + c,     t * x * y - s * z, t * x * z + s * y,
+                       t * x * y + s * z, t * y * y + c,     t * y * z - s * x,
+                       t * x * z - s * y, t * y * z + s * x, t * z * z + c};
+  std::copy(r, r + 9, result.rotation);
+  std::copy(translation, translation + 3, result.translation);
+  return result;
+}
+
+// the triangles placed by the transform, in reverse order and with their
+// vertices rotated cyclically
+static void place_copy(const std::vector<double>& coords,
+                       const InstanceTransform& transform,
+                       std::vector<double>& result) {
+  const size_t num = coords.size() / 9;
+  result.resize(coords.size());
+  for (size_t t = 0; t < num; t++) {
+    for (int i = 0; i < 3; i++) {
+      transform.to_instance(&coords[9 * t + 3 * ((i + t) % 3)],
+                            &result[9 * (num - 1 - t) + 3 * i]);
+    }
+  }
+}
+
+class VolumeInstanceTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    const double radii[3] = {1.0, 2.0, 3.0};
+    make_ellipsoid(20, 40, radii, coords);
+  }
+
+  std::vector<double> coords;
+};
+
+TEST_F(VolumeInstanceTest, volume_instance_transform) {
+  const double axis[3] = {0.0, 0.6, 0.8}, shift[3] = {10.0, -5.0, 2.0};
+  InstanceTransform transform = make_transform(axis, 0.7, shift);
+  const double p[3] = {1.0, 2.0, 3.0};
+  double q[3], back[3];
+  transform.to_instance(p, q);
+  transform.to_prototype(q, back);
+  for (int k = 0; k < 3; k++) EXPECT_NEAR(p[k], back[k], 1e-12);
+
+  // directions are only rotated
+  double dir[3];
+  transform.rotate_to_prototype(axis, dir);
+  for (int k = 0; k < 3; k++) EXPECT_NEAR(axis[k], dir[k], 1e-12);
+}
+
+TEST_F(VolumeInstanceTest, volume_instance_match) {
+  const uint32_t num = coords.size() / 9;
+  FacetMatcher matcher(coords.data(), num, 1e-9);
+  EXPECT_EQ(num, matcher.num_triangles());
+
+  const double axis[3] = {0.48, 0.6, 0.64}, shift[3] = {10.0, -5.0, 2.0};
+  InstanceTransform transform = make_transform(axis, 2.1, shift);
+  std::vector<double> copy;
+  place_copy(coords, transform, copy);
+
+  std::vector<uint32_t> matches;
+  ASSERT_TRUE(matcher.match(copy.data(), num, transform, matches));
+  for (uint32_t t = 0; t < num; t++) EXPECT_EQ(num - 1 - t, matches[t]);
+
+  // the wrong placement, a moved vertex and inward-facing triangles do not
+  // match
+  InstanceTransform shifted = transform;
+  shifted.translation[0] += 1e-6;
+  EXPECT_FALSE(matcher.match(copy.data(), num, shifted, matches));
+  std::vector<double> moved = copy;
+  moved[4] += 1e-6;
+  EXPECT_FALSE(matcher.match(moved.data(), num, transform, matches));
+  std::vector<double> flipped = copy;
+  for (uint32_t t = 0; t < num; t++)
+    std::swap_ranges(&flipped[9 * t + 3], &flipped[9 * t + 6],
+                     &flipped[9 * t + 6]);
+  EXPECT_FALSE(matcher.match(flipped.data(), num, transform, matches));
+}
+
+TEST_F(VolumeInstanceTest, volume_instance_find_transform) {
+  const uint32_t num = coords.size() / 9;
+  FacetMatcher matcher(coords.data(), num, 1e-8);
+
+  // a rotated and translated copy is found through its principal axes
+  const double axis[3] = {0.48, 0.6, 0.64}, shift[3] = {10.0, -5.0, 2.0};
+  InstanceTransform transform = make_transform(axis, 2.1, shift);
+  std::vector<double> copy;
+  place_copy(coords, transform, copy);
+  InstanceTransform found;
+  ASSERT_TRUE(matcher.find_transform(copy.data(), num, found));
+  std::vector<uint32_t> matches;
+  EXPECT_TRUE(matcher.match(copy.data(), num, found, matches));
+  for (int k = 0; k < 3; k++)
+    EXPECT_NEAR(shift[k], found.translation[k], 1e-9);
+
+  // a sphere has no unique principal axes, but translated copies are found
+  const double radii[3] = {2.0, 2.0, 2.0};
+  std::vector<double> sphere;
+  make_ellipsoid(10, 20, radii, sphere);
+  FacetMatcher sphere_matcher(sphere.data(), sphere.size() / 9, 1e-8);
+  InstanceTransform translation;
+  std::copy(shift, shift + 3, translation.translation);
+  place_copy(sphere, translation, copy);
+  ASSERT_TRUE(
+      sphere_matcher.find_transform(copy.data(), sphere.size() / 9, found));
+  for (int k = 0; k < 3; k++)
+    EXPECT_NEAR(shift[k], found.translation[k], 1e-9);
+
+  // another shape is not a copy
+  EXPECT_FALSE(
+      matcher.find_transform(sphere.data(), sphere.size() / 9, found));
+}
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "DagMC.hpp"
+#include "moab/Core.hpp"
+#include "moab/GeomTopoTool.hpp"
+#include "moab/Interface.hpp"
+
+using namespace moab;
+
+static int num_crossings = 10000000;
+static int randseed = 12345;
+
+static void usage(const char* error, const char* opt,
+                  const char* name = "crossing_bench") {
+  const char* default_message = "Invalid option";
+  if (opt && !error) error = default_message;
+
+  std::ostream& str = error ? std::cerr : std::cout;
+  if (error) {
+    str << error;
+    if (opt) str << ": " << opt;
+    str << std::endl;
+  }
+
+  str << "Usage: " << name << " [options] input_file" << std::endl;
+  str << "       " << name << " -h" << std::endl;
+
+  if (!error) {
+    str << "-h  print this help" << std::endl;
+    str << "-n <int>   number of surface crossings to time (default 10000000)"
+        << std::endl;
+    str << "-z <int>   seed the random number generator (default 12345)"
+        << std::endl;
+  }
+
+  exit(error ? 1 : 0);
+}
+
+static int get_int_option(int& i, int argc, char* argv[]) {
+  if (++i == argc) usage("Expected argument following option", argv[i - 1]);
+  char* end_ptr;
+  long val = strtol(argv[i], &end_ptr, 0);
+  if (!*argv[i] || *end_ptr)
+    usage("Expected integer following option", argv[i - 1]);
+  return val;
+}
+
+// a surface crossing: the surface and the volume the particle leaves
+struct Crossing {
+  EntityHandle surface;
+  EntityHandle volume;
+};
+
+// the queries of a boundary crossing through the topology sets and sense
+// tags of GeomTopoTool, as DagMC answered them before the surface tables
+static ErrorCode cross_with_gtt(GeomTopoTool* gtt, const Crossing& crossing,
+                                EntityHandle& next, int& sense) {
+  ErrorCode rval = gtt->next_vol(crossing.surface, crossing.volume, next);
+  if (MB_SUCCESS != rval) return rval;
+  return gtt->get_sense(crossing.surface, next, sense);
+}
+
+// the same queries through the DagMC surface tables
+static ErrorCode cross_with_tables(DagMC& dagmc, const Crossing& crossing,
+                                   EntityHandle& next, int& sense) {
+  ErrorCode rval = dagmc.next_vol(crossing.surface, crossing.volume, next);
+  if (MB_SUCCESS != rval) return rval;
+  return dagmc.surface_sense(next, crossing.surface, sense);
+}
+
+int main(int argc, char* argv[]) {
+  char* filename = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if (!argv[i][1] || argv[i][2]) usage(0, argv[i], argv[0]);
+      switch (argv[i][1]) {
+        default:
+          usage(0, argv[i], argv[0]);
+          break;
+        case 'h':
+          usage(0, 0, argv[0]);
+          break;
+        case 'n':
+          num_crossings = get_int_option(i, argc, argv);
+          break;
+        case 'z':
+          randseed = get_int_option(i, argc, argv);
+          break;
+      }
+    } else if (!filename) {
+      filename = argv[i];
+    } else {
+      usage("Unexpected parameter", 0, argv[0]);
+    }
+  }
+
+  if (!filename) usage("No filename specified", 0, argv[0]);
+  if (num_crossings <= 0) usage("Number of crossings must be positive", 0);
+
+  DagMC dagmc{};
+  ErrorCode rval = dagmc.load_file(filename);
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to load file '" << filename << "'" << std::endl;
+    return 2;
+  }
+  rval = dagmc.init_OBBTree();
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to initialize DagMC." << std::endl;
+    return 2;
+  }
+  GeomTopoTool* gtt = dagmc.geom_tool().get();
+
+  // every surface with a volume on each side, crossed from either side
+  std::vector<Crossing> sides;
+  for (unsigned s = 1; s <= dagmc.num_entities(2); s++) {
+    Crossing crossing;
+    crossing.surface = dagmc.entity_by_index(2, s);
+    std::vector<EntityHandle> parents;
+    rval = dagmc.moab_instance()->get_parent_meshsets(crossing.surface,
+                                                      parents);
+    if (MB_SUCCESS != rval || parents.size() != 2) continue;
+    for (int p = 0; p < 2; p++) {
+      crossing.volume = parents[p];
+      sides.push_back(crossing);
+    }
+  }
+  if (sides.empty()) {
+    std::cerr << "No surface has two volumes." << std::endl;
+    return 2;
+  }
+
+  // generate the crossings up front so that only the queries are timed
+  srand(randseed);
+  std::vector<Crossing> crossings(num_crossings);
+  for (int i = 0; i < num_crossings; i++)
+    crossings[i] = sides[rand() % sides.size()];
+
+  std::cout << "Timing " << num_crossings << " crossings of "
+            << sides.size() / 2 << " surfaces" << std::endl;
+  std::cout << std::setw(8) << "method" << std::setw(18) << "crossings/sec"
+            << std::setw(12) << "checksum" << std::endl;
+
+  for (int method = 0; method < 2; method++) {
+    // the checksum keeps the queries from being optimized away, and must
+    // be the same for both methods
+    long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_crossings; i++) {
+      EntityHandle next;
+      int sense;
+      rval = method == 0 ? cross_with_gtt(gtt, crossings[i], next, sense)
+                         : cross_with_tables(dagmc, crossings[i], next, sense);
+      if (MB_SUCCESS != rval) {
+        std::cerr << "ERROR: surface crossing failed!" << std::endl;
+        return 2;
+      }
+      checksum += dagmc.index_by_handle(next) * sense;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    std::cout << std::setw(8) << (method == 0 ? "gtt" : "tables")
+              << std::setw(18)
+              << (seconds > 0 ? num_crossings / seconds : 0.0)
+              << std::setw(12) << checksum << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,468 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "DagMC.hpp"
+#include "dagmcmetadata.hpp"
+#include "moab/Core.hpp"
+#include "moab/GeomTopoTool.hpp"
+#include "moab/Interface.hpp"
+
+using namespace moab;
+
+static int num_queries = 100000;
+static int randseed = 12345;
+static int safety_grid_cells = 0;
+static bool use_bvh = false;
+static bool shared_complement = false;
+static bool load_metadata = false;
+static const char* json_file = NULL;
+static std::string label;
+
+static void usage(const char* error, const char* opt,
+                  const char* name = "dagmc_bench") {
+  const char* default_message = "Invalid option";
+  if (opt && !error) error = default_message;
+
+  std::ostream& str = error ? std::cerr : std::cout;
+  if (error) {
+    str << error;
+    if (opt) str << ": " << opt;
+    str << std::endl;
+  }
+
+  str << "Usage: " << name << " [options] input_file" << std::endl;
+  str << "       " << name << " -h" << std::endl;
+
+  if (!error) {
+    str << "Times the loading and the setup of a geometry, and each kind of "
+           "query on"
+        << std::endl
+        << "random points and rays in its bounding box." << std::endl;
+    str << "-h  print this help" << std::endl;
+    str << "-n <int>   number of queries of each kind (default 100000)"
+        << std::endl;
+    str << "-z <int>   seed the random number generator (default 12345)"
+        << std::endl;
+    str << "-b         use the BVH trees instead of the OBB trees"
+        << std::endl;
+    str << "-c         with -b, query the implicit complement through the "
+           "trees of the"
+        << std::endl
+        << "           volumes it borders" << std::endl;
+    str << "-m         also time loading the metadata, which needs a "
+           "material on every"
+        << std::endl
+        << "           volume" << std::endl;
+    str << "-g <int>   cells of the safety grid of each volume, for "
+           "safety_conservative"
+        << std::endl
+        << "           (default 0, no grids)" << std::endl;
+    str << "-o <file>  write the results as JSON" << std::endl;
+    str << "-l <text>  label the JSON results, e.g. with a commit hash"
+        << std::endl;
+    str << std::endl
+        << "Models of growing size from dagmc_synth_model show how the "
+           "queries scale:"
+        << std::endl
+        << "  for f in 1000 10000 100000 1000000; do" << std::endl
+        << "    dagmc_synth_model -t spheres -f $f spheres_$f.h5m" << std::endl
+        << "    " << name
+        << " -b -o spheres_$f.json -l $(git rev-parse --short HEAD) "
+           "spheres_$f.h5m"
+        << std::endl
+        << "  done" << std::endl
+        << "and a lattice of 10^5 boxes times the lookups of 10^5 surfaces by "
+           "ID:"
+        << std::endl
+        << "  dagmc_synth_model -t lattice -v 100000 -f 1200000 lattice.h5m"
+        << std::endl
+        << "  " << name << " -b lattice.h5m" << std::endl
+        << "where half of the space is void, so that ray_fire_complement "
+           "shows the cost"
+        << std::endl
+        << "of the tracks in the implicit complement, with and without -c."
+        << std::endl;
+  }
+
+  exit(error ? 1 : 0);
+}
+
+static const char* get_option(int& i, int argc, char* argv[]) {
+  if (++i == argc) usage("Expected argument following option", argv[i - 1]);
+  return argv[i];
+}
+
+static int get_int_option(int& i, int argc, char* argv[]) {
+  const char* str = get_option(i, argc, argv);
+  char* end_ptr;
+  long val = strtol(str, &end_ptr, 0);
+  if (!*str || *end_ptr) usage("Expected integer following option", str);
+  return val;
+}
+
+static double uniform() { return rand() / (RAND_MAX + 1.0); }
+
+static void random_direction(double dir[3]) {
+  const double mu = 2.0 * uniform() - 1.0;
+  const double phi = 2.0 * M_PI * uniform();
+  const double s = sqrt(1.0 - mu * mu);
+  dir[0] = s * cos(phi);
+  dir[1] = s * sin(phi);
+  dir[2] = mu;
+}
+
+// the time and the number of calls of one benchmark
+struct Result {
+  std::string name;
+  long calls;
+  double seconds;
+};
+
+class Benchmarks {
+ public:
+  /** time fn(), which makes the given number of calls */
+  template <class Fn>
+  bool run(const std::string& name, long calls, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    ErrorCode rval = fn();
+    auto end = std::chrono::steady_clock::now();
+    if (MB_SUCCESS != rval) {
+      std::cerr << "ERROR: " << name << " failed!" << std::endl;
+      return false;
+    }
+    Result result;
+    result.name = name;
+    result.calls = calls;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << std::setw(22) << std::left << name << std::right
+              << std::setw(10) << calls << std::setw(14) << result.seconds
+              << std::setw(14) << ns_per_call(result) << std::endl;
+    results.push_back(result);
+    return true;
+  }
+
+  static double ns_per_call(const Result& result) {
+    return result.calls ? 1e9 * result.seconds / result.calls : 0.0;
+  }
+
+  std::vector<Result> results;
+};
+
+int main(int argc, char* argv[]) {
+  char* filename = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if (!argv[i][1] || argv[i][2]) usage(0, argv[i], argv[0]);
+      switch (argv[i][1]) {
+        default:
+          usage(0, argv[i], argv[0]);
+          break;
+        case 'h':
+          usage(0, 0, argv[0]);
+          break;
+        case 'n':
+          num_queries = get_int_option(i, argc, argv);
+          break;
+        case 'z':
+          randseed = get_int_option(i, argc, argv);
+          break;
+        case 'b':
+          use_bvh = true;
+          break;
+        case 'c':
+          shared_complement = true;
+          break;
+        case 'm':
+          load_metadata = true;
+          break;
+        case 'g':
+          safety_grid_cells = get_int_option(i, argc, argv);
+          break;
+        case 'o':
+          json_file = get_option(i, argc, argv);
+          break;
+        case 'l':
+          label = get_option(i, argc, argv);
+          break;
+      }
+    } else if (!filename) {
+      filename = argv[i];
+    } else {
+      usage("Unexpected parameter", 0, argv[0]);
+    }
+  }
+
+  if (!filename) usage("No filename specified", 0, argv[0]);
+  if (num_queries <= 0) usage("Number of queries must be positive", 0);
+  if (shared_complement && !use_bvh)
+    usage("A shared implicit complement needs the BVH trees", "-c");
+
+  DagMC dagmc{};
+  if (use_bvh) dagmc.set_accel_type(DagMC::ACCEL_BVH);
+  dagmc.set_shared_complement(shared_complement);
+  dagmc.set_safety_grid_cells(safety_grid_cells);
+  Benchmarks bench;
+  std::cout << std::setw(22) << std::left << "benchmark" << std::right
+            << std::setw(10) << "calls" << std::setw(14) << "seconds"
+            << std::setw(14) << "ns/call" << std::endl;
+
+  if (!bench.run("load_file", 1, [&]() { return dagmc.load_file(filename); }))
+    return 2;
+  if (!bench.run("init_OBBTree", 1, [&]() { return dagmc.init_OBBTree(); }))
+    return 2;
+  std::vector<std::string> keywords = {"mat", "rho", "boundary", "tally",
+                                       "importance"};
+  if (!bench.run("parse_properties", 1,
+                 [&]() { return dagmc.parse_properties(keywords); }))
+    return 2;
+
+  // lookups of random surfaces by ID and by index; GeomTopoTool is timed
+  // for comparison on fewer lookups, as it searches the geometry sets
+  const int num_surfaces = dagmc.num_entities(2);
+  srand(randseed);
+  std::vector<int> indices(num_queries), ids(num_queries);
+  GeomTopoTool* gtt = dagmc.geom_tool().get();
+  for (int i = 0; i < num_queries; i++) {
+    indices[i] = 1 + rand() % num_surfaces;
+    ids[i] = gtt->global_id(dagmc.entity_by_index(2, indices[i]));
+  }
+  long id_checksum = 0;
+  if (!bench.run("id_by_index", num_queries, [&]() {
+        for (int i = 0; i < num_queries; i++)
+          id_checksum += dagmc.id_by_index(2, indices[i]);
+        return MB_SUCCESS;
+      }))
+    return 2;
+  EntityHandle handle_checksum = 0;
+  if (!bench.run("entity_by_id", num_queries, [&]() {
+        for (int i = 0; i < num_queries; i++)
+          handle_checksum += dagmc.entity_by_id(2, ids[i]);
+        return MB_SUCCESS;
+      }))
+    return 2;
+  const int num_gtt_lookups = std::min(num_queries, 1000);
+  if (!bench.run("gtt_entity_by_id", num_gtt_lookups, [&]() {
+        for (int i = 0; i < num_gtt_lookups; i++)
+          handle_checksum += gtt->entity_by_id(2, ids[i]);
+        return MB_SUCCESS;
+      }))
+    return 2;
+
+  if (load_metadata) {
+    // exits if a volume has no material
+    dagmcMetaData metadata(&dagmc);
+    if (!bench.run("load_property_data", 1, [&]() {
+          metadata.load_property_data();
+          return MB_SUCCESS;
+        }))
+      return 2;
+  }
+
+  // the points are drawn from the box around the volumes, the implicit
+  // complement aside
+  const int num_volumes = dagmc.num_entities(3);
+  double lower[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL};
+  double upper[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (int v = 1; v <= num_volumes; v++) {
+    EntityHandle vol = dagmc.entity_by_index(3, v);
+    if (dagmc.is_implicit_complement(vol)) continue;
+    double vol_lower[3], vol_upper[3];
+    ErrorCode rval = dagmc.getobb(vol, vol_lower, vol_upper);
+    if (MB_SUCCESS != rval) {
+      std::cerr << "Failed to get the box of volume " << v << std::endl;
+      return 2;
+    }
+    for (int k = 0; k < 3; k++) {
+      lower[k] = std::min(lower[k], vol_lower[k]);
+      upper[k] = std::max(upper[k], vol_upper[k]);
+    }
+  }
+  if (lower[0] > upper[0]) {
+    std::cerr << "The geometry has no volumes." << std::endl;
+    return 2;
+  }
+
+  // generate the points and directions up front so that only the queries
+  // are timed
+  srand(randseed);
+  std::vector<double> points(3 * num_queries), dirs(3 * num_queries);
+  for (int i = 0; i < num_queries; i++) {
+    for (int k = 0; k < 3; k++)
+      points[3 * i + k] = lower[k] + (upper[k] - lower[k]) * uniform();
+    random_direction(&dirs[3 * i]);
+  }
+
+  // the points found in no volume are dropped from the other benchmarks
+  std::vector<EntityHandle> volumes(num_queries);
+  if (!bench.run("find_volume", num_queries, [&]() {
+        EntityHandle hint = 0;
+        for (int i = 0; i < num_queries; i++) {
+          ErrorCode rval = dagmc.find_volume(&points[3 * i], volumes[i],
+                                             &dirs[3 * i], hint);
+          if (MB_SUCCESS != rval) return rval;
+          if (volumes[i]) hint = volumes[i];
+        }
+        return MB_SUCCESS;
+      }))
+    return 2;
+  int num_found = 0;
+  for (int i = 0; i < num_queries; i++) {
+    if (!volumes[i]) continue;
+    volumes[num_found] = volumes[i];
+    std::copy(&points[3 * i], &points[3 * i] + 3, &points[3 * num_found]);
+    std::copy(&dirs[3 * i], &dirs[3 * i] + 3, &dirs[3 * num_found]);
+    num_found++;
+  }
+  if (!num_found) {
+    std::cerr << "No point was found in a volume." << std::endl;
+    return 2;
+  }
+
+  // the checksums keep the queries from being optimized away
+  std::vector<EntityHandle> surfaces(num_found);
+  long hits = 0;
+  if (!bench.run("ray_fire", num_found, [&]() {
+        for (int i = 0; i < num_found; i++) {
+          double dist;
+          ErrorCode rval = dagmc.ray_fire(volumes[i], &points[3 * i],
+                                          &dirs[3 * i], surfaces[i], dist);
+          if (MB_SUCCESS != rval) return rval;
+          if (surfaces[i]) hits++;
+        }
+        return MB_SUCCESS;
+      }))
+    return 2;
+
+  // the same rays, from the points in the void, which take most of the
+  // tracks of models that are mostly void
+  std::vector<int> in_complement;
+  long complement_hits = 0;
+  for (int i = 0; i < num_found; i++) {
+    if (dagmc.is_implicit_complement(volumes[i])) in_complement.push_back(i);
+  }
+  if (!in_complement.empty() &&
+      !bench.run("ray_fire_complement", in_complement.size(), [&]() {
+        for (unsigned j = 0; j < in_complement.size(); j++) {
+          const int i = in_complement[j];
+          EntityHandle surface;
+          double dist;
+          ErrorCode rval = dagmc.ray_fire(volumes[i], &points[3 * i],
+                                          &dirs[3 * i], surface, dist);
+          if (MB_SUCCESS != rval) return rval;
+          if (surface) complement_hits++;
+        }
+        return MB_SUCCESS;
+      }))
+    return 2;
+
+  long inside = 0;
+  if (!bench.run("point_in_volume", num_found, [&]() {
+        for (int i = 0; i < num_found; i++) {
+          int result;
+          ErrorCode rval = dagmc.point_in_volume(volumes[i], &points[3 * i],
+                                                 result, &dirs[3 * i]);
+          if (MB_SUCCESS != rval) return rval;
+          inside += result;
+        }
+        return MB_SUCCESS;
+      }))
+    return 2;
+
+  double total_dist = 0.0;
+  if (!bench.run("closest_to_location", num_found, [&]() {
+        for (int i = 0; i < num_found; i++) {
+          double dist;
+          ErrorCode rval =
+              dagmc.closest_to_location(volumes[i], &points[3 * i], dist);
+          if (MB_SUCCESS != rval) return rval;
+          total_dist += dist;
+        }
+        return MB_SUCCESS;
+      }))
+    return 2;
+
+  // the exact distance to the nearest facet, and the lower bound on it that
+  // a transport code may take as its safety
+  double total_safety = 0.0;
+  const DagMC::SafetyMode safety_modes[2] = {DagMC::SAFETY_EXACT,
+                                             DagMC::SAFETY_CONSERVATIVE};
+  const char* safety_names[2] = {"safety_distance", "safety_conservative"};
+  for (int m = 0; m < 2; m++) {
+    if (!bench.run(safety_names[m], num_found, [&]() {
+          for (int i = 0; i < num_found; i++) {
+            double safety;
+            ErrorCode rval = dagmc.safety_distance(
+                volumes[i], &points[3 * i], safety, safety_modes[m]);
+            if (MB_SUCCESS != rval) return rval;
+            total_safety += safety;
+          }
+          return MB_SUCCESS;
+        }))
+      return 2;
+  }
+
+  // the surfaces the rays hit, leaving their volumes
+  long crossings = 0;
+  if (!bench.run("next_vol", hits, [&]() {
+        for (int i = 0; i < num_found; i++) {
+          if (!surfaces[i]) continue;
+          EntityHandle next;
+          ErrorCode rval = dagmc.next_vol(surfaces[i], volumes[i], next);
+          if (MB_SUCCESS != rval) return rval;
+          if (next) crossings++;
+        }
+        return MB_SUCCESS;
+      }))
+    return 2;
+
+  int num_facets = 0;
+  dagmc.moab_instance()->get_number_entities_by_type(0, MBTRI, num_facets);
+  std::cout << num_found << " of " << num_queries << " points in volumes, "
+            << in_complement.size() << " in the implicit complement, " << hits
+            << " hits, " << complement_hits << " from the complement, "
+            << inside << " inside, " << crossings
+            << " crossings, mean distance " << total_dist / num_found
+            << ", lookup checksums " << id_checksum << " " << handle_checksum
+            << " " << total_safety << std::endl;
+  size_t bvh_bytes, bvh_facets;
+  if (use_bvh && MB_SUCCESS == dagmc.get_bvh_memory(bvh_bytes, bvh_facets))
+    std::cout << "BVH trees: " << bvh_bytes << " bytes, " << bvh_facets
+              << " facets" << std::endl;
+
+  if (json_file) {
+    std::ofstream out(json_file);
+    if (!out) {
+      std::cerr << "Failed to open '" << json_file << "'" << std::endl;
+      return 2;
+    }
+    std::string version;
+    DagMC::version(&version);
+    out << "{" << std::endl
+        << "  \"file\": \"" << filename << "\"," << std::endl
+        << "  \"label\": \"" << label << "\"," << std::endl
+        << "  \"dagmc_version\": \"" << version << "\"," << std::endl
+        << "  \"accel\": \"" << (use_bvh ? "bvh" : "obb") << "\"," << std::endl
+        << "  \"volumes\": " << num_volumes << "," << std::endl
+        << "  \"surfaces\": " << dagmc.num_entities(2) << "," << std::endl
+        << "  \"facets\": " << num_facets << "," << std::endl
+        << "  \"benchmarks\": [";
+    for (unsigned i = 0; i < bench.results.size(); i++) {
+      const Result& r = bench.results[i];
+      out << (i ? "," : "") << std::endl
+          << "    {\"name\": \"" << r.name << "\", \"calls\": " << r.calls
+          << ", \"seconds\": " << r.seconds
+          << ", \"ns_per_call\": " << Benchmarks::ns_per_call(r) << "}";
+    }
+    out << std::endl << "  ]" << std::endl << "}" << std::endl;
+  }
+
+  return 0;
+}
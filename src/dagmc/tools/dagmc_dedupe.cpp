@@ -0,0 +1,256 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "BVHRayTracer.hpp"
+#include "DagMC.hpp"
+#include "VolumeInstance.hpp"
+#include "moab/Core.hpp"
+#include "moab/GeomTopoTool.hpp"
+#include "moab/Interface.hpp"
+
+using namespace moab;
+
+static void usage(const char* error, const char* opt,
+                  const char* name = "dagmc_dedupe") {
+  const char* default_message = "Invalid option";
+  if (opt && !error) error = default_message;
+
+  std::ostream& str = error ? std::cerr : std::cout;
+  if (error) {
+    str << error;
+    if (opt) str << ": " << opt;
+    str << std::endl;
+  }
+
+  str << "Usage: " << name << " [options] input_file [output_file]"
+      << std::endl;
+  str << "       " << name << " -h" << std::endl;
+
+  if (!error) {
+    str << "Finds the volumes that are rigidly moved copies of another "
+           "volume and,"
+        << std::endl
+        << "if an output file is given, tags them as instances of it so "
+           "that they"
+        << std::endl
+        << "share its BVH tree. Only the memory of the BVH trees is saved: "
+           "the output"
+        << std::endl
+        << "keeps every facet of the instances, and the OBB trees are "
+           "still built per"
+        << std::endl
+        << "volume." << std::endl;
+    str << "-h  print this help" << std::endl;
+  }
+
+  exit(error ? 1 : 0);
+}
+
+// the facets of a volume with their normals pointing out of it, 9
+// coordinates per facet, and the diagonal of their bounding box
+static ErrorCode get_volume_facets(Interface* mbi, GeomTopoTool* gtt,
+                                   EntityHandle volume,
+                                   std::vector<double>& coords,
+                                   double& diagonal) {
+  std::vector<EntityHandle> surfs;
+  ErrorCode rval = mbi->get_child_meshsets(volume, surfs);
+  if (MB_SUCCESS != rval) return rval;
+
+  coords.clear();
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    int sense;
+    rval = gtt->get_sense(surfs[i], volume, sense);
+    if (MB_SUCCESS != rval) return rval;
+    std::vector<EntityHandle> facets, conn;
+    rval = mbi->get_entities_by_type(surfs[i], MBTRI, facets);
+    if (MB_SUCCESS != rval) return rval;
+    if (facets.empty()) continue;
+    rval = mbi->get_connectivity(&facets[0], facets.size(), conn);
+    if (MB_SUCCESS != rval) return rval;
+
+    const size_t first = coords.size();
+    coords.resize(first + 3 * conn.size());
+    rval = mbi->get_coords(&conn[0], conn.size(), &coords[first]);
+    if (MB_SUCCESS != rval) return rval;
+    if (-1 == sense) {
+      for (size_t j = first; j < coords.size(); j += 9)
+        std::swap_ranges(&coords[j + 3], &coords[j + 6], &coords[j + 6]);
+    }
+  }
+
+  double lower[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL};
+  double upper[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (size_t j = 0; j < coords.size(); j += 3) {
+    for (int k = 0; k < 3; k++) {
+      lower[k] = std::min(lower[k], coords[j + k]);
+      upper[k] = std::max(upper[k], coords[j + k]);
+    }
+  }
+  diagonal = 0.0;
+  if (!coords.empty()) {
+    for (int k = 0; k < 3; k++)
+      diagonal += (upper[k] - lower[k]) * (upper[k] - lower[k]);
+    diagonal = sqrt(diagonal);
+  }
+  return MB_SUCCESS;
+}
+
+// a volume whose copies are found by matching their facets to its own
+struct Prototype {
+  EntityHandle volume;
+  std::unique_ptr<FacetMatcher> matcher;
+  int num_instances;
+};
+
+// memory of the BVH trees of all volumes, sharing the trees of the
+// instances if there are any
+static ErrorCode tree_memory(GeomTopoTool* gtt,
+                             const std::map<EntityHandle, EntityHandle>& of,
+                             const std::map<EntityHandle, InstanceTransform>&
+                                 transforms,
+                             size_t& result) {
+  BVHRayTracer tracer(gtt);
+  for (auto i = of.begin(); i != of.end(); ++i) {
+    ErrorCode rval =
+        tracer.add_instance(i->first, i->second, transforms.at(i->first));
+    if (MB_SUCCESS != rval) return rval;
+  }
+  ErrorCode rval = tracer.build(0);
+  if (MB_SUCCESS != rval) return rval;
+  result = tracer.memory_use();
+  return MB_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  char* filename = NULL;
+  char* output = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if (!argv[i][1] || argv[i][2]) usage(0, argv[i], argv[0]);
+      switch (argv[i][1]) {
+        default:
+          usage(0, argv[i], argv[0]);
+          break;
+        case 'h':
+          usage(0, 0, argv[0]);
+          break;
+      }
+    } else if (!filename) {
+      filename = argv[i];
+    } else if (!output) {
+      output = argv[i];
+    } else {
+      usage("Unexpected parameter", 0, argv[0]);
+    }
+  }
+
+  if (!filename) usage("No filename specified", 0, argv[0]);
+
+  DagMC dagmc{};
+  ErrorCode rval = dagmc.load_file(filename);
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to load file '" << filename << "'" << std::endl;
+    return 2;
+  }
+  Interface* mbi = dagmc.moab_instance();
+  GeomTopoTool* gtt = dagmc.geom_tool().get();
+
+  Range vols;
+  rval = gtt->get_gsets_by_dimension(3, vols);
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to get the volumes" << std::endl;
+    return 2;
+  }
+
+  // only volumes with the same number of facets can be copies of each
+  // other
+  std::map<size_t, std::vector<Prototype>> prototypes;
+  std::map<EntityHandle, EntityHandle> instance_of;
+  std::map<EntityHandle, InstanceTransform> transforms;
+  size_t shared_facets = 0;
+  for (Range::iterator v = vols.begin(); v != vols.end(); ++v) {
+    std::vector<double> coords;
+    double diagonal;
+    rval = get_volume_facets(mbi, gtt, *v, coords, diagonal);
+    if (MB_SUCCESS != rval) {
+      std::cerr << "Failed to get the facets of volume "
+                << gtt->global_id(*v) << std::endl;
+      return 2;
+    }
+    const uint32_t num_facets = coords.size() / 9;
+    if (!num_facets) continue;
+
+    std::vector<Prototype>& candidates = prototypes[num_facets];
+    bool found = false;
+    for (unsigned i = 0; i < candidates.size() && !found; i++) {
+      InstanceTransform transform;
+      if (!candidates[i].matcher->find_transform(coords.data(), num_facets,
+                                                 transform))
+        continue;
+      instance_of[*v] = candidates[i].volume;
+      transforms[*v] = transform;
+      candidates[i].num_instances++;
+      shared_facets += num_facets;
+      found = true;
+    }
+    if (found) continue;
+
+    Prototype prototype;
+    prototype.volume = *v;
+    // the tolerance BVHRayTracer matches the instances with
+    prototype.matcher.reset(new FacetMatcher(
+        coords.data(), num_facets,
+        BVHRayTracer::INSTANCE_TOLERANCE * diagonal));
+    prototype.num_instances = 0;
+    candidates.push_back(std::move(prototype));
+  }
+
+  std::cout << "Volumes: " << vols.size() << std::endl;
+  for (auto g = prototypes.begin(); g != prototypes.end(); ++g) {
+    for (unsigned i = 0; i < g->second.size(); i++) {
+      const Prototype& prototype = g->second[i];
+      if (!prototype.num_instances) continue;
+      std::cout << "  volume " << gtt->global_id(prototype.volume) << " ("
+                << g->first << " facets): " << prototype.num_instances
+                << " instances" << std::endl;
+    }
+  }
+  std::cout << "Instances: " << instance_of.size() << ", sharing the trees of "
+            << shared_facets << " facets" << std::endl;
+  if (instance_of.empty()) return 0;
+
+  // building the trees with the instances also checks that they match
+  size_t memory_before, memory_after;
+  rval = tree_memory(gtt, std::map<EntityHandle, EntityHandle>(), transforms,
+                     memory_before);
+  if (MB_SUCCESS == rval)
+    rval = tree_memory(gtt, instance_of, transforms, memory_after);
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to build the BVH trees" << std::endl;
+    return 2;
+  }
+  std::cout << "BVH memory: " << memory_before << " bytes, "
+            << memory_after << " bytes with instances" << std::endl;
+
+  if (!output) return 0;
+  for (auto i = instance_of.begin(); i != instance_of.end(); ++i) {
+    const InstanceTransform& transform = transforms[i->first];
+    rval = dagmc.add_volume_instance(i->first, i->second, transform.rotation,
+                                     transform.translation);
+    if (MB_SUCCESS != rval) {
+      std::cerr << "Failed to tag volume " << gtt->global_id(i->first)
+                << std::endl;
+      return 2;
+    }
+  }
+  rval = dagmc.write_mesh(output, 1);
+  if (MB_SUCCESS != rval) return 2;
+  std::cout << "Wrote " << output << std::endl;
+  return 0;
+}
@@ -0,0 +1,346 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DagMC.hpp"
+#include "RayLog.hpp"
+#include "moab/Core.hpp"
+#include "moab/Interface.hpp"
+
+using namespace moab;
+
+static bool use_bvh = false;
+static int tree_storage = 0;
+static int num_threads = 1;
+static int num_repeats = 1;
+static double tolerance = 1e-6;
+static int max_printed = 10;
+static const char* profile_file = NULL;
+
+static void usage(const char* error, const char* opt,
+                  const char* name = "dagmc_replay") {
+  const char* default_message = "Invalid option";
+  if (opt && !error) error = default_message;
+
+  std::ostream& str = error ? std::cerr : std::cout;
+  if (error) {
+    str << error;
+    if (opt) str << ": " << opt;
+    str << std::endl;
+  }
+
+  str << "Usage: " << name << " [options] input_file ray_log" << std::endl;
+  str << "       " << name << " -h" << std::endl;
+
+  if (!error) {
+    str << "Repeats the queries of a ray log, recorded with the DAGMC_RAY_LOG "
+           "environment"
+        << std::endl
+        << "variable or DagMC::open_ray_log() on the same geometry, and "
+           "reports their"
+        << std::endl
+        << "throughput and the results that differ from the recorded ones. "
+           "Exits with 3"
+        << std::endl
+        << "if any result differs." << std::endl;
+    str << "-h  print this help" << std::endl;
+    str << "-b  use the native BVH trees instead of the OBB trees" << std::endl;
+    str << "-C <int>   storage of the BVH trees: 0 full (default), 1 compact, "
+           "2 compact"
+        << std::endl;
+    str << "           with float vertices" << std::endl;
+    str << "-t <int>   number of threads sharing the queries (default 1)"
+        << std::endl;
+    str << "-r <int>   number of times to repeat the log (default 1)"
+        << std::endl;
+    str << "-e <real>  relative tolerance of the distances (default 1e-6)"
+        << std::endl;
+    str << "-m <int>   number of differing results to print (default 10)"
+        << std::endl;
+    str << "-P <file>  write the time of the queries per volume to a JSON "
+           "(.json) or CSV file"
+        << std::endl;
+  }
+
+  exit(error ? 1 : 0);
+}
+
+static const char* get_option(int& i, int argc, char* argv[]) {
+  if (++i == argc) usage("Expected argument following option", argv[i - 1]);
+  return argv[i];
+}
+
+static int get_int_option(int& i, int argc, char* argv[]) {
+  const char* str = get_option(i, argc, argv);
+  char* end_ptr;
+  long val = strtol(str, &end_ptr, 0);
+  if (!*str || *end_ptr) usage("Expected integer following option", str);
+  return val;
+}
+
+static double get_double_option(int& i, int argc, char* argv[]) {
+  const char* str = get_option(i, argc, argv);
+  char* end_ptr;
+  double val = strtod(str, &end_ptr);
+  if (!*str || *end_ptr) usage("Expected real number following option", str);
+  return val;
+}
+
+static const char* query_name(RayLog::Query query) {
+  switch (query) {
+    case RayLog::RAY_FIRE:
+      return "ray_fire";
+    case RayLog::POINT_IN_VOLUME:
+      return "point_in_volume";
+    case RayLog::CLOSEST_TO_LOCATION:
+      return "closest_to_location";
+    default:
+      return "unknown";
+  }
+}
+
+static bool same_distance(double a, double b) {
+  return fabs(a - b) <= tolerance * std::max(1.0, fabs(b));
+}
+
+// the calls, time and differing results of each query of one thread
+struct Counts {
+  Counts() {
+    for (int q = 0; q <= RayLog::CLOSEST_TO_LOCATION; q++)
+      calls[q] = nanoseconds[q] = mismatches[q] = 0;
+  }
+
+  uint64_t calls[RayLog::CLOSEST_TO_LOCATION + 1];
+  uint64_t nanoseconds[RayLog::CLOSEST_TO_LOCATION + 1];
+  uint64_t mismatches[RayLog::CLOSEST_TO_LOCATION + 1];
+  /** the first differing results */
+  std::vector<std::string> messages;
+};
+
+// repeat one query with the history it was made with, and compare its
+// results with the recorded ones
+static void replay(DagMC& dagmc, DagMC::QueryContext& context,
+                   const RayLog::Record& record, long index, Counts& counts) {
+  context.history.reset();
+  for (unsigned i = 0; i < record.history.size(); i++)
+    context.history.add_entity(record.history[i]);
+  const EntityHandle volume = dagmc.entity_by_index(3, record.volume);
+
+  ErrorCode rval;
+  EntityHandle surface = 0;
+  double distance = 0;
+  int inside = 0;
+  auto start = std::chrono::steady_clock::now();
+  switch (record.query) {
+    case RayLog::RAY_FIRE:
+      rval = dagmc.ray_fire(context, volume, record.point, record.direction,
+                            surface, distance, record.dist_limit,
+                            record.orientation);
+      break;
+    case RayLog::POINT_IN_VOLUME:
+      rval = dagmc.point_in_volume(
+          context, volume, record.point, inside,
+          record.has_direction ? record.direction : NULL);
+      break;
+    default:
+      rval = dagmc.closest_to_location(volume, record.point, distance,
+                                       record.surface ? &surface : NULL);
+      break;
+  }
+  auto end = std::chrono::steady_clock::now();
+  counts.calls[record.query]++;
+  counts.nanoseconds[record.query] +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+
+  const int surface_index =
+      MB_SUCCESS == rval && surface ? dagmc.index_by_handle(surface) : 0;
+  bool same = (int)rval == record.status;
+  if (same && MB_SUCCESS == rval) {
+    if (RayLog::POINT_IN_VOLUME == record.query)
+      same = inside == record.inside;
+    else if (RayLog::RAY_FIRE == record.query)
+      same = surface_index == record.surface &&
+             (!surface_index || same_distance(distance, record.distance));
+    else
+      same = same_distance(distance, record.distance);
+  }
+  if (same) return;
+
+  counts.mismatches[record.query]++;
+  if ((int)counts.messages.size() < max_printed) {
+    std::ostringstream str;
+    str << std::setprecision(17) << "record " << index << ": "
+        << query_name(record.query) << " in volume " << record.volume
+        << " from (" << record.point[0] << ", " << record.point[1] << ", "
+        << record.point[2] << ") recorded status " << record.status
+        << " surface " << record.surface << " distance " << record.distance
+        << " inside " << record.inside << ", replayed status " << rval
+        << " surface " << surface_index << " distance " << distance
+        << " inside " << inside;
+    counts.messages.push_back(str.str());
+  }
+}
+
+int main(int argc, char* argv[]) {
+  char* filename = NULL;
+  char* log_file = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if (!argv[i][1] || argv[i][2]) usage(0, argv[i], argv[0]);
+      switch (argv[i][1]) {
+        default:
+          usage(0, argv[i], argv[0]);
+          break;
+        case 'h':
+          usage(0, 0, argv[0]);
+          break;
+        case 'b':
+          use_bvh = true;
+          break;
+        case 'C':
+          tree_storage = get_int_option(i, argc, argv);
+          break;
+        case 't':
+          num_threads = get_int_option(i, argc, argv);
+          break;
+        case 'r':
+          num_repeats = get_int_option(i, argc, argv);
+          break;
+        case 'e':
+          tolerance = get_double_option(i, argc, argv);
+          break;
+        case 'm':
+          max_printed = get_int_option(i, argc, argv);
+          break;
+        case 'P':
+          profile_file = get_option(i, argc, argv);
+          break;
+      }
+    } else if (!filename) {
+      filename = argv[i];
+    } else if (!log_file) {
+      log_file = argv[i];
+    } else {
+      usage("Unexpected parameter", 0, argv[0]);
+    }
+  }
+
+  if (!log_file) usage("Expected a geometry file and a ray log", 0, argv[0]);
+  if (num_threads <= 0) usage("Number of threads must be positive", 0);
+  if (num_repeats <= 0) usage("Number of repeats must be positive", 0);
+  if (tree_storage < 0 || tree_storage > 2)
+    usage("Expected a tree storage of 0, 1 or 2", 0);
+
+  // the whole log is read up front so that only the queries are timed
+  RayLog::Reader reader;
+  if (!reader.open(log_file)) {
+    std::cerr << "Failed to read the ray log '" << log_file << "'"
+              << std::endl;
+    return 2;
+  }
+  std::vector<RayLog::Record> records;
+  RayLog::Record record;
+  while (reader.read(record)) records.push_back(record);
+  if (reader.truncated())
+    std::cerr << "Warning: the ray log ends within a record" << std::endl;
+
+  DagMC dagmc{};
+  if (use_bvh) dagmc.set_accel_type(DagMC::ACCEL_BVH);
+  dagmc.set_tree_storage((DagMC::TreeStorage)tree_storage);
+  dagmc.set_profile_queries(profile_file != NULL);
+  ErrorCode rval = dagmc.load_file(filename);
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to load file '" << filename << "'" << std::endl;
+    return 2;
+  }
+  rval = dagmc.init_OBBTree();
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to initialize DagMC." << std::endl;
+    return 2;
+  }
+
+  // a log of another geometry would query volumes that do not exist
+  const int num_volumes = dagmc.num_entities(3);
+  for (unsigned i = 0; i < records.size(); i++) {
+    if (records[i].volume < 1 || records[i].volume > num_volumes) {
+      std::cerr << "Record " << i << " queries volume " << records[i].volume
+                << " of a geometry with " << num_volumes << " volumes"
+                << std::endl;
+      return 2;
+    }
+  }
+  if (records.empty()) {
+    std::cerr << "The ray log has no records." << std::endl;
+    return 2;
+  }
+
+  // each thread repeats a contiguous part of the log, in the order it was
+  // recorded
+  std::vector<Counts> counts(num_threads);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&dagmc, &records, &counts, t]() {
+      DagMC::QueryContext context;
+      const long begin = records.size() * t / num_threads;
+      const long end = records.size() * (t + 1) / num_threads;
+      for (int r = 0; r < num_repeats; r++)
+        for (long i = begin; i < end; i++)
+          replay(dagmc, context, records[i], i, counts[t]);
+    }));
+  }
+  for (unsigned t = 0; t < threads.size(); t++) threads[t].join();
+  auto end = std::chrono::steady_clock::now();
+  const double seconds = std::chrono::duration<double>(end - start).count();
+
+  Counts total;
+  for (int t = 0; t < num_threads; t++) {
+    for (int q = RayLog::RAY_FIRE; q <= RayLog::CLOSEST_TO_LOCATION; q++) {
+      total.calls[q] += counts[t].calls[q];
+      total.nanoseconds[q] += counts[t].nanoseconds[q];
+      total.mismatches[q] += counts[t].mismatches[q];
+    }
+    for (unsigned m = 0; m < counts[t].messages.size(); m++)
+      if ((int)total.messages.size() < max_printed)
+        total.messages.push_back(counts[t].messages[m]);
+  }
+
+  const double num_queries = (double)records.size() * num_repeats;
+  std::cout << "Replayed " << records.size() << " queries";
+  if (num_repeats > 1) std::cout << " " << num_repeats << " times";
+  std::cout << " with " << num_threads << " threads in " << seconds
+            << " seconds: " << (seconds > 0 ? num_queries / seconds : 0.0)
+            << " queries/sec" << std::endl;
+  std::cout << std::setw(20) << std::left << "query" << std::right
+            << std::setw(12) << "calls" << std::setw(12) << "ns/call"
+            << std::setw(12) << "mismatches" << std::endl;
+  uint64_t mismatches = 0;
+  for (int q = RayLog::RAY_FIRE; q <= RayLog::CLOSEST_TO_LOCATION; q++) {
+    if (!total.calls[q]) continue;
+    std::cout << std::setw(20) << std::left << query_name((RayLog::Query)q)
+              << std::right << std::setw(12) << total.calls[q]
+              << std::setw(12) << total.nanoseconds[q] / total.calls[q]
+              << std::setw(12) << total.mismatches[q] << std::endl;
+    mismatches += total.mismatches[q];
+  }
+  for (unsigned m = 0; m < total.messages.size(); m++)
+    std::cout << total.messages[m] << std::endl;
+
+  if (profile_file) {
+    if (MB_SUCCESS != dagmc.write_query_profile(profile_file)) {
+      std::cerr << "Failed to write the query profile" << std::endl;
+      return 2;
+    }
+  }
+
+  return mismatches ? 3 : 0;
+}
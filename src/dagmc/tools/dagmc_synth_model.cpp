@@ -0,0 +1,479 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "MBTagConventions.hpp"
+#include "moab/Core.hpp"
+#include "moab/Interface.hpp"
+#include "moab/Range.hpp"
+#include "moab/ReadUtilIface.hpp"
+
+using namespace moab;
+
+static const double PI = acos(-1.0);
+
+static std::string model_type = "spheres";
+static int num_volumes = 10;
+static long long num_facets = 100000;
+static double shell_thickness = 0.01;
+static int num_materials = 4;
+
+static void usage(const char* error, const char* opt,
+                  const char* name = "dagmc_synth_model") {
+  const char* default_message = "Invalid option";
+  if (opt && !error) error = default_message;
+
+  std::ostream& str = error ? std::cerr : std::cout;
+  if (error) {
+    str << error;
+    if (opt) str << ": " << opt;
+    str << std::endl;
+  }
+
+  str << "Usage: " << name << " [options] output_file" << std::endl;
+  str << "       " << name << " -h" << std::endl;
+
+  if (!error) {
+    str << "Writes a DAGMC model of a given size for benchmarks, with "
+           "materials and a"
+        << std::endl
+        << "graveyard." << std::endl;
+    str << "-h  print this help" << std::endl;
+    str << "-t <type>  spheres: nested spheres sharing their surfaces "
+           "(default)"
+        << std::endl;
+    str << "           lattice: a lattice of separate boxes" << std::endl;
+    str << "           shells: nested thin spherical shells with gaps "
+           "between them"
+        << std::endl;
+    str << "-v <int>   number of volumes, besides the graveyard (default 10)"
+        << std::endl;
+    str << "-f <int>   number of facets, shared equally by the surfaces "
+           "(default 100000)"
+        << std::endl;
+    str << "-s <real>  thickness of the shells, relative to their spacing "
+           "(default 0.01)"
+        << std::endl;
+    str << "-m <int>   number of materials the volumes cycle through "
+           "(default 4)"
+        << std::endl;
+  }
+
+  exit(error ? 1 : 0);
+}
+
+static const char* get_option(int& i, int argc, char* argv[]) {
+  if (++i == argc) usage("Expected argument following option", argv[i - 1]);
+  return argv[i];
+}
+
+static long long get_int_option(int& i, int argc, char* argv[]) {
+  const char* str = get_option(i, argc, argv);
+  char* end_ptr;
+  long long val = strtoll(str, &end_ptr, 0);
+  if (!*str || *end_ptr) usage("Expected integer following option", str);
+  return val;
+}
+
+static double get_double_option(int& i, int argc, char* argv[]) {
+  const char* str = get_option(i, argc, argv);
+  char* end_ptr;
+  double val = strtod(str, &end_ptr);
+  if (!*str || *end_ptr) usage("Expected real number following option", str);
+  return val;
+}
+
+// index of a point (i, j, l) on the surface of a cube of k^3 cells among the
+// 6 k^2 + 2 points of its surface: the bottom layer, then the rings of the
+// layers in between, then the top layer
+static int surface_point(int i, int j, int l, int k) {
+  const int layer = (k + 1) * (k + 1);
+  if (0 == l) return i * (k + 1) + j;
+  if (k == l) return layer + 4 * k * (k - 1) + i * (k + 1) + j;
+  int ring;
+  if (0 == j && i < k)
+    ring = i;
+  else if (k == i && j < k)
+    ring = k + j;
+  else if (k == j && i > 0)
+    ring = 2 * k + (k - i);
+  else
+    ring = 3 * k + (k - j);
+  return layer + 4 * k * (l - 1) + ring;
+}
+
+// geometry of a closed surface made from a cube of k^3 cells
+struct SurfaceShape {
+  /** a sphere if true, a box otherwise */
+  bool sphere;
+  double center[3];
+  /** radius of the sphere, or half widths of the box */
+  double size[3];
+};
+
+class ModelWriter {
+ public:
+  ModelWriter(Interface* mbi) : mbi(mbi), readUtil(NULL) {}
+
+  ErrorCode setup();
+
+  /** a surface with outward facets, the forward volume inside it */
+  ErrorCode add_surface(const SurfaceShape& shape, int k,
+                        EntityHandle& surface);
+
+  /** a volume bounded by surfaces with the given senses */
+  ErrorCode add_volume(const std::vector<EntityHandle>& surfs,
+                       const std::vector<int>& senses, EntityHandle& volume);
+
+  /** a group of volumes, named by its metadata */
+  ErrorCode add_group(const std::string& name,
+                      const std::vector<EntityHandle>& volumes);
+
+  ErrorCode finish();
+
+  long long facets() const { return numFacets; }
+
+ private:
+  ErrorCode set_geometry(EntityHandle set, int dimension, int id,
+                         const char* category);
+
+  Interface* mbi;
+  ReadUtilIface* readUtil;
+  Tag dimTag, idTag, senseTag, categoryTag, nameTag;
+  int nextId[5];
+  long long numFacets;
+  /** forward and reverse volume of each surface */
+  std::vector<EntityHandle> surfaces;
+  std::vector<EntityHandle> senseVolumes;
+};
+
+ErrorCode ModelWriter::setup() {
+  ErrorCode rval = mbi->query_interface(readUtil);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->tag_get_handle(GEOM_DIMENSION_TAG_NAME, 1, MB_TYPE_INTEGER,
+                             dimTag, MB_TAG_SPARSE | MB_TAG_CREAT);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->tag_get_handle(GLOBAL_ID_TAG_NAME, 1, MB_TYPE_INTEGER, idTag,
+                             MB_TAG_DENSE | MB_TAG_CREAT);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->tag_get_handle("GEOM_SENSE_2", 2, MB_TYPE_HANDLE, senseTag,
+                             MB_TAG_SPARSE | MB_TAG_CREAT);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->tag_get_handle(CATEGORY_TAG_NAME, CATEGORY_TAG_SIZE,
+                             MB_TYPE_OPAQUE, categoryTag,
+                             MB_TAG_SPARSE | MB_TAG_CREAT);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->tag_get_handle(NAME_TAG_NAME, NAME_TAG_SIZE, MB_TYPE_OPAQUE,
+                             nameTag, MB_TAG_SPARSE | MB_TAG_CREAT);
+  if (MB_SUCCESS != rval) return rval;
+  for (int d = 0; d < 5; d++) nextId[d] = 1;
+  numFacets = 0;
+  return MB_SUCCESS;
+}
+
+ErrorCode ModelWriter::set_geometry(EntityHandle set, int dimension, int id,
+                                    const char* category) {
+  ErrorCode rval = mbi->tag_set_data(dimTag, &set, 1, &dimension);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->tag_set_data(idTag, &set, 1, &id);
+  if (MB_SUCCESS != rval) return rval;
+  char name[CATEGORY_TAG_SIZE];
+  memset(name, 0, sizeof(name));
+  strncpy(name, category, sizeof(name) - 1);
+  return mbi->tag_set_data(categoryTag, &set, 1, name);
+}
+
+ErrorCode ModelWriter::add_surface(const SurfaceShape& shape, int k,
+                                   EntityHandle& surface) {
+  // the vertices and facets are allocated in bulk, as the MOAB readers do,
+  // so that models of 10^8 facets are written in reasonable time
+  const int num_verts = 6 * k * k + 2;
+  const int num_tris = 12 * k * k;
+  EntityHandle start_vert, start_tri, *conn;
+  std::vector<double*> coords;
+  ErrorCode rval =
+      readUtil->get_node_coords(3, num_verts, 0, start_vert, coords);
+  if (MB_SUCCESS != rval) return rval;
+  rval = readUtil->get_element_connect(num_tris, 3, MBTRI, 0, start_tri, conn);
+  if (MB_SUCCESS != rval) return rval;
+
+  for (int i = 0; i <= k; i++) {
+    for (int j = 0; j <= k; j++) {
+      for (int l = 0; l <= k; l++) {
+        if (i > 0 && i < k && j > 0 && j < k && l > 0 && l < k) {
+          l = k - 1;
+          continue;
+        }
+        const int index = surface_point(i, j, l, k);
+        double p[3] = {2.0 * i / k - 1.0, 2.0 * j / k - 1.0, 2.0 * l / k - 1.0};
+        if (shape.sphere) {
+          // equal angles along the cube faces spread the facets evenly
+          double norm = 0.0;
+          for (int d = 0; d < 3; d++) {
+            p[d] = tan(0.25 * PI * p[d]);
+            norm += p[d] * p[d];
+          }
+          for (int d = 0; d < 3; d++) p[d] /= sqrt(norm);
+        }
+        for (int d = 0; d < 3; d++)
+          coords[d][index] = shape.center[d] + shape.size[d] * p[d];
+      }
+    }
+  }
+
+  // two facets per cell of each face, facing out of the cube
+  EntityHandle* tri = conn;
+  for (int axis = 0; axis < 3; axis++) {
+    const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    for (int side = 0; side <= k; side += k) {
+      for (int a = 0; a < k; a++) {
+        for (int b = 0; b < k; b++) {
+          int corner[4];
+          const int cells[4][2] = {{a, b}, {a + 1, b}, {a + 1, b + 1},
+                                   {a, b + 1}};
+          for (int c = 0; c < 4; c++) {
+            int ijl[3];
+            ijl[axis] = side;
+            ijl[u] = cells[c][0];
+            ijl[v] = cells[c][1];
+            corner[c] = surface_point(ijl[0], ijl[1], ijl[2], k);
+          }
+          // u x v points along the axis, out of the cube on its upper side
+          const int order[2][6] = {{0, 3, 2, 0, 2, 1}, {0, 1, 2, 0, 2, 3}};
+          const int* o = order[side == k];
+          for (int c = 0; c < 6; c++) *tri++ = start_vert + corner[o[c]];
+        }
+      }
+    }
+  }
+
+  rval = mbi->create_meshset(MESHSET_SET, surface);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->add_entities(surface, Range(start_tri, start_tri + num_tris - 1));
+  if (MB_SUCCESS != rval) return rval;
+  rval = set_geometry(surface, 2, nextId[2]++, "Surface");
+  if (MB_SUCCESS != rval) return rval;
+  numFacets += num_tris;
+  surfaces.push_back(surface);
+  senseVolumes.push_back(0);
+  senseVolumes.push_back(0);
+  return MB_SUCCESS;
+}
+
+ErrorCode ModelWriter::add_volume(const std::vector<EntityHandle>& surfs,
+                                  const std::vector<int>& senses,
+                                  EntityHandle& volume) {
+  ErrorCode rval = mbi->create_meshset(MESHSET_SET, volume);
+  if (MB_SUCCESS != rval) return rval;
+  for (unsigned i = 0; i < surfs.size(); i++) {
+    rval = mbi->add_parent_child(volume, surfs[i]);
+    if (MB_SUCCESS != rval) return rval;
+    const size_t s =
+        std::find(surfaces.begin(), surfaces.end(), surfs[i]) -
+        surfaces.begin();
+    if (s == surfaces.size()) return MB_ENTITY_NOT_FOUND;
+    senseVolumes[2 * s + (senses[i] > 0 ? 0 : 1)] = volume;
+  }
+  return set_geometry(volume, 3, nextId[3]++, "Volume");
+}
+
+ErrorCode ModelWriter::add_group(const std::string& name,
+                                 const std::vector<EntityHandle>& volumes) {
+  EntityHandle group;
+  ErrorCode rval = mbi->create_meshset(MESHSET_SET, group);
+  if (MB_SUCCESS != rval) return rval;
+  rval = mbi->add_entities(group, volumes.data(), volumes.size());
+  if (MB_SUCCESS != rval) return rval;
+  rval = set_geometry(group, 4, nextId[4]++, "Group");
+  if (MB_SUCCESS != rval) return rval;
+  char group_name[NAME_TAG_SIZE];
+  memset(group_name, 0, sizeof(group_name));
+  strncpy(group_name, name.c_str(), sizeof(group_name) - 1);
+  return mbi->tag_set_data(nameTag, &group, 1, group_name);
+}
+
+ErrorCode ModelWriter::finish() {
+  if (surfaces.empty()) return MB_SUCCESS;
+  return mbi->tag_set_data(senseTag, surfaces.data(), surfaces.size(),
+                           senseVolumes.data());
+}
+
+// cells per cube edge giving each surface its share of the facets
+static int cells_per_edge(long long facets, int num_surfaces) {
+  const double per_surface = (double)facets / std::max(1, num_surfaces);
+  return std::max(1, (int)floor(sqrt(per_surface / 12.0) + 0.5));
+}
+
+// the volumes of the model, and the half width of a box around them
+static ErrorCode write_volumes(ModelWriter& writer,
+                               std::vector<EntityHandle>& volumes,
+                               double& extent) {
+  ErrorCode rval;
+  volumes.clear();
+  SurfaceShape shape;
+  shape.sphere = true;
+  for (int d = 0; d < 3; d++) shape.center[d] = 0.0;
+
+  if ("spheres" == model_type) {
+    // volume i lies between spheres i - 1 and i, which it shares with its
+    // neighbours
+    const int k = cells_per_edge(num_facets, num_volumes);
+    EntityHandle inner = 0;
+    for (int i = 1; i <= num_volumes; i++) {
+      EntityHandle outer, volume;
+      for (int d = 0; d < 3; d++) shape.size[d] = i;
+      rval = writer.add_surface(shape, k, outer);
+      if (MB_SUCCESS != rval) return rval;
+      std::vector<EntityHandle> surfs(1, outer);
+      std::vector<int> senses(1, 1);
+      if (inner) {
+        surfs.push_back(inner);
+        senses.push_back(-1);
+      }
+      rval = writer.add_volume(surfs, senses, volume);
+      if (MB_SUCCESS != rval) return rval;
+      volumes.push_back(volume);
+      inner = outer;
+    }
+    extent = num_volumes;
+  } else if ("shells" == model_type) {
+    // shell i lies between spheres of radii i - thickness and i, the gaps
+    // between them are left to the implicit complement
+    const int k = cells_per_edge(num_facets, 2 * num_volumes);
+    for (int i = 1; i <= num_volumes; i++) {
+      EntityHandle surfs[2], volume;
+      for (int s = 0; s < 2; s++) {
+        for (int d = 0; d < 3; d++) shape.size[d] = i - shell_thickness * s;
+        rval = writer.add_surface(shape, k, surfs[s]);
+        if (MB_SUCCESS != rval) return rval;
+      }
+      rval = writer.add_volume(std::vector<EntityHandle>(surfs, surfs + 2),
+                               std::vector<int>{1, -1}, volume);
+      if (MB_SUCCESS != rval) return rval;
+      volumes.push_back(volume);
+    }
+    extent = num_volumes;
+  } else if ("lattice" == model_type) {
+    // boxes filling 80% of their cells, in the first cells of an n^3 lattice
+    const int k = cells_per_edge(num_facets, num_volumes);
+    int n = 1;
+    while (n * n * n < num_volumes) n++;
+    shape.sphere = false;
+    for (int d = 0; d < 3; d++) shape.size[d] = 0.4;
+    for (int i = 0; i < num_volumes; i++) {
+      const int cell[3] = {i % n, (i / n) % n, i / (n * n)};
+      for (int d = 0; d < 3; d++) shape.center[d] = cell[d] - 0.5 * (n - 1);
+      EntityHandle surf, volume;
+      rval = writer.add_surface(shape, k, surf);
+      if (MB_SUCCESS != rval) return rval;
+      rval = writer.add_volume(std::vector<EntityHandle>(1, surf),
+                               std::vector<int>(1, 1), volume);
+      if (MB_SUCCESS != rval) return rval;
+      volumes.push_back(volume);
+    }
+    extent = 0.5 * n;
+  } else {
+    usage("Unknown model type", model_type.c_str());
+  }
+  return MB_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  char* filename = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if (!argv[i][1] || argv[i][2]) usage(0, argv[i], argv[0]);
+      switch (argv[i][1]) {
+        default:
+          usage(0, argv[i], argv[0]);
+          break;
+        case 'h':
+          usage(0, 0, argv[0]);
+          break;
+        case 't':
+          model_type = get_option(i, argc, argv);
+          break;
+        case 'v':
+          num_volumes = get_int_option(i, argc, argv);
+          break;
+        case 'f':
+          num_facets = get_int_option(i, argc, argv);
+          break;
+        case 's':
+          shell_thickness = get_double_option(i, argc, argv);
+          break;
+        case 'm':
+          num_materials = get_int_option(i, argc, argv);
+          break;
+      }
+    } else if (!filename) {
+      filename = argv[i];
+    } else {
+      usage("Unexpected parameter", 0, argv[0]);
+    }
+  }
+
+  if (!filename) usage("No filename specified", 0, argv[0]);
+  if (num_volumes < 1) usage("Expected at least one volume", 0, argv[0]);
+  if (num_materials < 1) usage("Expected at least one material", 0, argv[0]);
+  if (shell_thickness <= 0 || shell_thickness >= 1)
+    usage("Expected a thickness between 0 and 1", 0, argv[0]);
+
+  Core core;
+  ModelWriter writer(&core);
+  ErrorCode rval = writer.setup();
+  std::vector<EntityHandle> volumes;
+  double extent = 0.0;
+  if (MB_SUCCESS == rval) rval = write_volumes(writer, volumes, extent);
+
+  // the graveyard is a thin box shell around the other volumes
+  EntityHandle graveyard = 0;
+  if (MB_SUCCESS == rval) {
+    SurfaceShape shape;
+    shape.sphere = false;
+    EntityHandle surfs[2];
+    for (int s = 0; s < 2 && MB_SUCCESS == rval; s++) {
+      for (int d = 0; d < 3; d++) {
+        shape.center[d] = 0.0;
+        shape.size[d] = (1.1 + 0.1 * s) * extent;
+      }
+      rval = writer.add_surface(shape, 1, surfs[1 - s]);
+    }
+    if (MB_SUCCESS == rval)
+      rval = writer.add_volume(std::vector<EntityHandle>(surfs, surfs + 2),
+                               std::vector<int>{1, -1}, graveyard);
+  }
+
+  // the volumes cycle through the materials
+  for (int m = 0; m < num_materials && MB_SUCCESS == rval; m++) {
+    std::vector<EntityHandle> group;
+    for (unsigned i = m; i < volumes.size(); i += num_materials)
+      group.push_back(volumes[i]);
+    if (group.empty()) continue;
+    rval = writer.add_group("mat:m" + std::to_string(m + 1) + "/rho:1.0",
+                            group);
+  }
+  if (MB_SUCCESS == rval)
+    rval = writer.add_group("mat:Graveyard",
+                            std::vector<EntityHandle>(1, graveyard));
+  if (MB_SUCCESS == rval) rval = writer.finish();
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to create the model" << std::endl;
+    return 2;
+  }
+
+  rval = core.write_mesh(filename);
+  if (MB_SUCCESS != rval) {
+    std::cerr << "Failed to write '" << filename << "'" << std::endl;
+    return 2;
+  }
+  std::cout << "Wrote " << filename << ": " << model_type << ", "
+            << volumes.size() << " volumes and a graveyard, "
+            << writer.facets() << " facets" << std::endl;
+  return 0;
+}
@@ -0,0 +1,305 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "DagMC.hpp"
+#include "moab/Core.hpp"
+#include "moab/Interface.hpp"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace moab;
+
+static const double PI = acos(-1.0);
+static const double denom = 1.0 / ((double)RAND_MAX);
+
+static int vol_index = 1;
+static int num_random_rays = 100000;
+static int randseed = 12345;
+static double source_rad = 0;
+static std::vector<int> batch_sizes;
+static std::vector<std::string> accel_names;
+static bool compare_order = false;
+
+static void usage(const char* error, const char* opt,
+                  const char* name = "ray_fire_bench") {
+  const char* default_message = "Invalid option";
+  if (opt && !error) error = default_message;
+
+  std::ostream& str = error ? std::cerr : std::cout;
+  if (error) {
+    str << error;
+    if (opt) str << ": " << opt;
+    str << std::endl;
+  }
+
+  str << "Usage: " << name << " [options] input_file" << std::endl;
+  str << "       " << name << " -h" << std::endl;
+
+  if (!error) {
+    str << "-h  print this help" << std::endl;
+    str << "-i <int>   specify volume in which to fire rays (default 1)"
+        << std::endl;
+    str << "-n <int>   specify number of random rays to fire (default 100000)"
+        << std::endl;
+    str << "-r <real>  random ray radius.  Random rays begin at this distance "
+           "from the origin (default 0)"
+        << std::endl;
+    str << "-b <int>   batch size to time (may be given multiple times, "
+           "default 1, 16, 256 and 4096)"
+        << std::endl;
+    str << "-z <int>   seed the random number generator (default 12345)"
+        << std::endl;
+    str << "-a <name>  acceleration structure to time, obb or bvh (may be "
+           "given multiple times, default obb)"
+        << std::endl;
+    str << "-m  also time the batches traced in the given order instead of "
+           "Morton order"
+        << std::endl;
+  }
+
+  exit(error ? 1 : 0);
+}
+
+static int get_int_option(int& i, int argc, char* argv[]) {
+  if (++i == argc) usage("Expected argument following option", argv[i - 1]);
+  char* end_ptr;
+  long val = strtol(argv[i], &end_ptr, 0);
+  if (!*argv[i] || *end_ptr)
+    usage("Expected integer following option", argv[i - 1]);
+  return val;
+}
+
+static double get_double_option(int& i, int argc, char* argv[]) {
+  if (++i == argc) usage("Expected argument following option", argv[i - 1]);
+  char* end_ptr;
+  double val = strtod(argv[i], &end_ptr);
+  if (!*argv[i] || *end_ptr)
+    usage("Expected real number following option", argv[i - 1]);
+  return val;
+}
+
+// hardware cache misses of this process, where the kernel allows counting
+// them
+class CacheMissCounter {
+ public:
+  CacheMissCounter() : fd(-1) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (fd >= 0) close(fd);
+#endif
+  }
+
+  bool available() const { return fd >= 0; }
+
+  void start() {
+#ifdef __linux__
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  /** cache misses since start(), or -1 if they cannot be counted */
+  long long stop() {
+    long long count = -1;
+#ifdef __linux__
+    if (fd < 0) return count;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+    return count;
+  }
+
+ private:
+  int fd;
+};
+
+static void random_dir(double uvw[3]) {
+  double theta = 2.0 * PI * denom * rand();
+  double u = 2 * denom * rand() - 1;
+  uvw[0] = sqrt(1 - u * u) * cos(theta);
+  uvw[1] = sqrt(1 - u * u) * sin(theta);
+  uvw[2] = u;
+}
+
+int main(int argc, char* argv[]) {
+  char* filename = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      if (!argv[i][1] || argv[i][2]) usage(0, argv[i], argv[0]);
+      switch (argv[i][1]) {
+        default:
+          usage(0, argv[i], argv[0]);
+          break;
+        case 'h':
+          usage(0, 0, argv[0]);
+          break;
+        case 'i':
+          vol_index = get_int_option(i, argc, argv);
+          break;
+        case 'n':
+          num_random_rays = get_int_option(i, argc, argv);
+          break;
+        case 'r':
+          source_rad = get_double_option(i, argc, argv);
+          break;
+        case 'b':
+          batch_sizes.push_back(get_int_option(i, argc, argv));
+          break;
+        case 'z':
+          randseed = get_int_option(i, argc, argv);
+          break;
+        case 'm':
+          compare_order = true;
+          break;
+        case 'a':
+          if (++i == argc)
+            usage("Expected argument following option", argv[i - 1]);
+          accel_names.push_back(argv[i]);
+          break;
+      }
+    } else if (!filename) {
+      filename = argv[i];
+    } else {
+      usage("Unexpected parameter", 0, argv[0]);
+    }
+  }
+
+  if (!filename) usage("No filename specified", 0, argv[0]);
+  if (num_random_rays <= 0) usage("Number of rays must be positive", 0);
+  if (batch_sizes.empty()) batch_sizes = {1, 16, 256, 4096};
+
+  if (accel_names.empty()) accel_names.push_back("obb");
+
+  // generate all rays up front so that only the ray fire calls are timed
+  srand(randseed);
+  std::vector<double> x(num_random_rays), y(num_random_rays),
+      z(num_random_rays), u(num_random_rays), v(num_random_rays),
+      w(num_random_rays);
+  for (int j = 0; j < num_random_rays; j++) {
+    double uvw[3];
+    random_dir(uvw);
+    x[j] = uvw[0] * source_rad;
+    y[j] = uvw[1] * source_rad;
+    z[j] = uvw[2] * source_rad;
+    random_dir(uvw);
+    u[j] = uvw[0];
+    v[j] = uvw[1];
+    w[j] = uvw[2];
+  }
+
+  std::cout << "Firing " << num_random_rays << " random rays at volume "
+            << vol_index << std::endl;
+  CacheMissCounter cache_misses;
+  if (!cache_misses.available())
+    std::cout << "Cache misses cannot be counted on this system" << std::endl;
+  std::cout << std::setw(8) << "accel" << std::setw(12) << "build (s)"
+            << std::setw(12) << "batch size" << std::setw(8) << "order"
+            << std::setw(16) << "rays/sec" << std::setw(16) << "cache misses"
+            << std::setw(12) << "missed" << std::endl;
+
+  for (unsigned a = 0; a < accel_names.size(); a++) {
+    // each acceleration structure is built in its own DagMC instance
+    DagMC dagmc{};
+    if (accel_names[a] == "bvh")
+      dagmc.set_accel_type(DagMC::ACCEL_BVH);
+    else if (accel_names[a] != "obb")
+      usage("Unknown acceleration structure", accel_names[a].c_str());
+
+    ErrorCode rval = dagmc.load_file(filename);
+    if (MB_SUCCESS != rval) {
+      std::cerr << "Failed to load file '" << filename << "'" << std::endl;
+      return 2;
+    }
+
+    auto build_start = std::chrono::steady_clock::now();
+    rval = dagmc.init_OBBTree();
+    if (MB_SUCCESS != rval) {
+      std::cerr << "Failed to initialize DagMC." << std::endl;
+      return 2;
+    }
+    double build_seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - build_start)
+                               .count();
+
+    EntityHandle vol = dagmc.entity_by_id(3, vol_index);
+    if (0 == vol) {
+      std::cerr << "Problem getting volume " << vol_index << std::endl;
+      return 2;
+    }
+
+    std::vector<EntityHandle> volumes(num_random_rays, vol);
+    std::vector<EntityHandle> next_surfs(num_random_rays);
+    std::vector<double> next_surf_dists(num_random_rays);
+
+    for (unsigned b = 0; b < batch_sizes.size(); b++) {
+      int batch_size = batch_sizes[b];
+      if (batch_size <= 0) usage("Batch size must be positive", 0);
+
+      for (int sorted = compare_order ? 0 : 1; sorted < 2; sorted++) {
+        dagmc.set_sort_ray_batches(sorted);
+        cache_misses.start();
+        auto start = std::chrono::steady_clock::now();
+        for (int first = 0; first < num_random_rays; first += batch_size) {
+          int n = std::min(batch_size, num_random_rays - first);
+          const double* starts[3] = {&x[first], &y[first], &z[first]};
+          const double* dirs[3] = {&u[first], &v[first], &w[first]};
+          rval = dagmc.ray_fire_batch(n, &volumes[first], starts, dirs,
+                                      &next_surfs[first],
+                                      &next_surf_dists[first]);
+          if (MB_SUCCESS != rval) {
+            std::cerr << "ERROR: ray_fire_batch() failed!" << std::endl;
+            return 2;
+          }
+        }
+        auto end = std::chrono::steady_clock::now();
+        long long misses = cache_misses.stop();
+        double seconds = std::chrono::duration<double>(end - start).count();
+
+        int missed = 0;
+        for (int j = 0; j < num_random_rays; j++) {
+          if (next_surfs[j] == 0) missed++;
+        }
+
+        std::cout << std::setw(8) << accel_names[a] << std::setw(12)
+                  << build_seconds << std::setw(12) << batch_size
+                  << std::setw(8) << (sorted ? "morton" : "given")
+                  << std::setw(16)
+                  << (seconds > 0 ? num_random_rays / seconds : 0.0)
+                  << std::setw(16);
+        if (misses >= 0)
+          std::cout << misses;
+        else
+          std::cout << "-";
+        std::cout << std::setw(12) << missed << std::endl;
+      }
+    }
+  }
+
+  return 0;
+}
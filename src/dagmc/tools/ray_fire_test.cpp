@@ -68,9 +68,13 @@ static int num_random_rays = 1000;
 static int randseed = 12345;
 static bool do_stat_report = false;
 static bool do_trv_stats = false;
+static bool use_bvh = false;
+static int tree_storage = DagMC::TREES_FULL;
+static double dist_limit = 0;
 static double location_az = 2.0 * PI;
 static double direction_az = location_az;
 static const char* pyfile = NULL;
+static const char* profile_file = NULL;
 
 static int random_rays_missed =
     0;  // count of random rays that did not hit a surface
@@ -95,7 +99,20 @@ static void usage(const char* error, const char* opt,
   if (!error) {
     str << "-h  print this help" << std::endl;
     str << "-s  print OBB tree structural statistics" << std::endl;
-    str << "-S  track and print OBB tree traversal statistics" << std::endl;
+    str << "-S  track and print OBB tree traversal statistics, and the nodes "
+           "visited"
+        << std::endl;
+    str << "    with and without the distance limit (OBB) or front to back "
+           "ordering (BVH)"
+        << std::endl;
+    str << "-b  use the native BVH trees instead of the OBB trees" << std::endl;
+    str << "-P <file>  write the time of the queries per volume to a JSON "
+           "(.json) or CSV file"
+        << std::endl;
+    str << "-C <int>   storage of the BVH trees: 0 full (default), 1 compact, "
+           "2 compact"
+        << std::endl;
+    str << "           with float vertices" << std::endl;
     str << "-i <int>   specify volume to upon which to test ray intersections "
            "(default 1)"
         << std::endl;
@@ -117,6 +134,8 @@ static void usage(const char* error, const char* opt,
         << std::endl;
     str << "-z <int>   seed the random number generator (default 12345)"
         << std::endl;
+    str << "-l <real>  distance limit of the random rays (default none)"
+        << std::endl;
     str << "-L <real>  if present, limit random ray Location to between "
            "+-<value> degrees"
         << std::endl;
@@ -205,6 +224,49 @@ static void parse_ray(int& i, int argc, char* argv[]) {
   rays.push_back(ray);
 }
 
+// next random ray of the sequence started by srand(randseed)
+static void random_ray(CartVect& xyz, CartVect& uvw) {
+  RNDVEC(uvw, location_az);
+
+  xyz = uvw * source_rad + ray_source;
+  if (source_rad >= 0.0) {
+    RNDVEC(uvw, direction_az);
+  }
+}
+
+// fire the random rays again, collecting traversal statistics in context
+static void fire_stats_rays(DagMC& dagmc, EntityHandle vol, double limit,
+                            DagMC::QueryContext& context) {
+  context.reset();
+  context.collect_stats = true;
+  srand(randseed);
+  CartVect xyz, uvw;
+  EntityHandle surf;
+  double dist;
+  for (int j = 0; j < num_random_rays; j++) {
+    random_ray(xyz, uvw);
+    context.history.reset();
+    dagmc.ray_fire(context, vol, xyz.array(), uvw.array(), surf, dist, limit);
+  }
+}
+
+static unsigned long total_nodes_visited(
+    const OrientedBoxTreeTool::TrvStats& stats) {
+  unsigned long total = 0;
+  for (unsigned i = 0; i < stats.nodes_visited().size(); ++i)
+    total += stats.nodes_visited()[i];
+  return total;
+}
+
+static void print_reduction(const char* what, unsigned long before,
+                            unsigned long after) {
+  std::cout << "   " << what << ": " << before << " -> " << after;
+  if (before > 0)
+    std::cout << " (" << 100.0 * (1.0 - (double)after / before)
+              << "% fewer)";
+  std::cout << std::endl;
+}
+
 int main(int argc, char* argv[]) {
   char* filename = NULL;
   bool flags = true;
@@ -227,6 +289,18 @@ int main(int argc, char* argv[]) {
         case 'S':
           do_trv_stats = true;
           break;
+        case 'b':
+          use_bvh = true;
+          break;
+        case 'P':
+          profile_file = get_option(i, argc, argv);
+          break;
+        case 'C':
+          tree_storage = get_int_option(i, argc, argv);
+          break;
+        case 'l':
+          dist_limit = get_double_option(i, argc, argv);
+          break;
         case 'i':
           vol_index = get_int_option(i, argc, argv);
           break;
@@ -271,6 +345,13 @@ int main(int argc, char* argv[]) {
   if (!filename) {
     usage("No filename specified", 0, argv[0]);
   }
+  if (tree_storage < DagMC::TREES_FULL ||
+      tree_storage > DagMC::TREES_COMPACT_FLOAT) {
+    usage("Invalid tree storage", 0, argv[0]);
+  }
+  if (use_bvh && pyfile) {
+    usage("The python dictionary needs the OBB trees", 0, argv[0]);
+  }
 
   ErrorCode rval;
   EntityHandle surf = 0, vol = 0;
@@ -282,6 +363,9 @@ int main(int argc, char* argv[]) {
   }
 
   DagMC dagmc{};
+  if (use_bvh) dagmc.set_accel_type(DagMC::ACCEL_BVH);
+  dagmc.set_tree_storage((DagMC::TreeStorage)tree_storage);
+  dagmc.set_profile_queries(profile_file != NULL);
   rval = dagmc.load_file(filename);
   if (MB_SUCCESS != rval) {
     std::cerr << "Failed to load file '" << filename << "'" << std::endl;
@@ -348,12 +432,7 @@ int main(int argc, char* argv[]) {
 #endif
 
   for (int j = 0; j < num_random_rays; j++) {
-    RNDVEC(uvw, location_az);
-
-    xyz = uvw * source_rad + ray_source;
-    if (source_rad >= 0.0) {
-      RNDVEC(uvw, direction_az);
-    }
+    random_ray(xyz, uvw);
 
 #ifdef DEBUG
     std::cout << "x,y,z,u,v,w,u^2 + v^2 + w^2 = " << xyz << " " << uvw << " "
@@ -363,8 +442,8 @@ int main(int argc, char* argv[]) {
     wavg += uvw[2];
 #endif
     // added ray orientation
-    dagmc.ray_fire(vol, xyz.array(), uvw.array(), surf, dist, NULL, 0, 1,
-                   trv_stats);
+    dagmc.ray_fire(vol, xyz.array(), uvw.array(), surf, dist, NULL,
+                   dist_limit, 1, trv_stats);
 
     if (surf == 0) {
       random_rays_missed++;
@@ -377,12 +456,7 @@ int main(int argc, char* argv[]) {
 
   // now without ray fire call, to subtract out overhead
   for (int j = 0; j < num_random_rays; j++) {
-    RNDVEC(uvw, location_az);
-
-    xyz = uvw * source_rad + ray_source;
-    if (source_rad >= 0.0) {
-      RNDVEC(uvw, direction_az);
-    }
+    random_ray(xyz, uvw);
   }
 
   get_time_mem(ttime1, utime1, stime1, tmem2);
@@ -405,7 +479,55 @@ int main(int argc, char* argv[]) {
   std::cout << "Program memory used: " << tmem2 << " bytes ("
             << tmem2 / (1024 * 1024) << " MB)" << std::endl;
 
+  /* Compare the traversal work of the random rays */
+  if (do_trv_stats && num_random_rays > 0) {
+    DagMC::QueryContext before, after;
+    if (use_bvh) {
+      dagmc.set_ordered_traversal(false);
+      fire_stats_rays(dagmc, vol, dist_limit, before);
+      dagmc.set_ordered_traversal(true);
+      fire_stats_rays(dagmc, vol, dist_limit, after);
+      std::cout << "BVH traversal, depth first -> front to back:" << std::endl;
+      print_reduction("node tests", before.bvh_stats.node_tests,
+                      after.bvh_stats.node_tests);
+      print_reduction("leaves visited", before.bvh_stats.leaves_visited,
+                      after.bvh_stats.leaves_visited);
+      print_reduction("triangle tests", before.bvh_stats.triangle_tests,
+                      after.bvh_stats.triangle_tests);
+    } else if (dist_limit > 0) {
+      fire_stats_rays(dagmc, vol, 0, before);
+      fire_stats_rays(dagmc, vol, dist_limit, after);
+      std::cout << "OBB traversal, without -> with the distance limit:"
+                << std::endl;
+      print_reduction("nodes visited", total_nodes_visited(before.stats),
+                      total_nodes_visited(after.stats));
+      print_reduction("triangle tests", before.stats.ray_tri_tests(),
+                      after.stats.ray_tri_tests());
+    }
+  }
+
+  if (profile_file) {
+    if (MB_SUCCESS != dagmc.write_query_profile(profile_file)) {
+      std::cerr << "Failed to write " << profile_file << std::endl;
+      return 2;
+    }
+    std::cout << "Wrote the query profile to " << profile_file << std::endl;
+  }
+
   /* Gather OBB tree stats and make final reports */
+  if (use_bvh) {
+    int num_built, num_volumes;
+    dagmc.get_tree_counts(num_built, num_volumes);
+    std::cout << "BVH trees built for " << num_built << " of " << num_volumes
+              << " volumes" << std::endl;
+    size_t bytes, num_facets;
+    if (MB_SUCCESS == dagmc.get_bvh_memory(bytes, num_facets) && num_facets)
+      std::cout << "BVH memory: " << bytes << " bytes, "
+                << (double)bytes / num_facets << " bytes per facet"
+                << std::endl;
+    return 0;
+  }
+
   EntityHandle root;
   ErrorCode result = dagmc.get_root(vol, root);
   if (MB_SUCCESS != result) {
@@ -118,10 +118,19 @@ int main(int argc, char* argv[]) {
     std::cout << "Producing volume index & id correspondences" << std::endl;
     fludag_write_ididx(vol_id);
   } else {
+    // the queries of g_fire and the other geometry calls of the run, for
+    // dagmc_replay
+    const char* ray_log = getenv("DAGMC_RAY_LOG");
+    if (ray_log && *ray_log && moab::MB_SUCCESS != DAG->open_ray_log(ray_log)) {
+      std::cerr << "DAGMC failed to open the ray log " << ray_log << std::endl;
+      exit(EXIT_FAILURE);
+    }
     // call fluka run
     // flugg mode is flag = 1
     const int flag = 1;
     flukam(flag);
+    if (DAG->ray_log_open() && moab::MB_SUCCESS != DAG->close_ray_log())
+      std::cerr << "DAGMC failed to write the ray log" << std::endl;
   }
 
   return 0;
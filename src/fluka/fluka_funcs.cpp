@@ -46,6 +46,8 @@ int MAX_MATERIAL_NAME_SIZE = 32;
 
 // current state of the particle
 static particle_state state;
+// volume found by the last lookup, tested first by the next one
+static moab::EntityHandle last_volume = 0;
 
 /* For DAGMC only sets the number of volumes in the problem */
 void jomiwr(int& nge, const int& lin, const int& lou, int& flukaReg) {
@@ -114,6 +116,7 @@ void g_fire(int& oldRegion, double point[], double dir[], double& propStep,
   moab::EntityHandle next_surf;            // next surf we hit
   double next_surf_dist;
   moab::EntityHandle newvol = 0;
+  safety = 0.0;
 
   if (debug) print_state(state);
 
@@ -220,7 +223,14 @@ void g_fire(int& oldRegion, double point[], double dir[], double& propStep,
     return;
   }
 
-  // set the safety
+  // the distance the particle can move in any direction without leaving the
+  // region; a lower bound is enough, and it is zero on a boundary
+  if (!state.on_boundary) {
+    rval = DAG->safety_distance(vol, point, safety,
+                                moab::DagMC::SAFETY_CONSERVATIVE);
+    if (rval != moab::MB_SUCCESS) safety = 0.0;
+  }
+
   retStep =
       next_surf_dist;  // the returned step length is the distance to next surf
 
@@ -454,64 +464,23 @@ void f_look(double& pSx, double& pSy, double& pSz, double* pV,
   const double xyz[] = {pSx, pSy, pSz};  // location of the particle (xyz)
   const double dir[] = {pV[0], pV[1], pV[2]};
 
-  int is_inside = 0;
-  int num_vols = DAG->num_entities(3);  // number of volumes
-
-  for (int i = 1; i <= num_vols; i++) {  // loop over all volumes
-    moab::EntityHandle volume =
-        DAG->entity_by_index(3, i);  // get the volume by index
-    // No ray history  - doesnt matter, only called for new source particles
-    moab::ErrorCode rval = DAG->point_in_volume(volume, xyz, is_inside, dir);
-    // check for non error
-    if (moab::MB_SUCCESS != rval)
-      fludag_abort("f_look", "DAGMC failed in point_in_volume", rval);
-
-    // we think that we are inside ,
-    if (is_inside == 1) {  // we are inside the cell tested
-      // test point in vol again, but reverse the direction
-      double new_dir[3];
-      new_dir[0] = -1. * dir[0];
-      new_dir[1] = -1. * dir[1];
-      new_dir[2] = -1. * dir[2];
-
-      int second_test = 0;
-
-      moab::ErrorCode rval =
-          DAG->point_in_volume(volume, xyz, second_test, new_dir);
-      // check for non error
-      if (moab::MB_SUCCESS != rval)
-        fludag_abort("f_look", "DAGMC failed in point_in_volume", rval);
-
-      if (is_inside != second_test) {
-        if (debug) {
-          std::cout << "First test inconclusive, doing the slow test"
-                    << std::endl;
-        }
-
-        rval = DAG->point_in_volume_slow(volume, xyz, second_test);
-        if (moab::MB_SUCCESS != rval)
-          fludag_abort("f_look", "DAGMC failed in point_in_volume_slow", rval);
-        // firing rays in two opposing directions didnt work, the slow test
-        // didnt work
-        if (second_test == 0) {
-          continue;
-        }
-      }
+  // No ray history  - doesnt matter, only called for new source particles
+  moab::EntityHandle volume;
+  moab::ErrorCode rval = DAG->find_volume(xyz, volume, dir, last_volume);
+  if (moab::MB_SUCCESS != rval)
+    fludag_abort("f_look", "DAGMC failed in find_volume", rval);
 
-      // WHEN WE ARE INSIDE A VOLUME, BOTH, nextRegion has to equal flagErr
-      nextRegion = i;
-      flagErr = nextRegion;
+  if (volume) {
+    last_volume = volume;
+    // WHEN WE ARE INSIDE A VOLUME, BOTH, nextRegion has to equal flagErr
+    nextRegion = DAG->index_by_handle(volume);
+    flagErr = nextRegion;
 
-      if (debug) {
-        std::cout << "region is " << nextRegion << " aka " << volume
-                  << std::endl;
-      }
-      return;
-    } else if (is_inside == -1) {
-      std::cout << "We cannot be here" << std::endl;
-      exit(0);
+    if (debug) {
+      std::cout << "region is " << nextRegion << " aka " << volume << std::endl;
     }
-  }  // end loop over all volumes
+    return;
+  }
 
   // if are here then no volume has been found
   nextRegion = -33;
@@ -540,68 +509,26 @@ void f_lostlook(double& pSx, double& pSy, double& pSz, double* pV, int& oldReg,
   const double xyz[] = {pSx, pSy, pSz};  // location of the particle (xyz)
   const double dir[] = {pV[0], pV[1], pV[2]};
 
-  int is_inside = 0;
-  int num_vols = DAG->num_entities(3);  // number of volumes
-
-  for (int i = 1; i <= num_vols; i++) {  // loop over all volumes
-    moab::EntityHandle volume =
-        DAG->entity_by_index(3, i);  // get the volume by index
-    // No ray history  - doesnt matter, only called for new source particles
-    moab::ErrorCode rval = DAG->point_in_volume(volume, xyz, is_inside, dir);
-    // check for non error
-    if (moab::MB_SUCCESS != rval)
-      fludag_abort("f_lostlook", "DAGMC failed in point_in_volume", rval);
-
-    // we think that we are inside ,
-    if (is_inside == 1) {  // we are inside the cell tested
-      // test point in vol again, but reverse the direction
-      double new_dir[3];
-      new_dir[0] = -1. * dir[0];
-      new_dir[1] = -1. * dir[1];
-      new_dir[2] = -1. * dir[2];
-
-      int second_test = 0;
-
-      moab::ErrorCode rval =
-          DAG->point_in_volume(volume, xyz, second_test, new_dir);
-      // check for non error
-      if (moab::MB_SUCCESS != rval)
-        fludag_abort("f_lostlook", "DAGMC failed in point_in_volume", rval);
-
-      if (is_inside != second_test) {
-        if (debug) {
-          std::cout << "First test inconclusive, doing the slow test"
-                    << std::endl;
-        }
-
-        rval = DAG->point_in_volume_slow(volume, xyz, second_test);
-        if (moab::MB_SUCCESS != rval)
-          fludag_abort("f_lostlook", "DAGMC failed in point_in_volume_slow",
-                       rval);
-        // firing rays in two opposing directions didnt work, the slow test
-        // didnt work
-        if (second_test == 0) {
-          continue;
-        }
-      }
+  // No ray history  - doesnt matter, only called for new source particles
+  moab::EntityHandle volume;
+  moab::ErrorCode rval = DAG->find_volume(xyz, volume, dir, last_volume);
+  if (moab::MB_SUCCESS != rval)
+    fludag_abort("f_lostlook", "DAGMC failed in find_volume", rval);
 
-      // WHEN WE ARE INSIDE A VOLUME, BOTH, nextRegion has to equal flagErr
-      nextRegion = i;
-      flagErr = nextRegion;
+  if (volume) {
+    last_volume = volume;
+    // WHEN WE ARE INSIDE A VOLUME, BOTH, nextRegion has to equal flagErr
+    nextRegion = DAG->index_by_handle(volume);
+    flagErr = nextRegion;
 
-      if (debug) {
-        std::cout << "region is " << nextRegion << " aka " << volume
-                  << std::endl;
-      }
-      return;
-    } else if (is_inside == -1) {
-      std::cout << "We cannot be here" << std::endl;
-      exit(0);
+    if (debug) {
+      std::cout << "region is " << nextRegion << " aka " << volume << std::endl;
     }
-  }  // end loop over all volumes
+    return;
+  }
 
   // if are here then no volume has been found
-  nextRegion = num_vols + 1;  // return nextRegion
+  nextRegion = DAG->num_entities(3) + 1;  // return nextRegion
   flagErr = nextRegion;
 
   if (debug)
@@ -629,28 +556,21 @@ void lkmgwr(double& pSx, double& pSy, double& pSz, double* pV,
             const int& oldReg, const int& oldLttc, int& flagErr, int& newReg,
             int& newLttc) {
   const double xyz[] = {pSx, pSy, pSz};  // location of the particle (xyz)
-  int is_inside = 0;                     // logical inside or outside of volume
-  int num_vols = DAG->num_entities(3);   // number of volumes
-
-  for (int i = 1; i <= num_vols; i++) {  // loop over all volumes
-    moab::EntityHandle volume =
-        DAG->entity_by_index(3, i);  // get the volume by index
-    // No ray history or ray direction.
-    moab::ErrorCode rval = DAG->point_in_volume(volume, xyz, is_inside);
-
-    // check for non error
-    if (moab::MB_SUCCESS != rval)
-      fludag_abort("lkmgwr", "DAGMC failed in point_in_volume", rval);
+  // No ray history or ray direction.
+  moab::EntityHandle volume;
+  moab::ErrorCode rval = DAG->find_volume(xyz, volume, NULL, last_volume);
+  if (moab::MB_SUCCESS != rval)
+    fludag_abort("lkmgwr", "DAGMC failed in find_volume", rval);
 
-    if (is_inside == 1) {  // we are inside the cell tested
-      newReg = i;
-      flagErr = i + 1;
-      if (debug) {
-        std::cout << "point is in region = " << newReg << std::endl;
-      }
-      return;
+  if (volume) {  // we are inside the cell tested
+    last_volume = volume;
+    newReg = DAG->index_by_handle(volume);
+    flagErr = newReg + 1;
+    if (debug) {
+      std::cout << "point is in region = " << newReg << std::endl;
     }
-  }  // end loop over all volumes
+    return;
+  }
 
   if (debug) {
     std::cout << "particle is nowhere!" << std::endl;
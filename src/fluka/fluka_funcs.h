@@ -411,6 +411,8 @@ int look(double& posx, double& posy, double& posz, double* dir, int& region);
  * \param[in] dir[3] direction vector
  * \param[in] propStep physics proposed step length
  * \param[out] retStep actual returned distance, governed by geometry or physics
+ * \param[out] safety lower bound on the distance to the nearest surface, 0
+ *             on a boundary
  * \param[out] newRegion region after step
  **/
 void g_fire(int& oldRegion, double point[], double dir[], double& propStep,
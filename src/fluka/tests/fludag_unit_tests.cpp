@@ -2,8 +2,10 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <vector>
 
 #include "DagMC.hpp"
 #include "fluka_funcs.h"
@@ -228,6 +230,63 @@ TEST_F(FluDAGTest, GFireGoodPropStep) {
   EXPECT_DOUBLE_EQ(5.0 / dir_norm, retStep);
 }
 
+//---------------------------------------------------------------------------//
+// Test that the safety returned with the step bounds the distance to the
+// nearest face; dagmc_bench times the safety queries
+TEST_F(FluDAGTest, GFireSafety) {
+  f_g1rt();
+  oldReg = 2;
+  point[2] = 5.0;
+  dir[2] = 1.0;
+  propStep = 1.0;
+
+  // the middle of the 10x10x10 cube is 5 from its faces
+  g_fire(oldReg, point, dir, propStep, retStep, safety, newReg);
+  EXPECT_EQ(1.0, retStep);
+  EXPECT_LE(safety, 5.0);
+  EXPECT_GT(safety, 4.0);
+
+  // short steps from random points of the cube, in random directions
+  const int num_steps = 200;
+  std::vector<double> points(3 * num_steps), dirs(3 * num_steps);
+  srand(12345);
+  for (int i = 0; i < num_steps; i++) {
+    double norm = 0.0;
+    for (int k = 0; k < 3; k++) {
+      points[3 * i + k] = 9.8 * rand() / RAND_MAX - 4.9 + (k == 2 ? 5.0 : 0.0);
+      dirs[3 * i + k] = 2.0 * rand() / RAND_MAX - 1.0;
+      norm += dirs[3 * i + k] * dirs[3 * i + k];
+    }
+    for (int k = 0; k < 3; k++) dirs[3 * i + k] /= sqrt(norm);
+  }
+
+  propStep = 0.01;
+  for (int i = 0; i < num_steps; i++) {
+    g_fire(oldReg, &points[3 * i], &dirs[3 * i], propStep, retStep, safety,
+           newReg);
+    EXPECT_EQ(oldReg, newReg);
+    // distance to the nearest face of the cube
+    const double* p = &points[3 * i];
+    const double distance =
+        std::min(std::min(5.0 - fabs(p[0]), 5.0 - fabs(p[1])),
+                 5.0 - fabs(p[2] - 5.0));
+    EXPECT_LE(safety, distance + 1e-6);
+  }
+
+  // the conservative safety never exceeds the exact distance
+  moab::EntityHandle vol = DAG->entity_by_index(3, oldReg);
+  for (int i = 0; i < num_steps; i++) {
+    double exact, bound;
+    rval = DAG->safety_distance(vol, &points[3 * i], exact);
+    EXPECT_EQ(moab::MB_SUCCESS, rval);
+    rval = DAG->safety_distance(vol, &points[3 * i], bound,
+                                moab::DagMC::SAFETY_CONSERVATIVE);
+    EXPECT_EQ(moab::MB_SUCCESS, rval);
+    EXPECT_LE(bound, exact + 1e-6);
+  }
+  f_g1rt();
+}
+
 //---------------------------------------------------------------------------//
 // TEST FIXTURES
 //---------------------------------------------------------------------------//
@@ -285,7 +285,9 @@ G4double DagSolid::DistanceToIn(const G4ThreeVector& p) const {
   G4double point[3] = {p.x() / cm, p.y() / cm,
                        p.z() / cm};  // convert position to cm
 
-  fdagmc->closest_to_location(fvolEntity, point, minDist);
+  // Geant4 only needs a lower bound on the distance
+  fdagmc->safety_distance(fvolEntity, point, minDist,
+                          DagMC::SAFETY_CONSERVATIVE);
   minDist *= cm;  // convert back to mm
   if (minDist <= kCarTolerance * 0.5)
     return 0.0;
@@ -360,7 +362,9 @@ G4double DagSolid::DistanceToOut(const G4ThreeVector& p) const {
   G4double minDist = kInfinity;
   G4double point[3] = {p.x() / cm, p.y() / cm, p.z() / cm};  // convert to cm
 
-  fdagmc->closest_to_location(fvolEntity, point, minDist);
+  // Geant4 only needs a lower bound on the distance
+  fdagmc->safety_distance(fvolEntity, point, minDist,
+                          DagMC::SAFETY_CONSERVATIVE);
   minDist *= cm;  // convert back to mm
   if (minDist < kCarTolerance / 2.0)
     return 0.0;
@@ -44,7 +44,10 @@ ExN01DetectorConstruction::ExN01DetectorConstruction(UWUW* uwuw_workflow_data)
 }
 
 // destructor
-ExN01DetectorConstruction::~ExN01DetectorConstruction() {}
+ExN01DetectorConstruction::~ExN01DetectorConstruction() {
+  if (dagmc->ray_log_open() && moab::MB_SUCCESS != dagmc->close_ray_log())
+    G4cout << "ERROR: Failed to write the DAGMC ray log" << G4endl;
+}
 
 // the main method - takes the problem and loads
 G4VPhysicalVolume* ExN01DetectorConstruction::Construct() {
@@ -84,6 +87,13 @@ G4VPhysicalVolume* ExN01DetectorConstruction::Construct() {
     exit(1);
   }
 
+  // the queries of the DagSolids, for dagmc_replay
+  const char* ray_log = getenv("DAGMC_RAY_LOG");
+  if (ray_log && *ray_log && dagmc->open_ray_log(ray_log) != moab::MB_SUCCESS) {
+    G4cout << "ERROR: Failed to open the DAGMC ray log " << ray_log << G4endl;
+    exit(1);
+  }
+
   // attach a metadata instance
   DMD = new dagmcMetaData(dagmc);
   DMD->load_property_data();
@@ -1,9 +1,11 @@
 //  DagSolid_test.cpp
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <iostream>
+#include <vector>
 
 #include "DagSolid.hh"
 #include "G4TessellatedSolid.hh"
@@ -268,3 +270,33 @@ TEST_F(DagSolidTest, surface_area_test) {
   std::cout << surface_area << std::endl;
   return;
 }
+
+/*
+ * safety_test checks that the distances to the nearest surface from inside
+ * and outside points never exceed the true distance; dagmc_bench times them
+ */
+TEST_F(DagSolidTest, safety_test) {
+  const int num_points = 200;
+  std::vector<G4ThreeVector> points(num_points);
+  srand(12345);
+  for (int i = 0; i < num_points; i++)
+    points[i] = G4ThreeVector(160. * rand() / RAND_MAX - 80.,
+                              160. * rand() / RAND_MAX - 80.,
+                              160. * rand() / RAND_MAX - 80.);
+
+  for (int i = 0; i < num_points; i++) {
+    const G4ThreeVector& p = points[i];
+    // the cube of side 100 mm is centred at the origin
+    G4double inside =
+        std::max(std::max(fabs(p.x()), fabs(p.y())), fabs(p.z()));
+    if (inside < 50.) {
+      EXPECT_LE(vol_1->DistanceToOut(p), 50. - inside + 1e-6);
+    } else {
+      G4ThreeVector outside(std::max(fabs(p.x()) - 50., 0.),
+                            std::max(fabs(p.y()) - 50., 0.),
+                            std::max(fabs(p.z()) - 50., 0.));
+      EXPECT_LE(vol_1->DistanceToIn(p), outside.mag() + 1e-6);
+    }
+  }
+  return;
+}
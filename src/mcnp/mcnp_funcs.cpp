@@ -29,22 +29,31 @@ UWUW* workflow_data;
 #ifdef ENABLE_RAYSTAT_DUMPS
 
 #include <fstream>
+#include <mutex>
 #include <numeric>
 
+// shared by the threads, which write their lines under raystat_mutex
 static std::ostream* raystat_dump = NULL;
+static std::mutex raystat_mutex;
 #endif
 
-/* Static values used by dagmctrack_ */
+/* Per-thread values used by dagmctrack_: the DagMC instance is shared by all
+ * threads, the state of the particle being tracked is not */
 
-static DagMC::RayHistory history;
-static int last_nps = 0;
-static double last_uvw[3] = {0, 0, 0};
-static std::vector<DagMC::RayHistory> history_bank;
-static std::vector<DagMC::RayHistory> pblcm_history_stack;
-static bool visited_surface = false;
+static thread_local DagMC::QueryContext context;
+static thread_local int last_nps = 0;
+static thread_local double last_uvw[3] = {0, 0, 0};
+// the histories are stored inline, so banking and restoring them copies a
+// few handles without allocating, and growing the banks moves them
+static thread_local std::vector<moab::InlineRayHistory> history_bank;
+static thread_local std::vector<moab::InlineRayHistory> pblcm_history_stack;
+static thread_local bool visited_surface = false;
+static thread_local double dist_limit = 0;
 
 static bool use_dist_limit = false;
-static double dist_limit;  // needs to be thread-local
+// file the per-volume query profile is written to at teardown, if any
+static std::string profile_file;
+static int max_pbl_size = 0;
 
 static std::string graveyard_str = "Graveyard";
 static std::string vacuum_str = "Vacuum";
@@ -91,6 +100,38 @@ void dagmcinit_(char* cfile, int* clen,   // geom
   }
 #endif
 
+  // the MCNP input has no cards for the acceleration structure, so it is
+  // chosen before the trees are built through the environment
+  const char* accel = getenv("DAGMC_ACCEL");
+  if (accel && 0 == strncmp(accel, "bvh", 3))
+    DAG->set_accel_type(moab::DagMC::ACCEL_BVH);
+  if (accel && 0 == strcmp(accel, "bvh_compact"))
+    DAG->set_tree_storage(moab::DagMC::TREES_COMPACT);
+  else if (accel && 0 == strcmp(accel, "bvh_compact_float"))
+    DAG->set_tree_storage(moab::DagMC::TREES_COMPACT_FLOAT);
+  const char* lazy = getenv("DAGMC_LAZY_TREES");
+  if (lazy && 0 != strcmp(lazy, "0")) DAG->set_lazy_trees(true);
+  const char* shared_compl = getenv("DAGMC_SHARED_COMPLEMENT");
+  if (shared_compl && 0 != strcmp(shared_compl, "0"))
+    DAG->set_shared_complement(true);
+  // with MPI every rank reads the geometry; a cache under /dev/shm is built
+  // by one rank per node and mapped by all of them
+  const char* accel_cache = getenv("DAGMC_ACCEL_CACHE");
+  if (accel_cache && *accel_cache) DAG->set_accel_cache(accel_cache);
+  // the time spent in each volume, written at teardown as JSON if the name
+  // ends in .json, and as CSV otherwise
+  const char* profile = getenv("DAGMC_PROFILE");
+  if (profile && *profile) {
+    profile_file = profile;
+    DAG->set_profile_queries(true);
+  }
+  // every query of the run and its result, for dagmc_replay
+  const char* ray_log = getenv("DAGMC_RAY_LOG");
+  if (ray_log && *ray_log && moab::MB_SUCCESS != DAG->open_ray_log(ray_log)) {
+    std::cerr << "DAGMC failed to open the ray log " << ray_log << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   // initialize geometry
   rval = DAG->init_OBBTree();
   if (moab::MB_SUCCESS != rval) {
@@ -104,7 +145,7 @@ void dagmcinit_(char* cfile, int* clen,   // geom
   DMD->load_property_data();
   // all metadata now loaded
 
-  pblcm_history_stack.resize(*max_pbl + 1);  // fortran will index from 1
+  max_pbl_size = *max_pbl + 1;  // fortran will index from 1
 }
 
 void dagmcwritefacets_(char* ffile, int* flen) {  // facet file
@@ -360,7 +401,7 @@ void write_tally_data(std::ostringstream& lcadfile) {
 void dagmcangl_(int* jsu, double* xxx, double* yyy, double* zzz, double* ang) {
   moab::EntityHandle surf = DAG->entity_by_index(2, *jsu);
   double xyz[3] = {*xxx, *yyy, *zzz};
-  moab::ErrorCode rval = DAG->get_angle(surf, xyz, ang, &history);
+  moab::ErrorCode rval = DAG->get_angle(context, surf, xyz, ang);
   if (moab::MB_SUCCESS != rval) {
     std::cerr << "DAGMC: failed in calling get_angle" << std::endl;
     exit(EXIT_FAILURE);
@@ -397,7 +438,7 @@ void dagmcchkcel_by_angle_(double* uuu, double* vvv, double* www, double* xxx,
 
   int result;
   moab::ErrorCode rval =
-      DAG->test_volume_boundary(vol, surf, xyz, uvw, result, &history);
+      DAG->test_volume_boundary(context, vol, surf, xyz, uvw, result);
   if (moab::MB_SUCCESS != rval) {
     std::cerr << "DAGMC: failed calling test_volume_boundary" << std::endl;
     exit(EXIT_FAILURE);
@@ -538,7 +579,7 @@ void dagmc_surf_reflection_(double* uuu, double* vvv, double* www,
     last_uvw[0] = *uuu;
     last_uvw[1] = *vvv;
     last_uvw[2] = *www;
-    history.reset_to_last_intersection();
+    context.history.reset_to_last_intersection();
   }
 #ifdef TRACE_DAGMC_CALLS
   else {
@@ -551,7 +592,7 @@ void dagmc_surf_reflection_(double* uuu, double* vvv, double* www,
 }
 
 void dagmc_particle_terminate_() {
-  history.reset();
+  context.history.reset();
 
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "particle_terminate:" << std::endl;
@@ -574,17 +615,13 @@ void dagmctrack_(int* ih, double* uuu, double* vvv, double* www, double* xxx,
   moab::EntityHandle next_surf = 0;
   double next_surf_dist;
 
-#ifdef ENABLE_RAYSTAT_DUMPS
-  moab::OrientedBoxTreeTool::TrvStats trv;
-#endif
-
   double point[3] = {*xxx, *yyy, *zzz};
   double dir[3] = {*uuu, *vvv, *www};
 
   /* detect streaming or reflecting situations */
   if (last_nps != *nps || prev == 0) {
     // not streaming or reflecting: reset history
-    history.reset();
+    context.history.reset();
 #ifdef TRACE_DAGMC_CALLS
     std::cout << "track: new history" << std::endl;
 #endif
@@ -594,31 +631,32 @@ void dagmctrack_(int* ih, double* uuu, double* vvv, double* www, double* xxx,
     // streaming -- use history without change
     // unless a surface was not visited
     if (!visited_surface) {
-      history.rollback_last_intersection();
+      context.history.rollback_last_intersection();
 #ifdef TRACE_DAGMC_CALLS
       std::cout << "     : (rbl)" << std::endl;
 #endif
     }
 #ifdef TRACE_DAGMC_CALLS
-    std::cout << "track: streaming " << history.size() << std::endl;
+    std::cout << "track: streaming " << context.history.size() << std::endl;
 #endif
   } else {
     // not streaming or reflecting
-    history.reset();
+    context.history.reset();
 
 #ifdef TRACE_DAGMC_CALLS
     std::cout << "track: reset" << std::endl;
 #endif
   }
 
-  moab::ErrorCode result =
-      DAG->ray_fire(vol, point, dir, next_surf, next_surf_dist, &history,
-                    (use_dist_limit ? dist_limit : 0)
 #ifdef ENABLE_RAYSTAT_DUMPS
-                        ,
-                    raystat_dump ? &trv : NULL
+  context.collect_stats = (raystat_dump != NULL);
+  context.stats.reset();
+  context.bvh_stats.reset();
 #endif
-      );
+
+  moab::ErrorCode result =
+      DAG->ray_fire(context, vol, point, dir, next_surf, next_surf_dist,
+                    (use_dist_limit ? dist_limit : 0));
 
   if (moab::MB_SUCCESS != result) {
     std::cerr << "DAGMC: failed in ray_fire" << std::endl;
@@ -651,13 +689,23 @@ void dagmctrack_(int* ih, double* uuu, double* vvv, double* www, double* xxx,
 
 #ifdef ENABLE_RAYSTAT_DUMPS
   if (raystat_dump) {
-    *raystat_dump << *ih << ",";
-    *raystat_dump << trv.ray_tri_tests() << ",";
-    *raystat_dump << std::accumulate(trv.nodes_visited().begin(),
-                                     trv.nodes_visited().end(), 0)
-                  << ",";
-    *raystat_dump << std::accumulate(trv.leaves_visited().begin(),
-                                     trv.leaves_visited().end(), 0)
+    // the BVH trees count their traversals in bvh_stats
+    unsigned long triangles, nodes, leaves;
+    if (DAG->accel_type() == moab::DagMC::ACCEL_BVH) {
+      const moab::BVHTraversalStats& trv = context.bvh_stats;
+      triangles = trv.triangle_tests;
+      nodes = trv.node_tests;
+      leaves = trv.leaves_visited;
+    } else {
+      const moab::OrientedBoxTreeTool::TrvStats& trv = context.stats;
+      triangles = trv.ray_tri_tests();
+      nodes = std::accumulate(trv.nodes_visited().begin(),
+                              trv.nodes_visited().end(), 0ul);
+      leaves = std::accumulate(trv.leaves_visited().begin(),
+                               trv.leaves_visited().end(), 0ul);
+    }
+    std::lock_guard<std::mutex> lock(raystat_mutex);
+    *raystat_dump << *ih << "," << triangles << "," << nodes << "," << leaves
                   << std::endl;
   }
 #endif
@@ -681,7 +729,7 @@ void dagmc_bank_push_(int* nbnk) {
     std::cerr << "bank push size mismatch: F" << *nbnk << " C"
               << history_bank.size() << std::endl;
   }
-  history_bank.push_back(history);
+  history_bank.push_back(context.history);
 
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "bank_push (" << *nbnk + 1 << ")" << std::endl;
@@ -694,7 +742,7 @@ void dagmc_bank_usetop_() {
 #endif
 
   if (history_bank.size()) {
-    history = history_bank.back();
+    context.history = history_bank.back();
   } else {
     std::cerr << "dagmc_bank_usetop_() called without bank history!"
               << std::endl;
@@ -725,17 +773,20 @@ void dagmc_bank_clear_() {
 
 void dagmc_savpar_(int* n) {
 #ifdef TRACE_DAGMC_CALLS
-  std::cout << "savpar: " << *n << " (" << history.size() << ")" << std::endl;
+  std::cout << "savpar: " << *n << " (" << context.history.size() << ")"
+            << std::endl;
 #endif
-  pblcm_history_stack[*n] = history;
+  if (pblcm_history_stack.empty()) pblcm_history_stack.resize(max_pbl_size);
+  pblcm_history_stack[*n] = context.history;
 }
 
 void dagmc_getpar_(int* n) {
+  if (pblcm_history_stack.empty()) pblcm_history_stack.resize(max_pbl_size);
 #ifdef TRACE_DAGMC_CALLS
   std::cout << "getpar: " << *n << " (" << pblcm_history_stack[*n].size() << ")"
             << std::endl;
 #endif
-  history = pblcm_history_stack[*n];
+  context.history = pblcm_history_stack[*n];
 }
 
 void dagmcvolume_(int* mxa, double* vols, int* mxj, double* aras) {
@@ -803,6 +854,22 @@ void dagmc_init_settings_(int* fort_use_dist_limit, int* use_cad,
 
 // delete the stored data
 void dagmc_teardown_() {
+  if (DAG->lazy_trees()) {
+    int num_built, num_volumes;
+    DAG->get_tree_counts(num_built, num_volumes);
+    std::cout << "DAGMC built the trees of " << num_built << " of "
+              << num_volumes << " volumes" << std::endl;
+  }
+  if (!profile_file.empty()) {
+    if (moab::MB_SUCCESS == DAG->write_query_profile(profile_file.c_str()))
+      std::cout << "DAGMC wrote the query profile to " << profile_file
+                << std::endl;
+    else
+      std::cerr << "DAGMC: failed to write the query profile to "
+                << profile_file << std::endl;
+  }
+  if (DAG->ray_log_open() && moab::MB_SUCCESS != DAG->close_ray_log())
+    std::cerr << "DAGMC: failed to write the ray log" << std::endl;
   delete DMD;
   delete DAG;
 }
@@ -1,15 +1,30 @@
 
 #include "overlap.hpp"
 
+#include <vector>
+
 #include "ProgressBar.hpp"
 #include "moab/GeomQueryTool.hpp"
 #include "moab/GeomTopoTool.hpp"
 
 using namespace moab;
 
+// a volume and a box containing it, grown by the point in volume tolerances
+struct BoundedVolume {
+  EntityHandle vol;
+  CartVect lower;
+  CartVect upper;
+
+  bool contains(const CartVect& loc) const {
+    return loc[0] >= lower[0] && loc[1] >= lower[1] && loc[2] >= lower[2] &&
+           loc[0] <= upper[0] && loc[1] <= upper[1] && loc[2] <= upper[2];
+  }
+};
+
 ErrorCode check_location_for_overlap(std::shared_ptr<GeomQueryTool>& GQT,
-                                     const Range& all_vols, CartVect loc,
-                                     CartVect dir, OverlapMap& overlap_map) {
+                                     const std::vector<BoundedVolume>& all_vols,
+                                     CartVect loc, CartVect dir,
+                                     OverlapMap& overlap_map) {
   ErrorCode rval;
 
   GeomTopoTool* GTT = GQT->gttool();
@@ -19,7 +34,11 @@ ErrorCode check_location_for_overlap(std::shared_ptr<GeomQueryTool>& GQT,
   // move the point slightly off the vertex
   loc += dir * bump;
 
-  for (const auto& vol : all_vols) {
+  // most volumes are far from the location, and are skipped without firing
+  // a ray
+  for (const auto& bounded : all_vols) {
+    if (!bounded.contains(loc)) continue;
+    EntityHandle vol = bounded.vol;
     int result = 0;
     rval = GQT->point_in_volume(vol, loc.array(), result, dir.array());
     MB_CHK_SET_ERR(rval, "Failed point in volume for Vol with id "
@@ -39,7 +58,9 @@ ErrorCode check_location_for_overlap(std::shared_ptr<GeomQueryTool>& GQT,
   loc += dir * 2.0 * bump;
   vols_found.clear();
 
-  for (const auto& vol : all_vols) {
+  for (const auto& bounded : all_vols) {
+    if (!bounded.contains(loc)) continue;
+    EntityHandle vol = bounded.vol;
     int result = 0;
     rval = GQT->point_in_volume(vol, loc.array(), result, dir.array());
     MB_CHK_SET_ERR(rval, "Failed point in volume for Vol with id "
@@ -81,10 +102,24 @@ ErrorCode check_instance_for_overlaps(std::shared_ptr<Interface> MBI,
   rval = MBI->get_adjacencies(all_tris, 1, true, all_edges, Interface::UNION);
   MB_CHK_SET_ERR(rval, "Failed to get triangle edges");
 
-  Range all_vols;
-  rval = GTT->get_gsets_by_dimension(3, all_vols);
+  Range vols;
+  rval = GTT->get_gsets_by_dimension(3, vols);
   MB_CHK_SET_ERR(rval, "Failed to get volumes from GTT");
 
+  // the boxes of the volume trees
+  const double tolerance =
+      GQT->get_numerical_precision() + GQT->get_overlap_thickness();
+  std::vector<BoundedVolume> all_vols(vols.size());
+  for (size_t i = 0; i < vols.size(); i++) {
+    BoundedVolume& bounded = all_vols[i];
+    bounded.vol = vols[i];
+    rval = GTT->get_bounding_coords(bounded.vol, bounded.lower.array(),
+                                    bounded.upper.array());
+    MB_CHK_SET_ERR(rval, "Failed to get the bounding box of a volume");
+    bounded.lower -= CartVect(tolerance);
+    bounded.upper += CartVect(tolerance);
+  }
+
   // number of locations we'll be checking
   int num_locations = all_verts.size() + pnts_per_edge * all_edges.size();
   int num_checked = 1;